@@ -0,0 +1,55 @@
+// AddressIndex.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "AddressIndex.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CAddressIndex
+
+CAddressIndex::CAddressIndex()
+{
+}
+
+CAddressIndex::~CAddressIndex()
+{
+}
+
+unsigned long CAddressIndex::Hash(const __int64 Address)
+{
+	// 64-bit finalizer: the vendor part of the address must not decide the
+	// slot.
+	unsigned __int64 h = static_cast<unsigned __int64>(Address);
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return static_cast<unsigned long>(h);
+}
+
+void CAddressIndex::EraseSlot(const unsigned long Mask, const unsigned long Slot)
+{
+	// Move the following entries of the probe sequence into the hole.
+	unsigned long i = Slot;
+	unsigned long j = Slot;
+	while (true)
+	{
+		j = (j + 1) & Mask;
+		if (!IsSlotUsed(j))
+			break;
+
+		// The entry stays if its home slot lies cyclically in (i, j].
+		unsigned long k = Hash(GetSlotAddress(j)) & Mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		MoveSlot(i, j);
+		i = j;
+	}
+	ClearSlot(i);
+}
@@ -0,0 +1,54 @@
+// AddressIndex.h : open addressing index keyed by a MAC address
+//
+
+#pragma once
+
+#include "wclHelpers.h"
+
+/// <summary> The base of the open addressing hash tables keyed by a MAC
+///   address. </summary>
+/// <remarks> <para> The derived class owns the slots. Their number must be
+///   a power of 2 and the collisions are resolved by linear probing.
+///   <c>Hash</c> gives the home slot of an address and <c>EraseSlot</c>
+///   removes an entry by backward shift deletion, so no tombstones are
+///   needed. </para>
+///   <para> The methods must be called inside the critical section of the
+///   derived class. </para> </remarks>
+class CAddressIndex
+{
+	DISABLE_COPY(CAddressIndex);
+
+protected:
+	/// <summary> Checks if the slot holds an entry. </summary>
+	/// <param name="Slot"> The slot index. </param>
+	/// <returns> <c>True</c> if the slot is used. </returns>
+	virtual bool IsSlotUsed(const unsigned long Slot) const = 0;
+	/// <summary> Gets the address of the entry in the used slot. </summary>
+	/// <param name="Slot"> The slot index. </param>
+	/// <returns> The device MAC address. </returns>
+	virtual __int64 GetSlotAddress(const unsigned long Slot) const = 0;
+	/// <summary> Moves the entry of the used slot to the other one. </summary>
+	/// <param name="To"> The target slot index. </param>
+	/// <param name="From"> The source slot index. </param>
+	virtual void MoveSlot(const unsigned long To, const unsigned long From) = 0;
+	/// <summary> Marks the slot as empty. </summary>
+	/// <param name="Slot"> The slot index. </param>
+	virtual void ClearSlot(const unsigned long Slot) = 0;
+
+	/// <summary> Hashes the MAC address. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <returns> The hash. Mask it by the number of the slots minus 1 to get
+	///   the home slot. </returns>
+	static unsigned long Hash(const __int64 Address);
+
+	/// <summary> Removes the entry from the used slot. </summary>
+	/// <param name="Mask"> The number of the slots minus 1. </param>
+	/// <param name="Slot"> The slot index. </param>
+	void EraseSlot(const unsigned long Mask, const unsigned long Slot);
+
+public:
+	/// <summary> Creates new address index. </summary>
+	CAddressIndex();
+	/// <summary> Frees the address index. </summary>
+	virtual ~CAddressIndex();
+};
@@ -0,0 +1,477 @@
+// BatchPairing.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "BatchPairing.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static const unsigned long PAIRING_MAX_PARALLELISM = 16;
+
+
+// CPairingResultMessage
+
+CPairingResultMessage::CPairingResultMessage(const PairingResult& Result)
+	: CwclMessage(APP_MSG_ID_PAIRING_RESULT, mcUser)
+{
+	FResult = Result;
+}
+
+const PairingResult& CPairingResultMessage::GetResult() const
+{
+	return FResult;
+}
+
+
+// CBatchPairing
+
+CBatchPairing::CBatchPairing()
+{
+	FParallelism = 4;
+	FPolicy = PAIRING_ACCEPT_ALL;
+	FTimeout = 30000;
+
+	FBusy = 0;
+	FCS = new CwclCriticalSection();
+	FEvent = NULL;
+	FManager = NULL;
+	FReceiver = NULL;
+	FRunning = false;
+	FTerminated = 0;
+}
+
+CBatchPairing::~CBatchPairing()
+{
+	Close();
+
+	delete FCS;
+}
+
+UINT __stdcall CBatchPairing::_WorkerThreadProc(LPVOID lpParam)
+{
+	WORKER* Worker = static_cast<WORKER*>(lpParam);
+	Worker->Owner->WorkerThreadProc(Worker);
+	return 0;
+}
+
+void CBatchPairing::WorkerThreadProc(WORKER* const Worker)
+{
+	while (true)
+	{
+		FCS->Enter();
+		while (FJobs.empty() && FTerminated == 0)
+		{
+			FCS->Leave();
+			FEvent->WaitOne();
+			FCS->Enter();
+		}
+		if (FTerminated != 0)
+		{
+			FCS->Leave();
+			// Wake the next worker thread up.
+			FEvent->SetEvent();
+			break;
+		}
+
+		JOB Job = FJobs.front();
+		FJobs.pop_front();
+		FBusy++;
+		bool More = !FJobs.empty();
+		FCS->Leave();
+
+		if (More)
+			FEvent->SetEvent();
+
+		PairingResult Result;
+		Result.Address = Job.Address;
+		Result.Operation = Job.Operation;
+		Result.Started = CMessageStats::Now();
+		if (Job.Operation == poPair)
+			Result.Error = Pair(Worker, Job);
+		else
+			Result.Error = Job.Radio->RemoteUnpair(Job.Address, Job.Method, Job.Force);
+		Result.Duration = CMessageStats::Now() - Result.Started;
+
+		// Close interrupts the pairing: the result is not valid.
+		if (FTerminated != 0)
+			break;
+
+		CwclMessage* Msg = new CPairingResultMessage(Result);
+		FReceiver->Post(Msg);
+		Msg->Release();
+
+		FCS->Enter();
+		FBusy--;
+		bool Completed = (FJobs.empty() && FBusy == 0 && FTerminated == 0);
+		FCS->Leave();
+
+		if (Completed)
+		{
+			// Posted after the last result, so the receiver delivers it
+			// last.
+			Msg = new CwclMessage(APP_MSG_ID_PAIRING_COMPLETED, mcUser);
+			FReceiver->Post(Msg);
+			Msg->Release();
+		}
+	}
+}
+
+int CBatchPairing::Pair(WORKER* const Worker, const JOB& Job)
+{
+	// Announce the device before the pairing starts: the confirmation
+	// requests may arrive before RemotePair returns.
+	FCS->Enter();
+	Worker->Address = Job.Address;
+	Worker->Error = WCL_E_SUCCESS;
+	Worker->Waiting = true;
+	FCS->Leave();
+
+	int Res = Job.Radio->RemotePair(Job.Address, Job.Method);
+	if (Res == WCL_E_SUCCESS)
+		Worker->Done->WaitOne(FTimeout);
+
+	FCS->Enter();
+	if (Worker->Waiting)
+	{
+		Worker->Waiting = false;
+		if (Res == WCL_E_SUCCESS)
+			Res = APP_E_PAIRING_TIMEOUT;
+	}
+	else
+	{
+		if (Res == WCL_E_SUCCESS)
+			Res = Worker->Error;
+	}
+	FCS->Leave();
+
+	// A completion that raced with the timeout has signaled the event.
+	Worker->Done->ResetEvent();
+	return Res;
+}
+
+CBatchPairing::WORKER* CBatchPairing::FindWaiting(const __int64 Address) const
+{
+	for (WORKERS::const_iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+	{
+		if ((*w)->Waiting && (*w)->Address == Address)
+			return *w;
+	}
+	return NULL;
+}
+
+int CBatchPairing::Queue(CwclBluetoothRadio* const Radio,
+	const wclBluetoothAddresses& Addresses, const PairingOperation Operation,
+	const wclBluetoothPairingMethod Method, const bool Force)
+{
+	if (FWorkers.size() == 0)
+		return APP_E_PAIRING_NOT_OPENED;
+	if (Radio == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+	if (FRunning)
+		return APP_E_PAIRING_BUSY;
+	if (Addresses.size() == 0)
+		return WCL_E_SUCCESS;
+
+	JOB Job;
+	Job.Radio = Radio;
+	Job.Operation = Operation;
+	Job.Method = Method;
+	Job.Force = Force;
+
+	FRunning = true;
+	FResults.clear();
+	FResults.reserve(Addresses.size());
+
+	FCS->Enter();
+	for (wclBluetoothAddresses::const_iterator a = Addresses.begin(); a != Addresses.end(); a++)
+	{
+		Job.Address = *a;
+		FJobs.push_back(Job);
+	}
+	FCS->Leave();
+
+	FEvent->SetEvent();
+	return WCL_E_SUCCESS;
+}
+
+void CBatchPairing::Free()
+{
+	for (WORKERS::iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+	{
+		WORKER* Worker = *w;
+		if (Worker->Thread != NULL)
+			wclWaitAndCloseThread(Worker->Thread);
+		delete Worker->Done;
+		delete Worker;
+	}
+	FWorkers.clear();
+
+	if (FManager != NULL)
+	{
+		__unhook(&CwclBluetoothManager::OnAuthenticationCompleted, FManager,
+			&CBatchPairing::ManagerAuthenticationCompleted);
+		__unhook(&CwclBluetoothManager::OnConfirm, FManager,
+			&CBatchPairing::ManagerConfirm);
+		__unhook(&CwclBluetoothManager::OnNumericComparison, FManager,
+			&CBatchPairing::ManagerNumericComparison);
+		FManager = NULL;
+	}
+	if (FReceiver != NULL)
+	{
+		__unhook(&CwclMessageReceiver::OnMessage, FReceiver,
+			&CBatchPairing::ReceiverMessage);
+		FReceiver->Close();
+		delete FReceiver;
+		FReceiver = NULL;
+	}
+	if (FEvent != NULL)
+	{
+		delete FEvent;
+		FEvent = NULL;
+	}
+}
+
+void CBatchPairing::ManagerAuthenticationCompleted(void* Sender,
+	CwclBluetoothRadio* const Radio, const __int64 Address, const int Error)
+{
+	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Radio);
+
+	FCS->Enter();
+	WORKER* Worker = FindWaiting(Address);
+	if (Worker != NULL)
+	{
+		Worker->Error = Error;
+		Worker->Waiting = false;
+		Worker->Done->SetEvent();
+	}
+	FCS->Leave();
+}
+
+void CBatchPairing::ManagerConfirm(void* Sender, CwclBluetoothRadio* const Radio,
+	const __int64 Address, bool& Confirm)
+{
+	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Radio);
+
+	FCS->Enter();
+	bool Own = (FindWaiting(Address) != NULL);
+	FCS->Leave();
+
+	if (Own)
+		Confirm = ((FPolicy & PAIRING_ACCEPT_JUST_WORKS) != 0);
+}
+
+void CBatchPairing::ManagerNumericComparison(void* Sender,
+	CwclBluetoothRadio* const Radio, const __int64 Address,
+	const unsigned long Number, bool& Confirm)
+{
+	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Radio);
+	UNREFERENCED_PARAMETER(Number);
+
+	FCS->Enter();
+	bool Own = (FindWaiting(Address) != NULL);
+	FCS->Leave();
+
+	if (Own)
+		Confirm = ((FPolicy & PAIRING_ACCEPT_NUMERIC_COMPARISON) != 0);
+}
+
+void CBatchPairing::ReceiverMessage(const CwclMessage* const Message)
+{
+	if (Message->Category != mcUser)
+		return;
+
+	switch (Message->Id)
+	{
+		case APP_MSG_ID_PAIRING_RESULT:
+			{
+				const PairingResult& Result =
+					static_cast<const CPairingResultMessage*>(Message)->Result;
+				FResults.push_back(Result);
+				DoResult(Result);
+			}
+			break;
+
+		case APP_MSG_ID_PAIRING_COMPLETED:
+			FRunning = false;
+			DoCompleted(FResults);
+			break;
+	}
+}
+
+void CBatchPairing::DoResult(const PairingResult& Result)
+{
+	__raise OnResult(this, Result);
+}
+
+void CBatchPairing::DoCompleted(const PairingResults& Results)
+{
+	__raise OnCompleted(this, Results);
+}
+
+int CBatchPairing::Open(CwclBluetoothManager* const Manager,
+	const wclMessageProcessingMethod Method)
+{
+	if (FWorkers.size() > 0)
+		return APP_E_PAIRING_OPENED;
+	if (Manager == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FRunning = false;
+	FTerminated = 0;
+	FEvent = CwclAutoResetEvent::Create();
+	if (FEvent == NULL)
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+
+	FReceiver = new CwclMessageReceiver();
+	__hook(&CwclMessageReceiver::OnMessage, FReceiver, &CBatchPairing::ReceiverMessage);
+	int Res = FReceiver->Open(Method);
+	if (Res != WCL_E_SUCCESS)
+	{
+		Free();
+		return Res;
+	}
+
+	FManager = Manager;
+	__hook(&CwclBluetoothManager::OnAuthenticationCompleted, FManager,
+		&CBatchPairing::ManagerAuthenticationCompleted);
+	__hook(&CwclBluetoothManager::OnConfirm, FManager,
+		&CBatchPairing::ManagerConfirm);
+	__hook(&CwclBluetoothManager::OnNumericComparison, FManager,
+		&CBatchPairing::ManagerNumericComparison);
+
+	for (unsigned long i = 0; i < FParallelism; i++)
+	{
+		WORKER* Worker = new WORKER;
+		Worker->Owner = this;
+		Worker->Done = CwclAutoResetEvent::Create();
+		Worker->Thread = NULL;
+		Worker->Address = 0;
+		Worker->Waiting = false;
+		Worker->Error = WCL_E_SUCCESS;
+		FWorkers.push_back(Worker);
+
+		if (Worker->Done == NULL)
+		{
+			Res = WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+			break;
+		}
+		Worker->Thread = wclCreateThread(_WorkerThreadProc, Worker);
+		if (Worker->Thread == NULL)
+		{
+			Res = WCL_E_MR_UNABLE_SYNCHRONIZE;
+			break;
+		}
+	}
+
+	if (Res != WCL_E_SUCCESS)
+		Close();
+	return Res;
+}
+
+int CBatchPairing::Close()
+{
+	if (FEvent == NULL)
+		return APP_E_PAIRING_NOT_OPENED;
+
+	InterlockedExchange(&FTerminated, 1);
+	FEvent->SetEvent();
+	// Interrupt the workers waiting for the pairing completion.
+	FCS->Enter();
+	for (WORKERS::iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+	{
+		if ((*w)->Done != NULL)
+			(*w)->Done->SetEvent();
+	}
+	FCS->Leave();
+
+	Free();
+
+	FCS->Enter();
+	FJobs.clear();
+	FBusy = 0;
+	FCS->Leave();
+	FRunning = false;
+	return WCL_E_SUCCESS;
+}
+
+int CBatchPairing::RemotePairMany(CwclBluetoothRadio* const Radio,
+	const wclBluetoothAddresses& Addresses, const wclBluetoothPairingMethod Method)
+{
+	return Queue(Radio, Addresses, poPair, Method, false);
+}
+
+int CBatchPairing::RemoteUnpairMany(CwclBluetoothRadio* const Radio,
+	const wclBluetoothAddresses& Addresses, const wclBluetoothPairingMethod Method,
+	const bool Force)
+{
+	return Queue(Radio, Addresses, poUnpair, Method, Force);
+}
+
+int CBatchPairing::Cancel()
+{
+	if (FWorkers.size() == 0)
+		return APP_E_PAIRING_NOT_OPENED;
+
+	FCS->Enter();
+	bool Completed = (FJobs.size() > 0 && FBusy == 0);
+	FJobs.clear();
+	FCS->Leave();
+
+	// No worker thread is left to report the completion.
+	if (Completed)
+	{
+		CwclMessage* Msg = new CwclMessage(APP_MSG_ID_PAIRING_COMPLETED, mcUser);
+		FReceiver->Post(Msg);
+		Msg->Release();
+	}
+	return WCL_E_SUCCESS;
+}
+
+bool CBatchPairing::GetActive() const
+{
+	return (FWorkers.size() > 0);
+}
+
+bool CBatchPairing::GetRunning() const
+{
+	return FRunning;
+}
+
+unsigned long CBatchPairing::GetParallelism() const
+{
+	return FParallelism;
+}
+
+void CBatchPairing::SetParallelism(const unsigned long Value)
+{
+	if (FWorkers.size() == 0 && Value > 0 && Value <= PAIRING_MAX_PARALLELISM)
+		FParallelism = Value;
+}
+
+unsigned long CBatchPairing::GetPolicy() const
+{
+	return FPolicy;
+}
+
+void CBatchPairing::SetPolicy(const unsigned long Value)
+{
+	FPolicy = Value & PAIRING_ACCEPT_ALL;
+}
+
+unsigned long CBatchPairing::GetTimeout() const
+{
+	return FTimeout;
+}
+
+void CBatchPairing::SetTimeout(const unsigned long Value)
+{
+	if (Value > 0)
+		FTimeout = Value;
+}
@@ -0,0 +1,308 @@
+// BatchPairing.h : pairing and unpairing of many devices at once
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The pairing result message ID. The message category is
+///   <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_PAIRING_RESULT = 7;
+/// <summary> The pairing batch completed message ID. The message category
+///   is <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_PAIRING_COMPLETED = 8;
+
+/// <summary> The base value of the batch pairing error codes. </summary>
+const int APP_E_PAIRING_BASE = 0x00F0B000;
+/// <summary> The batch pairing is not opened. </summary>
+const int APP_E_PAIRING_NOT_OPENED = APP_E_PAIRING_BASE + 0x0000;
+/// <summary> The batch pairing is already opened. </summary>
+const int APP_E_PAIRING_OPENED = APP_E_PAIRING_BASE + 0x0001;
+/// <summary> Another batch is running. </summary>
+const int APP_E_PAIRING_BUSY = APP_E_PAIRING_BASE + 0x0002;
+/// <summary> The device has not completed the pairing in time. </summary>
+const int APP_E_PAIRING_TIMEOUT = APP_E_PAIRING_BASE + 0x0003;
+
+/// <summary> Accept the Just Works pairing. </summary>
+const unsigned long PAIRING_ACCEPT_JUST_WORKS = 0x00000001;
+/// <summary> Accept the numeric comparison pairing without comparing the
+///   number. </summary>
+const unsigned long PAIRING_ACCEPT_NUMERIC_COMPARISON = 0x00000002;
+/// <summary> Accept all the confirmation pairing methods. </summary>
+const unsigned long PAIRING_ACCEPT_ALL = 0x00000003;
+
+/// <summary> The batch operations. </summary>
+typedef enum
+{
+	/// <summary> Pair the device. </summary>
+	poPair,
+	/// <summary> Unpair the device. </summary>
+	poUnpair
+} PairingOperation;
+
+/// <summary> The result of a single device. </summary>
+typedef struct
+{
+	/// <summary> The device MAC address. </summary>
+	__int64 Address;
+	/// <summary> The operation. </summary>
+	PairingOperation Operation;
+	/// <summary> The operation result. </summary>
+	int Error;
+	/// <summary> The time the operation has started at, in
+	///   microseconds. </summary>
+	unsigned __int64 Started;
+	/// <summary> The operation duration in microseconds. </summary>
+	unsigned __int64 Duration;
+} PairingResult;
+/// <summary> The results of a batch. </summary>
+typedef std::vector<PairingResult> PairingResults;
+
+/// <summary> The message that carries a device pairing result. </summary>
+class CPairingResultMessage final : public CwclMessage
+{
+	DISABLE_COPY(CPairingResultMessage);
+
+private:
+	PairingResult	FResult;
+
+public:
+	/// <summary> Creates new pairing result message. </summary>
+	/// <param name="Result"> The device result. </param>
+	CPairingResultMessage(const PairingResult& Result);
+
+	/// <summary> Gets the device result. </summary>
+	/// <returns> The device result. </returns>
+	const PairingResult& GetResult() const;
+	/// <summary> Gets the device result. </summary>
+	/// <value> The device result. </value>
+	__declspec(property(get = GetResult)) const PairingResult& Result;
+};
+
+/// <summary> The <c>OnResult</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Result"> The device result. </param>
+#define PairingResultEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const PairingResult& Result)
+/// <summary> The <c>OnCompleted</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Results"> The results of all the devices. </param>
+#define PairingCompletedEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const PairingResults& Results)
+
+/// <summary> Pairs or unpairs many remote devices in parallel. </summary>
+/// <remarks> <para> Up to <c>Parallelism</c> devices are processed at
+///   once. A pairing counts as done when the <c>OnAuthenticationCompleted</c>
+///   event of the <c>CwclBluetoothManager</c> reports the device, or fails
+///   with <see cref="APP_E_PAIRING_TIMEOUT" /> after <c>Timeout</c>
+///   milliseconds. </para>
+///   <para> The <c>OnConfirm</c> and <c>OnNumericComparison</c> requests of
+///   the devices being paired are answered by the <c>Policy</c> so a fleet
+///   needs no per-device confirmation code. An application that handles
+///   these events itself must not answer them for the devices of a running
+///   pairing batch. </para>
+///   <para> <c>OnResult</c> fires for every device in completion order with
+///   its result and timing. <c>OnCompleted</c> fires with all the results
+///   when the batch is done. The events fire the way the
+///   <c>CwclMessageReceiver</c> opened with the method passed to
+///   <c>Open</c> delivers messages. </para> </remarks>
+class CBatchPairing
+{
+	DISABLE_COPY(CBatchPairing);
+
+private:
+	typedef struct
+	{
+		CwclBluetoothRadio*			Radio;
+		__int64						Address;
+		PairingOperation			Operation;
+		wclBluetoothPairingMethod	Method;
+		bool						Force;
+	} JOB;
+	typedef std::deque<JOB> JOBS;
+
+	typedef struct
+	{
+		CBatchPairing*			Owner;
+		// Signaled by the authentication completion of the device.
+		CwclAutoResetEvent*		Done;
+		HANDLE					Thread;
+		// The device being paired. Valid while Waiting is set.
+		__int64					Address;
+		bool					Waiting;
+		int						Error;
+	} WORKER;
+	typedef std::vector<WORKER*> WORKERS;
+
+	unsigned long			FParallelism;
+	unsigned long			FPolicy;
+	unsigned long			FTimeout;
+
+	// The number of the jobs being processed.
+	unsigned long			FBusy;
+	CwclCriticalSection*	FCS;
+	CwclAutoResetEvent*		FEvent;
+	JOBS					FJobs;
+	CwclBluetoothManager*	FManager;
+	CwclMessageReceiver*	FReceiver;
+	PairingResults			FResults;
+	bool					FRunning;
+	volatile LONG			FTerminated;
+	WORKERS					FWorkers;
+
+	static UINT __stdcall _WorkerThreadProc(LPVOID lpParam);
+	void WorkerThreadProc(WORKER* const Worker);
+
+	int Pair(WORKER* const Worker, const JOB& Job);
+
+	// Must be called inside the critical section.
+	WORKER* FindWaiting(const __int64 Address) const;
+
+	int Queue(CwclBluetoothRadio* const Radio, const wclBluetoothAddresses& Addresses,
+		const PairingOperation Operation, const wclBluetoothPairingMethod Method,
+		const bool Force);
+	void Free();
+
+	void ManagerAuthenticationCompleted(void* Sender, CwclBluetoothRadio* const Radio,
+		const __int64 Address, const int Error);
+	void ManagerConfirm(void* Sender, CwclBluetoothRadio* const Radio,
+		const __int64 Address, bool& Confirm);
+	void ManagerNumericComparison(void* Sender, CwclBluetoothRadio* const Radio,
+		const __int64 Address, const unsigned long Number, bool& Confirm);
+	void ReceiverMessage(const CwclMessage* const Message);
+
+protected:
+	/// <summary> Fires the <c>OnResult</c> event. </summary>
+	/// <param name="Result"> The device result. </param>
+	virtual void DoResult(const PairingResult& Result);
+	/// <summary> Fires the <c>OnCompleted</c> event. </summary>
+	/// <param name="Results"> The results of all the devices. </param>
+	virtual void DoCompleted(const PairingResults& Results);
+
+public:
+	/// <summary> Creates new batch pairing. </summary>
+	CBatchPairing();
+	/// <summary> Frees the batch pairing. </summary>
+	virtual ~CBatchPairing();
+
+	/// <summary> Starts the worker threads. </summary>
+	/// <param name="Manager"> The Bluetooth Manager that reports the
+	///   pairing events. </param>
+	/// <param name="Method"> The message processing method used to deliver
+	///   the events. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Open(CwclBluetoothManager* const Manager,
+		const wclMessageProcessingMethod Method = mpSync);
+	/// <summary> Stops the worker threads. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The devices that have not been processed yet are dropped
+	///   without events. The method waits for the pairings in progress, so
+	///   a pairing batch should be cancelled and completed before it is
+	///   called from the thread that processes the manager events. </remarks>
+	int Close();
+
+	/// <summary> Pairs the remote devices. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Addresses"> The remote device MAC addresses. </param>
+	/// <param name="Method"> The pairing method. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The method returns at once. </remarks>
+	int RemotePairMany(CwclBluetoothRadio* const Radio,
+		const wclBluetoothAddresses& Addresses,
+		const wclBluetoothPairingMethod Method = pmAuto);
+	/// <summary> Unpairs the remote devices. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Addresses"> The remote device MAC addresses. </param>
+	/// <param name="Method"> The unpairing method. </param>
+	/// <param name="Force"> Set this parameter to <c>true</c> to force the
+	///   unpairing. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The method returns at once. </remarks>
+	int RemoteUnpairMany(CwclBluetoothRadio* const Radio,
+		const wclBluetoothAddresses& Addresses,
+		const wclBluetoothPairingMethod Method = pmAuto, const bool Force = false);
+	/// <summary> Drops the devices that have not been started yet. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The devices being processed are still reported. </remarks>
+	int Cancel();
+
+	/// <summary> Gets the active state. </summary>
+	/// <returns> <c>true</c> if the batch pairing is opened. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the active state. </summary>
+	/// <value> <c>true</c> if the batch pairing is opened. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> Gets the running state. </summary>
+	/// <returns> <c>true</c> if a batch has not completed yet. </returns>
+	bool GetRunning() const;
+	/// <summary> Gets the running state. </summary>
+	/// <value> <c>true</c> if a batch has not completed yet. </value>
+	__declspec(property(get = GetRunning)) bool Running;
+
+	/// <summary> Gets the maximum number of the devices processed at
+	///   once. </summary>
+	/// <returns> The number of the worker threads. </returns>
+	unsigned long GetParallelism() const;
+	/// <summary> Sets the maximum number of the devices processed at
+	///   once. </summary>
+	/// <param name="Value"> The number of the worker threads from 1 to 16.
+	///   Can be changed only when the batch pairing is closed. </param>
+	void SetParallelism(const unsigned long Value);
+	/// <summary> Gets and sets the maximum number of the devices processed
+	///   at once. </summary>
+	/// <value> The number of the worker threads. </value>
+	__declspec(property(get = GetParallelism, put = SetParallelism))
+		unsigned long Parallelism;
+
+	/// <summary> Gets the confirmation policy. </summary>
+	/// <returns> A combination of the <c>PAIRING_ACCEPT_*</c>
+	///   flags. </returns>
+	unsigned long GetPolicy() const;
+	/// <summary> Sets the confirmation policy. </summary>
+	/// <param name="Value"> A combination of the <c>PAIRING_ACCEPT_*</c>
+	///   flags. The methods that are not accepted are rejected. </param>
+	void SetPolicy(const unsigned long Value);
+	/// <summary> Gets and sets the confirmation policy. </summary>
+	/// <value> A combination of the <c>PAIRING_ACCEPT_*</c> flags. </value>
+	__declspec(property(get = GetPolicy, put = SetPolicy)) unsigned long Policy;
+
+	/// <summary> Gets the pairing timeout. </summary>
+	/// <returns> The timeout in milliseconds. </returns>
+	unsigned long GetTimeout() const;
+	/// <summary> Sets the pairing timeout. </summary>
+	/// <param name="Value"> The timeout in milliseconds. Must not be
+	///   0. </param>
+	void SetTimeout(const unsigned long Value);
+	/// <summary> Gets and sets the pairing timeout. </summary>
+	/// <value> The timeout in milliseconds. </value>
+	__declspec(property(get = GetTimeout, put = SetTimeout)) unsigned long Timeout;
+
+	/// <summary> The event fires when a device has been processed. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Result"> The device result. </param>
+	PairingResultEvent(OnResult);
+	/// <summary> The event fires when all the devices of the batch have been
+	///   processed. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Results"> The results in completion order. </param>
+	PairingCompletedEvent(OnCompleted);
+};
@@ -0,0 +1,265 @@
+// ConnectionTuner.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "ConnectionTuner.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CConnectionTuner
+
+CConnectionTuner::CConnectionTuner()
+{
+	FClient = NULL;
+
+	FThresholds.BulkRate = 50;
+	FThresholds.BulkDepth = 4;
+	FThresholds.BulkLatency = 0;
+	FThresholds.IdleRate = 1;
+	// Speed up at once, slow down only when the link stays quiet.
+	FThresholds.UpHold = 1;
+	FThresholds.DownHold = 5;
+
+	ZeroMemory(FProfiles, sizeof(FProfiles));
+	FProfiles[tpIdle].Preset = ppPowerOptimized;
+	FProfiles[tpBalanced].Preset = ppBalanced;
+	FProfiles[tpBulk].Preset = ppThroughputOptimized;
+
+	FProfile = tpBalanced;
+	FCandidate = tpBalanced;
+	FVotes = 0;
+	FWindowStarted = 0;
+
+	FNotifications = 0;
+	FDepth = 0;
+	FRequests = 0;
+	FLatency = 0;
+
+	ZeroMemory(&FParams, sizeof(FParams));
+}
+
+CConnectionTuner::~CConnectionTuner()
+{
+	Detach();
+}
+
+int CConnectionTuner::Apply(const ConnectionTunerProfile Profile)
+{
+	const PROFILE& Params = FProfiles[Profile];
+	if (Params.UseValue)
+		return FClient->SetConnectionParams(Params.Value);
+	return FClient->SetConnectionParams(Params.Preset);
+}
+
+void CConnectionTuner::ClientCharacteristicChanged(void* Sender, const unsigned short Handle,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Handle);
+	UNREFERENCED_PARAMETER(Value);
+	UNREFERENCED_PARAMETER(Length);
+
+	InterlockedIncrement(&FNotifications);
+}
+
+void CConnectionTuner::ClientConnectionParamsChanged(void* Sender)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	FClient->GetConnectionParams(FParams);
+}
+
+void CConnectionTuner::DoDecision(const ConnectionTunerDecision& Decision)
+{
+	__raise OnDecision(this, Decision);
+}
+
+int CConnectionTuner::Attach(CwclGattClient* const Client,
+	const ConnectionTunerProfile Profile)
+{
+	if (Client == NULL || Profile > tpBulk)
+		return WCL_E_INVALID_ARGUMENT;
+	if (FClient != NULL)
+		return WCL_E_MR_OPENED;
+
+	FClient = Client;
+	int Res = Apply(Profile);
+	if (Res != WCL_E_SUCCESS)
+	{
+		FClient = NULL;
+		return Res;
+	}
+
+	FProfile = Profile;
+	FCandidate = Profile;
+	FVotes = 0;
+	FWindowStarted = CMessageStats::Now();
+	InterlockedExchange(&FNotifications, 0);
+	InterlockedExchange(&FDepth, 0);
+	InterlockedExchange(&FRequests, 0);
+	InterlockedExchange64(&FLatency, 0);
+	FClient->GetConnectionParams(FParams);
+
+	__hook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CConnectionTuner::ClientCharacteristicChanged);
+	__hook(&CwclGattClient::OnConnectionParamsChanged, FClient,
+		&CConnectionTuner::ClientConnectionParamsChanged);
+	return WCL_E_SUCCESS;
+}
+
+int CConnectionTuner::Detach()
+{
+	if (FClient == NULL)
+		return WCL_E_MR_NOT_OPENED;
+
+	__unhook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CConnectionTuner::ClientCharacteristicChanged);
+	__unhook(&CwclGattClient::OnConnectionParamsChanged, FClient,
+		&CConnectionTuner::ClientConnectionParamsChanged);
+	FClient = NULL;
+	return WCL_E_SUCCESS;
+}
+
+void CConnectionTuner::ReportDepth(const unsigned long Depth)
+{
+	LONG Current = FDepth;
+	while (static_cast<LONG>(Depth) > Current)
+	{
+		LONG Prev = InterlockedCompareExchange(&FDepth, static_cast<LONG>(Depth), Current);
+		if (Prev == Current)
+			break;
+		Current = Prev;
+	}
+}
+
+void CConnectionTuner::ReportRequest(const unsigned long Latency)
+{
+	InterlockedExchangeAdd64(&FLatency, Latency);
+	InterlockedIncrement(&FRequests);
+}
+
+int CConnectionTuner::Evaluate()
+{
+	if (FClient == NULL)
+		return WCL_E_MR_NOT_OPENED;
+
+	unsigned __int64 Now = CMessageStats::Now();
+	unsigned __int64 Elapsed = Now - FWindowStarted;
+	if (Elapsed == 0)
+		return WCL_E_SUCCESS;
+	FWindowStarted = Now;
+
+	ConnectionTunerDecision Decision;
+	Decision.From = FProfile;
+	Decision.Rate = static_cast<unsigned long>(
+		static_cast<unsigned __int64>(InterlockedExchange(&FNotifications, 0)) * 1000000 /
+		Elapsed);
+	Decision.Depth = static_cast<unsigned long>(InterlockedExchange(&FDepth, 0));
+	Decision.Requests = static_cast<unsigned long>(InterlockedExchange(&FRequests, 0));
+	LONG64 Latency = InterlockedExchange64(&FLatency, 0);
+	if (Decision.Requests == 0)
+		Decision.Latency = 0;
+	else
+		Decision.Latency = static_cast<unsigned long>(Latency / Decision.Requests);
+	Decision.Error = WCL_E_SUCCESS;
+
+	if (Decision.Rate >= FThresholds.BulkRate || Decision.Depth >= FThresholds.BulkDepth ||
+		(FThresholds.BulkLatency > 0 && Decision.Latency >= FThresholds.BulkLatency))
+	{
+		Decision.To = tpBulk;
+	}
+	else
+	{
+		if (Decision.Rate <= FThresholds.IdleRate && Decision.Depth == 0 &&
+			Decision.Requests == 0)
+		{
+			Decision.To = tpIdle;
+		}
+		else
+			Decision.To = tpBalanced;
+	}
+
+	// Hysteresis: the same new profile must win several evaluations in a
+	// row.
+	if (Decision.To == FProfile)
+	{
+		FCandidate = FProfile;
+		FVotes = 0;
+		return WCL_E_SUCCESS;
+	}
+	if (Decision.To != FCandidate)
+	{
+		FCandidate = Decision.To;
+		FVotes = 0;
+	}
+	FVotes++;
+
+	unsigned long Hold = Decision.To > FProfile ? FThresholds.UpHold : FThresholds.DownHold;
+	if (FVotes < Hold)
+		return WCL_E_SUCCESS;
+
+	FVotes = 0;
+	Decision.Error = Apply(Decision.To);
+	// A failed change is logged too; the next evaluations retry it.
+	if (Decision.Error == WCL_E_SUCCESS)
+		FProfile = Decision.To;
+	DoDecision(Decision);
+	return Decision.Error;
+}
+
+void CConnectionTuner::SetProfilePreset(const ConnectionTunerProfile Profile,
+	const wclBluetoothLeConnectionParametersType Preset)
+{
+	if (Profile <= tpBulk)
+	{
+		FProfiles[Profile].Preset = Preset;
+		FProfiles[Profile].UseValue = false;
+	}
+}
+
+void CConnectionTuner::SetProfileValue(const ConnectionTunerProfile Profile,
+	const wclBluetoothLeConnectionParametersValue& Value)
+{
+	if (Profile <= tpBulk)
+	{
+		FProfiles[Profile].Value = Value;
+		FProfiles[Profile].UseValue = true;
+	}
+}
+
+void CConnectionTuner::GetThresholds(ConnectionTunerThresholds& Thresholds) const
+{
+	Thresholds = FThresholds;
+}
+
+int CConnectionTuner::SetThresholds(const ConnectionTunerThresholds& Thresholds)
+{
+	if (Thresholds.IdleRate >= Thresholds.BulkRate || Thresholds.BulkDepth == 0 ||
+		Thresholds.UpHold == 0 || Thresholds.DownHold == 0)
+	{
+		return WCL_E_INVALID_ARGUMENT;
+	}
+
+	FThresholds = Thresholds;
+	return WCL_E_SUCCESS;
+}
+
+void CConnectionTuner::GetParams(wclBluetoothLeConnectionParameters& Params) const
+{
+	Params = FParams;
+}
+
+ConnectionTunerProfile CConnectionTuner::GetProfile() const
+{
+	return FProfile;
+}
+
+CwclGattClient* CConnectionTuner::GetClient() const
+{
+	return FClient;
+}
@@ -0,0 +1,218 @@
+// ConnectionTuner.h : traffic driven connection parameters selection
+//
+
+#pragma once
+
+#include "wclBluetooth.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The connection profiles selected by the tuner. </summary>
+typedef enum
+{
+	/// <summary> No or little traffic: long connection interval. </summary>
+	tpIdle,
+	/// <summary> Moderate traffic. </summary>
+	tpBalanced,
+	/// <summary> Bulk transfer: short connection interval. </summary>
+	tpBulk
+} ConnectionTunerProfile;
+
+/// <summary> The number of the tuner profiles. </summary>
+const unsigned long CONNECTION_TUNER_PROFILES = tpBulk + 1;
+
+/// <summary> The tuner thresholds. </summary>
+typedef struct
+{
+	/// <summary> The notification rate in notifications per second at or
+	///   above which the link is busy. </summary>
+	unsigned long BulkRate;
+	/// <summary> The write queue depth at or above which the link is
+	///   busy. </summary>
+	unsigned long BulkDepth;
+	/// <summary> The average request latency in microseconds at or above
+	///   which the link is busy. 0 disables the latency check. </summary>
+	unsigned long BulkLatency;
+	/// <summary> The notification rate at or below which the link is idle
+	///   if there are no writes and requests either. </summary>
+	unsigned long IdleRate;
+	/// <summary> The number of consecutive evaluations that must ask for a
+	///   faster profile before the tuner switches. </summary>
+	unsigned long UpHold;
+	/// <summary> The number of consecutive evaluations that must ask for a
+	///   slower profile before the tuner switches. </summary>
+	unsigned long DownHold;
+} ConnectionTunerThresholds;
+
+/// <summary> A tuner decision. </summary>
+typedef struct
+{
+	/// <summary> The previous profile. </summary>
+	ConnectionTunerProfile From;
+	/// <summary> The new profile. </summary>
+	ConnectionTunerProfile To;
+	/// <summary> The observed notification rate per second. </summary>
+	unsigned long Rate;
+	/// <summary> The maximum observed write queue depth. </summary>
+	unsigned long Depth;
+	/// <summary> The average observed request latency in
+	///   microseconds. </summary>
+	unsigned long Latency;
+	/// <summary> The number of the observed requests. </summary>
+	unsigned long Requests;
+	/// <summary> The result of the connection parameters change. </summary>
+	int Error;
+} ConnectionTunerDecision;
+
+/// <summary> The <c>OnDecision</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Decision"> The decision. </param>
+#define ConnectionTunerDecisionEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const ConnectionTunerDecision& Decision)
+
+/// <summary> Selects the connection parameters of a GATT client from the
+///   observed traffic. </summary>
+/// <remarks> <para> The tuner counts the client notifications itself. The
+///   write queue depth and the request latencies are reported by the
+///   <c>CGattStreamWriter</c>, <c>CGattCoalescingWriter</c> and
+///   <c>CGattAsyncClient</c> objects with the <c>Tuner</c> property set, or
+///   by the application with <c>ReportDepth</c> and <c>ReportRequest</c>. Every
+///   <c>Evaluate</c> call classifies the traffic since the previous call as
+///   idle, balanced or bulk. </para>
+///   <para> The profile is switched only after <c>UpHold</c> (faster) or
+///   <c>DownHold</c> (slower) consecutive evaluations agree, so short bursts
+///   and gaps do not flip the connection parameters. Every switch is
+///   reported by the <c>OnDecision</c> event. </para>
+///   <para> A profile maps to one of the connection parameter presets or,
+///   if set with <c>SetProfileValue</c>, to an explicit interval
+///   range. </para>
+///   <para> <c>Evaluate</c> must be called periodically from the thread
+///   that receives the client events, for example once a second from a
+///   timer. </para> </remarks>
+class CConnectionTuner
+{
+	DISABLE_COPY(CConnectionTuner);
+
+private:
+	typedef struct
+	{
+		wclBluetoothLeConnectionParametersType	Preset;
+		bool									UseValue;
+		wclBluetoothLeConnectionParametersValue	Value;
+	} PROFILE;
+
+	CwclGattClient*				FClient;
+	ConnectionTunerThresholds	FThresholds;
+	PROFILE						FProfiles[CONNECTION_TUNER_PROFILES];
+
+	ConnectionTunerProfile		FProfile;
+	ConnectionTunerProfile		FCandidate;
+	unsigned long				FVotes;
+	unsigned __int64			FWindowStarted;
+
+	volatile LONG				FNotifications;
+	volatile LONG				FDepth;
+	volatile LONG				FRequests;
+	volatile LONG64				FLatency;
+
+	wclBluetoothLeConnectionParameters	FParams;
+
+	int Apply(const ConnectionTunerProfile Profile);
+
+	void ClientCharacteristicChanged(void* Sender, const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+	void ClientConnectionParamsChanged(void* Sender);
+
+protected:
+	/// <summary> Fires the <c>OnDecision</c> event. </summary>
+	/// <param name="Decision"> The decision. </param>
+	virtual void DoDecision(const ConnectionTunerDecision& Decision);
+
+public:
+	/// <summary> Creates new connection tuner. </summary>
+	CConnectionTuner();
+	/// <summary> Frees the connection tuner. </summary>
+	virtual ~CConnectionTuner();
+
+	/// <summary> Starts tuning the client. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Profile"> The initial profile. It is applied at
+	///   once. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Attach(CwclGattClient* const Client,
+		const ConnectionTunerProfile Profile = tpBalanced);
+	/// <summary> Stops tuning the client. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The current connection parameters are kept. </remarks>
+	int Detach();
+
+	/// <summary> Reports the current write queue depth. </summary>
+	/// <param name="Depth"> The number of the queued writes. </param>
+	/// <remarks> The maximum depth since the previous evaluation is used. Can
+	///   be called from any thread. </remarks>
+	void ReportDepth(const unsigned long Depth);
+	/// <summary> Reports a completed request. </summary>
+	/// <param name="Latency"> The request latency in microseconds. </param>
+	/// <remarks> Can be called from any thread. </remarks>
+	void ReportRequest(const unsigned long Latency);
+
+	/// <summary> Classifies the traffic since the previous call and switches
+	///   the profile if needed. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Evaluate();
+
+	/// <summary> Uses the connection parameters preset for the
+	///   profile. </summary>
+	/// <param name="Profile"> The profile. </param>
+	/// <param name="Preset"> The connection parameters preset. </param>
+	void SetProfilePreset(const ConnectionTunerProfile Profile,
+		const wclBluetoothLeConnectionParametersType Preset);
+	/// <summary> Uses the explicit connection parameters for the
+	///   profile. </summary>
+	/// <param name="Profile"> The profile. </param>
+	/// <param name="Value"> The connection parameters. </param>
+	void SetProfileValue(const ConnectionTunerProfile Profile,
+		const wclBluetoothLeConnectionParametersValue& Value);
+
+	/// <summary> Gets the thresholds. </summary>
+	/// <param name="Thresholds"> On output the thresholds. </param>
+	void GetThresholds(ConnectionTunerThresholds& Thresholds) const;
+	/// <summary> Sets the thresholds. </summary>
+	/// <param name="Thresholds"> The thresholds. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int SetThresholds(const ConnectionTunerThresholds& Thresholds);
+
+	/// <summary> Gets the last connection parameters reported by the
+	///   client. </summary>
+	/// <param name="Params"> On output the connection parameters. </param>
+	void GetParams(wclBluetoothLeConnectionParameters& Params) const;
+
+	/// <summary> Gets the current profile. </summary>
+	/// <returns> The profile. </returns>
+	ConnectionTunerProfile GetProfile() const;
+	/// <summary> Gets the current profile. </summary>
+	/// <value> The profile. </value>
+	__declspec(property(get = GetProfile)) ConnectionTunerProfile Profile;
+
+	/// <summary> Gets the tuned client. </summary>
+	/// <returns> The client or <c>NULL</c>. </returns>
+	CwclGattClient* GetClient() const;
+	/// <summary> Gets the tuned client. </summary>
+	/// <value> The client or <c>NULL</c>. </value>
+	__declspec(property(get = GetClient)) CwclGattClient* Client;
+
+	/// <summary> The event fires when the tuner switches the
+	///   profile. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Decision"> The decision. </param>
+	ConnectionTunerDecisionEvent(OnDecision);
+};
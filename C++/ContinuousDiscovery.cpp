@@ -0,0 +1,340 @@
+// ContinuousDiscovery.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "ContinuousDiscovery.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The aging timer period in milliseconds.
+static const unsigned long DISCOVERY_TICK_INTERVAL = 500;
+// The minimum pause before an inquiry that has failed is started again, in
+// milliseconds.
+static const unsigned long DISCOVERY_RETRY_INTERVAL = 1000;
+
+
+// CContinuousDiscovery
+
+CContinuousDiscovery::CContinuousDiscovery()
+{
+	FIdleTime = 0;
+	FLifetime = 30000;
+	FScanTime = 10;
+
+	FEvent = NULL;
+	FCycles = 0;
+	FDiscovering = false;
+	FManager = NULL;
+	FRadio = NULL;
+	FReceiver = NULL;
+	FRestartAt = 0;
+	FTerminated = 0;
+	FThread = NULL;
+	FTickPending = 0;
+
+	__hook(&CDeviceRegistry::OnDeviceAdded, &FRegistry,
+		&CContinuousDiscovery::RegistryDeviceAdded);
+	__hook(&CDeviceRegistry::OnDeviceChanged, &FRegistry,
+		&CContinuousDiscovery::RegistryDeviceChanged);
+}
+
+CContinuousDiscovery::~CContinuousDiscovery()
+{
+	Stop();
+
+	__unhook(&FRegistry);
+}
+
+UINT __stdcall CContinuousDiscovery::_TimerThreadProc(LPVOID lpParam)
+{
+	static_cast<CContinuousDiscovery*>(lpParam)->TimerThreadProc();
+	return 0;
+}
+
+void CContinuousDiscovery::TimerThreadProc()
+{
+	while (FTerminated == 0)
+	{
+		// Wake up earlier when the next inquiry is due before the tick.
+		unsigned long Wait = DISCOVERY_TICK_INTERVAL;
+		unsigned __int64 RestartAt = static_cast<unsigned __int64>(
+			InterlockedCompareExchange64(&FRestartAt, 0, 0));
+		if (RestartAt != 0)
+		{
+			unsigned __int64 Now = CMessageStats::Now();
+			if (RestartAt <= Now)
+				Wait = 0;
+			else
+			{
+				unsigned __int64 Left = (RestartAt - Now + 999) / 1000;
+				if (Left < Wait)
+					Wait = static_cast<unsigned long>(Left);
+			}
+		}
+
+		if (Wait > 0)
+		{
+			FEvent->WaitOne(Wait);
+			if (FTerminated != 0)
+				break;
+		}
+
+		// Never queue more than one tick: a busy UI thread gets a single
+		// sweep when it comes back, not a backlog of them.
+		if (InterlockedExchange(&FTickPending, 1) != 0)
+		{
+			FEvent->WaitOne(DISCOVERY_TICK_INTERVAL);
+			continue;
+		}
+
+		CwclMessage* Msg = new CwclMessage(APP_MSG_ID_DISCOVERY_TICK, mcUser);
+		FReceiver->Post(Msg);
+		Msg->Release();
+	}
+}
+
+void CContinuousDiscovery::Free()
+{
+	if (FReceiver != NULL)
+	{
+		__unhook(&CwclMessageReceiver::OnMessage, FReceiver,
+			&CContinuousDiscovery::ReceiverMessage);
+		FReceiver->Close();
+		delete FReceiver;
+		FReceiver = NULL;
+	}
+	if (FEvent != NULL)
+	{
+		delete FEvent;
+		FEvent = NULL;
+	}
+}
+
+void CContinuousDiscovery::Restart()
+{
+	InterlockedExchange64(&FRestartAt, 0);
+
+	int Res = FRadio->Discover(FScanTime, dkBle);
+	if (Res == WCL_E_SUCCESS)
+		FDiscovering = true;
+	else
+	{
+		// The radio may be busy with another discovering: try again later.
+		unsigned long Pause = max(FIdleTime, DISCOVERY_RETRY_INTERVAL);
+		InterlockedExchange64(&FRestartAt, static_cast<LONGLONG>(
+			CMessageStats::Now() + static_cast<unsigned __int64>(Pause) * 1000));
+	}
+}
+
+void CContinuousDiscovery::Sweep()
+{
+	unsigned __int64 Now = CMessageStats::Now();
+	unsigned __int64 Lifetime = static_cast<unsigned __int64>(FLifetime) * 1000;
+	if (Now <= Lifetime)
+		return;
+
+	FRegistry.Expire(Now - Lifetime, FExpired);
+	for (DeviceRecords::const_iterator r = FExpired.begin(); r != FExpired.end(); r++)
+		DoDeviceDisappeared(*r);
+}
+
+void CContinuousDiscovery::ManagerDiscoveringCompleted(void* Sender,
+	CwclBluetoothRadio* const Radio, const int Error)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	if (Radio != FRadio || !FDiscovering)
+		return;
+
+	FDiscovering = false;
+	FCycles++;
+
+	unsigned long Pause = FIdleTime;
+	if (Error != WCL_E_SUCCESS)
+		Pause = max(Pause, DISCOVERY_RETRY_INTERVAL);
+	InterlockedExchange64(&FRestartAt, static_cast<LONGLONG>(
+		CMessageStats::Now() + static_cast<unsigned __int64>(Pause) * 1000));
+
+	// The timer thread posts the restart tick at once when there is no
+	// pause.
+	FEvent->SetEvent();
+}
+
+void CContinuousDiscovery::ReceiverMessage(const CwclMessage* const Message)
+{
+	if (Message->Category != mcUser || Message->Id != APP_MSG_ID_DISCOVERY_TICK)
+		return;
+
+	InterlockedExchange(&FTickPending, 0);
+	// The tick may have been queued before Stop.
+	if (FRadio == NULL)
+		return;
+
+	Sweep();
+
+	unsigned __int64 RestartAt = static_cast<unsigned __int64>(
+		InterlockedCompareExchange64(&FRestartAt, 0, 0));
+	if (RestartAt != 0 && RestartAt <= CMessageStats::Now())
+		Restart();
+}
+
+void CContinuousDiscovery::RegistryDeviceAdded(void* Sender, const DeviceRecord& Record)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	DoDeviceAppeared(Record);
+}
+
+void CContinuousDiscovery::RegistryDeviceChanged(void* Sender, const DeviceRecord& Record)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	DoDeviceChanged(Record);
+}
+
+void CContinuousDiscovery::DoDeviceAppeared(const DeviceRecord& Record)
+{
+	__raise OnDeviceAppeared(this, Record);
+}
+
+void CContinuousDiscovery::DoDeviceChanged(const DeviceRecord& Record)
+{
+	__raise OnDeviceChanged(this, Record);
+}
+
+void CContinuousDiscovery::DoDeviceDisappeared(const DeviceRecord& Record)
+{
+	__raise OnDeviceDisappeared(this, Record);
+}
+
+int CContinuousDiscovery::Start(CwclBluetoothManager* const Manager,
+	CwclBluetoothRadio* const Radio, const unsigned long Fields)
+{
+	if (FRadio != NULL)
+		return APP_E_DISCOVERY_STARTED;
+	if (Manager == NULL || Radio == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FEvent = CwclAutoResetEvent::Create();
+	if (FEvent == NULL)
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+
+	FReceiver = new CwclMessageReceiver();
+	__hook(&CwclMessageReceiver::OnMessage, FReceiver,
+		&CContinuousDiscovery::ReceiverMessage);
+	int Res = FReceiver->Open(mpSync);
+	if (Res == WCL_E_SUCCESS)
+		Res = FRegistry.Attach(Manager, Radio, Fields, mpSync);
+	if (Res != WCL_E_SUCCESS)
+	{
+		Free();
+		return Res;
+	}
+
+	FManager = Manager;
+	FRadio = Radio;
+	__hook(&CwclBluetoothManager::OnDiscoveringCompleted, FManager,
+		&CContinuousDiscovery::ManagerDiscoveringCompleted);
+
+	FCycles = 0;
+	FRestartAt = 0;
+	FTerminated = 0;
+	FTickPending = 0;
+	FThread = wclCreateThread(_TimerThreadProc, this);
+	if (FThread == NULL)
+	{
+		Stop();
+		return WCL_E_MR_UNABLE_SYNCHRONIZE;
+	}
+
+	Res = FRadio->Discover(FScanTime, dkBle);
+	if (Res != WCL_E_SUCCESS)
+	{
+		Stop();
+		return Res;
+	}
+	FDiscovering = true;
+	return WCL_E_SUCCESS;
+}
+
+int CContinuousDiscovery::Stop()
+{
+	if (FRadio == NULL)
+		return APP_E_DISCOVERY_NOT_STARTED;
+
+	if (FThread != NULL)
+	{
+		InterlockedExchange(&FTerminated, 1);
+		FEvent->SetEvent();
+		wclWaitAndCloseThread(FThread);
+		FThread = NULL;
+	}
+
+	__unhook(&CwclBluetoothManager::OnDiscoveringCompleted, FManager,
+		&CContinuousDiscovery::ManagerDiscoveringCompleted);
+	if (FDiscovering)
+	{
+		FRadio->Terminate();
+		FDiscovering = false;
+	}
+
+	FRegistry.Detach();
+	FRegistry.Clear();
+	FManager = NULL;
+	FRadio = NULL;
+	FRestartAt = 0;
+
+	Free();
+	return WCL_E_SUCCESS;
+}
+
+void CContinuousDiscovery::GetSnapshot(DeviceRecords& Records) const
+{
+	FRegistry.GetSnapshot(Records);
+}
+
+bool CContinuousDiscovery::GetActive() const
+{
+	return (FRadio != NULL);
+}
+
+unsigned long CContinuousDiscovery::GetCycles() const
+{
+	return FCycles;
+}
+
+unsigned long CContinuousDiscovery::GetIdleTime() const
+{
+	return FIdleTime;
+}
+
+void CContinuousDiscovery::SetIdleTime(const unsigned long Value)
+{
+	FIdleTime = Value;
+}
+
+unsigned long CContinuousDiscovery::GetLifetime() const
+{
+	return FLifetime;
+}
+
+void CContinuousDiscovery::SetLifetime(const unsigned long Value)
+{
+	if (Value > 0)
+		FLifetime = Value;
+}
+
+unsigned char CContinuousDiscovery::GetScanTime() const
+{
+	return FScanTime;
+}
+
+void CContinuousDiscovery::SetScanTime(const unsigned char Value)
+{
+	if (Value > 0)
+		FScanTime = Value;
+}
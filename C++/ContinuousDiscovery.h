@@ -0,0 +1,191 @@
+// ContinuousDiscovery.h : duty cycled background discovery with device aging
+//
+
+#pragma once
+
+#include "wclBluetooth.h"
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+#include "DeviceRegistry.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The discovery timer message ID. The message category is
+///   <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_DISCOVERY_TICK = 6;
+
+/// <summary> The base value of the continuous discovery error
+///   codes. </summary>
+const int APP_E_DISCOVERY_BASE = 0x00F0A000;
+/// <summary> The continuous discovery is not running. </summary>
+const int APP_E_DISCOVERY_NOT_STARTED = APP_E_DISCOVERY_BASE + 0x0000;
+/// <summary> The continuous discovery is already running. </summary>
+const int APP_E_DISCOVERY_STARTED = APP_E_DISCOVERY_BASE + 0x0001;
+
+/// <summary> Discovers Bluetooth LE devices continuously and reports the
+///   devices that come and go. </summary>
+/// <remarks> <para> The radio runs bounded inquiries of <c>ScanTime</c>
+///   seconds. A new inquiry is started from the <c>OnDiscoveringCompleted</c>
+///   event of the previous one after <c>IdleTime</c> milliseconds, so the
+///   duty cycle is <c>ScanTime / (ScanTime + IdleTime)</c>. With a zero
+///   <c>IdleTime</c> the radio never stays idle. </para>
+///   <para> The found devices are kept in a <see cref="CDeviceRegistry" />.
+///   <c>OnDeviceAppeared</c> fires on the first report of a device and
+///   <c>OnDeviceDisappeared</c> fires when the device has not been reported
+///   for <c>Lifetime</c> milliseconds. A device that comes back appears
+///   again. </para>
+///   <para> The aging runs on a fixed timer, not per report: a report costs
+///   a single hash lookup and the timer visits each registry slot once per
+///   tick, so the CPU time per device per second does not grow with the
+///   running time. </para>
+///   <para> The events fire in the thread that called <c>Start</c>. That
+///   thread must process messages. </para> </remarks>
+class CContinuousDiscovery
+{
+	DISABLE_COPY(CContinuousDiscovery);
+
+private:
+	unsigned long			FIdleTime;
+	unsigned long			FLifetime;
+	unsigned char			FScanTime;
+
+	CwclAutoResetEvent*		FEvent;
+	// The number of the inquiries completed since Start.
+	unsigned long			FCycles;
+	bool					FDiscovering;
+	CwclBluetoothManager*	FManager;
+	CwclBluetoothRadio*		FRadio;
+	CwclMessageReceiver*	FReceiver;
+	CDeviceRegistry			FRegistry;
+	// Reused by every sweep so the aging does not allocate.
+	DeviceRecords			FExpired;
+	// The time the next inquiry starts at, in microseconds. 0 if no inquiry
+	// is scheduled. Accessed from the timer thread.
+	volatile LONGLONG		FRestartAt;
+	volatile LONG			FTerminated;
+	HANDLE					FThread;
+	// Set while a tick message is in the receiver queue.
+	volatile LONG			FTickPending;
+
+	static UINT __stdcall _TimerThreadProc(LPVOID lpParam);
+	void TimerThreadProc();
+
+	void Free();
+	void Restart();
+	void Sweep();
+
+	void ManagerDiscoveringCompleted(void* Sender, CwclBluetoothRadio* const Radio,
+		const int Error);
+	void ReceiverMessage(const CwclMessage* const Message);
+	void RegistryDeviceAdded(void* Sender, const DeviceRecord& Record);
+	void RegistryDeviceChanged(void* Sender, const DeviceRecord& Record);
+
+protected:
+	/// <summary> Fires the <c>OnDeviceAppeared</c> event. </summary>
+	/// <param name="Record"> The device record. </param>
+	virtual void DoDeviceAppeared(const DeviceRecord& Record);
+	/// <summary> Fires the <c>OnDeviceChanged</c> event. </summary>
+	/// <param name="Record"> The device record. </param>
+	virtual void DoDeviceChanged(const DeviceRecord& Record);
+	/// <summary> Fires the <c>OnDeviceDisappeared</c> event. </summary>
+	/// <param name="Record"> The device record. </param>
+	virtual void DoDeviceDisappeared(const DeviceRecord& Record);
+
+public:
+	/// <summary> Creates new continuous discovery. </summary>
+	CContinuousDiscovery();
+	/// <summary> Frees the continuous discovery. </summary>
+	virtual ~CContinuousDiscovery();
+
+	/// <summary> Starts the continuous discovery. </summary>
+	/// <param name="Manager"> The opened Bluetooth Manager. </param>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Fields"> The information read for every appeared device:
+	///   a combination of the <c>REMOTE_INFO_*</c> flags. 0 disables the
+	///   lookups. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Start(CwclBluetoothManager* const Manager, CwclBluetoothRadio* const Radio,
+		const unsigned long Fields = REMOTE_INFO_NAME);
+	/// <summary> Stops the continuous discovery. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The devices are removed without the
+	///   <c>OnDeviceDisappeared</c> events. </remarks>
+	int Stop();
+
+	/// <summary> Gets the present devices. </summary>
+	/// <param name="Records"> On output the device records in the order they
+	///   have appeared. </param>
+	void GetSnapshot(DeviceRecords& Records) const;
+
+	/// <summary> Gets the running state. </summary>
+	/// <returns> <c>true</c> if the discovery is running. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the running state. </summary>
+	/// <value> <c>true</c> if the discovery is running. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> Gets the number of the completed inquiries. </summary>
+	/// <returns> The number of the inquiries since <c>Start</c>. </returns>
+	unsigned long GetCycles() const;
+	/// <summary> Gets the number of the completed inquiries. </summary>
+	/// <value> The number of the inquiries since <c>Start</c>. </value>
+	__declspec(property(get = GetCycles)) unsigned long Cycles;
+
+	/// <summary> Gets the pause between the inquiries. </summary>
+	/// <returns> The pause in milliseconds. </returns>
+	unsigned long GetIdleTime() const;
+	/// <summary> Sets the pause between the inquiries. </summary>
+	/// <param name="Value"> The pause in milliseconds. 0 starts the next
+	///   inquiry as soon as the previous one completes. </param>
+	void SetIdleTime(const unsigned long Value);
+	/// <summary> Gets and sets the pause between the inquiries. </summary>
+	/// <value> The pause in milliseconds. </value>
+	__declspec(property(get = GetIdleTime, put = SetIdleTime)) unsigned long IdleTime;
+
+	/// <summary> Gets the time a device stays present without
+	///   reports. </summary>
+	/// <returns> The time in milliseconds. </returns>
+	unsigned long GetLifetime() const;
+	/// <summary> Sets the time a device stays present without
+	///   reports. </summary>
+	/// <param name="Value"> The time in milliseconds. Should cover at least
+	///   one inquiry and one pause, otherwise the devices that are reported
+	///   once per inquiry disappear between the inquiries. </param>
+	void SetLifetime(const unsigned long Value);
+	/// <summary> Gets and sets the time a device stays present without
+	///   reports. </summary>
+	/// <value> The time in milliseconds. </value>
+	__declspec(property(get = GetLifetime, put = SetLifetime)) unsigned long Lifetime;
+
+	/// <summary> Gets the inquiry duration. </summary>
+	/// <returns> The duration in seconds. </returns>
+	unsigned char GetScanTime() const;
+	/// <summary> Sets the inquiry duration. </summary>
+	/// <param name="Value"> The duration in seconds. Must not be 0. Applies
+	///   from the next inquiry. </param>
+	void SetScanTime(const unsigned char Value);
+	/// <summary> Gets and sets the inquiry duration. </summary>
+	/// <value> The duration in seconds. </value>
+	__declspec(property(get = GetScanTime, put = SetScanTime)) unsigned char ScanTime;
+
+	/// <summary> The event fires when a device has been found. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Record"> The device record. </param>
+	DeviceRegistryEvent(OnDeviceAppeared);
+	/// <summary> The event fires when the device information has been
+	///   read. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Record"> The device record. </param>
+	DeviceRegistryEvent(OnDeviceChanged);
+	/// <summary> The event fires when a device has not been reported for
+	///   <c>Lifetime</c> milliseconds. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Record"> The last device record. </param>
+	DeviceRegistryEvent(OnDeviceDisappeared);
+};
@@ -0,0 +1,414 @@
+// DeviceRegistry.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "DeviceRegistry.h"
+
+#include <algorithm>
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The initial number of the hash table slots. Must be a power of 2.
+static const unsigned long REGISTRY_INITIAL_SLOTS = 256;
+
+static bool RecordIndexLess(const DeviceRecord& a, const DeviceRecord& b)
+{
+	return (a.Index < b.Index);
+}
+
+
+// CDeviceRegistry
+
+CDeviceRegistry::CDeviceRegistry()
+{
+	FCS = new CwclCriticalSection();
+	FCount = 0;
+	FFields = 0;
+	FManager = NULL;
+	FNextIndex = 0;
+	FRadio = NULL;
+	FResolver = NULL;
+}
+
+CDeviceRegistry::~CDeviceRegistry()
+{
+	Detach();
+
+	delete FCS;
+}
+
+CDeviceRegistry::SLOT* CDeviceRegistry::Find(const __int64 Address)
+{
+	if (FSlots.size() == 0)
+		return NULL;
+
+	unsigned long Mask = static_cast<unsigned long>(FSlots.size()) - 1;
+	for (unsigned long i = Hash(Address) & Mask; FSlots[i].Used; i = (i + 1) & Mask)
+	{
+		if (FSlots[i].Record.Address == Address)
+			return &FSlots[i];
+	}
+	return NULL;
+}
+
+CDeviceRegistry::SLOT* CDeviceRegistry::Insert(const __int64 Address, bool& Added)
+{
+	Added = false;
+	SLOT* Slot = Find(Address);
+	if (Slot != NULL)
+		return Slot;
+
+	// Keep the load factor under 3/4 so the probe sequences stay short.
+	if ((FCount + 1) * 4 > FSlots.size() * 3)
+		Grow();
+
+	unsigned long Mask = static_cast<unsigned long>(FSlots.size()) - 1;
+	unsigned long i = Hash(Address) & Mask;
+	while (FSlots[i].Used)
+		i = (i + 1) & Mask;
+
+	Slot = &FSlots[i];
+	Slot->Used = true;
+	Slot->RssiPending = false;
+	DeviceRecord& Record = Slot->Record;
+	Record.Address = Address;
+	Record.Index = FNextIndex++;
+	Record.FirstSeen = 0;
+	Record.LastSeen = 0;
+	Record.Reports = 0;
+	Record.Resolved = 0;
+	Record.Updated = 0;
+	Record.Name.clear();
+	Record.NameError = WCL_E_SUCCESS;
+	Record.Paired = false;
+	Record.PairedError = WCL_E_SUCCESS;
+	Record.AddressType = atPublic;
+	Record.DeviceType = dtBle;
+	Record.Rssi = 0;
+	FCount++;
+
+	Added = true;
+	return Slot;
+}
+
+void CDeviceRegistry::Erase(unsigned long Index)
+{
+	EraseSlot(static_cast<unsigned long>(FSlots.size()) - 1, Index);
+	FCount--;
+}
+
+void CDeviceRegistry::Grow()
+{
+	SLOTS Old;
+	Old.swap(FSlots);
+
+	size_t Size = Old.size() == 0 ? REGISTRY_INITIAL_SLOTS : Old.size() * 2;
+	FSlots.resize(Size);
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+		s->Used = false;
+
+	unsigned long Mask = static_cast<unsigned long>(Size) - 1;
+	for (SLOTS::iterator s = Old.begin(); s != Old.end(); s++)
+	{
+		if (s->Used)
+		{
+			unsigned long i = Hash(s->Record.Address) & Mask;
+			while (FSlots[i].Used)
+				i = (i + 1) & Mask;
+			FSlots[i].Used = true;
+			FSlots[i].RssiPending = s->RssiPending;
+			FSlots[i].Record = s->Record;
+		}
+	}
+}
+
+bool CDeviceRegistry::IsSlotUsed(const unsigned long Slot) const
+{
+	return FSlots[Slot].Used;
+}
+
+__int64 CDeviceRegistry::GetSlotAddress(const unsigned long Slot) const
+{
+	return FSlots[Slot].Record.Address;
+}
+
+void CDeviceRegistry::MoveSlot(const unsigned long To, const unsigned long From)
+{
+	FSlots[To].RssiPending = FSlots[From].RssiPending;
+	FSlots[To].Record = FSlots[From].Record;
+}
+
+void CDeviceRegistry::ClearSlot(const unsigned long Slot)
+{
+	FSlots[Slot].Used = false;
+	FSlots[Slot].Record.Name.clear();
+}
+
+void CDeviceRegistry::ManagerDeviceFound(void* Sender, CwclBluetoothRadio* const Radio,
+	const __int64 Address)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	if (Radio != FRadio)
+		return;
+
+	unsigned __int64 Now = CMessageStats::Now();
+
+	bool Added;
+	DeviceRecord Record;
+	unsigned long Fields = 0;
+	FCS->Enter();
+	SLOT* Slot = Insert(Address, Added);
+	if (Added)
+	{
+		Slot->Record.FirstSeen = Now;
+		Fields = FFields;
+	}
+	else
+	{
+		// Only the RSSI changes between the reports. One read at a time per
+		// device keeps a chatty device from flooding the resolver.
+		if ((FFields & REMOTE_INFO_RSSI) != 0 && !Slot->RssiPending)
+			Fields = REMOTE_INFO_RSSI;
+	}
+	if ((Fields & REMOTE_INFO_RSSI) != 0)
+		Slot->RssiPending = true;
+	Slot->Record.LastSeen = Now;
+	Slot->Record.Reports++;
+	if (Added)
+		Record = Slot->Record;
+	FCS->Leave();
+
+	if (Added)
+		DoDeviceAdded(Record);
+	if (FResolver != NULL && Fields != 0)
+	{
+		wclBluetoothAddresses Addresses;
+		Addresses.push_back(Address);
+		FResolver->Resolve(FRadio, Addresses, Fields);
+	}
+}
+
+void CDeviceRegistry::ResolverResolved(void* Sender, const RemoteInfo& Info)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	DeviceRecord Record;
+	FCS->Enter();
+	SLOT* Slot = Find(Info.Address);
+	if (Slot != NULL)
+	{
+		DeviceRecord& r = Slot->Record;
+		r.Updated = Info.Fields;
+		if ((Info.Fields & REMOTE_INFO_NAME) != 0)
+		{
+			r.NameError = Info.NameError;
+			if (Info.NameError == WCL_E_SUCCESS)
+			{
+				r.Name = Info.Name;
+				r.Resolved |= REMOTE_INFO_NAME;
+			}
+		}
+		if ((Info.Fields & REMOTE_INFO_PAIRED) != 0)
+		{
+			r.PairedError = Info.PairedError;
+			if (Info.PairedError == WCL_E_SUCCESS)
+			{
+				r.Paired = Info.Paired;
+				r.Resolved |= REMOTE_INFO_PAIRED;
+			}
+		}
+		if ((Info.Fields & REMOTE_INFO_ADDRESS_TYPE) != 0 &&
+			Info.AddressTypeError == WCL_E_SUCCESS)
+		{
+			r.AddressType = Info.AddressType;
+			r.Resolved |= REMOTE_INFO_ADDRESS_TYPE;
+		}
+		if ((Info.Fields & REMOTE_INFO_DEVICE_TYPE) != 0 &&
+			Info.DeviceTypeError == WCL_E_SUCCESS)
+		{
+			r.DeviceType = Info.DeviceType;
+			r.Resolved |= REMOTE_INFO_DEVICE_TYPE;
+		}
+		if ((Info.Fields & REMOTE_INFO_RSSI) != 0)
+		{
+			Slot->RssiPending = false;
+			if (Info.RssiError == WCL_E_SUCCESS)
+			{
+				r.Rssi = Info.Rssi;
+				r.Resolved |= REMOTE_INFO_RSSI;
+			}
+		}
+		Record = r;
+	}
+	FCS->Leave();
+
+	// Skip the device removed while it was being resolved.
+	if (Slot != NULL)
+		DoDeviceChanged(Record);
+}
+
+void CDeviceRegistry::DoDeviceAdded(const DeviceRecord& Record)
+{
+	__raise OnDeviceAdded(this, Record);
+}
+
+void CDeviceRegistry::DoDeviceChanged(const DeviceRecord& Record)
+{
+	__raise OnDeviceChanged(this, Record);
+}
+
+int CDeviceRegistry::Attach(CwclBluetoothManager* const Manager,
+	CwclBluetoothRadio* const Radio, const unsigned long Fields,
+	const wclMessageProcessingMethod Method)
+{
+	if (FRadio != NULL)
+		return APP_E_REGISTRY_ATTACHED;
+	if (Manager == NULL || Radio == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	if ((Fields & REMOTE_INFO_ALL) != 0)
+	{
+		FResolver = new CRemoteInfoResolver();
+		__hook(&CRemoteInfoResolver::OnResolved, FResolver,
+			&CDeviceRegistry::ResolverResolved);
+		int Res = FResolver->Open(Method);
+		if (Res != WCL_E_SUCCESS)
+		{
+			__unhook(&CRemoteInfoResolver::OnResolved, FResolver,
+				&CDeviceRegistry::ResolverResolved);
+			delete FResolver;
+			FResolver = NULL;
+			return Res;
+		}
+	}
+
+	FFields = Fields & REMOTE_INFO_ALL;
+	FManager = Manager;
+	FRadio = Radio;
+	__hook(&CwclBluetoothManager::OnDeviceFound, FManager,
+		&CDeviceRegistry::ManagerDeviceFound);
+	return WCL_E_SUCCESS;
+}
+
+int CDeviceRegistry::Detach()
+{
+	if (FRadio == NULL)
+		return APP_E_REGISTRY_NOT_ATTACHED;
+
+	__unhook(&CwclBluetoothManager::OnDeviceFound, FManager,
+		&CDeviceRegistry::ManagerDeviceFound);
+	if (FResolver != NULL)
+	{
+		FResolver->Close();
+		__unhook(&CRemoteInfoResolver::OnResolved, FResolver,
+			&CDeviceRegistry::ResolverResolved);
+		delete FResolver;
+		FResolver = NULL;
+
+		// The closed resolver drops its queued reads.
+		FCS->Enter();
+		for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+			s->RssiPending = false;
+		FCS->Leave();
+	}
+	FManager = NULL;
+	FRadio = NULL;
+	return WCL_E_SUCCESS;
+}
+
+void CDeviceRegistry::Clear()
+{
+	if (FResolver != NULL)
+		FResolver->Cancel();
+
+	FCS->Enter();
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		if (s->Used)
+		{
+			s->Used = false;
+			s->Record.Name.clear();
+		}
+	}
+	FCount = 0;
+	FNextIndex = 0;
+	FCS->Leave();
+}
+
+int CDeviceRegistry::Remove(const __int64 Address)
+{
+	int Res = APP_E_REGISTRY_NOT_FOUND;
+	FCS->Enter();
+	SLOT* Slot = Find(Address);
+	if (Slot != NULL)
+	{
+		Erase(static_cast<unsigned long>(Slot - FSlots.data()));
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+void CDeviceRegistry::Expire(const unsigned __int64 Before, DeviceRecords& Expired)
+{
+	Expired.clear();
+	FCS->Enter();
+	unsigned long Size = static_cast<unsigned long>(FSlots.size());
+	for (unsigned long i = 0; i < Size; i++)
+	{
+		// Erase shifts the next entry into the slot, so check it again.
+		while (FSlots[i].Used && FSlots[i].Record.LastSeen < Before)
+		{
+			Expired.push_back(FSlots[i].Record);
+			Erase(i);
+		}
+	}
+	FCS->Leave();
+}
+
+int CDeviceRegistry::GetDevice(const __int64 Address, DeviceRecord& Record) const
+{
+	int Res = APP_E_REGISTRY_NOT_FOUND;
+	FCS->Enter();
+	SLOT* Slot = const_cast<CDeviceRegistry*>(this)->Find(Address);
+	if (Slot != NULL)
+	{
+		Record = Slot->Record;
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+void CDeviceRegistry::GetSnapshot(DeviceRecords& Records) const
+{
+	Records.clear();
+	FCS->Enter();
+	Records.reserve(FCount);
+	for (SLOTS::const_iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		if (s->Used)
+			Records.push_back(s->Record);
+	}
+	FCS->Leave();
+
+	std::sort(Records.begin(), Records.end(), RecordIndexLess);
+}
+
+unsigned long CDeviceRegistry::GetCount() const
+{
+	FCS->Enter();
+	unsigned long Count = FCount;
+	FCS->Leave();
+	return Count;
+}
+
+CwclBluetoothRadio* CDeviceRegistry::GetRadio() const
+{
+	return FRadio;
+}
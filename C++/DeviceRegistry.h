@@ -0,0 +1,217 @@
+// DeviceRegistry.h : deduplicated registry of the discovered devices
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+#include "AddressIndex.h"
+#include "RemoteInfoResolver.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the device registry error codes. </summary>
+const int APP_E_REGISTRY_BASE = 0x00F09000;
+/// <summary> The registry is not attached to a radio. </summary>
+const int APP_E_REGISTRY_NOT_ATTACHED = APP_E_REGISTRY_BASE + 0x0000;
+/// <summary> The registry is already attached to a radio. </summary>
+const int APP_E_REGISTRY_ATTACHED = APP_E_REGISTRY_BASE + 0x0001;
+/// <summary> The device is not in the registry. </summary>
+const int APP_E_REGISTRY_NOT_FOUND = APP_E_REGISTRY_BASE + 0x0002;
+
+/// <summary> A registered device. </summary>
+typedef struct
+{
+	/// <summary> The device MAC address. </summary>
+	__int64 Address;
+	/// <summary> The registration order number. It never changes while the
+	///   device stays in the registry. </summary>
+	unsigned long Index;
+	/// <summary> The time the device has been found first, in
+	///   microseconds. </summary>
+	unsigned __int64 FirstSeen;
+	/// <summary> The time the device has been reported last, in
+	///   microseconds. </summary>
+	unsigned __int64 LastSeen;
+	/// <summary> The number of the discovery reports. </summary>
+	unsigned long Reports;
+	/// <summary> The <c>REMOTE_INFO_*</c> flags of the fields that have been
+	///   read successfully. The other fields are not valid. </summary>
+	unsigned long Resolved;
+	/// <summary> The <c>REMOTE_INFO_*</c> flags of the fields the latest
+	///   read has returned, successfully or not. A repeated report reads
+	///   the RSSI only. </summary>
+	unsigned long Updated;
+	/// <summary> The device name. </summary>
+	tstring Name;
+	/// <summary> The device name read result. </summary>
+	int NameError;
+	/// <summary> The device paired state. </summary>
+	bool Paired;
+	/// <summary> The device paired state read result. </summary>
+	int PairedError;
+	/// <summary> The device address type. </summary>
+	wclBluetoothAddressType AddressType;
+	/// <summary> The device type. </summary>
+	wclBluetoothDeviceType DeviceType;
+	/// <summary> The device RSSI of the latest report that has been
+	///   resolved. </summary>
+	char Rssi;
+} DeviceRecord;
+/// <summary> The list of the registered devices. </summary>
+typedef std::vector<DeviceRecord> DeviceRecords;
+
+/// <summary> The device registry event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Record"> The device record. </param>
+#define DeviceRegistryEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const DeviceRecord& Record)
+
+/// <summary> Keeps the devices discovered by a radio. </summary>
+/// <remarks> <para> The registry listens to the <c>OnDeviceFound</c> event
+///   of the <c>CwclBluetoothManager</c> for a single radio. A device is added
+///   on its first report and fires <c>OnDeviceAdded</c> once; repeated
+///   reports update the last seen time and the report counter. </para>
+///   <para> The device information is read once per device by an internal
+///   <see cref="CRemoteInfoResolver" />. <c>OnDeviceChanged</c> fires when it
+///   arrives. The RSSI changes from report to report, so when it is read a
+///   repeated report reads it again, unless the previous read is still
+///   pending, and <c>OnDeviceChanged</c> fires with the new value. </para>
+///   <para> The devices are kept in an open addressing hash table with
+///   linear probing, so a report costs a hash and a few slot compares and
+///   no allocation once the table has grown. The registry is thread safe:
+///   <c>GetSnapshot</c> returns a consistent copy of all devices in the
+///   registration order. </para> </remarks>
+class CDeviceRegistry : private CAddressIndex
+{
+	DISABLE_COPY(CDeviceRegistry);
+
+private:
+	typedef struct
+	{
+		bool			Used;
+		// The RSSI read is queued and has not been resolved yet.
+		bool			RssiPending;
+		DeviceRecord	Record;
+	} SLOT;
+	typedef std::vector<SLOT> SLOTS;
+
+	CwclCriticalSection*	FCS;
+	unsigned long			FCount;
+	unsigned long			FFields;
+	CwclBluetoothManager*	FManager;
+	unsigned long			FNextIndex;
+	CwclBluetoothRadio*		FRadio;
+	CRemoteInfoResolver*	FResolver;
+	SLOTS					FSlots;
+
+	// Must be called inside the critical section.
+	SLOT* Find(const __int64 Address);
+	SLOT* Insert(const __int64 Address, bool& Added);
+	void Erase(unsigned long Index);
+	void Grow();
+
+	// CAddressIndex.
+	virtual bool IsSlotUsed(const unsigned long Slot) const;
+	virtual __int64 GetSlotAddress(const unsigned long Slot) const;
+	virtual void MoveSlot(const unsigned long To, const unsigned long From);
+	virtual void ClearSlot(const unsigned long Slot);
+
+	void ManagerDeviceFound(void* Sender, CwclBluetoothRadio* const Radio,
+		const __int64 Address);
+	void ResolverResolved(void* Sender, const RemoteInfo& Info);
+
+protected:
+	/// <summary> Fires the <c>OnDeviceAdded</c> event. </summary>
+	/// <param name="Record"> The device record. </param>
+	virtual void DoDeviceAdded(const DeviceRecord& Record);
+	/// <summary> Fires the <c>OnDeviceChanged</c> event. </summary>
+	/// <param name="Record"> The device record. </param>
+	virtual void DoDeviceChanged(const DeviceRecord& Record);
+
+public:
+	/// <summary> Creates new device registry. </summary>
+	CDeviceRegistry();
+	/// <summary> Frees the device registry. </summary>
+	virtual ~CDeviceRegistry();
+
+	/// <summary> Starts tracking the devices found by the radio. </summary>
+	/// <param name="Manager"> The opened Bluetooth Manager. </param>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Fields"> The information read for every new device: a
+	///   combination of the <c>REMOTE_INFO_*</c> flags. 0 disables the
+	///   lookups. </param>
+	/// <param name="Method"> The message processing method used to deliver
+	///   the <c>OnDeviceChanged</c> events. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Attach(CwclBluetoothManager* const Manager, CwclBluetoothRadio* const Radio,
+		const unsigned long Fields = REMOTE_INFO_NAME | REMOTE_INFO_PAIRED,
+		const wclMessageProcessingMethod Method = mpSync);
+	/// <summary> Stops tracking the devices. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The registered devices are kept. </remarks>
+	int Detach();
+
+	/// <summary> Removes all devices. </summary>
+	void Clear();
+	/// <summary> Removes the device. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The device is added again, with a new <c>Index</c>, when it
+	///   is reported next time. </remarks>
+	int Remove(const __int64 Address);
+	/// <summary> Removes the devices that have not been reported since the
+	///   given time. </summary>
+	/// <param name="Before"> The time in microseconds. The devices last seen
+	///   before it are removed. </param>
+	/// <param name="Expired"> On output the removed devices. </param>
+	/// <remarks> The method visits every hash table slot once and does not
+	///   allocate memory unless devices expire. </remarks>
+	void Expire(const unsigned __int64 Before, DeviceRecords& Expired);
+
+	/// <summary> Gets the device. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="Record"> On output the device record. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int GetDevice(const __int64 Address, DeviceRecord& Record) const;
+	/// <summary> Gets all devices. </summary>
+	/// <param name="Records"> On output the device records in the
+	///   registration order. </param>
+	void GetSnapshot(DeviceRecords& Records) const;
+
+	/// <summary> Gets the number of the devices. </summary>
+	/// <returns> The number of the devices. </returns>
+	unsigned long GetCount() const;
+	/// <summary> Gets the number of the devices. </summary>
+	/// <value> The number of the devices. </value>
+	__declspec(property(get = GetCount)) unsigned long Count;
+
+	/// <summary> Gets the tracked radio. </summary>
+	/// <returns> The radio or <c>NULL</c>. </returns>
+	CwclBluetoothRadio* GetRadio() const;
+	/// <summary> Gets the tracked radio. </summary>
+	/// <value> The radio or <c>NULL</c>. </value>
+	__declspec(property(get = GetRadio)) CwclBluetoothRadio* Radio;
+
+	/// <summary> The event fires when a new device has been found. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Record"> The device record. </param>
+	DeviceRegistryEvent(OnDeviceAdded);
+	/// <summary> The event fires when the device information has been
+	///   read. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Record"> The device record. </param>
+	DeviceRegistryEvent(OnDeviceChanged);
+};
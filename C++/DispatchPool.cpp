@@ -0,0 +1,263 @@
+// DispatchPool.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "DispatchPool.h"
+
+#include "MessageDispatcher.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CDispatchPool
+
+__declspec(thread) CDispatchPool::WORKER* CDispatchPool::FCurrent = NULL;
+
+CDispatchPool::CDispatchPool()
+{
+	FNext = 0;
+	FSlice = 1000;
+	FTerminated = 0;
+}
+
+CDispatchPool::~CDispatchPool()
+{
+	Close();
+}
+
+int CDispatchPool::Schedule(CMessageDispatcher* const Dispatcher)
+{
+	if (FWorkers.size() == 0)
+		return WCL_E_MR_CLOSED;
+
+	// A dispatcher re-scheduled by a pool thread stays on that thread: its
+	// data is most likely still in the cache. Other producers spread the
+	// dispatchers round-robin.
+	WORKER* Worker = FCurrent;
+	if (Worker == NULL || Worker->Pool != this)
+	{
+		unsigned long Index = static_cast<unsigned long>(InterlockedIncrement(&FNext));
+		Worker = FWorkers[Index % FWorkers.size()];
+	}
+
+	Worker->CS->Enter();
+	Worker->Queue.push_back(Dispatcher);
+	Worker->CS->Leave();
+
+	if (InterlockedCompareExchange(&Worker->Idle, 0, 1) == 1)
+		Worker->Event->SetEvent();
+	else
+	{
+		// The target is busy. Wake up any idle thread so it can steal the
+		// dispatcher.
+		for (WORKERS::const_iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+		{
+			if (InterlockedCompareExchange(&(*w)->Idle, 0, 1) == 1)
+			{
+				(*w)->Event->SetEvent();
+				break;
+			}
+		}
+	}
+	return WCL_E_SUCCESS;
+}
+
+CMessageDispatcher* CDispatchPool::Pop(WORKER* const Worker)
+{
+	CMessageDispatcher* Dispatcher = NULL;
+	Worker->CS->Enter();
+	if (!Worker->Queue.empty())
+	{
+		Dispatcher = Worker->Queue.front();
+		Worker->Queue.pop_front();
+	}
+	Worker->CS->Leave();
+	return Dispatcher;
+}
+
+CMessageDispatcher* CDispatchPool::Steal(WORKER* const Thief)
+{
+	// Take from the end of the victim's queue: the victim works on the
+	// front.
+	size_t Count = FWorkers.size();
+	for (size_t i = 1; i < Count; i++)
+	{
+		WORKER* Victim = FWorkers[(Thief->Index + i) % Count];
+
+		CMessageDispatcher* Dispatcher = NULL;
+		Victim->CS->Enter();
+		if (!Victim->Queue.empty())
+		{
+			Dispatcher = Victim->Queue.back();
+			Victim->Queue.pop_back();
+		}
+		Victim->CS->Leave();
+
+		if (Dispatcher != NULL)
+			return Dispatcher;
+	}
+	return NULL;
+}
+
+bool CDispatchPool::HasWork() const
+{
+	for (WORKERS::const_iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+	{
+		(*w)->CS->Enter();
+		bool Empty = (*w)->Queue.empty();
+		(*w)->CS->Leave();
+
+		if (!Empty)
+			return true;
+	}
+	return false;
+}
+
+void CDispatchPool::FreeWorkers()
+{
+	for (WORKERS::iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+	{
+		WORKER* Worker = *w;
+		if (Worker->Thread != NULL)
+			wclWaitAndCloseThread(Worker->Thread);
+		delete Worker->Event;
+		delete Worker->CS;
+		delete Worker;
+	}
+	FWorkers.clear();
+}
+
+UINT __stdcall CDispatchPool::_WorkerThreadProc(LPVOID lpParam)
+{
+	WORKER* Worker = static_cast<WORKER*>(lpParam);
+	Worker->Pool->WorkerThreadProc(Worker);
+	return 0;
+}
+
+void CDispatchPool::WorkerThreadProc(WORKER* const Worker)
+{
+	FCurrent = Worker;
+
+	while (FTerminated == 0)
+	{
+		CMessageDispatcher* Dispatcher = Pop(Worker);
+		if (Dispatcher == NULL)
+			Dispatcher = Steal(Worker);
+
+		if (Dispatcher != NULL)
+			Dispatcher->PoolRun();
+		else
+		{
+			// Announce the idle state first and check the queues again: a
+			// dispatcher scheduled in between would be lost otherwise.
+			InterlockedExchange(&Worker->Idle, 1);
+			if (FTerminated == 0 && !HasWork())
+				Worker->Event->WaitOne();
+			InterlockedExchange(&Worker->Idle, 0);
+		}
+	}
+
+	FCurrent = NULL;
+}
+
+int CDispatchPool::Open(const unsigned long Threads)
+{
+	if (FWorkers.size() > 0)
+		return WCL_E_MR_OPENED;
+
+	unsigned long Count = Threads;
+	if (Count == 0)
+	{
+		SYSTEM_INFO Info;
+		GetSystemInfo(&Info);
+		Count = Info.dwNumberOfProcessors;
+		if (Count == 0)
+			Count = 1;
+	}
+
+	FNext = 0;
+	FTerminated = 0;
+
+	// Create all the workers before any thread starts: threads steal from
+	// each other.
+	int Res = WCL_E_SUCCESS;
+	for (unsigned long i = 0; i < Count; i++)
+	{
+		WORKER* Worker = new WORKER;
+		Worker->Pool = this;
+		Worker->Index = i;
+		Worker->CS = new CwclCriticalSection();
+		Worker->Event = CwclAutoResetEvent::Create();
+		Worker->Idle = 0;
+		Worker->Thread = NULL;
+		FWorkers.push_back(Worker);
+
+		if (Worker->Event == NULL)
+		{
+			Res = WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+			break;
+		}
+	}
+
+	if (Res == WCL_E_SUCCESS)
+	{
+		for (WORKERS::iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+		{
+			(*w)->Thread = wclCreateThread(_WorkerThreadProc, *w);
+			if ((*w)->Thread == NULL)
+			{
+				Res = WCL_E_MR_UNABLE_SYNCHRONIZE;
+				break;
+			}
+		}
+	}
+
+	if (Res != WCL_E_SUCCESS)
+	{
+		InterlockedExchange(&FTerminated, 1);
+		for (WORKERS::iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+		{
+			if ((*w)->Event != NULL)
+				(*w)->Event->SetEvent();
+		}
+		FreeWorkers();
+	}
+
+	return Res;
+}
+
+int CDispatchPool::Close()
+{
+	if (FWorkers.size() == 0)
+		return WCL_E_MR_CLOSED;
+
+	InterlockedExchange(&FTerminated, 1);
+	for (WORKERS::iterator w = FWorkers.begin(); w != FWorkers.end(); w++)
+		(*w)->Event->SetEvent();
+	FreeWorkers();
+
+	return WCL_E_SUCCESS;
+}
+
+bool CDispatchPool::GetActive() const
+{
+	return (FWorkers.size() > 0);
+}
+
+unsigned long CDispatchPool::GetSlice() const
+{
+	return FSlice;
+}
+
+void CDispatchPool::SetSlice(const unsigned long Value)
+{
+	if (Value > 0)
+		FSlice = Value;
+}
+
+unsigned long CDispatchPool::GetThreads() const
+{
+	return static_cast<unsigned long>(FWorkers.size());
+}
@@ -0,0 +1,118 @@
+// DispatchPool.h : shared thread pool for message dispatchers
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "wclSync.h"
+
+using namespace wclCommon;
+
+class CMessageDispatcher;
+
+/// <summary> The work-stealing thread pool that runs message
+///   dispatchers. </summary>
+/// <remarks> <para> A <see cref="CMessageDispatcher" /> with the <c>Pool</c>
+///   property set does not create its own thread. When a message is posted to an idle
+///   dispatcher the dispatcher is scheduled to the pool once, and a pool
+///   thread drains it. A dispatcher is never run by two threads at the same
+///   time so the messages of every dispatcher are still delivered in FIFO
+///   order. </para>
+///   <para> Each pool thread has its own run queue. A thread that has nothing
+///   to do steals dispatchers from the other threads queues. A busy
+///   dispatcher gives its thread up after the time slice and is put at the
+///   end of the queue so it can not starve the others. </para>
+///   <para> The number of threads depends on the number of processors, not
+///   on the number of dispatchers. </para> </remarks>
+class CDispatchPool
+{
+	DISABLE_COPY(CDispatchPool);
+
+private:
+	friend class CMessageDispatcher;
+
+	typedef std::deque<CMessageDispatcher*> RUN_QUEUE;
+
+	typedef struct
+	{
+		CDispatchPool*			Pool;
+		unsigned long			Index;
+		CwclCriticalSection*	CS;
+		RUN_QUEUE				Queue;
+		CwclAutoResetEvent*		Event;
+		volatile LONG			Idle;
+		HANDLE					Thread;
+	} WORKER;
+	typedef std::vector<WORKER*> WORKERS;
+
+	volatile LONG	FNext;
+	unsigned long	FSlice;
+	volatile LONG	FTerminated;
+	WORKERS			FWorkers;
+
+	static __declspec(thread) WORKER*	FCurrent;
+
+	// Returns WCL_E_MR_CLOSED if the pool has no threads.
+	int Schedule(CMessageDispatcher* const Dispatcher);
+
+	CMessageDispatcher* Pop(WORKER* const Worker);
+	CMessageDispatcher* Steal(WORKER* const Thief);
+	bool HasWork() const;
+
+	void FreeWorkers();
+
+	static UINT __stdcall _WorkerThreadProc(LPVOID lpParam);
+	void WorkerThreadProc(WORKER* const Worker);
+
+public:
+	/// <summary> Creates new dispatch pool. </summary>
+	CDispatchPool();
+	/// <summary> Frees the dispatch pool. </summary>
+	/// <remarks> All the dispatchers that use the pool must be closed
+	///   before. </remarks>
+	virtual ~CDispatchPool();
+
+	/// <summary> Starts the pool threads. </summary>
+	/// <param name="Threads"> The number of threads. 0 means one thread per
+	///   logical processor. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Open(const unsigned long Threads = 0);
+	/// <summary> Stops the pool threads. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> All the dispatchers that use the pool must be closed
+	///   before. </remarks>
+	int Close();
+
+	/// <summary> Gets the pool status. </summary>
+	/// <returns> <c>True</c> if the pool is running. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the pool status. </summary>
+	/// <value> <c>True</c> if the pool is running. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> Gets the time slice. </summary>
+	/// <returns> The time slice in microseconds. </returns>
+	unsigned long GetSlice() const;
+	/// <summary> Sets the time slice. </summary>
+	/// <param name="Value"> The maximum time in microseconds a pool thread
+	///   drains the single dispatcher before it switches to the next one. Used
+	///   when the dispatcher's <c>BatchTime</c> is 0. The default value is
+	///   1000. </param>
+	void SetSlice(const unsigned long Value);
+	/// <summary> Gets and sets the time slice. </summary>
+	/// <value> The time slice in microseconds. </value>
+	__declspec(property(get = GetSlice, put = SetSlice)) unsigned long Slice;
+
+	/// <summary> Gets the number of pool threads. </summary>
+	/// <returns> The number of threads. </returns>
+	unsigned long GetThreads() const;
+	/// <summary> Gets the number of pool threads. </summary>
+	/// <value> The number of threads. </value>
+	__declspec(property(get = GetThreads)) unsigned long Threads;
+};
@@ -0,0 +1,446 @@
+// GattAsyncClient.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattAsyncClient.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CGattRequest
+
+CGattRequest::CGattRequest(const GattRequestOperation Operation, void* const Context)
+	: CwclMessage(APP_MSG_ID_GATT_REQUEST, mcUser)
+{
+	FOperation = Operation;
+	FContext = Context;
+
+	FFlag = goNone;
+	FProtection = plNone;
+	FWriteKind = wkAuto;
+	FSubscribeKind = skManual;
+	ZeroMemory(&FService, sizeof(FService));
+	ZeroMemory(&FCharacteristic, sizeof(FCharacteristic));
+	ZeroMemory(&FDescriptor, sizeof(FDescriptor));
+
+	FResult = APP_E_GATT_REQUEST_PENDING;
+	FValue = NULL;
+	FLength = 0;
+	FDescriptorValue.Data = NULL;
+	FDescriptorValue.Length = 0;
+
+	FDone = CwclManualResetEvent::Create();
+}
+
+CGattRequest::~CGattRequest()
+{
+	if (FValue != NULL)
+		delete[] FValue;
+	if (FDescriptorValue.Data != NULL)
+		delete[] FDescriptorValue.Data;
+	if (FDone != NULL)
+		delete FDone;
+}
+
+void CGattRequest::Complete(const int Result)
+{
+	InterlockedExchange(&FResult, Result);
+	FDone->SetEvent();
+}
+
+int CGattRequest::Wait(const unsigned long Timeout) const
+{
+	if (FDone->WaitOne(Timeout) != WCL_WAIT_OBJECT_0)
+		return WCL_E_BLUETOOTH_TIMEOUT;
+	return FResult;
+}
+
+GattRequestOperation CGattRequest::GetOperation() const
+{
+	return FOperation;
+}
+
+void* CGattRequest::GetContext() const
+{
+	return FContext;
+}
+
+bool CGattRequest::GetCompleted() const
+{
+	return (FResult != APP_E_GATT_REQUEST_PENDING);
+}
+
+int CGattRequest::GetResult() const
+{
+	return FResult;
+}
+
+const wclGattServices& CGattRequest::GetServices() const
+{
+	return FServices;
+}
+
+const wclGattCharacteristics& CGattRequest::GetCharacteristics() const
+{
+	return FCharacteristics;
+}
+
+const wclGattDescriptors& CGattRequest::GetDescriptors() const
+{
+	return FDescriptors;
+}
+
+void CGattRequest::GetValue(const unsigned char*& Value, unsigned long& Length) const
+{
+	Value = FValue;
+	Length = FLength;
+}
+
+const wclGattDescriptorValue& CGattRequest::GetDescriptorValue() const
+{
+	return FDescriptorValue;
+}
+
+
+// CGattAsyncClient
+
+CGattAsyncClient::CGattAsyncClient(CwclGattClient* const Client)
+{
+	FClient = Client;
+	FTuner = NULL;
+	FQueue = new CMessageDispatcher();
+	FCompletions = NULL;
+	FCS = new CwclCriticalSection();
+
+	__hook(&CMessageDispatcher::OnMessage, FQueue, &CGattAsyncClient::QueueMessage);
+}
+
+CGattAsyncClient::~CGattAsyncClient()
+{
+	Close();
+
+	__unhook(&CMessageDispatcher::OnMessage, FQueue, &CGattAsyncClient::QueueMessage);
+
+	delete FQueue;
+	delete FCS;
+}
+
+int CGattAsyncClient::Queue(CGattRequest* const Request, CGattRequest*& Result)
+{
+	Result = NULL;
+	if (Request->FDone == NULL)
+	{
+		Request->Release();
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+	}
+
+	// The pending list holds its own reference: Close completes the
+	// requests the dispatcher has dropped.
+	Request->AddRef();
+	FCS->Enter();
+	Request->FPending = FPending.insert(FPending.end(), Request);
+	unsigned long Depth = static_cast<unsigned long>(FPending.size());
+	FCS->Leave();
+
+	// Queuing never blocks the caller: a full queue fails the request.
+	int Res = FQueue->Post(Request, opDropNewest);
+	if (Res != WCL_E_SUCCESS)
+	{
+		FCS->Enter();
+		FPending.erase(Request->FPending);
+		FCS->Leave();
+		Request->Release();
+		Request->Release();
+		return Res;
+	}
+
+	if (FTuner != NULL)
+		FTuner->ReportDepth(Depth);
+	Result = Request;
+	return WCL_E_SUCCESS;
+}
+
+void CGattAsyncClient::Execute(CGattRequest* const Request)
+{
+	unsigned __int64 Started = CMessageStats::Now();
+	int Res;
+	switch (Request->FOperation)
+	{
+		case roReadServices:
+			Res = FClient->ReadServices(Request->FFlag, Request->FServices);
+			break;
+
+		case roReadCharacteristics:
+			Res = FClient->ReadCharacteristics(Request->FService, Request->FFlag,
+				Request->FCharacteristics);
+			break;
+
+		case roReadDescriptors:
+			Res = FClient->ReadDescriptors(Request->FCharacteristic, Request->FFlag,
+				Request->FDescriptors);
+			break;
+
+		case roReadCharacteristicValue:
+			// The value allocated by the client is kept by the request; no
+			// copy.
+			Res = FClient->ReadCharacteristicValue(Request->FCharacteristic, Request->FFlag,
+				Request->FValue, Request->FLength, Request->FProtection);
+			break;
+
+		case roReadDescriptorValue:
+			Res = FClient->ReadDescriptorValue(Request->FDescriptor, Request->FFlag,
+				Request->FDescriptorValue, Request->FProtection);
+			break;
+
+		case roWriteCharacteristicValue:
+			Res = FClient->WriteCharacteristicValue(Request->FCharacteristic,
+				Request->FData.size() == 0 ? NULL : Request->FData.data(),
+				static_cast<unsigned long>(Request->FData.size()), Request->FProtection,
+				Request->FWriteKind);
+			break;
+
+		case roWriteDescriptorValue:
+			Res = FClient->WriteDescriptorValue(Request->FDescriptor, Request->FDescriptorValue,
+				Request->FProtection);
+			break;
+
+		case roSubscribe:
+			Res = FClient->SubscribeForNotifications(Request->FCharacteristic, goNone,
+				Request->FProtection, Request->FSubscribeKind);
+			break;
+
+		case roUnsubscribe:
+			Res = FClient->UnsubscribeFromNotifications(Request->FCharacteristic, goNone,
+				Request->FProtection, Request->FSubscribeKind);
+			break;
+
+		default:
+			Res = WCL_E_INVALID_ARGUMENT;
+			break;
+	}
+
+	if (FTuner != NULL)
+		FTuner->ReportRequest(static_cast<unsigned long>(CMessageStats::Now() - Started));
+	Complete(Request, Res);
+}
+
+void CGattAsyncClient::Complete(CGattRequest* const Request, const int Result)
+{
+	Request->Complete(Result);
+	// A completion the dispatcher does not accept is not lost: the event
+	// reports it on this thread instead.
+	if (FCompletions == NULL || FCompletions->Post(Request) != WCL_E_SUCCESS)
+		DoCompleted(Request);
+}
+
+void CGattAsyncClient::QueueMessage(const CwclMessage* const Message)
+{
+	if (Message->Category != mcUser || Message->Id != APP_MSG_ID_GATT_REQUEST)
+		return;
+
+	CGattRequest* Request = static_cast<CGattRequest*>(const_cast<CwclMessage*>(Message));
+
+	// The request is executed only if Close has not cancelled it.
+	FCS->Enter();
+	bool Pending = (Request->FPending != FPending.end());
+	if (Pending)
+	{
+		FPending.erase(Request->FPending);
+		Request->FPending = FPending.end();
+	}
+	FCS->Leave();
+
+	if (Pending)
+	{
+		Execute(Request);
+		Request->Release();
+	}
+}
+
+void CGattAsyncClient::DoCompleted(CGattRequest* const Request)
+{
+	__raise OnCompleted(this, Request);
+}
+
+int CGattAsyncClient::Open(const unsigned long Capacity)
+{
+	if (FClient == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+	return FQueue->Open(Capacity);
+}
+
+int CGattAsyncClient::Close()
+{
+	int Res = FQueue->Close();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	// The dispatcher has dropped the queued requests: complete them so no
+	// waiter hangs.
+	FCS->Enter();
+	REQUESTS Cancelled;
+	Cancelled.swap(FPending);
+	for (REQUESTS::iterator r = Cancelled.begin(); r != Cancelled.end(); r++)
+		(*r)->FPending = FPending.end();
+	FCS->Leave();
+
+	for (REQUESTS::iterator r = Cancelled.begin(); r != Cancelled.end(); r++)
+	{
+		Complete(*r, APP_E_GATT_REQUEST_CANCELLED);
+		(*r)->Release();
+	}
+	return WCL_E_SUCCESS;
+}
+
+int CGattAsyncClient::ReadServices(const wclGattOperationFlag Flag, void* const Context,
+	CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roReadServices, Context);
+	Req->FFlag = Flag;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::ReadCharacteristics(const wclGattService& Service,
+	const wclGattOperationFlag Flag, void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roReadCharacteristics, Context);
+	Req->FService = Service;
+	Req->FFlag = Flag;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::ReadDescriptors(const wclGattCharacteristic& Characteristic,
+	const wclGattOperationFlag Flag, void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roReadDescriptors, Context);
+	Req->FCharacteristic = Characteristic;
+	Req->FFlag = Flag;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::ReadCharacteristicValue(const wclGattCharacteristic& Characteristic,
+	const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+	void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roReadCharacteristicValue, Context);
+	Req->FCharacteristic = Characteristic;
+	Req->FFlag = Flag;
+	Req->FProtection = Protection;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::ReadDescriptorValue(const wclGattDescriptor& Descriptor,
+	const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+	void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roReadDescriptorValue, Context);
+	Req->FDescriptor = Descriptor;
+	Req->FFlag = Flag;
+	Req->FProtection = Protection;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::WriteCharacteristicValue(const wclGattCharacteristic& Characteristic,
+	const unsigned char* const Value, const unsigned long Length,
+	const wclGattProtectionLevel Protection, const wclGattWriteKind WriteKind,
+	void* const Context, CGattRequest*& Request)
+{
+	Request = NULL;
+	if (Value == NULL && Length > 0)
+		return WCL_E_INVALID_ARGUMENT;
+
+	CGattRequest* Req = new CGattRequest(roWriteCharacteristicValue, Context);
+	Req->FCharacteristic = Characteristic;
+	if (Length > 0)
+		Req->FData.assign(Value, Value + Length);
+	Req->FProtection = Protection;
+	Req->FWriteKind = WriteKind;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::WriteDescriptorValue(const wclGattDescriptor& Descriptor,
+	const wclGattDescriptorValue& Value, const wclGattProtectionLevel Protection,
+	void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roWriteDescriptorValue, Context);
+	Req->FDescriptor = Descriptor;
+	Req->FDescriptorValue = Value;
+	// The raw data is owned by the request.
+	Req->FDescriptorValue.Data = NULL;
+	Req->FDescriptorValue.Length = 0;
+	if (Value.Data != NULL && Value.Length > 0)
+	{
+		Req->FDescriptorValue.Data = new unsigned char[Value.Length];
+		CopyMemory(Req->FDescriptorValue.Data, Value.Data, Value.Length);
+		Req->FDescriptorValue.Length = Value.Length;
+	}
+	Req->FProtection = Protection;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::Subscribe(const wclGattCharacteristic& Characteristic,
+	const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind,
+	void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roSubscribe, Context);
+	Req->FCharacteristic = Characteristic;
+	Req->FProtection = Protection;
+	Req->FSubscribeKind = SubscribeKind;
+	return Queue(Req, Request);
+}
+
+int CGattAsyncClient::Unsubscribe(const wclGattCharacteristic& Characteristic,
+	const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind,
+	void* const Context, CGattRequest*& Request)
+{
+	CGattRequest* Req = new CGattRequest(roUnsubscribe, Context);
+	Req->FCharacteristic = Characteristic;
+	Req->FProtection = Protection;
+	Req->FSubscribeKind = SubscribeKind;
+	return Queue(Req, Request);
+}
+
+CwclGattClient* CGattAsyncClient::GetClient() const
+{
+	return FClient;
+}
+
+CMessageDispatcher* CGattAsyncClient::GetCompletions() const
+{
+	return FCompletions;
+}
+
+void CGattAsyncClient::SetCompletions(CMessageDispatcher* const Value)
+{
+	FCompletions = Value;
+}
+
+CDispatchPool* CGattAsyncClient::GetPool() const
+{
+	return FQueue->Pool;
+}
+
+void CGattAsyncClient::SetPool(CDispatchPool* const Value)
+{
+	FQueue->Pool = Value;
+}
+
+CConnectionTuner* CGattAsyncClient::GetTuner() const
+{
+	return FTuner;
+}
+
+void CGattAsyncClient::SetTuner(CConnectionTuner* const Value)
+{
+	if (!FQueue->Listening)
+		FTuner = Value;
+}
+
+bool CGattAsyncClient::GetActive() const
+{
+	return FQueue->Listening;
+}
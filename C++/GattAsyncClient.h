@@ -0,0 +1,419 @@
+// GattAsyncClient.h : non-blocking GATT client operations
+//
+
+#pragma once
+
+#include <list>
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+#include "ConnectionTuner.h"
+#include "MessageDispatcher.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The GATT request message ID. The message category is
+///   <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_GATT_REQUEST = 3;
+
+/// <summary> The base value of the asynchronous client error codes. </summary>
+const int APP_E_GATT_ASYNC_BASE = 0x00F06000;
+/// <summary> The request has not been completed yet. </summary>
+const int APP_E_GATT_REQUEST_PENDING = APP_E_GATT_ASYNC_BASE + 0x0000;
+/// <summary> The request has been dropped because the client has been
+///   closed. </summary>
+const int APP_E_GATT_REQUEST_CANCELLED = APP_E_GATT_ASYNC_BASE + 0x0001;
+
+/// <summary> The GATT request operations. </summary>
+typedef enum
+{
+	/// <summary> <c>ReadServices</c>. </summary>
+	roReadServices,
+	/// <summary> <c>ReadCharacteristics</c>. </summary>
+	roReadCharacteristics,
+	/// <summary> <c>ReadDescriptors</c>. </summary>
+	roReadDescriptors,
+	/// <summary> <c>ReadCharacteristicValue</c>. </summary>
+	roReadCharacteristicValue,
+	/// <summary> <c>ReadDescriptorValue</c>. </summary>
+	roReadDescriptorValue,
+	/// <summary> <c>WriteCharacteristicValue</c>. </summary>
+	roWriteCharacteristicValue,
+	/// <summary> <c>WriteDescriptorValue</c>. </summary>
+	roWriteDescriptorValue,
+	/// <summary> <c>SubscribeForNotifications</c>. </summary>
+	roSubscribe,
+	/// <summary> <c>UnsubscribeFromNotifications</c>. </summary>
+	roUnsubscribe
+} GattRequestOperation;
+
+/// <summary> The completion token of an asynchronous GATT
+///   operation. </summary>
+/// <remarks> <para> The request is a reference counted message. The caller
+///   gets a reference from the <see cref="CGattAsyncClient" /> method and
+///   must <c>Release</c> it. The results are valid after the request has been
+///   completed: check <c>Completed</c>, wait with <c>Wait</c> or handle the
+///   completion notification. </para> </remarks>
+class CGattRequest final : public CwclMessage
+{
+	DISABLE_COPY(CGattRequest);
+
+private:
+	friend class CGattAsyncClient;
+
+	GattRequestOperation		FOperation;
+	void*						FContext;
+
+	// Parameters.
+	wclGattOperationFlag		FFlag;
+	wclGattProtectionLevel		FProtection;
+	wclGattWriteKind			FWriteKind;
+	wclGattSubscribeKind		FSubscribeKind;
+	wclGattService				FService;
+	wclGattCharacteristic		FCharacteristic;
+	wclGattDescriptor			FDescriptor;
+	std::vector<unsigned char>	FData;
+
+	// Results.
+	volatile LONG				FResult;
+	wclGattServices				FServices;
+	wclGattCharacteristics		FCharacteristics;
+	wclGattDescriptors			FDescriptors;
+	unsigned char*				FValue;
+	unsigned long				FLength;
+	wclGattDescriptorValue		FDescriptorValue;
+
+	CwclEvent*					FDone;
+	// The position in the client's pending list.
+	std::list<CGattRequest*>::iterator	FPending;
+
+	CGattRequest(const GattRequestOperation Operation, void* const Context);
+
+	void Complete(const int Result);
+
+public:
+	/// <summary> Frees the request. </summary>
+	virtual ~CGattRequest();
+
+	/// <summary> Waits for the request completion. </summary>
+	/// <param name="Timeout"> The maximum wait time in milliseconds. </param>
+	/// <returns> The operation result, <see cref="WCL_E_BLUETOOTH_TIMEOUT" />
+	///   if the request has not been completed in time or
+	///   <c>APP_E_GATT_REQUEST_CANCELLED</c>. </returns>
+	/// <remarks> Do not wait on the thread that executes the requests. </remarks>
+	int Wait(const unsigned long Timeout = WCL_WAIT_INFINITE) const;
+
+	/// <summary> Gets the operation. </summary>
+	/// <returns> The requested operation. </returns>
+	GattRequestOperation GetOperation() const;
+	/// <summary> Gets the operation. </summary>
+	/// <value> The requested operation. </value>
+	__declspec(property(get = GetOperation)) GattRequestOperation Operation;
+
+	/// <summary> Gets the application context. </summary>
+	/// <returns> The context passed to the request method. </returns>
+	void* GetContext() const;
+	/// <summary> Gets the application context. </summary>
+	/// <value> The context passed to the request method. </value>
+	__declspec(property(get = GetContext)) void* Context;
+
+	/// <summary> Gets the request state. </summary>
+	/// <returns> <c>true</c> if the request has been completed. </returns>
+	bool GetCompleted() const;
+	/// <summary> Gets the request state. </summary>
+	/// <value> <c>true</c> if the request has been completed. </value>
+	__declspec(property(get = GetCompleted)) bool Completed;
+
+	/// <summary> Gets the operation result. </summary>
+	/// <returns> The operation result or <c>APP_E_GATT_REQUEST_PENDING</c>
+	///   if the request has not been completed yet. </returns>
+	int GetResult() const;
+	/// <summary> Gets the operation result. </summary>
+	/// <value> The operation result. </value>
+	__declspec(property(get = GetResult)) int Result;
+
+	/// <summary> Gets the services read by the <c>roReadServices</c>
+	///   request. </summary>
+	/// <returns> The services. </returns>
+	const wclGattServices& GetServices() const;
+	/// <summary> Gets the characteristics read by the
+	///   <c>roReadCharacteristics</c> request. </summary>
+	/// <returns> The characteristics. </returns>
+	const wclGattCharacteristics& GetCharacteristics() const;
+	/// <summary> Gets the descriptors read by the <c>roReadDescriptors</c>
+	///   request. </summary>
+	/// <returns> The descriptors. </returns>
+	const wclGattDescriptors& GetDescriptors() const;
+	/// <summary> Gets the value read by the
+	///   <c>roReadCharacteristicValue</c> request. </summary>
+	/// <param name="Value"> On output the pointer to the value or
+	///   <c>NULL</c>. Valid while the request is referenced. </param>
+	/// <param name="Length"> On output the value length in bytes. </param>
+	void GetValue(const unsigned char*& Value, unsigned long& Length) const;
+	/// <summary> Gets the value read by the <c>roReadDescriptorValue</c>
+	///   request. </summary>
+	/// <returns> The descriptor value. Its data is valid while the request
+	///   is referenced and must not be freed. </returns>
+	const wclGattDescriptorValue& GetDescriptorValue() const;
+};
+
+/// <summary> The <c>OnCompleted</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Request"> The completed request. Call <c>AddRef</c> to keep
+///   it after the handler returns. </param>
+#define GattRequestEvent(_event_name_) \
+	__event void _event_name_(void* Sender, CGattRequest* const Request)
+
+/// <summary> Runs the operations of a <c>CwclGattClient</c> without blocking
+///   the caller. </summary>
+/// <remarks> <para> Every method queues a <see cref="CGattRequest" /> and
+///   returns it at once as the completion token. The requests of a client are
+///   executed one by one in the order they were queued by a
+///   <see cref="CMessageDispatcher" />. The dispatcher has its own thread or,
+///   with the <c>Pool</c> property set, runs on a shared
+///   <see cref="CDispatchPool" />: a few pool threads then drive any number
+///   of clients, and the requests to different devices overlap. </para>
+///   <para> A completed request is posted to the <c>Completions</c>
+///   dispatcher if it is set, so the application handles all the completions
+///   on one thread in its <c>OnMessage</c> event. Otherwise the
+///   <c>OnCompleted</c> event fires on the executing thread. </para>
+///   <para> The ATT protocol allows a single outstanding request per
+///   connection, so the requests of one client never overlap. </para>
+///   <para> With the <c>Tuner</c> property set every queued request reports
+///   the number of the pending requests and every executed request reports
+///   its latency to the connection tuner. </para> </remarks>
+class CGattAsyncClient
+{
+	DISABLE_COPY(CGattAsyncClient);
+
+private:
+	typedef std::list<CGattRequest*> REQUESTS;
+
+	CwclGattClient*			FClient;
+	CConnectionTuner*		FTuner;
+	CMessageDispatcher*		FQueue;
+	CMessageDispatcher*		FCompletions;
+	CwclCriticalSection*	FCS;
+	// Queued requests that have not been executed yet.
+	REQUESTS				FPending;
+
+	int Queue(CGattRequest* const Request, CGattRequest*& Result);
+	void Execute(CGattRequest* const Request);
+	void Complete(CGattRequest* const Request, const int Result);
+
+	// Request queue event handler.
+	void QueueMessage(const CwclMessage* const Message);
+
+protected:
+	/// <summary> Fires the <c>OnCompleted</c> event. </summary>
+	/// <param name="Request"> The completed request. </param>
+	virtual void DoCompleted(CGattRequest* const Request);
+
+public:
+	/// <summary> Creates new asynchronous client. </summary>
+	/// <param name="Client"> The <c>CwclGattClient</c>. It must not be
+	///   destroyed before the asynchronous client. </param>
+	explicit CGattAsyncClient(CwclGattClient* const Client);
+	/// <summary> Frees the asynchronous client. </summary>
+	virtual ~CGattAsyncClient();
+
+	/// <summary> Starts executing the requests. </summary>
+	/// <param name="Capacity"> The maximum number of the queued requests.
+	///   The operation methods return <see cref="WCL_E_OUT_OF_MEMORY" />
+	///   instead of waiting when the queue is full. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Open(const unsigned long Capacity = 256);
+	/// <summary> Stops executing the requests. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The queued requests are completed with
+	///   <c>APP_E_GATT_REQUEST_CANCELLED</c>. </remarks>
+	int Close();
+
+	/// <summary> Queues the <c>ReadServices</c> operation. </summary>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadServices(const wclGattOperationFlag Flag, void* const Context,
+		CGattRequest*& Request);
+	/// <summary> Queues the <c>ReadCharacteristics</c> operation. </summary>
+	/// <param name="Service"> The service. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadCharacteristics(const wclGattService& Service, const wclGattOperationFlag Flag,
+		void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>ReadDescriptors</c> operation. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadDescriptors(const wclGattCharacteristic& Characteristic,
+		const wclGattOperationFlag Flag, void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>ReadCharacteristicValue</c> operation. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadCharacteristicValue(const wclGattCharacteristic& Characteristic,
+		const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+		void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>ReadDescriptorValue</c> operation. </summary>
+	/// <param name="Descriptor"> The descriptor. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadDescriptorValue(const wclGattDescriptor& Descriptor,
+		const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+		void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>WriteCharacteristicValue</c>
+	///   operation. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Value"> The value. It is copied. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="WriteKind"> The write operation mode. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int WriteCharacteristicValue(const wclGattCharacteristic& Characteristic,
+		const unsigned char* const Value, const unsigned long Length,
+		const wclGattProtectionLevel Protection, const wclGattWriteKind WriteKind,
+		void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>WriteDescriptorValue</c> operation. </summary>
+	/// <param name="Descriptor"> The descriptor. </param>
+	/// <param name="Value"> The descriptor value. It is copied. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int WriteDescriptorValue(const wclGattDescriptor& Descriptor,
+		const wclGattDescriptorValue& Value, const wclGattProtectionLevel Protection,
+		void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>SubscribeForNotifications</c>
+	///   operation. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="SubscribeKind"> The notification method. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Subscribe(const wclGattCharacteristic& Characteristic,
+		const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind,
+		void* const Context, CGattRequest*& Request);
+	/// <summary> Queues the <c>UnsubscribeFromNotifications</c>
+	///   operation. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="SubscribeKind"> The notification method. </param>
+	/// <param name="Context"> The application context. </param>
+	/// <param name="Request"> On output the request. The caller must release
+	///   it. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Unsubscribe(const wclGattCharacteristic& Characteristic,
+		const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind,
+		void* const Context, CGattRequest*& Request);
+
+	/// <summary> Gets the client. </summary>
+	/// <returns> The <c>CwclGattClient</c>. </returns>
+	CwclGattClient* GetClient() const;
+	/// <summary> Gets the client. </summary>
+	/// <value> The <c>CwclGattClient</c>. </value>
+	__declspec(property(get = GetClient)) CwclGattClient* Client;
+
+	/// <summary> Gets the completions dispatcher. </summary>
+	/// <returns> The dispatcher or <c>NULL</c>. </returns>
+	CMessageDispatcher* GetCompletions() const;
+	/// <summary> Sets the completions dispatcher. </summary>
+	/// <param name="Value"> The opened dispatcher the completed requests are
+	///   posted to or <c>NULL</c> to fire the <c>OnCompleted</c> event. If
+	///   the dispatcher does not accept a request the <c>OnCompleted</c>
+	///   event fires for it. </param>
+	void SetCompletions(CMessageDispatcher* const Value);
+	/// <summary> Gets and sets the completions dispatcher. </summary>
+	/// <value> The dispatcher or <c>NULL</c>. </value>
+	__declspec(property(get = GetCompletions, put = SetCompletions))
+		CMessageDispatcher* Completions;
+
+	/// <summary> Gets the dispatch pool. </summary>
+	/// <returns> The pool that executes the requests or <c>NULL</c>. </returns>
+	CDispatchPool* GetPool() const;
+	/// <summary> Sets the dispatch pool. </summary>
+	/// <param name="Value"> The pool that executes the requests or
+	///   <c>NULL</c> to use the own thread. Can be changed only when the
+	///   client is closed. </param>
+	void SetPool(CDispatchPool* const Value);
+	/// <summary> Gets and sets the dispatch pool. </summary>
+	/// <value> The pool that executes the requests or <c>NULL</c>. </value>
+	__declspec(property(get = GetPool, put = SetPool)) CDispatchPool* Pool;
+
+	/// <summary> Gets the connection tuner. </summary>
+	/// <returns> The tuner the traffic is reported to or <c>NULL</c>. </returns>
+	CConnectionTuner* GetTuner() const;
+	/// <summary> Sets the connection tuner. </summary>
+	/// <param name="Value"> The tuner the traffic is reported to or
+	///   <c>NULL</c>. Can be changed only when the client is closed. </param>
+	void SetTuner(CConnectionTuner* const Value);
+	/// <summary> Gets and sets the connection tuner. </summary>
+	/// <value> The tuner the traffic is reported to or <c>NULL</c>. </value>
+	__declspec(property(get = GetTuner, put = SetTuner)) CConnectionTuner* Tuner;
+
+	/// <summary> Gets the client state. </summary>
+	/// <returns> <c>true</c> if the client executes the requests. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the client state. </summary>
+	/// <value> <c>true</c> if the client executes the requests. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> The event fires when a request has been completed and no
+	///   <c>Completions</c> dispatcher is set. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Request"> The completed request. </param>
+	GattRequestEvent(OnCompleted);
+};
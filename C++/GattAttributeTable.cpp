@@ -0,0 +1,297 @@
+// GattAttributeTable.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattAttributeTable.h"
+
+#include <algorithm>
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The Bluetooth Base UUID: 00000000-0000-1000-8000-00805F9B34FB.
+static const GUID GATT_BASE_UUID = { 0x00000000, 0x0000, 0x1000,
+	{ 0x80, 0x00, 0x00, 0x80, 0x5F, 0x9B, 0x34, 0xFB } };
+
+static bool ServiceLess(const wclGattService& s1, const wclGattService& s2)
+{
+	return (s1.Handle < s2.Handle);
+}
+
+static bool CharacteristicLess(const wclGattCharacteristic& c1,
+	const wclGattCharacteristic& c2)
+{
+	return (c1.Handle < c2.Handle);
+}
+
+static bool DescriptorLess(const wclGattDescriptor& d1, const wclGattDescriptor& d2)
+{
+	return (d1.Handle < d2.Handle);
+}
+
+
+// CGattAttributeTable
+
+CGattAttributeTable::CGattAttributeTable()
+{
+}
+
+CGattAttributeTable::~CGattAttributeTable()
+{
+}
+
+GUID CGattAttributeTable::ToGuid(const wclGattUuid& Uuid)
+{
+	if (!Uuid.IsShortUuid)
+		return Uuid.LongUuid;
+
+	GUID Result = GATT_BASE_UUID;
+	Result.Data1 = Uuid.ShortUuid;
+	return Result;
+}
+
+const wclGattUuid& CGattAttributeTable::GetUuid(const GattAttribute& Attribute) const
+{
+	switch (Attribute.Kind)
+	{
+	case akService:
+		return FServices[Attribute.Index].Uuid;
+	case akCharacteristic:
+		return FCharacteristics[Attribute.Index].Uuid;
+	default:
+		return FDescriptors[Attribute.Index].Uuid;
+	}
+}
+
+void CGattAttributeTable::Build()
+{
+	// Devices normally report the attributes in the handle order, but nothing
+	// guarantees that.
+	std::stable_sort(FServices.begin(), FServices.end(), ServiceLess);
+	std::stable_sort(FCharacteristics.begin(), FCharacteristics.end(), CharacteristicLess);
+	std::stable_sort(FDescriptors.begin(), FDescriptors.end(), DescriptorLess);
+
+	// Merge the three sorted lists into the table. The parents are resolved
+	// by handle once the handle index is ready.
+	FBuild.clear();
+	unsigned short MaxHandle = 0;
+	size_t s = 0;
+	size_t c = 0;
+	size_t d = 0;
+	while (s < FServices.size() || c < FCharacteristics.size() || d < FDescriptors.size())
+	{
+		unsigned long sh = s < FServices.size() ? FServices[s].Handle : 0x10000;
+		unsigned long ch = c < FCharacteristics.size() ? FCharacteristics[c].Handle : 0x10000;
+		unsigned long dh = d < FDescriptors.size() ? FDescriptors[d].Handle : 0x10000;
+
+		BUILD_ENTRY Entry;
+		Entry.Attribute.Parent = GATT_NO_INDEX;
+		if (sh <= ch && sh <= dh)
+		{
+			Entry.Attribute.Kind = akService;
+			Entry.Attribute.Index = static_cast<unsigned long>(s++);
+			Entry.ParentHandle = 0;
+		}
+		else
+		{
+			if (ch <= dh)
+			{
+				const wclGattCharacteristic& Characteristic = FCharacteristics[c];
+				Entry.Attribute.Kind = akCharacteristic;
+				Entry.Attribute.Index = static_cast<unsigned long>(c++);
+				Entry.ParentHandle = Characteristic.ServiceHandle;
+				MaxHandle = max(MaxHandle, Characteristic.ValueHandle);
+			}
+			else
+			{
+				Entry.Attribute.Kind = akDescriptor;
+				Entry.Attribute.Index = static_cast<unsigned long>(d++);
+				Entry.ParentHandle = FDescriptors[Entry.Attribute.Index].CharacteristicHandle;
+			}
+		}
+		Entry.Attribute.Handle = static_cast<unsigned short>(min(min(sh, ch), dh));
+		MaxHandle = max(MaxHandle, Entry.Attribute.Handle);
+		FBuild.push_back(Entry);
+	}
+
+	// Handle index. Handles are 16 bit and dense so a plain array is both the
+	// fastest and a small index.
+	FByHandle.assign(static_cast<size_t>(MaxHandle) + 1, GATT_NO_INDEX);
+	FAttributes.clear();
+	for (size_t i = 0; i < FBuild.size(); i++)
+	{
+		FAttributes.push_back(FBuild[i].Attribute);
+		FByHandle[FBuild[i].Attribute.Handle] = static_cast<unsigned long>(i);
+	}
+	for (size_t i = 0; i < FBuild.size(); i++)
+	{
+		if (FBuild[i].Attribute.Kind != akService)
+			FAttributes[i].Parent = FindByHandle(FBuild[i].ParentHandle);
+	}
+	// Value handles do not have their own entries; they map to the
+	// characteristic unless another attribute uses the handle.
+	for (size_t i = 0; i < FAttributes.size(); i++)
+	{
+		if (FAttributes[i].Kind == akCharacteristic)
+		{
+			unsigned short ValueHandle = FCharacteristics[FAttributes[i].Index].ValueHandle;
+			if (FByHandle[ValueHandle] == GATT_NO_INDEX)
+				FByHandle[ValueHandle] = static_cast<unsigned long>(i);
+		}
+	}
+
+	// UUID index. Walk backwards so every chain is in the handle order.
+	FByUuid.clear();
+	FNextByUuid.assign(FAttributes.size(), GATT_NO_INDEX);
+	for (size_t i = FAttributes.size(); i > 0; i--)
+	{
+		unsigned long Index = static_cast<unsigned long>(i - 1);
+		GUID Key = ToGuid(GetUuid(FAttributes[Index]));
+		UUID_INDEX::iterator u = FByUuid.find(Key);
+		if (u == FByUuid.end())
+			FByUuid[Key] = Index;
+		else
+		{
+			FNextByUuid[Index] = u->second;
+			u->second = Index;
+		}
+	}
+}
+
+int CGattAttributeTable::Discover(CwclGattClient* const Client,
+	const GattDescriptorDiscovery Descriptors, CGattCache* const Cache)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	Clear();
+
+	int Res;
+	if (Cache != NULL)
+		Res = Cache->ReadServices(Client, FServices);
+	else
+		Res = Client->ReadServices(goNone, FServices);
+
+	for (wclGattServices::const_iterator s = FServices.begin();
+		s != FServices.end() && Res == WCL_E_SUCCESS; s++)
+	{
+		if (Cache != NULL)
+			Res = Cache->ReadCharacteristics(Client, *s, FScratchCharacteristics);
+		else
+			Res = Client->ReadCharacteristics(*s, goNone, FScratchCharacteristics);
+		if (Res != WCL_E_SUCCESS)
+			break;
+
+		FCharacteristics.insert(FCharacteristics.end(), FScratchCharacteristics.begin(),
+			FScratchCharacteristics.end());
+
+		if (Descriptors == ddNone)
+			continue;
+
+		for (wclGattCharacteristics::const_iterator c = FScratchCharacteristics.begin();
+			c != FScratchCharacteristics.end(); c++)
+		{
+			// Skipping the characteristics that can not have the configuration
+			// descriptors saves a request per characteristic.
+			if (Descriptors == ddConfigurable && !(*c).IsNotifiable && !(*c).IsIndicatable &&
+				!(*c).HasExtendedProperties)
+			{
+				continue;
+			}
+
+			if (Cache != NULL)
+				Res = Cache->ReadDescriptors(Client, *c, FScratchDescriptors);
+			else
+				Res = Client->ReadDescriptors(*c, goNone, FScratchDescriptors);
+			if (Res != WCL_E_SUCCESS)
+				break;
+
+			FDescriptors.insert(FDescriptors.end(), FScratchDescriptors.begin(),
+				FScratchDescriptors.end());
+		}
+	}
+
+	if (Res != WCL_E_SUCCESS)
+		Clear();
+	else
+		Build();
+	return Res;
+}
+
+void CGattAttributeTable::Clear()
+{
+	// The vectors keep their capacity across the discoveries. The UUID index
+	// map and the framework lists read by the client still allocate.
+	FAttributes.clear();
+	FServices.clear();
+	FCharacteristics.clear();
+	FDescriptors.clear();
+	FByHandle.clear();
+	FByUuid.clear();
+	FNextByUuid.clear();
+}
+
+const GattAttribute& CGattAttributeTable::GetItem(const unsigned long Index) const
+{
+	return FAttributes[Index];
+}
+
+unsigned long CGattAttributeTable::GetCount() const
+{
+	return static_cast<unsigned long>(FAttributes.size());
+}
+
+unsigned long CGattAttributeTable::FindByHandle(const unsigned short Handle) const
+{
+	if (Handle >= FByHandle.size())
+		return GATT_NO_INDEX;
+	return FByHandle[Handle];
+}
+
+unsigned long CGattAttributeTable::FindByUuid(const wclGattUuid& Uuid) const
+{
+	UUID_INDEX::const_iterator u = FByUuid.find(ToGuid(Uuid));
+	if (u == FByUuid.end())
+		return GATT_NO_INDEX;
+	return u->second;
+}
+
+unsigned long CGattAttributeTable::FindNextByUuid(const unsigned long Index) const
+{
+	if (Index >= FNextByUuid.size())
+		return GATT_NO_INDEX;
+	return FNextByUuid[Index];
+}
+
+const wclGattService& CGattAttributeTable::GetService(const GattAttribute& Attribute) const
+{
+	return FServices[Attribute.Index];
+}
+
+const wclGattCharacteristic& CGattAttributeTable::GetCharacteristic(
+	const GattAttribute& Attribute) const
+{
+	return FCharacteristics[Attribute.Index];
+}
+
+const wclGattDescriptor& CGattAttributeTable::GetDescriptor(
+	const GattAttribute& Attribute) const
+{
+	return FDescriptors[Attribute.Index];
+}
+
+const wclGattServices& CGattAttributeTable::GetServices() const
+{
+	return FServices;
+}
+
+const wclGattCharacteristics& CGattAttributeTable::GetCharacteristics() const
+{
+	return FCharacteristics;
+}
+
+const wclGattDescriptors& CGattAttributeTable::GetDescriptors() const
+{
+	return FDescriptors;
+}
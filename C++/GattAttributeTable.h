@@ -0,0 +1,191 @@
+// GattAttributeTable.h : flat handle-indexed GATT attribute table
+//
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "wclBluetooth.h"
+
+#include "GattCache.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The index value that means "no attribute". </summary>
+const unsigned long GATT_NO_INDEX = 0xFFFFFFFF;
+
+/// <summary> The GATT attribute kinds. </summary>
+typedef enum
+{
+	/// <summary> The primary service declaration. </summary>
+	akService,
+	/// <summary> The characteristic declaration. </summary>
+	akCharacteristic,
+	/// <summary> The characteristic descriptor. </summary>
+	akDescriptor
+} GattAttributeKind;
+
+/// <summary> Defines which characteristics the descriptors are discovered
+///   for. </summary>
+typedef enum
+{
+	/// <summary> All the characteristics. </summary>
+	ddAll,
+	/// <summary> Only the characteristics that can be notified, indicated or
+	///   have extended properties: the ones with the descriptors an
+	///   application usually needs. </summary>
+	ddConfigurable,
+	/// <summary> The descriptors are not discovered. </summary>
+	ddNone
+} GattDescriptorDiscovery;
+
+/// <summary> An entry of the attribute table. </summary>
+typedef struct
+{
+	/// <summary> The attribute kind. </summary>
+	GattAttributeKind Kind;
+	/// <summary> The attribute handle. </summary>
+	unsigned short Handle;
+	/// <summary> The table index of the parent attribute. The parent of a
+	///   characteristic is its service, the parent of a descriptor is its
+	///   characteristic. <c>GATT_NO_INDEX</c> for services. </summary>
+	unsigned long Parent;
+	/// <summary> The index of the attribute declaration in the list of its
+	///   kind. </summary>
+	unsigned long Index;
+} GattAttribute;
+
+/// <summary> The complete GATT database of a device in a single
+///   table. </summary>
+/// <remarks> <para> <c>Discover</c> reads the services, the characteristics
+///   and the descriptors in one call and stores them in one contiguous table
+///   sorted by handle. Each entry refers to its parent so the whole
+///   hierarchy can be walked without additional lookups. </para>
+///   <para> Entries can be found by handle and by UUID in constant time. A
+///   characteristic can be found by both its declaration and its value
+///   handle. </para>
+///   <para> The object reuses its memory: discovering the same device again
+///   does not allocate. </para> </remarks>
+class CGattAttributeTable
+{
+	DISABLE_COPY(CGattAttributeTable);
+
+private:
+	struct UUID_HASH
+	{
+		size_t operator()(const GUID& Uuid) const
+		{
+			// FNV-1a over the UUID bytes.
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(&Uuid);
+			size_t Hash = 2166136261;
+			for (size_t i = 0; i < sizeof(GUID); i++)
+				Hash = (Hash ^ p[i]) * 16777619;
+			return Hash;
+		}
+	};
+	typedef std::unordered_map<GUID, unsigned long, UUID_HASH> UUID_INDEX;
+
+	typedef struct
+	{
+		GattAttribute	Attribute;
+		unsigned short	ParentHandle;
+	} BUILD_ENTRY;
+	typedef std::vector<BUILD_ENTRY> BUILD_ENTRIES;
+
+	std::vector<GattAttribute>	FAttributes;
+	wclGattServices				FServices;
+	wclGattCharacteristics		FCharacteristics;
+	wclGattDescriptors			FDescriptors;
+
+	// Table index by handle.
+	std::vector<unsigned long>	FByHandle;
+	// First table index by UUID and the next entry with the same UUID.
+	UUID_INDEX					FByUuid;
+	std::vector<unsigned long>	FNextByUuid;
+
+	// Reused between discoveries.
+	BUILD_ENTRIES				FBuild;
+	wclGattCharacteristics		FScratchCharacteristics;
+	wclGattDescriptors			FScratchDescriptors;
+
+	static GUID ToGuid(const wclGattUuid& Uuid);
+	const wclGattUuid& GetUuid(const GattAttribute& Attribute) const;
+
+	void Build();
+
+public:
+	/// <summary> Creates new empty attribute table. </summary>
+	CGattAttributeTable();
+	/// <summary> Frees the attribute table. </summary>
+	virtual ~CGattAttributeTable();
+
+	/// <summary> Discovers the complete GATT database of the connected
+	///   device. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Descriptors"> Defines which characteristics the
+	///   descriptors are discovered for. </param>
+	/// <param name="Cache"> The optional <see cref="CGattCache" />. If
+	///   specified the attributes are read through the cache. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes and the table is empty. </returns>
+	int Discover(CwclGattClient* const Client,
+		const GattDescriptorDiscovery Descriptors = ddAll, CGattCache* const Cache = NULL);
+	/// <summary> Clears the table. </summary>
+	void Clear();
+
+	/// <summary> Gets the table entry. </summary>
+	/// <param name="Index"> The table index. </param>
+	/// <returns> The <see cref="GattAttribute" />. </returns>
+	const GattAttribute& GetItem(const unsigned long Index) const;
+	/// <summary> Gets the number of the table entries. </summary>
+	/// <returns> The number of the attributes. </returns>
+	unsigned long GetCount() const;
+	/// <summary> Gets the number of the table entries. </summary>
+	/// <value> The number of the attributes. </value>
+	__declspec(property(get = GetCount)) unsigned long Count;
+
+	/// <summary> Finds the attribute by handle. </summary>
+	/// <param name="Handle"> The attribute handle. For a characteristic both
+	///   the declaration and the value handles are accepted. </param>
+	/// <returns> The table index or <c>GATT_NO_INDEX</c>. </returns>
+	unsigned long FindByHandle(const unsigned short Handle) const;
+	/// <summary> Finds the first attribute with the UUID. </summary>
+	/// <param name="Uuid"> The attribute UUID. Short and long forms of the same
+	///   UUID are equal. </param>
+	/// <returns> The table index or <c>GATT_NO_INDEX</c>. </returns>
+	unsigned long FindByUuid(const wclGattUuid& Uuid) const;
+	/// <summary> Finds the next attribute with the same UUID. </summary>
+	/// <param name="Index"> The table index returned by <c>FindByUuid</c> or
+	///   the previous <c>FindNextByUuid</c> call. </param>
+	/// <returns> The table index or <c>GATT_NO_INDEX</c>. </returns>
+	unsigned long FindNextByUuid(const unsigned long Index) const;
+
+	/// <summary> Gets the service declaration. </summary>
+	/// <param name="Attribute"> The <c>akService</c> table entry. </param>
+	/// <returns> The <see cref="wclGattService" />. </returns>
+	const wclGattService& GetService(const GattAttribute& Attribute) const;
+	/// <summary> Gets the characteristic declaration. </summary>
+	/// <param name="Attribute"> The <c>akCharacteristic</c> table
+	///   entry. </param>
+	/// <returns> The <see cref="wclGattCharacteristic" />. </returns>
+	const wclGattCharacteristic& GetCharacteristic(const GattAttribute& Attribute) const;
+	/// <summary> Gets the descriptor declaration. </summary>
+	/// <param name="Attribute"> The <c>akDescriptor</c> table entry. </param>
+	/// <returns> The <see cref="wclGattDescriptor" />. </returns>
+	const wclGattDescriptor& GetDescriptor(const GattAttribute& Attribute) const;
+
+	/// <summary> Gets all the services. </summary>
+	/// <returns> The services in the handle order. </returns>
+	const wclGattServices& GetServices() const;
+	/// <summary> Gets all the characteristics. </summary>
+	/// <returns> The characteristics of all the services in the handle
+	///   order. </returns>
+	const wclGattCharacteristics& GetCharacteristics() const;
+	/// <summary> Gets all the descriptors. </summary>
+	/// <returns> The descriptors of all the characteristics in the handle
+	///   order. </returns>
+	const wclGattDescriptors& GetDescriptors() const;
+};
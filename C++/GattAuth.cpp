@@ -4,6 +4,7 @@
 #include "stdafx.h"
 #include "GattAuth.h"
 #include "GattAuthDlg.h"
+#include "GattBenchmark.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -23,6 +24,8 @@ CGattAuthApp::CGattAuthApp()
 {
 	// TODO: add construction code here,
 	// Place all significant initialization in InitInstance
+	m_bBenchmark = false;
+	m_nBenchmarkExitCode = 0;
 }
 
 
@@ -47,6 +50,14 @@ BOOL CGattAuthApp::InitInstance()
 
 	CWinApp::InitInstance();
 
+	// "/benchmark [report]" runs the GATT benchmark over the simulated radio,
+	// writes the CSV report and exits without showing the dialog.
+	if (__argc >= 2 && _tcsicmp(__targv[1], _T("/benchmark")) == 0)
+	{
+		RunBenchmark(__argc >= 3 ? __targv[2] : _T("GattBenchmark.csv"));
+		return FALSE;
+	}
+
 	// Standard initialization
 	// If you are not using these features and wish to reduce the size
 	// of your final executable, you should remove from the following
@@ -74,3 +85,35 @@ BOOL CGattAuthApp::InitInstance()
 	//  application, rather than start the application's message pump.
 	return FALSE;
 }
+
+int CGattAuthApp::ExitInstance()
+{
+	int nExitCode = CWinApp::ExitInstance();
+	if (m_bBenchmark)
+		return m_nBenchmarkExitCode;
+	return nExitCode;
+}
+
+void CGattAuthApp::RunBenchmark(LPCTSTR lpszReport)
+{
+	m_bBenchmark = true;
+
+	GattBenchmarkSettings Settings;
+	Settings.Count = 1000;
+	Settings.Length = 0;
+	Settings.Timeout = 5000;
+
+	GattBenchmarkResults Results;
+	int Res = CGattBenchmark::RunLoopback(Settings, Results);
+
+	CStringA Report(CGattBenchmark::ToText(Results).c_str());
+	CFile File;
+	if (!File.Open(lpszReport, CFile::modeCreate | CFile::modeWrite))
+		m_nBenchmarkExitCode = 2;
+	else
+	{
+		File.Write(Report, Report.GetLength());
+		File.Close();
+		m_nBenchmarkExitCode = (Res == WCL_E_SUCCESS ? 0 : 1);
+	}
+}
@@ -22,8 +22,14 @@ public:
 // Overrides
 	public:
 	virtual BOOL InitInstance();
+	virtual int ExitInstance();
 
 // Implementation
+private:
+	bool m_bBenchmark;
+	int m_nBenchmarkExitCode;
+
+	void RunBenchmark(LPCTSTR lpszReport);
 
 	DECLARE_MESSAGE_MAP()
 };
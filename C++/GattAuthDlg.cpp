@@ -9,6 +9,15 @@
 #define new DEBUG_NEW
 #endif
 
+static const LPCTSTR PairingRequestNames[] = {
+	_T("Just Works"),
+	_T("Numeric comparison"),
+	_T("Passkey"),
+	_T("PIN"),
+	_T("IO capability"),
+	_T("Protection level")
+};
+
 
 // CGattAuthDlg dialog
 
@@ -58,6 +67,7 @@ BOOL CGattAuthDlg::OnInitDialog()
 	// TODO: Add extra initialization here
 	lvDevices.InsertColumn(0, _T("Address"), 0, 150);
 	lvDevices.InsertColumn(1, _T("Name"), 0, 150);
+	lvDevices.InsertColumn(2, _T("RSSI"), 0, 60);
 
 	btConnect.EnableWindow(FALSE);
 	btDisconnect.EnableWindow(FALSE);
@@ -70,12 +80,6 @@ BOOL CGattAuthDlg::OnInitDialog()
 		&CGattAuthDlg::wclBluetoothManagerDiscoveringStarted);
 	__hook(&CwclBluetoothManager::OnDiscoveringCompleted, &wclBluetoothManager,
 		&CGattAuthDlg::wclBluetoothManagerDiscoveringCompleted);
-	__hook(&CwclBluetoothManager::OnDeviceFound, &wclBluetoothManager,
-		&CGattAuthDlg::wclBluetoothManagerDeviceFound);
-	__hook(&CwclBluetoothManager::OnConfirm, &wclBluetoothManager,
-		&CGattAuthDlg::wclBluetoothManagerConfirm);
-	__hook(&CwclBluetoothManager::OnNumericComparison, &wclBluetoothManager,
-		&CGattAuthDlg::wclBluetoothManagerNumericComparison);
 	__hook(&CwclBluetoothManager::OnAuthenticationCompleted, &wclBluetoothManager,
 		&CGattAuthDlg::wclBluetoothManagerAuthenticationCompleted);
 
@@ -84,6 +88,32 @@ BOOL CGattAuthDlg::OnInitDialog()
 	__hook(&CwclGattClient::OnConnect, &wclGattClient,
 		&CGattAuthDlg::wclGattClientConnect);
 
+	__hook(&CDeviceRegistry::OnDeviceAdded, &DeviceRegistry,
+		&CGattAuthDlg::DeviceRegistryDeviceAdded);
+	__hook(&CDeviceRegistry::OnDeviceChanged, &DeviceRegistry,
+		&CGattAuthDlg::DeviceRegistryDeviceChanged);
+
+	__hook(&CBatchPairing::OnResult, &BatchPairing,
+		&CGattAuthDlg::BatchPairingResult);
+	__hook(&CBatchPairing::OnCompleted, &BatchPairing,
+		&CGattAuthDlg::BatchPairingCompleted);
+
+	// Confirm Just Works and numeric comparison pairing of any device
+	// without the event round trip.
+	PairingRule Rule;
+	Rule.Address = 0;
+	Rule.PrefixBits = 0;
+	Rule.MatchAddressType = false;
+	Rule.AddressType = atPublic;
+	Rule.Requests = PAIRING_REQUEST_CONFIRM | PAIRING_REQUEST_NUMERIC_COMPARISON;
+	Rule.Action = paAccept;
+	Rule.Passkey = 0;
+	Rule.Mitm = mitmProtectionNotDefined;
+	Rule.IoCapability = iocapNotDefined;
+	Rule.Protection = pplDefault;
+	PairingPolicy.Add(Rule);
+	wclBluetoothManager.Policy = &PairingPolicy;
+
 	int Res = wclBluetoothManager.Open();
 	if (Res != WCL_E_SUCCESS)
 		Trace(_T("Bluetooth Manager open failed"), Res);
@@ -156,11 +186,6 @@ CString CGattAuthDlg::IntToHex(const unsigned short i) const
 	return s;
 }
 
-__int64 CGattAuthDlg::StrToInt64(const CString& s) const
-{
-	return _tcstoi64(s, NULL, 16);
-}
-
 void CGattAuthDlg::OnBnClickedButtonClear()
 {
 	lbLog.ResetContent();
@@ -179,10 +204,14 @@ void CGattAuthDlg::Trace(const CString& Msg, const int Error)
 void CGattAuthDlg::OnClose()
 {
 	// TODO: Add your message handler code here and/or call default
+	DeviceRegistry.Detach();
+	BatchPairing.Close();
 	wclBluetoothManager.Close();
 
 	__unhook(&wclBluetoothManager);
 	__unhook(&wclGattClient);
+	__unhook(&DeviceRegistry);
+	__unhook(&BatchPairing);
 
 	CDialog::OnClose();
 }
@@ -192,6 +221,22 @@ void CGattAuthDlg::wclBluetoothManagerAfterOpen(void* Sender)
 	UNREFERENCED_PARAMETER(Sender);
 
 	Trace(_T("Bluetooth Manager has been opened"));
+
+	CwclBluetoothRadio* Radio;
+	int Res = wclBluetoothManager.GetRadio(Radio);
+	if (Res != WCL_E_SUCCESS)
+		Trace(_T("Get working radio failed"), Res);
+	else
+	{
+		Res = DeviceRegistry.Attach(&wclBluetoothManager, Radio,
+			REMOTE_INFO_NAME | REMOTE_INFO_PAIRED | REMOTE_INFO_RSSI);
+		if (Res != WCL_E_SUCCESS)
+			Trace(_T("Device registry attach failed"), Res);
+	}
+
+	Res = BatchPairing.Open(&wclBluetoothManager);
+	if (Res != WCL_E_SUCCESS)
+		Trace(_T("Batch pairing open failed"), Res);
 }
 
 void CGattAuthDlg::wclBluetoothManagerClosed(void* Sender)
@@ -223,6 +268,10 @@ void CGattAuthDlg::wclBluetoothManagerDiscoveringStarted(void* Sender,
 	UNREFERENCED_PARAMETER(Sender);
 	
 	Trace(_T("Discovering started on radio: ") + CString(Radio->ApiName.c_str()));
+	// The tracker keeps the RSSI history of the devices found again.
+	DeviceRegistry.Clear();
+	DeviceAddresses.clear();
+	PairedAddresses.clear();
 	lvDevices.DeleteAllItems();
 }
 
@@ -230,76 +279,153 @@ void CGattAuthDlg::wclBluetoothManagerDiscoveringCompleted(void* Sender,
 	CwclBluetoothRadio* const Radio, const int Error)
 {
 	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Radio);
 
 	Trace(_T("Discovering completed with result"), Error);
-	if (lvDevices.GetItemCount() > 0)
-	{
-		for (int i = 0; i < lvDevices.GetItemCount(); i++)
-		{
-			CString Addr = lvDevices.GetItemText(i, 0);
-			__int64 Mac = StrToInt64(Addr);
-			tstring Name;
-			int Res = Radio->GetRemoteName(Mac, Name);
-			if (Res != WCL_E_SUCCESS)
-				Name = _T("Error: 0x") + IntToHex(Res);
-			lvDevices.SetItemText(i, 1, Name.c_str());
-			bool Paired;
-			Res = Radio->GetRemotePaired(Mac, Paired);
-			if (Res != WCL_E_SUCCESS)
-				Trace(_T("Get paired status failed"), Res);
-			else
-			{
-				if (Paired)
-				{
-					Res = Radio->RemoteUnpair(Mac);
-					if (Res != WCL_E_SUCCESS)
-						Trace(_T("Failed unpair device ") + Addr, Res);
-					else
-						Trace(_T("Device ") + Addr + _T(" unpaired"));
-				}
-				else
-					Trace(_T("Device ") + Addr + _T(" is not paired"));
-			}
-		}
-	}
+	UnpairPaired();
 
 	btDiscover.EnableWindow(TRUE);
 	btConnect.EnableWindow(lvDevices.GetFirstSelectedItemPosition() != NULL);
 }
 
-void CGattAuthDlg::wclBluetoothManagerDeviceFound(void* Sender,
-	CwclBluetoothRadio* const Radio, const __int64 Address)
+void CGattAuthDlg::DeviceRegistryDeviceAdded(void* Sender, const DeviceRecord& Record)
 {
 	UNREFERENCED_PARAMETER(Sender);
-	UNREFERENCED_PARAMETER(Radio);
 
 	int Item = lvDevices.GetItemCount();
-	lvDevices.InsertItem(Item, IntToHex(Address));
+	lvDevices.InsertItem(Item, IntToHex(Record.Address));
 	lvDevices.SetItemText(Item, 1, _T(""));
+	lvDevices.SetItemText(Item, 2, _T(""));
+	lvDevices.SetItemData(Item, Record.Index);
+	DeviceAddresses.push_back(Record.Address);
 }
 
-void CGattAuthDlg::wclBluetoothManagerConfirm(void* Sender,
-	CwclBluetoothRadio* const Radio, const __int64 Address, bool& Confirm)
+void CGattAuthDlg::DeviceRegistryDeviceChanged(void* Sender, const DeviceRecord& Record)
 {
 	UNREFERENCED_PARAMETER(Sender);
-	UNREFERENCED_PARAMETER(Radio);
-	UNREFERENCED_PARAMETER(Address);
 
-	Trace(_T("On confirm pairing (Just Works)"));
-	Confirm = true;
+	LVFINDINFO Find;
+	Find.flags = LVFI_PARAM;
+	Find.lParam = Record.Index;
+	int Item = lvDevices.FindItem(&Find);
+	if (Item == -1)
+		return;
+
+	if ((Record.Updated & REMOTE_INFO_NAME) != 0)
+	{
+		if ((Record.Resolved & REMOTE_INFO_NAME) != 0)
+			lvDevices.SetItemText(Item, 1, Record.Name.c_str());
+		else
+		{
+			if (Record.NameError != WCL_E_SUCCESS)
+				lvDevices.SetItemText(Item, 1, _T("Error: 0x") + IntToHex(Record.NameError));
+		}
+	}
+
+	// Every report reads the RSSI again, so each read is a new sample.
+	if ((Record.Updated & REMOTE_INFO_RSSI) != 0 &&
+		(Record.Resolved & REMOTE_INFO_RSSI) != 0)
+	{
+		RssiTracker.Add(Record.Address, Record.Rssi);
+		RssiState State;
+		if (RssiTracker.GetDevice(Record.Address, State) == WCL_E_SUCCESS)
+			lvDevices.SetItemText(Item, 2, IntToStr(static_cast<int>(State.Kalman)));
+	}
+
+	// A refreshed RSSI must not report the paired state again.
+	if ((Record.Updated & REMOTE_INFO_PAIRED) == 0)
+		return;
+
+	CString Addr = IntToHex(Record.Address);
+	if ((Record.Resolved & REMOTE_INFO_PAIRED) != 0)
+	{
+		if (Record.Paired)
+		{
+			// Unpaired in one batch when the discovering completes.
+			PairedAddresses.push_back(Record.Address);
+			if (!DeviceRegistry.Radio->Discovering)
+				UnpairPaired();
+		}
+		else
+			Trace(_T("Device ") + Addr + _T(" is not paired"));
+	}
+	else
+	{
+		if (Record.PairedError != WCL_E_SUCCESS)
+			Trace(_T("Get paired status failed for device ") + Addr, Record.PairedError);
+	}
 }
 
-void CGattAuthDlg::wclBluetoothManagerNumericComparison(void* Sender,
-	CwclBluetoothRadio* const Radio, const __int64 Address, 
-	const unsigned long Number, bool& Confirm)
+void CGattAuthDlg::UnpairPaired()
+{
+	if (PairedAddresses.size() == 0 || BatchPairing.Running)
+		return;
+
+	int Res = BatchPairing.RemoteUnpairMany(DeviceRegistry.Radio, PairedAddresses);
+	if (Res != WCL_E_SUCCESS)
+		Trace(_T("Unpair devices failed"), Res);
+	else
+		Trace(_T("Unpairing ") + IntToStr(static_cast<int>(PairedAddresses.size())) +
+			_T(" devices"));
+	PairedAddresses.clear();
+}
+
+void CGattAuthDlg::BatchPairingResult(void* Sender, const PairingResult& Result)
 {
 	UNREFERENCED_PARAMETER(Sender);
-	UNREFERENCED_PARAMETER(Radio);
-	UNREFERENCED_PARAMETER(Address);
-	UNREFERENCED_PARAMETER(Number);
 
-	Trace(_T("Numeric comparison pairing"));
-	Confirm = true;
+	CString Addr = IntToHex(Result.Address);
+	if (Result.Error != WCL_E_SUCCESS)
+		Trace(_T("Failed unpair device ") + Addr, Result.Error);
+	else
+	{
+		Trace(_T("Device ") + Addr + _T(" unpaired in ") +
+			IntToStr(static_cast<int>(Result.Duration / 1000)) + _T(" ms"));
+	}
+}
+
+void CGattAuthDlg::BatchPairingCompleted(void* Sender, const PairingResults& Results)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	int Succeeded = 0;
+	for (PairingResults::const_iterator r = Results.begin(); r != Results.end(); r++)
+	{
+		if (r->Error == WCL_E_SUCCESS)
+			Succeeded++;
+	}
+	Trace(_T("Unpaired ") + IntToStr(Succeeded) + _T(" of ") +
+		IntToStr(static_cast<int>(Results.size())) + _T(" devices"));
+
+	// The devices resolved while the batch was running.
+	UnpairPaired();
+}
+
+void CGattAuthDlg::TracePolicy()
+{
+	// All the devices: a decision taken from the log is not logged again.
+	PairingDecisions Decisions;
+	PairingPolicy.TakeLog(Decisions);
+
+	for (PairingDecisions::const_iterator d = Decisions.begin(); d != Decisions.end(); d++)
+	{
+		CString Msg = CString(PairingRequestNames[d->Request]) + _T(" pairing of ") +
+			IntToHex(d->Address) + _T(" ");
+		switch (d->Action)
+		{
+			case paAccept:
+				Msg += _T("accepted");
+				break;
+			case paReject:
+				Msg += _T("rejected");
+				break;
+			default:
+				Msg += _T("passed to the application");
+				break;
+		}
+		Trace(Msg + _T(" by policy in ") + IntToStr(static_cast<int>(d->Duration)) +
+			_T(" us"));
+	}
 }
 
 void CGattAuthDlg::wclBluetoothManagerAuthenticationCompleted(void* Sender,
@@ -307,8 +433,8 @@ void CGattAuthDlg::wclBluetoothManagerAuthenticationCompleted(void* Sender,
 {
 	UNREFERENCED_PARAMETER(Sender);
 	UNREFERENCED_PARAMETER(Radio);
-	UNREFERENCED_PARAMETER(Address);
 
+	TracePolicy();
 	if (Error != WCL_E_SUCCESS)
 	{
 		Trace(_T("Authentication failed"), Error);
@@ -394,7 +520,7 @@ void CGattAuthDlg::OnBnClickedButtonConnect()
 	else
 	{
 		int Item = lvDevices.GetNextSelectedItem(Pos);
-		__int64 Mac = StrToInt64(lvDevices.GetItemText(Item, 0));
+		__int64 Mac = DeviceAddresses[Item];
 		CwclBluetoothRadio* Radio;
 		int Res = wclBluetoothManager.GetRadio(Radio);
 		if (Res != WCL_E_SUCCESS)
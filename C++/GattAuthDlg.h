@@ -6,8 +6,15 @@
 #include "afxcmn.h"
 #include "afxwin.h"
 
+#include <vector>
+
 #include "wclBluetooth.h"
 
+#include "BatchPairing.h"
+#include "DeviceRegistry.h"
+#include "PairingPolicy.h"
+#include "RssiTracker.h"
+
 using namespace wclCommon;
 using namespace wclBluetooth;
 
@@ -36,8 +43,18 @@ protected:
 	DECLARE_MESSAGE_MAP()
 
 private:
-	CwclBluetoothManager wclBluetoothManager;
+	// Declared first: the manager refers to it until it is destroyed.
+	CPairingPolicy PairingPolicy;
+	CPolicyBluetoothManager wclBluetoothManager;
 	CwclGattClient wclGattClient;
+	CDeviceRegistry DeviceRegistry;
+	// Fed with the RSSI the registry reads for every device.
+	CRssiTracker RssiTracker;
+	// The addresses of the list items.
+	std::vector<__int64> DeviceAddresses;
+	CBatchPairing BatchPairing;
+	// The paired devices waiting for the unpairing batch.
+	wclBluetoothAddresses PairedAddresses;
 	CListCtrl lvDevices;
 	CListBox lbLog;
 
@@ -45,7 +62,6 @@ private:
 	CString IntToHex(const __int64 i) const;
 	CString IntToStr(const int i) const;
 	CString IntToHex(const unsigned short i) const;
-	__int64 StrToInt64(const CString& s) const;
 
 	void Trace(const CString& Msg);
 	void Trace(const CString& Msg, const int Error);
@@ -57,20 +73,21 @@ private:
 		CwclBluetoothRadio* const Radio);
 	void wclBluetoothManagerDiscoveringCompleted(void* Sender,
 		CwclBluetoothRadio* const Radio, const int Error);
-	void wclBluetoothManagerDeviceFound(void* Sender,
-		CwclBluetoothRadio* const Radio, const __int64 Address);
-	void wclBluetoothManagerConfirm(void* Sender,
-		CwclBluetoothRadio* const Radio, const __int64 Address,
-		bool& Confirm);
-	void wclBluetoothManagerNumericComparison(void* Sender,
-		CwclBluetoothRadio* const Radio, const __int64 Address, 
-		const unsigned long Number, bool& Confirm);
 	void wclBluetoothManagerAuthenticationCompleted(void* Sender,
 		CwclBluetoothRadio* const Radio, const __int64 Address,
 		const int Error);
 
 	void wclGattClientDisconnect(void* Sender, const int Reason);
 	void wclGattClientConnect(void* Sender, const int Error);
+
+	void DeviceRegistryDeviceAdded(void* Sender, const DeviceRecord& Record);
+	void DeviceRegistryDeviceChanged(void* Sender, const DeviceRecord& Record);
+
+	void BatchPairingResult(void* Sender, const PairingResult& Result);
+	void BatchPairingCompleted(void* Sender, const PairingResults& Results);
+
+	void UnpairPaired();
+	void TracePolicy();
     
 public:
 	afx_msg void OnBnClickedButtonClear();
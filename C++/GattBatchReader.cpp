@@ -0,0 +1,402 @@
+// GattBatchReader.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattBatchReader.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// Values are aligned so the caller can overlay structures on them.
+static const unsigned long ARENA_ALIGNMENT = 8;
+
+// The maximum pipeline depth. More outstanding requests do not fit into a
+// connection event anyway.
+static const unsigned long BATCH_MAX_PIPELINE = 16;
+
+
+// CGattValueArena
+
+CGattValueArena::CGattValueArena(unsigned char* const Buffer, const unsigned long Size)
+{
+	FBuffer = Buffer;
+	FOwned = false;
+	FSize = Size;
+	FUsed = 0;
+}
+
+CGattValueArena::CGattValueArena(const unsigned long Size)
+{
+	FBuffer = new unsigned char[Size];
+	FOwned = true;
+	FSize = Size;
+	FUsed = 0;
+}
+
+CGattValueArena::~CGattValueArena()
+{
+	if (FOwned)
+		delete[] FBuffer;
+}
+
+void CGattValueArena::Reset(const unsigned long Count)
+{
+	GattArenaValue Value;
+	Value.Offset = 0;
+	Value.Length = 0;
+	Value.Error = APP_E_GATT_VALUE_NOT_READ;
+	FValues.assign(Count, Value);
+	FUsed = 0;
+}
+
+unsigned char* CGattValueArena::Allocate(const unsigned long Length)
+{
+	unsigned long Aligned = (Length + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+	LONG Used = FUsed;
+	while (true)
+	{
+		if (Aligned > FSize - static_cast<unsigned long>(Used))
+			return NULL;
+
+		LONG Prev = InterlockedCompareExchange(&FUsed, Used + static_cast<LONG>(Aligned), Used);
+		if (Prev == Used)
+			return FBuffer + Used;
+		Used = Prev;
+	}
+}
+
+int CGattValueArena::Store(const unsigned long Index, const unsigned char* const Value,
+	const unsigned long Length)
+{
+	if (Index >= FValues.size())
+		return WCL_E_INVALID_ARGUMENT;
+
+	GattArenaValue& Slot = FValues[Index];
+	unsigned char* Data = NULL;
+	if (Length > 0)
+	{
+		Data = Allocate(Length);
+		if (Data == NULL)
+		{
+			Slot.Error = APP_E_GATT_ARENA_FULL;
+			return APP_E_GATT_ARENA_FULL;
+		}
+		CopyMemory(Data, Value, Length);
+	}
+
+	Slot.Offset = Data == NULL ? 0 : static_cast<unsigned long>(Data - FBuffer);
+	Slot.Length = Length;
+	Slot.Error = WCL_E_SUCCESS;
+	return WCL_E_SUCCESS;
+}
+
+void CGattValueArena::SetError(const unsigned long Index, const int Error)
+{
+	if (Index < FValues.size())
+		FValues[Index].Error = Error;
+}
+
+int CGattValueArena::GetValue(const unsigned long Index, const unsigned char*& Value,
+	unsigned long& Length) const
+{
+	Value = NULL;
+	Length = 0;
+	if (Index >= FValues.size())
+		return WCL_E_INVALID_ARGUMENT;
+
+	const GattArenaValue& Slot = FValues[Index];
+	if (Slot.Error == WCL_E_SUCCESS && Slot.Length > 0)
+	{
+		Value = FBuffer + Slot.Offset;
+		Length = Slot.Length;
+	}
+	return Slot.Error;
+}
+
+unsigned long CGattValueArena::GetCount() const
+{
+	return static_cast<unsigned long>(FValues.size());
+}
+
+unsigned long CGattValueArena::GetSize() const
+{
+	return FSize;
+}
+
+unsigned long CGattValueArena::GetUsed() const
+{
+	return static_cast<unsigned long>(FUsed);
+}
+
+
+// CGattBatchReader
+
+CGattBatchReader::CGattBatchReader()
+{
+	FPipeline = 1;
+
+	ZeroMemory(&FBatch, sizeof(FBatch));
+	FDoneEvent = NULL;
+	FTerminated = 0;
+}
+
+CGattBatchReader::~CGattBatchReader()
+{
+	FreeHelpers();
+}
+
+int CGattBatchReader::CreateHelpers()
+{
+	FDoneEvent = CwclAutoResetEvent::Create();
+	if (FDoneEvent == NULL)
+	{
+		FreeHelpers();
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+	}
+
+	FTerminated = 0;
+	for (unsigned long i = 1; i < FPipeline; i++)
+	{
+		HELPER* Helper = new HELPER;
+		Helper->Reader = this;
+		Helper->Event = CwclAutoResetEvent::Create();
+		Helper->Thread = NULL;
+		FHelpers.push_back(Helper);
+
+		if (Helper->Event == NULL)
+		{
+			FreeHelpers();
+			return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+		}
+		Helper->Thread = wclCreateThread(_HelperThreadProc, Helper);
+		if (Helper->Thread == NULL)
+		{
+			FreeHelpers();
+			return WCL_E_MR_UNABLE_SYNCHRONIZE;
+		}
+	}
+	return WCL_E_SUCCESS;
+}
+
+void CGattBatchReader::FreeHelpers()
+{
+	InterlockedExchange(&FTerminated, 1);
+	for (HELPERS::iterator h = FHelpers.begin(); h != FHelpers.end(); h++)
+	{
+		if ((*h)->Thread != NULL)
+		{
+			(*h)->Event->SetEvent();
+			wclWaitAndCloseThread((*h)->Thread);
+		}
+		delete (*h)->Event;
+		delete *h;
+	}
+	FHelpers.clear();
+
+	if (FDoneEvent != NULL)
+	{
+		delete FDoneEvent;
+		FDoneEvent = NULL;
+	}
+}
+
+void CGattBatchReader::ReadValue(CwclGattClient* const Client,
+	const wclGattCharacteristic& Characteristic, const unsigned long Index,
+	CGattValueArena& Arena, const wclGattOperationFlag Flag,
+	const wclGattProtectionLevel Protection)
+{
+	unsigned char* Value = NULL;
+	unsigned long Length = 0;
+	int Res = Client->ReadCharacteristicValue(Characteristic, Flag, Value, Length, Protection);
+	if (Res == WCL_E_SUCCESS)
+	{
+		Arena.Store(Index, Value, Length);
+		if (Value != NULL)
+			delete[] Value;
+	}
+	else
+		Arena.SetError(Index, Res);
+}
+
+int CGattBatchReader::GetResult(const CGattValueArena& Arena)
+{
+	for (unsigned long i = 0; i < Arena.Count; i++)
+	{
+		const unsigned char* Value;
+		unsigned long Length;
+		int Res = Arena.GetValue(i, Value, Length);
+		if (Res != WCL_E_SUCCESS)
+			return Res;
+	}
+	return WCL_E_SUCCESS;
+}
+
+void CGattBatchReader::Group(const GattBatchItem* const Items, const unsigned long Count)
+{
+	// A batch spans a few clients, a linear search is cheaper than a map.
+	FClients.clear();
+	FGroups.clear();
+	INDICES Groups(Count);
+	for (unsigned long i = 0; i < Count; i++)
+	{
+		unsigned long g = 0;
+		while (g < FClients.size() && FClients[g] != Items[i].Client)
+			g++;
+		if (g == FClients.size())
+		{
+			FClients.push_back(Items[i].Client);
+			FGroups.push_back(0);
+		}
+		Groups[i] = g;
+		FGroups[g]++;
+	}
+
+	// The group sizes become the group starts.
+	unsigned long Start = 0;
+	for (INDICES::iterator g = FGroups.begin(); g != FGroups.end(); g++)
+	{
+		unsigned long Size = *g;
+		*g = Start;
+		Start += Size;
+	}
+	FGroups.push_back(Count);
+
+	// Every group keeps the order of its items.
+	FOrder.resize(Count);
+	INDICES Next(FGroups.begin(), FGroups.end() - 1);
+	for (unsigned long i = 0; i < Count; i++)
+		FOrder[Next[Groups[i]]++] = i;
+}
+
+void CGattBatchReader::Run()
+{
+	unsigned long Groups = static_cast<unsigned long>(FGroups.size()) - 1;
+	while (true)
+	{
+		LONG Group = InterlockedIncrement(&FBatch.Next) - 1;
+		if (static_cast<unsigned long>(Group) >= Groups)
+			break;
+
+		// Only this thread talks to the group client.
+		for (unsigned long i = FGroups[Group]; i < FGroups[Group + 1]; i++)
+		{
+			const GattBatchItem& Item = FBatch.Items[FOrder[i]];
+			ReadValue(Item.Client, Item.Characteristic, FOrder[i], *FBatch.Arena,
+				FBatch.Flag, FBatch.Protection);
+		}
+	}
+}
+
+UINT __stdcall CGattBatchReader::_HelperThreadProc(LPVOID lpParam)
+{
+	HELPER* Helper = static_cast<HELPER*>(lpParam);
+	Helper->Reader->HelperThreadProc(Helper);
+	return 0;
+}
+
+void CGattBatchReader::HelperThreadProc(HELPER* const Helper)
+{
+	while (true)
+	{
+		Helper->Event->WaitOne();
+		if (FTerminated != 0)
+			break;
+
+		Run();
+		if (InterlockedDecrement(&FBatch.Active) == 0)
+			FDoneEvent->SetEvent();
+	}
+}
+
+int CGattBatchReader::Read(CwclGattClient* const Client,
+	const wclGattCharacteristic* const Characteristics, const unsigned long Count,
+	CGattValueArena& Arena, const wclGattOperationFlag Flag,
+	const wclGattProtectionLevel Protection)
+{
+	if (Client == NULL || (Characteristics == NULL && Count > 0))
+		return WCL_E_INVALID_ARGUMENT;
+
+	Arena.Reset(Count);
+	for (unsigned long i = 0; i < Count; i++)
+		ReadValue(Client, Characteristics[i], i, Arena, Flag, Protection);
+	return GetResult(Arena);
+}
+
+int CGattBatchReader::Read(CwclGattClient* const Client,
+	const wclGattCharacteristics& Characteristics, CGattValueArena& Arena,
+	const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection)
+{
+	if (Characteristics.size() == 0)
+		return Read(Client, NULL, 0, Arena, Flag, Protection);
+	return Read(Client, Characteristics.data(),
+		static_cast<unsigned long>(Characteristics.size()), Arena, Flag, Protection);
+}
+
+int CGattBatchReader::Read(const GattBatchItem* const Items, const unsigned long Count,
+	CGattValueArena& Arena, const wclGattOperationFlag Flag,
+	const wclGattProtectionLevel Protection)
+{
+	if (Items == NULL && Count > 0)
+		return WCL_E_INVALID_ARGUMENT;
+	for (unsigned long i = 0; i < Count; i++)
+	{
+		if (Items[i].Client == NULL)
+			return WCL_E_INVALID_ARGUMENT;
+	}
+
+	Arena.Reset(Count);
+	if (Count == 0)
+		return WCL_E_SUCCESS;
+
+	Group(Items, Count);
+
+	// The helpers are needed only if there is more than one client.
+	unsigned long Helpers = min(FPipeline, static_cast<unsigned long>(FClients.size())) - 1;
+	if (Helpers > 0 && FDoneEvent == NULL)
+	{
+		int Res = CreateHelpers();
+		if (Res != WCL_E_SUCCESS)
+			return Res;
+	}
+
+	FBatch.Items = Items;
+	FBatch.Arena = &Arena;
+	FBatch.Flag = Flag;
+	FBatch.Protection = Protection;
+	FBatch.Next = 0;
+	FBatch.Active = static_cast<LONG>(Helpers);
+
+	for (unsigned long i = 0; i < Helpers; i++)
+		FHelpers[i]->Event->SetEvent();
+	// The calling thread reads too.
+	Run();
+	if (Helpers > 0)
+		FDoneEvent->WaitOne();
+
+	return GetResult(Arena);
+}
+
+int CGattBatchReader::Read(const GattBatchItems& Items, CGattValueArena& Arena,
+	const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection)
+{
+	if (Items.size() == 0)
+		return Read(static_cast<const GattBatchItem*>(NULL), 0, Arena, Flag, Protection);
+	return Read(Items.data(), static_cast<unsigned long>(Items.size()), Arena, Flag,
+		Protection);
+}
+
+unsigned long CGattBatchReader::GetPipeline() const
+{
+	return FPipeline;
+}
+
+void CGattBatchReader::SetPipeline(const unsigned long Value)
+{
+	if (Value == 0 || Value > BATCH_MAX_PIPELINE || Value == FPipeline)
+		return;
+
+	// The helpers are re-created for the new depth on the next read.
+	FreeHelpers();
+	FPipeline = Value;
+}
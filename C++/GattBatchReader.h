@@ -0,0 +1,284 @@
+// GattBatchReader.h : batched characteristic value reads into an arena
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the batch reader error codes. </summary>
+const int APP_E_GATT_BATCH_BASE = 0x00F01000;
+/// <summary> The arena has no room for the value. </summary>
+const int APP_E_GATT_ARENA_FULL = APP_E_GATT_BATCH_BASE + 0x0000;
+/// <summary> The value has not been read. </summary>
+const int APP_E_GATT_VALUE_NOT_READ = APP_E_GATT_BATCH_BASE + 0x0001;
+
+/// <summary> A value stored in the <see cref="CGattValueArena" />. </summary>
+typedef struct
+{
+	/// <summary> The value offset in the arena buffer. </summary>
+	unsigned long Offset;
+	/// <summary> The value length in bytes. </summary>
+	unsigned long Length;
+	/// <summary> The read result. </summary>
+	int Error;
+} GattArenaValue;
+
+/// <summary> The contiguous storage for a batch of characteristic
+///   values. </summary>
+/// <remarks> <para> Values are appended to a single buffer with a lock-free
+///   bump pointer, so any number of threads can fill the arena. There is no
+///   per-value allocation and <c>Reset</c> makes the whole buffer available
+///   again. </para>
+///   <para> The buffer is either provided by the caller or allocated once by
+///   the arena. </para> </remarks>
+class CGattValueArena
+{
+	DISABLE_COPY(CGattValueArena);
+
+private:
+	unsigned char*				FBuffer;
+	bool						FOwned;
+	unsigned long				FSize;
+	volatile LONG				FUsed;
+	std::vector<GattArenaValue>	FValues;
+
+public:
+	/// <summary> Creates new arena over the caller buffer. </summary>
+	/// <param name="Buffer"> The buffer. It must stay valid while the arena
+	///   is used. </param>
+	/// <param name="Size"> The buffer size in bytes. </param>
+	CGattValueArena(unsigned char* const Buffer, const unsigned long Size);
+	/// <summary> Creates new arena with its own buffer. </summary>
+	/// <param name="Size"> The buffer size in bytes. </param>
+	explicit CGattValueArena(const unsigned long Size);
+	/// <summary> Frees the arena. </summary>
+	virtual ~CGattValueArena();
+
+	/// <summary> Prepares the arena for the new batch. </summary>
+	/// <param name="Count"> The number of values in the batch. </param>
+	/// <remarks> The stored values are dropped and all the value slots are
+	///   marked as not read. </remarks>
+	void Reset(const unsigned long Count);
+
+	/// <summary> Reserves room for a value. </summary>
+	/// <param name="Length"> The value length in bytes. </param>
+	/// <returns> The pointer to the reserved room or <c>NULL</c> if the arena
+	///   is full. </returns>
+	/// <remarks> The method can be called from any thread. </remarks>
+	unsigned char* Allocate(const unsigned long Length);
+	/// <summary> Copies the value into the arena. </summary>
+	/// <param name="Index"> The value slot index. </param>
+	/// <param name="Value"> The value. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> Different threads can store different slots at the same
+	///   time. </remarks>
+	int Store(const unsigned long Index, const unsigned char* const Value,
+		const unsigned long Length);
+	/// <summary> Sets the value slot error. </summary>
+	/// <param name="Index"> The value slot index. </param>
+	/// <param name="Error"> The read error. </param>
+	void SetError(const unsigned long Index, const int Error);
+
+	/// <summary> Gets the value. </summary>
+	/// <param name="Index"> The value slot index. </param>
+	/// <param name="Value"> On output the pointer to the value in the arena or
+	///   <c>NULL</c>. Valid until the next <c>Reset</c>. </param>
+	/// <param name="Length"> On output the value length in bytes. </param>
+	/// <returns> The value read result. </returns>
+	int GetValue(const unsigned long Index, const unsigned char*& Value,
+		unsigned long& Length) const;
+
+	/// <summary> Gets the number of the value slots. </summary>
+	/// <returns> The number of the slots. </returns>
+	unsigned long GetCount() const;
+	/// <summary> Gets the number of the value slots. </summary>
+	/// <value> The number of the slots. </value>
+	__declspec(property(get = GetCount)) unsigned long Count;
+
+	/// <summary> Gets the arena size. </summary>
+	/// <returns> The buffer size in bytes. </returns>
+	unsigned long GetSize() const;
+	/// <summary> Gets the arena size. </summary>
+	/// <value> The buffer size in bytes. </value>
+	__declspec(property(get = GetSize)) unsigned long Size;
+
+	/// <summary> Gets the used arena size. </summary>
+	/// <returns> The number of bytes used by the values. </returns>
+	unsigned long GetUsed() const;
+	/// <summary> Gets the used arena size. </summary>
+	/// <value> The number of bytes used by the values. </value>
+	__declspec(property(get = GetUsed)) unsigned long Used;
+};
+
+/// <summary> A characteristic read by the
+///   <see cref="CGattBatchReader" />. </summary>
+typedef struct
+{
+	/// <summary> The connected <c>CwclGattClient</c>. </summary>
+	CwclGattClient* Client;
+	/// <summary> The characteristic to read. </summary>
+	wclGattCharacteristic Characteristic;
+} GattBatchItem;
+/// <summary> The list of the batch items. </summary>
+typedef std::vector<GattBatchItem> GattBatchItems;
+
+/// <summary> Reads the values of many characteristics in one
+///   call. </summary>
+/// <remarks> <para> The values are stored in the caller's
+///   <see cref="CGattValueArena" />, the slot index is the index of the
+///   characteristic in the batch. </para>
+///   <para> The requests to one <c>CwclGattClient</c> are always issued one
+///   by one: a client does not accept concurrent GATT requests. With
+///   <c>Pipeline</c> greater than 1 a batch that spans several clients is
+///   read by the calling thread and up to <c>Pipeline - 1</c> helper
+///   threads, each thread reading the characteristics of one client at a
+///   time, so the connections wait their round trips in parallel. The
+///   helper threads are created once and reused. </para>
+///   <para> A reader must be used by one thread at a time. </para> </remarks>
+class CGattBatchReader
+{
+	DISABLE_COPY(CGattBatchReader);
+
+private:
+	typedef struct
+	{
+		const GattBatchItem*			Items;
+		CGattValueArena*				Arena;
+		wclGattOperationFlag			Flag;
+		wclGattProtectionLevel			Protection;
+		// Next client group to read.
+		volatile LONG					Next;
+		// Helper threads still working on the batch.
+		volatile LONG					Active;
+	} BATCH;
+
+	typedef std::vector<unsigned long> INDICES;
+	typedef std::vector<CwclGattClient*> CLIENTS;
+
+	typedef struct
+	{
+		CGattBatchReader*		Reader;
+		CwclAutoResetEvent*		Event;
+		HANDLE					Thread;
+	} HELPER;
+	typedef std::vector<HELPER*> HELPERS;
+
+	unsigned long			FPipeline;
+
+	BATCH					FBatch;
+	// The item indices grouped by the client.
+	INDICES					FOrder;
+	// The first FOrder position of every group, followed by FOrder size.
+	INDICES					FGroups;
+	CLIENTS					FClients;
+	CwclAutoResetEvent*		FDoneEvent;
+	HELPERS					FHelpers;
+	volatile LONG			FTerminated;
+
+	int CreateHelpers();
+	void FreeHelpers();
+
+	// Reads one value into the arena slot.
+	void ReadValue(CwclGattClient* const Client, const wclGattCharacteristic& Characteristic,
+		const unsigned long Index, CGattValueArena& Arena, const wclGattOperationFlag Flag,
+		const wclGattProtectionLevel Protection);
+	// Returns the error of the first failed value.
+	static int GetResult(const CGattValueArena& Arena);
+
+	// Fills FOrder and FGroups.
+	void Group(const GattBatchItem* const Items, const unsigned long Count);
+	// Reads the client groups until none is left.
+	void Run();
+
+	static UINT __stdcall _HelperThreadProc(LPVOID lpParam);
+	void HelperThreadProc(HELPER* const Helper);
+
+public:
+	/// <summary> Creates new batch reader. </summary>
+	CGattBatchReader();
+	/// <summary> Frees the batch reader. </summary>
+	virtual ~CGattBatchReader();
+
+	/// <summary> Reads the characteristic values. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Characteristics"> The array of the characteristics. </param>
+	/// <param name="Count"> The number of the characteristics. </param>
+	/// <param name="Arena"> The <see cref="CGattValueArena" /> that receives
+	///   the values. It is reset by the call. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> <see cref="WCL_E_SUCCESS" /> if all the values have been
+	///   read. Otherwise the error of the first failed characteristic. Every
+	///   characteristic is tried in any case; check the per-value results in
+	///   the arena. </returns>
+	/// <remarks> The values are read one by one by the calling
+	///   thread. </remarks>
+	int Read(CwclGattClient* const Client, const wclGattCharacteristic* const Characteristics,
+		const unsigned long Count, CGattValueArena& Arena,
+		const wclGattOperationFlag Flag = goReadFromDevice,
+		const wclGattProtectionLevel Protection = plNone);
+	/// <summary> Reads the characteristic values. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Characteristics"> The list of the characteristics. </param>
+	/// <param name="Arena"> The <see cref="CGattValueArena" /> that receives
+	///   the values. It is reset by the call. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> <see cref="WCL_E_SUCCESS" /> if all the values have been
+	///   read. Otherwise the error of the first failed characteristic. </returns>
+	int Read(CwclGattClient* const Client, const wclGattCharacteristics& Characteristics,
+		CGattValueArena& Arena, const wclGattOperationFlag Flag = goReadFromDevice,
+		const wclGattProtectionLevel Protection = plNone);
+	/// <summary> Reads the characteristic values of several
+	///   clients. </summary>
+	/// <param name="Items"> The array of the batch items. </param>
+	/// <param name="Count"> The number of the items. </param>
+	/// <param name="Arena"> The <see cref="CGattValueArena" /> that receives
+	///   the values. It is reset by the call. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> <see cref="WCL_E_SUCCESS" /> if all the values have been
+	///   read. Otherwise the error of the first failed characteristic. Every
+	///   characteristic is tried in any case; check the per-value results in
+	///   the arena. </returns>
+	int Read(const GattBatchItem* const Items, const unsigned long Count,
+		CGattValueArena& Arena, const wclGattOperationFlag Flag = goReadFromDevice,
+		const wclGattProtectionLevel Protection = plNone);
+	/// <summary> Reads the characteristic values of several
+	///   clients. </summary>
+	/// <param name="Items"> The list of the batch items. </param>
+	/// <param name="Arena"> The <see cref="CGattValueArena" /> that receives
+	///   the values. It is reset by the call. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> <see cref="WCL_E_SUCCESS" /> if all the values have been
+	///   read. Otherwise the error of the first failed characteristic. </returns>
+	int Read(const GattBatchItems& Items, CGattValueArena& Arena,
+		const wclGattOperationFlag Flag = goReadFromDevice,
+		const wclGattProtectionLevel Protection = plNone);
+
+	/// <summary> Gets the pipeline depth. </summary>
+	/// <returns> The maximum number of the clients read at once. </returns>
+	unsigned long GetPipeline() const;
+	/// <summary> Sets the pipeline depth. </summary>
+	/// <param name="Value"> The maximum number of the clients read at once.
+	///   The default value is 1: the values are read one by one by the
+	///   calling thread. </param>
+	void SetPipeline(const unsigned long Value);
+	/// <summary> Gets and sets the pipeline depth. </summary>
+	/// <value> The maximum number of the clients read at once. </value>
+	__declspec(property(get = GetPipeline, put = SetPipeline)) unsigned long Pipeline;
+};
@@ -0,0 +1,641 @@
+// GattBenchmark.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattBenchmark.h"
+
+#include "GattSubscriptionTable.h"
+#include "SimulatedRadio.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The time the loopback benchmark waits for the connection.
+static const unsigned long BENCHMARK_CONNECT_TIMEOUT = 10000;
+
+static wclGattUuid BenchmarkUuid(const GUID& Uuid)
+{
+	wclGattUuid Result;
+	ZeroMemory(&Result, sizeof(Result));
+	Result.IsShortUuid = false;
+	Result.LongUuid = Uuid;
+	return Result;
+}
+
+static void RoutedNotification(void* const Context,
+	const wclGattCharacteristic& Characteristic, const unsigned char* const Value,
+	const unsigned long Length)
+{
+	UNREFERENCED_PARAMETER(Characteristic);
+	UNREFERENCED_PARAMETER(Value);
+	UNREFERENCED_PARAMETER(Length);
+
+	static_cast<CwclAutoResetEvent*>(Context)->SetEvent();
+}
+
+static unsigned __int64 WrittenBytes(const GattBenchmarkResults& Results)
+{
+	unsigned __int64 Bytes = 0;
+	for (GattBenchmarkResults::const_iterator r = Results.begin(); r != Results.end(); r++)
+	{
+		if ((*r).Test == btWriteWithoutResponse || (*r).Test == btWriteWithResponse)
+			Bytes += (*r).Bytes;
+	}
+	return Bytes;
+}
+
+static const TCHAR* TestName(const GattBenchmarkTest Test)
+{
+	switch (Test)
+	{
+		case btWriteWithoutResponse:
+			return _T("WriteWithoutResponse");
+		case btWriteWithResponse:
+			return _T("WriteWithResponse");
+		case btNotification:
+			return _T("Notification");
+		case btIndication:
+			return _T("Indication");
+		default:
+			return _T("Unknown");
+	}
+}
+
+static const TCHAR* PhyName(const wclBluetoothLeConnectionPhyInfo& Phy)
+{
+	if (Phy.IsUncoded2MPhy)
+		return _T("2M");
+	if (Phy.IsUncoded1MPhy)
+		return _T("1M");
+	if (Phy.IsCoded)
+		return _T("Coded");
+	return _T("Unknown");
+}
+
+
+// CGattBenchmarkPeer
+
+CGattBenchmarkPeer::CGattBenchmarkPeer()
+{
+}
+
+CGattBenchmarkPeer::~CGattBenchmarkPeer()
+{
+}
+
+
+// CGattBenchmarkServer
+
+CGattBenchmarkServer::CGattBenchmarkServer()
+	: CGattBenchmarkPeer()
+{
+	FCharacteristic = NULL;
+	FReceived = 0;
+	FServer = NULL;
+}
+
+CGattBenchmarkServer::~CGattBenchmarkServer()
+{
+	Stop();
+}
+
+void CGattBenchmarkServer::ServerWrite(void* Sender, CwclGattServerClient* const Client,
+	CwclGattLocalCharacteristic* const Characteristic,
+	CwclGattLocalCharacteristicWriteRequest* const Request)
+{
+	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Client);
+
+	if (Characteristic != FCharacteristic)
+		Request->RespondWithError(WCL_E_BLUETOOTH_LE_ATTRIBUTE_NOT_FOUND);
+	else
+	{
+		InterlockedExchangeAdd64(&FReceived, Request->Size);
+		if (Request->WithResponse)
+			Request->Respond();
+	}
+}
+
+int CGattBenchmarkServer::Start(CwclBluetoothRadio* const Radio)
+{
+	if (FServer != NULL)
+		return WCL_E_BLUETOOTH_LE_GATT_SERVER_RUNNING;
+	if (Radio == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FServer = new CwclGattServer();
+	__hook(&CwclGattServer::OnWrite, FServer, &CGattBenchmarkServer::ServerWrite);
+
+	int Res = FServer->Initialize(Radio);
+	if (Res == WCL_E_SUCCESS)
+	{
+		CwclGattLocalService* Service;
+		Res = FServer->AddService(BenchmarkUuid(GATT_BENCHMARK_SERVICE_UUID), Service);
+		if (Res == WCL_E_SUCCESS)
+		{
+			wclGattLocalCharacteristicParameters Params;
+			Params.Props.insert(cpWritable);
+			Params.Props.insert(cpWritableWithoutResponse);
+			Params.Props.insert(cpNotifiable);
+			Params.Props.insert(cpIndicatable);
+			Params.ReadProtectionLevel = plNone;
+			Params.WriteProtectionLevel = plNone;
+			Res = Service->AddCharacteristic(BenchmarkUuid(GATT_BENCHMARK_CHARACTERISTIC_UUID),
+				Params, FCharacteristic);
+			if (Res == WCL_E_SUCCESS)
+				Res = FServer->Start();
+		}
+	}
+
+	if (Res != WCL_E_SUCCESS)
+		Stop();
+	else
+		InterlockedExchange64(&FReceived, 0);
+	return Res;
+}
+
+int CGattBenchmarkServer::Stop()
+{
+	if (FServer == NULL)
+		return WCL_E_BLUETOOTH_LE_GATT_SERVER_NOT_RUNNING;
+
+	if (FServer->Started)
+		FServer->Stop();
+	if (FServer->Initialized)
+		FServer->Uninitialize();
+	__unhook(&CwclGattServer::OnWrite, FServer, &CGattBenchmarkServer::ServerWrite);
+	delete FServer;
+	FServer = NULL;
+	FCharacteristic = NULL;
+	return WCL_E_SUCCESS;
+}
+
+int CGattBenchmarkServer::Send(const unsigned char* const Value, const unsigned long Length)
+{
+	if (FServer == NULL || !FServer->Started)
+		return WCL_E_BLUETOOTH_LE_GATT_SERVER_NOT_RUNNING;
+	return FCharacteristic->Notify(Value, Length);
+}
+
+unsigned __int64 CGattBenchmarkServer::GetReceived() const
+{
+	return static_cast<unsigned __int64>(FReceived);
+}
+
+
+// CGattBenchmark
+
+CGattBenchmark::CGattBenchmark()
+{
+	ZeroMemory(&FCharacteristic, sizeof(FCharacteristic));
+	FClient = NULL;
+	FPeer = NULL;
+
+	FSettings.Count = 1000;
+	FSettings.Length = 0;
+	FSettings.Timeout = 5000;
+
+	FConnectEvent = NULL;
+	FConnectError = WCL_E_SUCCESS;
+
+	FExpected = 0;
+	FReceived = 0;
+	FReceivedBytes = 0;
+	FReceivedEvent = NULL;
+	FReceiving = 0;
+}
+
+CGattBenchmark::~CGattBenchmark()
+{
+	Close();
+}
+
+void CGattBenchmark::ClientConnect(void* Sender, const int Error)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	FConnectError = Error;
+	FConnectEvent->SetEvent();
+}
+
+void CGattBenchmark::ClientCharacteristicChanged(void* Sender, const unsigned short Handle,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	if (Handle != FCharacteristic.ValueHandle || FReceiving == 0)
+		return;
+
+	// The first 8 bytes of the value are the peer send time.
+	if (Length >= sizeof(unsigned __int64))
+	{
+		unsigned __int64 Sent;
+		CopyMemory(&Sent, Value, sizeof(Sent));
+		FLatency.Record(static_cast<unsigned long>(CMessageStats::Now() - Sent));
+	}
+	InterlockedExchangeAdd64(&FReceivedBytes, Length);
+	// Wake the waiting thread up only when it has something to check.
+	if (InterlockedIncrement(&FReceived) >= FExpected)
+		FReceivedEvent->SetEvent();
+}
+
+int CGattBenchmark::RunWrite(const wclGattWriteKind WriteKind,
+	const std::vector<unsigned char>& Value, GattBenchmarkResult& Result)
+{
+	int Res = WCL_E_SUCCESS;
+	unsigned __int64 Started = CMessageStats::Now();
+	for (unsigned long i = 0; i < FSettings.Count && Res == WCL_E_SUCCESS; i++)
+	{
+		unsigned __int64 Op = CMessageStats::Now();
+		Res = FClient->WriteCharacteristicValue(FCharacteristic, Value.data(),
+			static_cast<unsigned long>(Value.size()), plNone, WriteKind);
+		if (Res == WCL_E_SUCCESS)
+		{
+			FLatency.Record(static_cast<unsigned long>(CMessageStats::Now() - Op));
+			Result.Operations++;
+		}
+	}
+	Result.Elapsed = CMessageStats::Now() - Started;
+	Result.Bytes = static_cast<unsigned __int64>(Result.Operations) * Value.size();
+	return Res;
+}
+
+int CGattBenchmark::RunReceive(const bool Indication, std::vector<unsigned char>& Value,
+	GattBenchmarkResult& Result)
+{
+	// The framework subscribes for notifications if the characteristic
+	// supports both kinds, so hide the kind that is not tested.
+	wclGattCharacteristic Characteristic = FCharacteristic;
+	if (Indication)
+		Characteristic.IsNotifiable = false;
+	else
+		Characteristic.IsIndicatable = false;
+
+	int Res = FClient->SubscribeForNotifications(Characteristic);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	InterlockedExchange(&FExpected, MAXLONG);
+	InterlockedExchange(&FReceived, 0);
+	InterlockedExchange64(&FReceivedBytes, 0);
+	InterlockedExchange(&FReceiving, 1);
+
+	unsigned long Sent = 0;
+	unsigned __int64 Started = CMessageStats::Now();
+	while (Sent < FSettings.Count && Res == WCL_E_SUCCESS)
+	{
+		unsigned __int64 Now = CMessageStats::Now();
+		CopyMemory(Value.data(), &Now, sizeof(Now));
+		Res = FPeer->Send(Value.data(), static_cast<unsigned long>(Value.size()));
+		if (Res == WCL_E_SUCCESS)
+		{
+			Sent++;
+			// An indication must be confirmed before the next one goes.
+			if (Indication)
+				Res = WaitReceived(static_cast<LONG>(Sent));
+		}
+	}
+	if (Res == WCL_E_SUCCESS)
+		Res = WaitReceived(static_cast<LONG>(Sent));
+	Result.Elapsed = CMessageStats::Now() - Started;
+
+	InterlockedExchange(&FReceiving, 0);
+	FClient->UnsubscribeFromNotifications(Characteristic);
+
+	Result.Operations = static_cast<unsigned long>(FReceived);
+	Result.Bytes = static_cast<unsigned __int64>(FReceivedBytes);
+	if (Sent > Result.Operations)
+		Result.Lost = Sent - Result.Operations;
+	return Res;
+}
+
+int CGattBenchmark::WaitReceived(const LONG Count)
+{
+	InterlockedExchange(&FExpected, Count);
+
+	// The timeout restarts on every received value: a slow link is fine, a
+	// stalled one is not.
+	LONG Last = FReceived;
+	DWORD Started = GetTickCount();
+	while (FReceived < Count)
+	{
+		DWORD Wait = INFINITE;
+		if (FSettings.Timeout != WCL_WAIT_INFINITE)
+		{
+			DWORD Elapsed = GetTickCount() - Started;
+			if (Elapsed >= FSettings.Timeout)
+				return APP_E_GATT_BENCHMARK_LOST;
+			Wait = FSettings.Timeout - Elapsed;
+		}
+		FReceivedEvent->WaitOne(Wait);
+
+		if (FReceived != Last)
+		{
+			Last = FReceived;
+			Started = GetTickCount();
+		}
+	}
+	return WCL_E_SUCCESS;
+}
+
+int CGattBenchmark::Connect(CwclGattClient* const Client, CwclBluetoothRadio* const Radio)
+{
+	FConnectEvent = CwclAutoResetEvent::Create();
+	if (FConnectEvent == NULL)
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+
+	__hook(&CwclGattClient::OnConnect, Client, &CGattBenchmark::ClientConnect);
+	int Res = Client->Connect(Radio);
+	if (Res == WCL_E_SUCCESS)
+	{
+		if (FConnectEvent->WaitOne(BENCHMARK_CONNECT_TIMEOUT) == WCL_WAIT_OBJECT_0)
+			Res = FConnectError;
+		else
+		{
+			Client->Disconnect();
+			Res = WCL_E_BLUETOOTH_TIMEOUT;
+		}
+	}
+	__unhook(&CwclGattClient::OnConnect, Client, &CGattBenchmark::ClientConnect);
+
+	delete FConnectEvent;
+	FConnectEvent = NULL;
+	return Res;
+}
+
+int CGattBenchmark::CheckRouting()
+{
+	CwclAutoResetEvent* Event = CwclAutoResetEvent::Create();
+	if (Event == NULL)
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+
+	// The route is keyed by the handle the peer notifies with, so a handle
+	// mismatch shows up here instead of as lost values.
+	CGattSubscriptionTable Table;
+	int Res = Table.Attach(FClient);
+	if (Res == WCL_E_SUCCESS)
+	{
+		Res = Table.Subscribe(FCharacteristic, RoutedNotification, Event);
+		if (Res == WCL_E_SUCCESS)
+		{
+			unsigned char Value[sizeof(unsigned __int64)];
+			ZeroMemory(Value, sizeof(Value));
+			Res = FPeer->Send(Value, sizeof(Value));
+			if (Res == WCL_E_SUCCESS && Event->WaitOne(FSettings.Timeout) != WCL_WAIT_OBJECT_0)
+				Res = APP_E_GATT_BENCHMARK_NOT_ROUTED;
+			Table.Unsubscribe(FCharacteristic);
+		}
+		Table.Detach();
+	}
+
+	delete Event;
+	return Res;
+}
+
+unsigned __int64 CGattBenchmark::CpuTime()
+{
+	FILETIME Creation, Exit, Kernel, User;
+	if (!GetProcessTimes(GetCurrentProcess(), &Creation, &Exit, &Kernel, &User))
+		return 0;
+
+	ULARGE_INTEGER k, u;
+	k.LowPart = Kernel.dwLowDateTime;
+	k.HighPart = Kernel.dwHighDateTime;
+	u.LowPart = User.dwLowDateTime;
+	u.HighPart = User.dwHighDateTime;
+	// FILETIME counts 100 ns intervals.
+	return (k.QuadPart + u.QuadPart) / 10;
+}
+
+int CGattBenchmark::Open(CwclGattClient* const Client, CGattBenchmarkPeer* const Peer)
+{
+	if (FClient != NULL)
+		return APP_E_GATT_BENCHMARK_OPENED;
+	if (Client == NULL || Peer == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	wclGattService Service;
+	int Res = Client->FindService(BenchmarkUuid(GATT_BENCHMARK_SERVICE_UUID), Service);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+	Res = Client->FindCharacteristic(Service, BenchmarkUuid(GATT_BENCHMARK_CHARACTERISTIC_UUID),
+		FCharacteristic);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	FReceivedEvent = CwclAutoResetEvent::Create();
+	if (FReceivedEvent == NULL)
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+
+	FClient = Client;
+	FPeer = Peer;
+	FReceiving = 0;
+	__hook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CGattBenchmark::ClientCharacteristicChanged);
+	return WCL_E_SUCCESS;
+}
+
+int CGattBenchmark::Close()
+{
+	if (FClient == NULL)
+		return APP_E_GATT_BENCHMARK_NOT_OPENED;
+
+	__unhook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CGattBenchmark::ClientCharacteristicChanged);
+	FClient = NULL;
+	FPeer = NULL;
+
+	delete FReceivedEvent;
+	FReceivedEvent = NULL;
+	return WCL_E_SUCCESS;
+}
+
+int CGattBenchmark::Run(const GattBenchmarkTest Test, GattBenchmarkResult& Result)
+{
+	ZeroMemory(&Result, sizeof(Result));
+	Result.Test = Test;
+	if (FClient == NULL)
+		Result.Error = APP_E_GATT_BENCHMARK_NOT_OPENED;
+	else
+	{
+		if (Test > btIndication)
+			Result.Error = WCL_E_INVALID_ARGUMENT;
+	}
+	if (Result.Error != WCL_E_SUCCESS)
+		return Result.Error;
+
+	// Not every driver reports the link properties: the test runs anyway.
+	FClient->GetMaxPduSize(Result.MaxPduSize);
+	FClient->GetConnectionPhyInfo(Result.Phy);
+	FClient->GetConnectionParams(Result.Params);
+
+	Result.Length = FSettings.Length;
+	if (Result.Length == 0)
+	{
+		unsigned short Payload;
+		Result.Error = FClient->GetMaxPayloadSize(Payload);
+		if (Result.Error != WCL_E_SUCCESS)
+			return Result.Error;
+		Result.Length = Payload;
+	}
+	if (Test >= btNotification && Result.Length < sizeof(unsigned __int64))
+	{
+		Result.Error = WCL_E_INVALID_ARGUMENT;
+		return Result.Error;
+	}
+
+	std::vector<unsigned char> Value(Result.Length);
+	for (unsigned long i = 0; i < Result.Length; i++)
+		Value[i] = static_cast<unsigned char>(i);
+
+	FLatency.Reset();
+	unsigned __int64 Cpu = CpuTime();
+	switch (Test)
+	{
+		case btWriteWithoutResponse:
+			Result.Error = RunWrite(wkWithoutResponse, Value, Result);
+			break;
+		case btWriteWithResponse:
+			Result.Error = RunWrite(wkWithResponse, Value, Result);
+			break;
+		case btNotification:
+			Result.Error = RunReceive(false, Value, Result);
+			break;
+		default:
+			Result.Error = RunReceive(true, Value, Result);
+			break;
+	}
+	Cpu = CpuTime() - Cpu;
+
+	FLatency.GetSummary(Result.Latency);
+	if (Result.Operations > 0)
+		Result.Cpu = static_cast<unsigned long>(Cpu / Result.Operations);
+	if (Result.Elapsed > 0)
+		Result.Throughput = Result.Bytes * 1000000 / Result.Elapsed;
+	return Result.Error;
+}
+
+int CGattBenchmark::RunAll(GattBenchmarkResults& Results)
+{
+	Results.clear();
+	int Res = WCL_E_SUCCESS;
+	for (unsigned long t = 0; t < GATT_BENCHMARK_TESTS; t++)
+	{
+		GattBenchmarkResult Result;
+		int TestRes = Run(static_cast<GattBenchmarkTest>(t), Result);
+		if (Res == WCL_E_SUCCESS)
+			Res = TestRes;
+		Results.push_back(Result);
+	}
+	return Res;
+}
+
+void CGattBenchmark::GetSettings(GattBenchmarkSettings& Settings) const
+{
+	Settings = FSettings;
+}
+
+int CGattBenchmark::SetSettings(const GattBenchmarkSettings& Settings)
+{
+	if (Settings.Count == 0 || Settings.Timeout == 0)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FSettings = Settings;
+	return WCL_E_SUCCESS;
+}
+
+int CGattBenchmark::RunSimulated(CwclBluetoothManager* const Manager,
+	GattBenchmarkResults& Results)
+{
+	CSimulatedRadio Radio(Manager);
+	int Res = Radio.Open();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	// Both ends of the link run on the radio: the radio serves the benchmark
+	// server as a peer with its own address.
+	CGattBenchmarkServer Server;
+	Res = Server.Start(&Radio);
+	if (Res == WCL_E_SUCCESS)
+	{
+		__int64 Address;
+		Res = Radio.GetAddress(Address);
+		if (Res == WCL_E_SUCCESS)
+		{
+			CwclGattClient Client;
+			Client.Address = Address;
+			Res = Connect(&Client, &Radio);
+			if (Res == WCL_E_SUCCESS)
+			{
+				Res = Open(&Client, &Server);
+				if (Res == WCL_E_SUCCESS)
+				{
+					Res = CheckRouting();
+					if (Res == WCL_E_SUCCESS)
+					{
+						Res = RunAll(Results);
+						// A write returns once the server has processed it.
+						if (Res == WCL_E_SUCCESS && Server.Received != WrittenBytes(Results))
+							Res = APP_E_GATT_BENCHMARK_LOST;
+					}
+					Close();
+				}
+				Client.Disconnect();
+			}
+		}
+		Server.Stop();
+	}
+	Radio.Close();
+	return Res;
+}
+
+int CGattBenchmark::RunLoopback(const GattBenchmarkSettings& Settings,
+	GattBenchmarkResults& Results)
+{
+	Results.clear();
+
+	CGattBenchmark Benchmark;
+	int Res = Benchmark.SetSettings(Settings);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	// The benchmark waits for the client events in the calling thread, so
+	// the events must come from the framework threads.
+	CwclBluetoothManager Manager;
+	Manager.MessageProcessing = mpAsync;
+	Res = Manager.Open();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	// The radio and the client are freed before the manager is closed.
+	Res = Benchmark.RunSimulated(&Manager, Results);
+	Manager.Close();
+	return Res;
+}
+
+tstring CGattBenchmark::ToText(const GattBenchmarkResults& Results)
+{
+	tstring Text = _T("Test,Error,Phy,MaxPduSize,Interval,Length,Operations,Lost,Bytes,")
+		_T("ElapsedUs,BytesPerSec,MeanUs,P50Us,P90Us,P99Us,MaxUs,CpuUsPerOp\r\n");
+
+	TCHAR Line[512];
+	for (GattBenchmarkResults::const_iterator r = Results.begin(); r != Results.end(); r++)
+	{
+		const GattBenchmarkResult& Result = *r;
+		_stprintf_s(Line, _countof(Line),
+			_T("%s,0x%.8X,%s,%u,%u,%u,%u,%u,%I64u,%I64u,%I64u,%u,%u,%u,%u,%u,%u\r\n"),
+			TestName(Result.Test), Result.Error, PhyName(Result.Phy.Transmit),
+			Result.MaxPduSize, Result.Params.Interval, Result.Length, Result.Operations,
+			Result.Lost, Result.Bytes, Result.Elapsed, Result.Throughput,
+			Result.Latency.Mean, Result.Latency.P50, Result.Latency.P90, Result.Latency.P99,
+			Result.Latency.Max, Result.Cpu);
+		Text += Line;
+	}
+	return Text;
+}
+
+bool CGattBenchmark::GetActive() const
+{
+	return (FClient != NULL);
+}
@@ -0,0 +1,299 @@
+// GattBenchmark.h : GATT link throughput benchmark
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+#include "MessageStats.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the benchmark error codes. </summary>
+const int APP_E_GATT_BENCHMARK_BASE = 0x00F07000;
+/// <summary> The benchmark is not opened. </summary>
+const int APP_E_GATT_BENCHMARK_NOT_OPENED = APP_E_GATT_BENCHMARK_BASE + 0x0000;
+/// <summary> The benchmark is already opened. </summary>
+const int APP_E_GATT_BENCHMARK_OPENED = APP_E_GATT_BENCHMARK_BASE + 0x0001;
+/// <summary> Not all notifications or indications have been received
+///   before the timeout. </summary>
+const int APP_E_GATT_BENCHMARK_LOST = APP_E_GATT_BENCHMARK_BASE + 0x0002;
+/// <summary> The notification has not reached the bound route before the
+///   timeout. </summary>
+const int APP_E_GATT_BENCHMARK_NOT_ROUTED = APP_E_GATT_BENCHMARK_BASE + 0x0003;
+
+/// <summary> The benchmark service UUID. </summary>
+const GUID GATT_BENCHMARK_SERVICE_UUID =
+	{ 0x6b8e0b10, 0x52d4, 0x4c0e, { 0x9a, 0x3b, 0x5e, 0x21, 0x0c, 0x7f, 0x41, 0x01 } };
+/// <summary> The benchmark sink/source characteristic UUID. The
+///   characteristic is writable with and without response, notifiable and
+///   indicatable. </summary>
+const GUID GATT_BENCHMARK_CHARACTERISTIC_UUID =
+	{ 0x6b8e0b11, 0x52d4, 0x4c0e, { 0x9a, 0x3b, 0x5e, 0x21, 0x0c, 0x7f, 0x41, 0x01 } };
+
+/// <summary> The benchmark tests. </summary>
+typedef enum
+{
+	/// <summary> Client writes without response. </summary>
+	btWriteWithoutResponse,
+	/// <summary> Client writes with response. </summary>
+	btWriteWithResponse,
+	/// <summary> Peer notifications. </summary>
+	btNotification,
+	/// <summary> Peer indications. </summary>
+	btIndication
+} GattBenchmarkTest;
+
+/// <summary> The number of the benchmark tests. </summary>
+const unsigned long GATT_BENCHMARK_TESTS = btIndication + 1;
+
+/// <summary> The benchmark settings. </summary>
+typedef struct
+{
+	/// <summary> The number of operations per test. </summary>
+	unsigned long Count;
+	/// <summary> The value length in bytes. 0 means the maximum payload size
+	///   of the connection. Must be at least 8 bytes for the notification
+	///   and indication tests: the value carries its send time. </summary>
+	unsigned long Length;
+	/// <summary> The time in milliseconds the notification and indication
+	///   tests wait for the next value before they give up. </summary>
+	unsigned long Timeout;
+} GattBenchmarkSettings;
+
+/// <summary> The result of a benchmark test. </summary>
+typedef struct
+{
+	/// <summary> The test. </summary>
+	GattBenchmarkTest Test;
+	/// <summary> The test result. </summary>
+	int Error;
+
+	/// <summary> The connection ATT PDU size. </summary>
+	unsigned short MaxPduSize;
+	/// <summary> The connection PHY. </summary>
+	wclBluetoothLeConnectionPhy Phy;
+	/// <summary> The connection parameters. </summary>
+	wclBluetoothLeConnectionParameters Params;
+
+	/// <summary> The value length used. </summary>
+	unsigned long Length;
+	/// <summary> The number of completed operations. </summary>
+	unsigned long Operations;
+	/// <summary> The number of notifications or indications the peer sent
+	///   but the client has not received. </summary>
+	unsigned long Lost;
+	/// <summary> The number of transferred bytes. </summary>
+	unsigned __int64 Bytes;
+	/// <summary> The test duration in microseconds. </summary>
+	unsigned __int64 Elapsed;
+	/// <summary> The throughput in bytes per second. </summary>
+	unsigned __int64 Throughput;
+	/// <summary> The operation latency in microseconds. For writes it is the
+	///   write call time, for notifications and indications the time from the
+	///   peer send to the client event. </summary>
+	LatencySummary Latency;
+	/// <summary> The process CPU time per operation in
+	///   microseconds. </summary>
+	unsigned long Cpu;
+} GattBenchmarkResult;
+/// <summary> The list of the benchmark results. </summary>
+typedef std::vector<GattBenchmarkResult> GattBenchmarkResults;
+
+/// <summary> The peer side of the benchmark. </summary>
+/// <remarks> The peer exposes the benchmark service and sends the
+///   notifications and indications when the benchmark asks it to. Whether
+///   a value goes as notification or indication depends on the client
+///   subscription. </remarks>
+class CGattBenchmarkPeer
+{
+	DISABLE_COPY(CGattBenchmarkPeer);
+
+public:
+	/// <summary> Creates new benchmark peer. </summary>
+	CGattBenchmarkPeer();
+	/// <summary> Frees the benchmark peer. </summary>
+	virtual ~CGattBenchmarkPeer();
+
+	/// <summary> Sends the value to the subscribed client. </summary>
+	/// <param name="Value"> The value. </param>
+	/// <param name="Length"> The value length. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	virtual int Send(const unsigned char* const Value, const unsigned long Length) = 0;
+};
+
+/// <summary> The benchmark peer based on the <c>CwclGattServer</c>. </summary>
+/// <remarks> The server runs on its own radio; the client connects to it
+///   from another radio or another machine. Written values are counted and
+///   dropped. </remarks>
+class CGattBenchmarkServer : public CGattBenchmarkPeer
+{
+	DISABLE_COPY(CGattBenchmarkServer);
+
+private:
+	CwclGattLocalCharacteristic*	FCharacteristic;
+	volatile LONG64					FReceived;
+	CwclGattServer*					FServer;
+
+	void ServerWrite(void* Sender, CwclGattServerClient* const Client,
+		CwclGattLocalCharacteristic* const Characteristic,
+		CwclGattLocalCharacteristicWriteRequest* const Request);
+
+public:
+	/// <summary> Creates new benchmark server. </summary>
+	CGattBenchmarkServer();
+	/// <summary> Frees the benchmark server. </summary>
+	virtual ~CGattBenchmarkServer();
+
+	/// <summary> Starts the server. </summary>
+	/// <param name="Radio"> The radio the server runs on. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Start(CwclBluetoothRadio* const Radio);
+	/// <summary> Stops the server. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Stop();
+
+	/// <summary> Sends the value to the subscribed clients. </summary>
+	/// <param name="Value"> The value. </param>
+	/// <param name="Length"> The value length. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	virtual int Send(const unsigned char* const Value, const unsigned long Length) override;
+
+	/// <summary> Gets the number of bytes written by the clients. </summary>
+	/// <returns> The number of bytes. </returns>
+	unsigned __int64 GetReceived() const;
+	/// <summary> Gets the number of bytes written by the clients. </summary>
+	/// <value> The number of bytes. </value>
+	__declspec(property(get = GetReceived)) unsigned __int64 Received;
+};
+
+/// <summary> Measures the GATT throughput of a connection. </summary>
+/// <remarks> <para> The benchmark runs against the benchmark service of a
+///   <see cref="CGattBenchmarkPeer" />. Every test reports the throughput,
+///   the operation latency percentiles and the process CPU time per
+///   operation, together with the PDU size, PHY and connection parameters
+///   the test ran with. </para>
+///   <para> The client must use the <c>mpAsync</c> message processing:
+///   <c>Run</c> blocks while it waits for the notifications. </para>
+///   <para> <c>RunLoopback</c> runs all tests between a
+///   <see cref="CGattBenchmarkServer" /> and a client on the simulated radio
+///   and needs no Bluetooth hardware. Before the tests it checks that a
+///   notification reaches a <see cref="CGattSubscriptionTable" /> route,
+///   after them that every written byte reached the server. </para> </remarks>
+class CGattBenchmark
+{
+	DISABLE_COPY(CGattBenchmark);
+
+private:
+	wclGattCharacteristic	FCharacteristic;
+	CwclGattClient*			FClient;
+	CLatencyHistogram		FLatency;
+	CGattBenchmarkPeer*		FPeer;
+	GattBenchmarkSettings	FSettings;
+
+	CwclAutoResetEvent*		FConnectEvent;
+	int						FConnectError;
+
+	volatile LONG			FExpected;
+	volatile LONG			FReceived;
+	volatile LONG64			FReceivedBytes;
+	CwclAutoResetEvent*		FReceivedEvent;
+	volatile LONG			FReceiving;
+
+	void ClientConnect(void* Sender, const int Error);
+	void ClientCharacteristicChanged(void* Sender, const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+
+	int RunWrite(const wclGattWriteKind WriteKind, const std::vector<unsigned char>& Value,
+		GattBenchmarkResult& Result);
+	int RunReceive(const bool Indication, std::vector<unsigned char>& Value,
+		GattBenchmarkResult& Result);
+	int WaitReceived(const LONG Count);
+
+	// Connects the client and waits for the connection result.
+	int Connect(CwclGattClient* const Client, CwclBluetoothRadio* const Radio);
+	// Checks that a peer notification reaches the subscription table route
+	// of the benchmark characteristic.
+	int CheckRouting();
+	// Runs all tests over a simulated radio of the opened manager.
+	int RunSimulated(CwclBluetoothManager* const Manager, GattBenchmarkResults& Results);
+
+	static unsigned __int64 CpuTime();
+
+public:
+	/// <summary> Creates new benchmark. </summary>
+	CGattBenchmark();
+	/// <summary> Frees the benchmark. </summary>
+	virtual ~CGattBenchmark();
+
+	/// <summary> Prepares the benchmark. </summary>
+	/// <param name="Client"> The client connected to the peer. </param>
+	/// <param name="Peer"> The peer. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The method looks up the benchmark characteristic. </remarks>
+	int Open(CwclGattClient* const Client, CGattBenchmarkPeer* const Peer);
+	/// <summary> Releases the client. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Close();
+
+	/// <summary> Runs the test. </summary>
+	/// <param name="Test"> The test. </param>
+	/// <param name="Result"> On output the test result. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Run(const GattBenchmarkTest Test, GattBenchmarkResult& Result);
+	/// <summary> Runs all tests. </summary>
+	/// <param name="Results"> On output the results of the tests. A failed
+	///   test does not stop the next ones. </param>
+	/// <returns> If all tests succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns the error
+	///   of the first failed test. </returns>
+	int RunAll(GattBenchmarkResults& Results);
+
+	/// <summary> Gets the settings. </summary>
+	/// <param name="Settings"> On output the settings. </param>
+	void GetSettings(GattBenchmarkSettings& Settings) const;
+	/// <summary> Sets the settings. </summary>
+	/// <param name="Settings"> The settings. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int SetSettings(const GattBenchmarkSettings& Settings);
+
+	/// <summary> Runs all tests over the simulated radio. </summary>
+	/// <param name="Settings"> The settings. </param>
+	/// <param name="Results"> On output the results of the tests. </param>
+	/// <returns> If all tests succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	static int RunLoopback(const GattBenchmarkSettings& Settings,
+		GattBenchmarkResults& Results);
+	/// <summary> Formats the results as CSV text. </summary>
+	/// <param name="Results"> The results. </param>
+	/// <returns> The header line and one line per result. </returns>
+	static tstring ToText(const GattBenchmarkResults& Results);
+
+	/// <summary> Gets the active state. </summary>
+	/// <returns> <c>true</c> if the benchmark is opened. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the active state. </summary>
+	/// <value> <c>true</c> if the benchmark is opened. </value>
+	__declspec(property(get = GetActive)) bool Active;
+};
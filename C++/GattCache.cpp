@@ -0,0 +1,787 @@
+// GattCache.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattCache.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The cache file is a header followed by the payload. All the values are
+// little endian.
+//   Header: Magic, Version, Flags, Address, Hash, PayloadSize, Checksum.
+//   Payload: services, characteristic lists (by service handle) and
+//   descriptor lists (by characteristic handle). A UUID is written as the
+//   short flag followed by either 2 or 16 bytes.
+static const unsigned long GATT_CACHE_MAGIC = 0x43544147; // "GATC"
+static const unsigned short GATT_CACHE_VERSION = 1;
+static const unsigned short GATT_CACHE_HAS_HASH = 0x0001;
+static const unsigned short GATT_CACHE_HAS_SERVICES = 0x0002;
+static const unsigned long GATT_CACHE_HEADER_SIZE = 4 + 2 + 2 + 8 + GATT_DATABASE_HASH_SIZE + 4 + 4;
+// Larger files are never created by the cache; they are damaged.
+static const unsigned long GATT_CACHE_MAX_FILE_SIZE = 0x00100000;
+static const LPCTSTR GATT_CACHE_EXT = _T(".gattdb");
+
+typedef struct
+{
+	const unsigned char*	Data;
+	size_t					Size;
+	size_t					Pos;
+} CACHE_READER;
+
+static void CachePut(std::vector<unsigned char>& Buffer, const void* const Data,
+	const size_t Size)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(Data);
+	Buffer.insert(Buffer.end(), p, p + Size);
+}
+
+static void CachePutUuid(std::vector<unsigned char>& Buffer, const wclGattUuid& Uuid)
+{
+	unsigned char IsShort = Uuid.IsShortUuid ? 1 : 0;
+	CachePut(Buffer, &IsShort, sizeof(IsShort));
+	if (Uuid.IsShortUuid)
+		CachePut(Buffer, &Uuid.ShortUuid, sizeof(Uuid.ShortUuid));
+	else
+		CachePut(Buffer, &Uuid.LongUuid, sizeof(Uuid.LongUuid));
+}
+
+static bool CacheGet(CACHE_READER& Reader, void* const Data, const size_t Size)
+{
+	if (Reader.Size - Reader.Pos < Size)
+		return false;
+	CopyMemory(Data, Reader.Data + Reader.Pos, Size);
+	Reader.Pos += Size;
+	return true;
+}
+
+static bool CacheGetUuid(CACHE_READER& Reader, wclGattUuid& Uuid)
+{
+	ZeroMemory(&Uuid, sizeof(Uuid));
+	unsigned char IsShort;
+	if (!CacheGet(Reader, &IsShort, sizeof(IsShort)))
+		return false;
+	Uuid.IsShortUuid = (IsShort != 0);
+	if (Uuid.IsShortUuid)
+		return CacheGet(Reader, &Uuid.ShortUuid, sizeof(Uuid.ShortUuid));
+	return CacheGet(Reader, &Uuid.LongUuid, sizeof(Uuid.LongUuid));
+}
+
+static unsigned long CacheChecksum(const unsigned char* const Data, const size_t Size)
+{
+	// FNV-1a.
+	unsigned long Hash = 2166136261;
+	for (size_t i = 0; i < Size; i++)
+	{
+		Hash ^= Data[i];
+		Hash *= 16777619;
+	}
+	return Hash;
+}
+
+static bool IsShortUuid(const wclGattUuid& Uuid, const unsigned short Value)
+{
+	return (Uuid.IsShortUuid && Uuid.ShortUuid == Value);
+}
+
+
+// CGattCache
+
+CGattCache::CGattCache()
+{
+	FCS = new CwclCriticalSection();
+	FDirectory = _T("");
+	ZeroMemory(&FStatistics, sizeof(FStatistics));
+	FTrustUnhashed = false;
+}
+
+CGattCache::~CGattCache()
+{
+	Flush();
+
+	for (ENTRIES::iterator e = FEntries.begin(); e != FEntries.end(); e++)
+		delete e->second;
+	delete FCS;
+}
+
+tstring CGattCache::FileName(const __int64 Address) const
+{
+	TCHAR Name[32];
+	_stprintf_s(Name, _countof(Name), _T("%.12I64X"), Address);
+	return FDirectory + _T("\\") + Name + GATT_CACHE_EXT;
+}
+
+CGattCache::ENTRY* CGattCache::GetEntry(const __int64 Address, const bool Create)
+{
+	ENTRIES::iterator e = FEntries.find(Address);
+	if (e != FEntries.end())
+		return e->second;
+
+	ENTRY* Entry = Load(Address);
+	if (Entry == NULL && Create)
+	{
+		Entry = new ENTRY;
+		ResetEntry(Entry);
+	}
+	if (Entry != NULL)
+		FEntries[Address] = Entry;
+	return Entry;
+}
+
+void CGattCache::ResetEntry(ENTRY* const Entry)
+{
+	Entry->Validated = false;
+	Entry->Dirty = false;
+	Entry->HasHash = false;
+	ZeroMemory(Entry->Hash, sizeof(Entry->Hash));
+	Entry->HasServices = false;
+	Entry->Services.clear();
+	Entry->Characteristics.clear();
+	Entry->Descriptors.clear();
+}
+
+void CGattCache::DropEntry(const __int64 Address)
+{
+	ENTRIES::iterator e = FEntries.find(Address);
+	if (e != FEntries.end())
+	{
+		delete e->second;
+		FEntries.erase(e);
+	}
+	if (FDirectory.length() > 0)
+		DeleteFile(FileName(Address).c_str());
+	FStatistics.Invalidations++;
+}
+
+bool CGattCache::FindCharacteristic(const ENTRY* const Entry, const unsigned short Uuid,
+	wclGattCharacteristic& Characteristic) const
+{
+	for (CHARACTERISTICS::const_iterator l = Entry->Characteristics.begin();
+		l != Entry->Characteristics.end(); l++)
+	{
+		for (wclGattCharacteristics::const_iterator c = l->second.begin();
+			c != l->second.end(); c++)
+		{
+			if (IsShortUuid((*c).Uuid, Uuid))
+			{
+				Characteristic = *c;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void CGattCache::Serialize(const __int64 Address, const ENTRY* const Entry,
+	BUFFER& Buffer) const
+{
+	Buffer.clear();
+	Buffer.resize(GATT_CACHE_HEADER_SIZE);
+
+	unsigned long Count = static_cast<unsigned long>(Entry->Services.size());
+	CachePut(Buffer, &Count, sizeof(Count));
+	for (wclGattServices::const_iterator s = Entry->Services.begin();
+		s != Entry->Services.end(); s++)
+	{
+		CachePutUuid(Buffer, (*s).Uuid);
+		CachePut(Buffer, &(*s).Handle, sizeof((*s).Handle));
+	}
+
+	Count = static_cast<unsigned long>(Entry->Characteristics.size());
+	CachePut(Buffer, &Count, sizeof(Count));
+	for (CHARACTERISTICS::const_iterator l = Entry->Characteristics.begin();
+		l != Entry->Characteristics.end(); l++)
+	{
+		CachePut(Buffer, &l->first, sizeof(l->first));
+		Count = static_cast<unsigned long>(l->second.size());
+		CachePut(Buffer, &Count, sizeof(Count));
+		for (wclGattCharacteristics::const_iterator c = l->second.begin();
+			c != l->second.end(); c++)
+		{
+			CachePut(Buffer, &(*c).ServiceHandle, sizeof((*c).ServiceHandle));
+			CachePutUuid(Buffer, (*c).Uuid);
+			CachePut(Buffer, &(*c).Handle, sizeof((*c).Handle));
+			CachePut(Buffer, &(*c).ValueHandle, sizeof((*c).ValueHandle));
+			unsigned char Flags = static_cast<unsigned char>(
+				((*c).IsBroadcastable ? 0x01 : 0) | ((*c).IsReadable ? 0x02 : 0) |
+				((*c).IsWritable ? 0x04 : 0) | ((*c).IsWritableWithoutResponse ? 0x08 : 0) |
+				((*c).IsSignedWritable ? 0x10 : 0) | ((*c).IsNotifiable ? 0x20 : 0) |
+				((*c).IsIndicatable ? 0x40 : 0) | ((*c).HasExtendedProperties ? 0x80 : 0));
+			CachePut(Buffer, &Flags, sizeof(Flags));
+		}
+	}
+
+	Count = static_cast<unsigned long>(Entry->Descriptors.size());
+	CachePut(Buffer, &Count, sizeof(Count));
+	for (DESCRIPTORS::const_iterator l = Entry->Descriptors.begin();
+		l != Entry->Descriptors.end(); l++)
+	{
+		CachePut(Buffer, &l->first, sizeof(l->first));
+		Count = static_cast<unsigned long>(l->second.size());
+		CachePut(Buffer, &Count, sizeof(Count));
+		for (wclGattDescriptors::const_iterator d = l->second.begin();
+			d != l->second.end(); d++)
+		{
+			CachePut(Buffer, &(*d).ServiceHandle, sizeof((*d).ServiceHandle));
+			CachePut(Buffer, &(*d).CharacteristicHandle, sizeof((*d).CharacteristicHandle));
+			unsigned char Type = static_cast<unsigned char>((*d).DescriptorType);
+			CachePut(Buffer, &Type, sizeof(Type));
+			CachePutUuid(Buffer, (*d).Uuid);
+			CachePut(Buffer, &(*d).Handle, sizeof((*d).Handle));
+		}
+	}
+
+	// Now the payload size and checksum are known: fill the header.
+	unsigned long PayloadSize = static_cast<unsigned long>(Buffer.size()) -
+		GATT_CACHE_HEADER_SIZE;
+	unsigned long Checksum = CacheChecksum(Buffer.data() + GATT_CACHE_HEADER_SIZE,
+		PayloadSize);
+	unsigned short Flags = static_cast<unsigned short>(
+		(Entry->HasHash ? GATT_CACHE_HAS_HASH : 0) |
+		(Entry->HasServices ? GATT_CACHE_HAS_SERVICES : 0));
+
+	BUFFER Header;
+	CachePut(Header, &GATT_CACHE_MAGIC, sizeof(GATT_CACHE_MAGIC));
+	CachePut(Header, &GATT_CACHE_VERSION, sizeof(GATT_CACHE_VERSION));
+	CachePut(Header, &Flags, sizeof(Flags));
+	CachePut(Header, &Address, sizeof(Address));
+	CachePut(Header, Entry->Hash, sizeof(Entry->Hash));
+	CachePut(Header, &PayloadSize, sizeof(PayloadSize));
+	CachePut(Header, &Checksum, sizeof(Checksum));
+	CopyMemory(Buffer.data(), Header.data(), GATT_CACHE_HEADER_SIZE);
+}
+
+bool CGattCache::Deserialize(const __int64 Address, const BUFFER& Buffer,
+	ENTRY* const Entry) const
+{
+	CACHE_READER Reader;
+	Reader.Data = Buffer.data();
+	Reader.Size = Buffer.size();
+	Reader.Pos = 0;
+
+	unsigned long Magic;
+	unsigned short Version;
+	unsigned short Flags;
+	__int64 FileAddress;
+	unsigned long PayloadSize;
+	unsigned long Checksum;
+	if (!CacheGet(Reader, &Magic, sizeof(Magic)) ||
+		!CacheGet(Reader, &Version, sizeof(Version)) ||
+		!CacheGet(Reader, &Flags, sizeof(Flags)) ||
+		!CacheGet(Reader, &FileAddress, sizeof(FileAddress)) ||
+		!CacheGet(Reader, Entry->Hash, sizeof(Entry->Hash)) ||
+		!CacheGet(Reader, &PayloadSize, sizeof(PayloadSize)) ||
+		!CacheGet(Reader, &Checksum, sizeof(Checksum)))
+	{
+		return false;
+	}
+	if (Magic != GATT_CACHE_MAGIC || Version != GATT_CACHE_VERSION || FileAddress != Address)
+		return false;
+	if (PayloadSize != Reader.Size - Reader.Pos)
+		return false;
+	if (CacheChecksum(Reader.Data + Reader.Pos, PayloadSize) != Checksum)
+		return false;
+
+	Entry->HasHash = ((Flags & GATT_CACHE_HAS_HASH) != 0);
+	Entry->HasServices = ((Flags & GATT_CACHE_HAS_SERVICES) != 0);
+
+	unsigned long Count;
+	if (!CacheGet(Reader, &Count, sizeof(Count)))
+		return false;
+	for (unsigned long i = 0; i < Count; i++)
+	{
+		wclGattService Service;
+		if (!CacheGetUuid(Reader, Service.Uuid) ||
+			!CacheGet(Reader, &Service.Handle, sizeof(Service.Handle)))
+		{
+			return false;
+		}
+		Entry->Services.push_back(Service);
+	}
+
+	unsigned long Lists;
+	if (!CacheGet(Reader, &Lists, sizeof(Lists)))
+		return false;
+	for (unsigned long l = 0; l < Lists; l++)
+	{
+		unsigned short ServiceHandle;
+		if (!CacheGet(Reader, &ServiceHandle, sizeof(ServiceHandle)) ||
+			!CacheGet(Reader, &Count, sizeof(Count)))
+		{
+			return false;
+		}
+		wclGattCharacteristics& Characteristics = Entry->Characteristics[ServiceHandle];
+		for (unsigned long i = 0; i < Count; i++)
+		{
+			wclGattCharacteristic c;
+			unsigned char f;
+			if (!CacheGet(Reader, &c.ServiceHandle, sizeof(c.ServiceHandle)) ||
+				!CacheGetUuid(Reader, c.Uuid) ||
+				!CacheGet(Reader, &c.Handle, sizeof(c.Handle)) ||
+				!CacheGet(Reader, &c.ValueHandle, sizeof(c.ValueHandle)) ||
+				!CacheGet(Reader, &f, sizeof(f)))
+			{
+				return false;
+			}
+			c.IsBroadcastable = ((f & 0x01) != 0);
+			c.IsReadable = ((f & 0x02) != 0);
+			c.IsWritable = ((f & 0x04) != 0);
+			c.IsWritableWithoutResponse = ((f & 0x08) != 0);
+			c.IsSignedWritable = ((f & 0x10) != 0);
+			c.IsNotifiable = ((f & 0x20) != 0);
+			c.IsIndicatable = ((f & 0x40) != 0);
+			c.HasExtendedProperties = ((f & 0x80) != 0);
+			Characteristics.push_back(c);
+		}
+	}
+
+	if (!CacheGet(Reader, &Lists, sizeof(Lists)))
+		return false;
+	for (unsigned long l = 0; l < Lists; l++)
+	{
+		unsigned short CharacteristicHandle;
+		if (!CacheGet(Reader, &CharacteristicHandle, sizeof(CharacteristicHandle)) ||
+			!CacheGet(Reader, &Count, sizeof(Count)))
+		{
+			return false;
+		}
+		wclGattDescriptors& Descriptors = Entry->Descriptors[CharacteristicHandle];
+		for (unsigned long i = 0; i < Count; i++)
+		{
+			wclGattDescriptor d;
+			unsigned char Type;
+			if (!CacheGet(Reader, &d.ServiceHandle, sizeof(d.ServiceHandle)) ||
+				!CacheGet(Reader, &d.CharacteristicHandle, sizeof(d.CharacteristicHandle)) ||
+				!CacheGet(Reader, &Type, sizeof(Type)) ||
+				!CacheGetUuid(Reader, d.Uuid) ||
+				!CacheGet(Reader, &d.Handle, sizeof(d.Handle)))
+			{
+				return false;
+			}
+			if (Type > dtCustomDescriptor)
+				return false;
+			d.DescriptorType = static_cast<wclGattDescriptorType>(Type);
+			Descriptors.push_back(d);
+		}
+	}
+
+	return (Reader.Pos == Reader.Size);
+}
+
+CGattCache::ENTRY* CGattCache::Load(const __int64 Address) const
+{
+	if (FDirectory.length() == 0)
+		return NULL;
+
+	HANDLE File = CreateFile(FileName(Address).c_str(), GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	BUFFER Buffer;
+	DWORD Size = GetFileSize(File, NULL);
+	bool Loaded = false;
+	if (Size != INVALID_FILE_SIZE && Size >= GATT_CACHE_HEADER_SIZE &&
+		Size <= GATT_CACHE_MAX_FILE_SIZE)
+	{
+		Buffer.resize(Size);
+		DWORD Read;
+		Loaded = (ReadFile(File, Buffer.data(), Size, &Read, NULL) && Read == Size);
+	}
+	CloseHandle(File);
+	if (!Loaded)
+		return NULL;
+
+	ENTRY* Entry = new ENTRY;
+	ResetEntry(Entry);
+	if (!Deserialize(Address, Buffer, Entry))
+	{
+		delete Entry;
+		return NULL;
+	}
+	return Entry;
+}
+
+int CGattCache::Save(const __int64 Address, ENTRY* const Entry)
+{
+	if (FDirectory.length() == 0)
+	{
+		Entry->Dirty = false;
+		return WCL_E_SUCCESS;
+	}
+
+	BUFFER Buffer;
+	Serialize(Address, Entry, Buffer);
+
+	// Write a temporary file and replace the old one with it, so a crash never
+	// leaves a half written cache.
+	tstring Name = FileName(Address);
+	tstring TempName = Name + _T(".tmp");
+	HANDLE File = CreateFile(TempName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return APP_E_GATT_CACHE_WRITE_FAILED;
+
+	DWORD Written;
+	bool Ok = (WriteFile(File, Buffer.data(), static_cast<DWORD>(Buffer.size()), &Written,
+		NULL) && Written == Buffer.size());
+	CloseHandle(File);
+
+	if (Ok)
+		Ok = (MoveFileEx(TempName.c_str(), Name.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE);
+	if (!Ok)
+	{
+		DeleteFile(TempName.c_str());
+		return APP_E_GATT_CACHE_WRITE_FAILED;
+	}
+
+	Entry->Dirty = false;
+	return WCL_E_SUCCESS;
+}
+
+void CGattCache::ReadHash(CwclGattClient* const Client,
+	const wclGattCharacteristics& Characteristics)
+{
+	for (wclGattCharacteristics::const_iterator c = Characteristics.begin();
+		c != Characteristics.end(); c++)
+	{
+		if (IsShortUuid((*c).Uuid, GATT_UUID_DATABASE_HASH))
+		{
+			unsigned char* Value = NULL;
+			unsigned long Length = 0;
+			int Res = Client->ReadCharacteristicValue(*c, goReadFromDevice, Value, Length);
+			if (Res == WCL_E_SUCCESS)
+			{
+				if (Length == GATT_DATABASE_HASH_SIZE)
+				{
+					FCS->Enter();
+					ENTRY* Entry = GetEntry(Client->Address, false);
+					if (Entry != NULL && Entry->Validated)
+					{
+						CopyMemory(Entry->Hash, Value, GATT_DATABASE_HASH_SIZE);
+						Entry->HasHash = true;
+						Entry->Dirty = true;
+					}
+					FCS->Leave();
+				}
+				delete[] Value;
+			}
+			break;
+		}
+	}
+}
+
+int CGattCache::Validate(CwclGattClient* const Client)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	__int64 Address = Client->Address;
+	bool Hashed = false;
+	wclGattCharacteristic HashCharacteristic;
+	unsigned char Hash[GATT_DATABASE_HASH_SIZE];
+
+	int Res = WCL_E_SUCCESS;
+	FCS->Enter();
+	ENTRY* Entry = GetEntry(Address, false);
+	if (Entry == NULL)
+		Res = APP_E_GATT_CACHE_NOT_FOUND;
+	else
+	{
+		Entry->Validated = false;
+		Hashed = (Entry->HasHash && FindCharacteristic(Entry, GATT_UUID_DATABASE_HASH,
+			HashCharacteristic));
+		if (Hashed)
+			CopyMemory(Hash, Entry->Hash, GATT_DATABASE_HASH_SIZE);
+		else
+		{
+			if (FTrustUnhashed)
+				Entry->Validated = true;
+			else
+			{
+				DropEntry(Address);
+				Res = APP_E_GATT_CACHE_OUT_OF_DATE;
+			}
+		}
+	}
+	FCS->Leave();
+
+	if (!Hashed)
+		return Res;
+
+	// The hash is read from its cached handle: this is the only ATT request
+	// a valid cache costs.
+	unsigned char* Value = NULL;
+	unsigned long Length = 0;
+	Res = Client->ReadCharacteristicValue(HashCharacteristic, goReadFromDevice, Value,
+		Length);
+	bool Match = false;
+	if (Res == WCL_E_SUCCESS)
+	{
+		Match = (Length == GATT_DATABASE_HASH_SIZE &&
+			memcmp(Value, Hash, GATT_DATABASE_HASH_SIZE) == 0);
+		delete[] Value;
+		if (!Match)
+			Res = APP_E_GATT_CACHE_OUT_OF_DATE;
+	}
+
+	FCS->Enter();
+	if (Match)
+	{
+		Entry = GetEntry(Address, false);
+		if (Entry != NULL)
+			Entry->Validated = true;
+	}
+	else
+		DropEntry(Address);
+	FCS->Leave();
+
+	return Res;
+}
+
+int CGattCache::ReadServices(CwclGattClient* const Client, wclGattServices& Services)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	__int64 Address = Client->Address;
+	FCS->Enter();
+	ENTRY* Entry = GetEntry(Address, false);
+	bool Hit = (Entry != NULL && Entry->Validated && Entry->HasServices);
+	if (Hit)
+	{
+		Services = Entry->Services;
+		FStatistics.Hits++;
+	}
+	FCS->Leave();
+	if (Hit)
+		return WCL_E_SUCCESS;
+
+	int Res = Client->ReadServices(goReadFromDevice, Services);
+
+	FCS->Enter();
+	FStatistics.Misses++;
+	if (Res == WCL_E_SUCCESS)
+	{
+		// The device is the source of truth now: whatever was cached before
+		// the validation is dropped.
+		Entry = GetEntry(Address, true);
+		if (!Entry->Validated)
+		{
+			ResetEntry(Entry);
+			Entry->Validated = true;
+		}
+		Entry->Services = Services;
+		Entry->HasServices = true;
+		Entry->Dirty = true;
+	}
+	FCS->Leave();
+
+	return Res;
+}
+
+int CGattCache::ReadCharacteristics(CwclGattClient* const Client,
+	const wclGattService& Service, wclGattCharacteristics& Characteristics)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	__int64 Address = Client->Address;
+	FCS->Enter();
+	ENTRY* Entry = GetEntry(Address, false);
+	bool Hit = false;
+	if (Entry != NULL && Entry->Validated)
+	{
+		CHARACTERISTICS::const_iterator l = Entry->Characteristics.find(Service.Handle);
+		if (l != Entry->Characteristics.end())
+		{
+			Characteristics = l->second;
+			FStatistics.Hits++;
+			Hit = true;
+		}
+	}
+	FCS->Leave();
+	if (Hit)
+		return WCL_E_SUCCESS;
+
+	int Res = Client->ReadCharacteristics(Service, goReadFromDevice, Characteristics);
+
+	FCS->Enter();
+	FStatistics.Misses++;
+	if (Res == WCL_E_SUCCESS)
+	{
+		Entry = GetEntry(Address, true);
+		if (!Entry->Validated)
+		{
+			ResetEntry(Entry);
+			Entry->Validated = true;
+		}
+		Entry->Characteristics[Service.Handle] = Characteristics;
+		Entry->Dirty = true;
+	}
+	FCS->Leave();
+
+	if (Res == WCL_E_SUCCESS && IsShortUuid(Service.Uuid, GATT_UUID_GENERIC_ATTRIBUTE))
+		ReadHash(Client, Characteristics);
+
+	return Res;
+}
+
+int CGattCache::ReadDescriptors(CwclGattClient* const Client,
+	const wclGattCharacteristic& Characteristic, wclGattDescriptors& Descriptors)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	__int64 Address = Client->Address;
+	FCS->Enter();
+	ENTRY* Entry = GetEntry(Address, false);
+	bool Hit = false;
+	if (Entry != NULL && Entry->Validated)
+	{
+		DESCRIPTORS::const_iterator l = Entry->Descriptors.find(Characteristic.Handle);
+		if (l != Entry->Descriptors.end())
+		{
+			Descriptors = l->second;
+			FStatistics.Hits++;
+			Hit = true;
+		}
+	}
+	FCS->Leave();
+	if (Hit)
+		return WCL_E_SUCCESS;
+
+	int Res = Client->ReadDescriptors(Characteristic, goReadFromDevice, Descriptors);
+
+	FCS->Enter();
+	FStatistics.Misses++;
+	if (Res == WCL_E_SUCCESS)
+	{
+		Entry = GetEntry(Address, true);
+		if (!Entry->Validated)
+		{
+			ResetEntry(Entry);
+			Entry->Validated = true;
+		}
+		Entry->Descriptors[Characteristic.Handle] = Descriptors;
+		Entry->Dirty = true;
+	}
+	FCS->Leave();
+
+	return Res;
+}
+
+void CGattCache::CharacteristicChanged(const __int64 Address, const unsigned short Handle)
+{
+	FCS->Enter();
+	ENTRY* Entry = GetEntry(Address, false);
+	if (Entry != NULL)
+	{
+		wclGattCharacteristic ServiceChanged;
+		if (FindCharacteristic(Entry, GATT_UUID_SERVICE_CHANGED, ServiceChanged))
+		{
+			if (Handle == ServiceChanged.ValueHandle)
+				DropEntry(Address);
+		}
+	}
+	FCS->Leave();
+}
+
+void CGattCache::Disconnected(const __int64 Address)
+{
+	// Only a loaded entry can be validated: nothing to read from the file.
+	FCS->Enter();
+	ENTRIES::iterator e = FEntries.find(Address);
+	if (e != FEntries.end())
+		e->second->Validated = false;
+	FCS->Leave();
+}
+
+void CGattCache::Invalidate(const __int64 Address)
+{
+	FCS->Enter();
+	DropEntry(Address);
+	FCS->Leave();
+}
+
+void CGattCache::Clear()
+{
+	FCS->Enter();
+	for (ENTRIES::iterator e = FEntries.begin(); e != FEntries.end(); e++)
+		delete e->second;
+	FEntries.clear();
+
+	if (FDirectory.length() > 0)
+	{
+		// Delete the files of the devices that have not been loaded too.
+		WIN32_FIND_DATA Data;
+		tstring Mask = FDirectory + _T("\\*") + GATT_CACHE_EXT;
+		HANDLE Find = FindFirstFile(Mask.c_str(), &Data);
+		if (Find != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				tstring Name = FDirectory + _T("\\") + Data.cFileName;
+				DeleteFile(Name.c_str());
+			} while (FindNextFile(Find, &Data));
+			FindClose(Find);
+		}
+	}
+	FCS->Leave();
+}
+
+int CGattCache::Flush()
+{
+	int Res = WCL_E_SUCCESS;
+	FCS->Enter();
+	for (ENTRIES::iterator e = FEntries.begin(); e != FEntries.end(); e++)
+	{
+		if (e->second->Dirty)
+		{
+			int SaveRes = Save(e->first, e->second);
+			if (Res == WCL_E_SUCCESS)
+				Res = SaveRes;
+		}
+	}
+	FCS->Leave();
+	return Res;
+}
+
+void CGattCache::GetStatistics(GattCacheStatistics& Statistics) const
+{
+	FCS->Enter();
+	Statistics = FStatistics;
+	FCS->Leave();
+}
+
+tstring CGattCache::GetDirectory() const
+{
+	FCS->Enter();
+	tstring Result = FDirectory;
+	FCS->Leave();
+	return Result;
+}
+
+void CGattCache::SetDirectory(const tstring& Value)
+{
+	FCS->Enter();
+	FDirectory = Value;
+	// No trailing delimiter: FileName adds it.
+	while (FDirectory.length() > 0 && (FDirectory[FDirectory.length() - 1] == _T('\\') ||
+		FDirectory[FDirectory.length() - 1] == _T('/')))
+	{
+		FDirectory.erase(FDirectory.length() - 1);
+	}
+	FCS->Leave();
+}
+
+bool CGattCache::GetTrustUnhashed() const
+{
+	return FTrustUnhashed;
+}
+
+void CGattCache::SetTrustUnhashed(const bool Value)
+{
+	FTrustUnhashed = Value;
+}
@@ -0,0 +1,229 @@
+// GattCache.h : persistent GATT attribute database cache
+//
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the GATT cache error codes. </summary>
+const int APP_E_GATT_CACHE_BASE = 0x00F00000;
+/// <summary> The cache file can not be written. </summary>
+const int APP_E_GATT_CACHE_WRITE_FAILED = APP_E_GATT_CACHE_BASE + 0x0000;
+/// <summary> The device has no cached attributes. </summary>
+const int APP_E_GATT_CACHE_NOT_FOUND = APP_E_GATT_CACHE_BASE + 0x0001;
+/// <summary> The cached attributes are out of date and have been
+///   dropped. </summary>
+const int APP_E_GATT_CACHE_OUT_OF_DATE = APP_E_GATT_CACHE_BASE + 0x0002;
+
+/// <summary> The Generic Attribute service UUID. </summary>
+const unsigned short GATT_UUID_GENERIC_ATTRIBUTE = 0x1801;
+/// <summary> The Service Changed characteristic UUID. </summary>
+const unsigned short GATT_UUID_SERVICE_CHANGED = 0x2A05;
+/// <summary> The Database Hash characteristic UUID. </summary>
+const unsigned short GATT_UUID_DATABASE_HASH = 0x2B2A;
+/// <summary> The Database Hash value size. </summary>
+const unsigned long GATT_DATABASE_HASH_SIZE = 16;
+
+/// <summary> The GATT cache statistics. </summary>
+typedef struct
+{
+	/// <summary> The number of reads served from the cache. </summary>
+	unsigned long Hits;
+	/// <summary> The number of reads sent to the device. </summary>
+	unsigned long Misses;
+	/// <summary> The number of devices whose cache has been dropped because
+	///   the database has changed. </summary>
+	unsigned long Invalidations;
+} GattCacheStatistics;
+
+/// <summary> The application owned cache of the remote GATT
+///   databases. </summary>
+/// <remarks> <para> The cache keeps the services, characteristics and
+///   descriptors of every device in memory and in a compact binary file per
+///   device address. Use its <c>ReadServices</c>, <c>ReadCharacteristics</c>
+///   and <c>ReadDescriptors</c> methods instead of the
+///   <c>CwclGattClient</c> ones: the first connection reads the attributes
+///   from the device, the following ones are served from the cache with no
+///   ATT traffic. </para>
+///   <para> Cached attributes are used only after <c>Validate</c> has been
+///   called on the new connection. It reads the Database Hash characteristic
+///   (0x2B2A) from its cached handle and drops the cache if the hash differs.
+///   While connected, the application forwards <c>OnCharacteristicChanged</c>
+///   events to <c>CharacteristicChanged</c>; a Service Changed (0x2A05)
+///   indication drops the cache too. The application is responsible to
+///   subscribe for the Service Changed indications and to call
+///   <c>Disconnected</c> from the <c>OnDisconnect</c> event handler, so the
+///   next connection is validated again. </para>
+///   <para> Devices without the Database Hash characteristic can not be
+///   validated. Their cache is dropped on every connection unless
+///   <c>TrustUnhashed</c> is set. </para>
+///   <para> All the methods are thread safe. The device is never accessed
+///   inside the cache lock. </para> </remarks>
+class CGattCache
+{
+	DISABLE_COPY(CGattCache);
+
+private:
+	typedef std::map<unsigned short, wclGattCharacteristics> CHARACTERISTICS;
+	typedef std::map<unsigned short, wclGattDescriptors> DESCRIPTORS;
+
+	typedef struct
+	{
+		// Valid for the current connection.
+		bool					Validated;
+		// Has changes not written to the file yet.
+		bool					Dirty;
+
+		bool					HasHash;
+		unsigned char			Hash[GATT_DATABASE_HASH_SIZE];
+
+		bool					HasServices;
+		wclGattServices			Services;
+		// By service handle.
+		CHARACTERISTICS			Characteristics;
+		// By characteristic handle.
+		DESCRIPTORS				Descriptors;
+	} ENTRY;
+	typedef std::map<__int64, ENTRY*> ENTRIES;
+
+	typedef std::vector<unsigned char> BUFFER;
+
+	CwclCriticalSection*	FCS;
+	tstring					FDirectory;
+	ENTRIES					FEntries;
+	GattCacheStatistics		FStatistics;
+	bool					FTrustUnhashed;
+
+	tstring FileName(const __int64 Address) const;
+
+	// Must be called inside the critical section.
+	ENTRY* GetEntry(const __int64 Address, const bool Create);
+	void ResetEntry(ENTRY* const Entry);
+	void DropEntry(const __int64 Address);
+	bool FindCharacteristic(const ENTRY* const Entry, const unsigned short Uuid,
+		wclGattCharacteristic& Characteristic) const;
+
+	void Serialize(const __int64 Address, const ENTRY* const Entry, BUFFER& Buffer) const;
+	bool Deserialize(const __int64 Address, const BUFFER& Buffer, ENTRY* const Entry) const;
+	ENTRY* Load(const __int64 Address) const;
+	int Save(const __int64 Address, ENTRY* const Entry);
+
+	// Reads and stores the Database Hash if the Generic Attribute
+	// characteristics have just been cached.
+	void ReadHash(CwclGattClient* const Client, const wclGattCharacteristics& Characteristics);
+
+public:
+	/// <summary> Creates new GATT cache. </summary>
+	CGattCache();
+	/// <summary> Frees the GATT cache. </summary>
+	/// <remarks> The changed entries are written to the files. </remarks>
+	virtual ~CGattCache();
+
+	/// <summary> Validates the cached attributes of the connected
+	///   device. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <returns> <see cref="WCL_E_SUCCESS" /> if the cached attributes can be
+	///   used. <c>APP_E_GATT_CACHE_NOT_FOUND</c> if nothing is cached for the
+	///   device. <c>APP_E_GATT_CACHE_OUT_OF_DATE</c> if the cache has been
+	///   dropped. Otherwise the method returns one of the WCL error codes and
+	///   the cache is dropped. </returns>
+	/// <remarks> Must be called after every connection before the cache can
+	///   serve the device. In any case the following reads return the actual
+	///   device attributes. </remarks>
+	int Validate(CwclGattClient* const Client);
+
+	/// <summary> Reads the device services. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Services"> On output contains the list of the
+	///   services. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadServices(CwclGattClient* const Client, wclGattServices& Services);
+	/// <summary> Reads the service characteristics. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Service"> The <see cref="wclGattService" />. </param>
+	/// <param name="Characteristics"> On output contains the list of the
+	///   characteristics. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadCharacteristics(CwclGattClient* const Client, const wclGattService& Service,
+		wclGattCharacteristics& Characteristics);
+	/// <summary> Reads the characteristic descriptors. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Characteristic"> The
+	///   <see cref="wclGattCharacteristic" />. </param>
+	/// <param name="Descriptors"> On output contains the list of the
+	///   descriptors. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadDescriptors(CwclGattClient* const Client,
+		const wclGattCharacteristic& Characteristic, wclGattDescriptors& Descriptors);
+
+	/// <summary> Processes the characteristic change. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="Handle"> The changed characteristic value
+	///   handle. </param>
+	/// <remarks> Call the method from the <c>OnCharacteristicChanged</c>
+	///   event handler. If the handle is the value handle of the Service
+	///   Changed characteristic of the device the cache is dropped. </remarks>
+	void CharacteristicChanged(const __int64 Address, const unsigned short Handle);
+	/// <summary> Processes the device disconnection. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <remarks> Call the method from the <c>OnDisconnect</c> event handler.
+	///   The cached attributes are kept but are not used until
+	///   <c>Validate</c> is called on the next connection. </remarks>
+	void Disconnected(const __int64 Address);
+
+	/// <summary> Drops the cached attributes of the device. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	void Invalidate(const __int64 Address);
+	/// <summary> Drops all the cached attributes and deletes the
+	///   files. </summary>
+	void Clear();
+	/// <summary> Writes the changed entries to the files. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> Call the method once the discovery is done, for example when
+	///   the device disconnects. </remarks>
+	int Flush();
+
+	/// <summary> Gets the cache statistics. </summary>
+	/// <param name="Statistics"> On output contains the statistics. </param>
+	void GetStatistics(GattCacheStatistics& Statistics) const;
+
+	/// <summary> Gets the cache files directory. </summary>
+	/// <returns> The directory path. </returns>
+	tstring GetDirectory() const;
+	/// <summary> Sets the cache files directory. </summary>
+	/// <param name="Value"> The existing directory path. An empty path (the
+	///   default) keeps the cache in memory only. </param>
+	void SetDirectory(const tstring& Value);
+	/// <summary> Gets and sets the cache files directory. </summary>
+	/// <value> The directory path. </value>
+	__declspec(property(get = GetDirectory, put = SetDirectory)) tstring Directory;
+
+	/// <summary> Gets the unhashed databases policy. </summary>
+	/// <returns> <c>True</c> if the cache of a device without the Database
+	///   Hash characteristic is used without validation. </returns>
+	bool GetTrustUnhashed() const;
+	/// <summary> Sets the unhashed databases policy. </summary>
+	/// <param name="Value"> <c>True</c> to use the cache of a device without
+	///   the Database Hash characteristic without validation. Set it only if
+	///   the device database never changes. The default value is
+	///   <c>False</c>. </param>
+	void SetTrustUnhashed(const bool Value);
+	/// <summary> Gets and sets the unhashed databases policy. </summary>
+	/// <value> <c>True</c> if unhashed databases are trusted. </value>
+	__declspec(property(get = GetTrustUnhashed, put = SetTrustUnhashed)) bool TrustUnhashed;
+};
@@ -0,0 +1,324 @@
+// GattCoalescingWriter.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattCoalescingWriter.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static const unsigned long COALESCE_MAX_IN_FLIGHT = 8;
+
+
+// CGattCoalescingWriter
+
+CGattCoalescingWriter::CGattCoalescingWriter()
+{
+	FInFlight = 1;
+	FTuner = NULL;
+	FProtection = plNone;
+	FWriteKind = wkAuto;
+
+	FClient = NULL;
+	FCS = new CwclCriticalSection();
+	FBusy = 0;
+	FEvent = NULL;
+	FIdleEvent = NULL;
+	FTerminated = 0;
+
+	ZeroMemory(&FStatistics, sizeof(FStatistics));
+}
+
+CGattCoalescingWriter::~CGattCoalescingWriter()
+{
+	Close();
+	FreeSlots();
+
+	delete FCS;
+}
+
+void CGattCoalescingWriter::Free()
+{
+	if (FIdleEvent != NULL)
+	{
+		delete FIdleEvent;
+		FIdleEvent = NULL;
+	}
+	if (FEvent != NULL)
+	{
+		delete FEvent;
+		FEvent = NULL;
+	}
+	FClient = NULL;
+}
+
+void CGattCoalescingWriter::FreeSlots()
+{
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+		delete s->second;
+	FSlots.clear();
+	FQueue.clear();
+	FBusy = 0;
+}
+
+UINT __stdcall CGattCoalescingWriter::_SendThreadProc(LPVOID lpParam)
+{
+	static_cast<CGattCoalescingWriter*>(lpParam)->SendThreadProc();
+	return 0;
+}
+
+void CGattCoalescingWriter::SendThreadProc()
+{
+	// The value is copied out of the slot so Write never waits for the
+	// device. The copy buffer is reused.
+	std::vector<unsigned char> Value;
+
+	while (true)
+	{
+		FCS->Enter();
+		while (FQueue.empty() && FTerminated == 0)
+		{
+			FCS->Leave();
+			FEvent->WaitOne();
+			FCS->Enter();
+		}
+		if (FTerminated != 0)
+		{
+			FCS->Leave();
+			// Wake the next send thread up.
+			FEvent->SetEvent();
+			break;
+		}
+
+		SLOT* Slot = FQueue.front();
+		FQueue.pop_front();
+		Slot->Pending = false;
+		Slot->Busy = true;
+		FBusy++;
+		Value.assign(Slot->Value.begin(), Slot->Value.end());
+		wclGattCharacteristic Characteristic = Slot->Characteristic;
+		bool More = !FQueue.empty();
+		FCS->Leave();
+
+		if (More)
+			FEvent->SetEvent();
+
+		unsigned __int64 Started = CMessageStats::Now();
+		int Res = FClient->WriteCharacteristicValue(Characteristic,
+			Value.size() == 0 ? NULL : Value.data(), static_cast<unsigned long>(Value.size()),
+			FProtection, FWriteKind);
+		if (FTuner != NULL)
+			FTuner->ReportRequest(static_cast<unsigned long>(CMessageStats::Now() - Started));
+
+		FCS->Enter();
+		Slot->Busy = false;
+		FBusy--;
+		Slot->Error = Res;
+		if (Res == WCL_E_SUCCESS)
+			FStatistics.Sent++;
+		else
+			FStatistics.Failed++;
+		// A newer value came while this one was being written.
+		bool Requeued = Slot->Pending;
+		if (Requeued)
+			FQueue.push_back(Slot);
+		bool Idle = (FQueue.empty() && FBusy == 0);
+		FCS->Leave();
+
+		if (Requeued)
+			FEvent->SetEvent();
+		if (Idle)
+			FIdleEvent->SetEvent();
+	}
+}
+
+int CGattCoalescingWriter::Open(CwclGattClient* const Client,
+	const wclGattProtectionLevel Protection, const wclGattWriteKind WriteKind)
+{
+	if (FThreads.size() > 0)
+		return APP_E_GATT_COALESCE_OPENED;
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FClient = Client;
+	FProtection = Protection;
+	FWriteKind = WriteKind;
+	FTerminated = 0;
+
+	FEvent = CwclAutoResetEvent::Create();
+	FIdleEvent = CwclAutoResetEvent::Create();
+	if (FEvent == NULL || FIdleEvent == NULL)
+	{
+		Free();
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+	}
+
+	for (unsigned long i = 0; i < FInFlight; i++)
+	{
+		HANDLE Thread = wclCreateThread(_SendThreadProc, this);
+		if (Thread == NULL)
+		{
+			Close();
+			return WCL_E_MR_UNABLE_SYNCHRONIZE;
+		}
+		FThreads.push_back(Thread);
+	}
+	return WCL_E_SUCCESS;
+}
+
+int CGattCoalescingWriter::Close()
+{
+	if (FEvent == NULL)
+		return APP_E_GATT_COALESCE_NOT_OPENED;
+
+	InterlockedExchange(&FTerminated, 1);
+	FEvent->SetEvent();
+	for (THREADS::iterator t = FThreads.begin(); t != FThreads.end(); t++)
+		wclWaitAndCloseThread(*t);
+	FThreads.clear();
+
+	// Drop the pending values but keep the slots: their buffers are reused
+	// when the writer is opened again.
+	FCS->Enter();
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		s->second->Pending = false;
+		s->second->Busy = false;
+	}
+	FQueue.clear();
+	FBusy = 0;
+	FCS->Leave();
+
+	Free();
+	return WCL_E_SUCCESS;
+}
+
+int CGattCoalescingWriter::Write(const wclGattCharacteristic& Characteristic,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	if (FThreads.size() == 0)
+		return APP_E_GATT_COALESCE_NOT_OPENED;
+	if (Value == NULL && Length > 0)
+		return WCL_E_INVALID_ARGUMENT;
+
+	bool Signal = false;
+
+	FCS->Enter();
+	SLOT* Slot;
+	SLOTS::iterator s = FSlots.find(Characteristic.ValueHandle);
+	if (s != FSlots.end())
+		Slot = s->second;
+	else
+	{
+		Slot = new SLOT;
+		Slot->Pending = false;
+		Slot->Busy = false;
+		Slot->Error = WCL_E_SUCCESS;
+		FSlots[Characteristic.ValueHandle] = Slot;
+	}
+
+	if (Slot->Pending)
+		FStatistics.Superseded++;
+	else
+	{
+		Slot->Pending = true;
+		// A busy slot is queued again by its send thread.
+		if (!Slot->Busy)
+		{
+			FQueue.push_back(Slot);
+			Signal = true;
+		}
+	}
+	Slot->Characteristic = Characteristic;
+	Slot->Value.assign(Value, Value + Length);
+	FStatistics.Submitted++;
+	unsigned long Depth = static_cast<unsigned long>(FQueue.size()) + FBusy;
+	FCS->Leave();
+
+	if (Signal)
+		FEvent->SetEvent();
+	if (FTuner != NULL)
+		FTuner->ReportDepth(Depth);
+	return WCL_E_SUCCESS;
+}
+
+int CGattCoalescingWriter::Flush(const unsigned long Timeout)
+{
+	if (FThreads.size() == 0)
+		return APP_E_GATT_COALESCE_NOT_OPENED;
+
+	DWORD Started = GetTickCount();
+	while (true)
+	{
+		FCS->Enter();
+		bool Idle = (FQueue.empty() && FBusy == 0);
+		FCS->Leave();
+		if (Idle)
+			return WCL_E_SUCCESS;
+
+		DWORD Wait = INFINITE;
+		if (Timeout != WCL_WAIT_INFINITE)
+		{
+			DWORD Elapsed = GetTickCount() - Started;
+			if (Elapsed >= Timeout)
+				return WCL_E_BLUETOOTH_TIMEOUT;
+			Wait = Timeout - Elapsed;
+		}
+		FIdleEvent->WaitOne(Wait);
+	}
+}
+
+int CGattCoalescingWriter::GetWriteError(const unsigned short Handle) const
+{
+	int Res = WCL_E_SUCCESS;
+	FCS->Enter();
+	SLOTS::const_iterator s = FSlots.find(Handle);
+	if (s != FSlots.end())
+		Res = s->second->Error;
+	FCS->Leave();
+	return Res;
+}
+
+void CGattCoalescingWriter::GetStatistics(GattCoalesceStatistics& Statistics) const
+{
+	FCS->Enter();
+	Statistics = FStatistics;
+	FCS->Leave();
+}
+
+void CGattCoalescingWriter::ResetStatistics()
+{
+	FCS->Enter();
+	ZeroMemory(&FStatistics, sizeof(FStatistics));
+	FCS->Leave();
+}
+
+bool CGattCoalescingWriter::GetActive() const
+{
+	return (FThreads.size() > 0);
+}
+
+unsigned long CGattCoalescingWriter::GetInFlight() const
+{
+	return FInFlight;
+}
+
+void CGattCoalescingWriter::SetInFlight(const unsigned long Value)
+{
+	if (FThreads.size() == 0 && Value > 0 && Value <= COALESCE_MAX_IN_FLIGHT)
+		FInFlight = Value;
+}
+
+CConnectionTuner* CGattCoalescingWriter::GetTuner() const
+{
+	return FTuner;
+}
+
+void CGattCoalescingWriter::SetTuner(CConnectionTuner* const Value)
+{
+	if (FThreads.size() == 0)
+		FTuner = Value;
+}
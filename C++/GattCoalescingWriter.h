@@ -0,0 +1,179 @@
+// GattCoalescingWriter.h : "latest value wins" characteristic writes
+//
+
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+#include "ConnectionTuner.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the coalescing writer error codes. </summary>
+const int APP_E_GATT_COALESCE_BASE = 0x00F05000;
+/// <summary> The writer is not opened. </summary>
+const int APP_E_GATT_COALESCE_NOT_OPENED = APP_E_GATT_COALESCE_BASE + 0x0000;
+/// <summary> The writer is already opened. </summary>
+const int APP_E_GATT_COALESCE_OPENED = APP_E_GATT_COALESCE_BASE + 0x0001;
+
+/// <summary> The coalescing writer counters. </summary>
+typedef struct
+{
+	/// <summary> The number of values passed to <c>Write</c>. </summary>
+	unsigned long Submitted;
+	/// <summary> The number of values written to the device. </summary>
+	unsigned long Sent;
+	/// <summary> The number of values replaced by a newer one before they
+	///   have been sent. </summary>
+	unsigned long Superseded;
+	/// <summary> The number of failed writes. </summary>
+	unsigned long Failed;
+} GattCoalesceStatistics;
+
+/// <summary> Writes characteristic values in the "latest value wins"
+///   mode. </summary>
+/// <remarks> <para> <c>Write</c> stores the value and returns at once. Every
+///   characteristic has a single pending value: a new value replaces the one
+///   that has not been sent yet. The values are written by <c>InFlight</c>
+///   send threads, never more than one write per characteristic at a time,
+///   so the writes to a characteristic keep their order and the last value
+///   always reaches the device. </para>
+///   <para> The value storage of a characteristic is reused, so steady
+///   writes do not allocate memory. </para>
+///   <para> With the <c>Tuner</c> property set <c>Write</c> reports the
+///   number of the queued and outstanding values and every write reports
+///   its latency to the connection tuner. </para> </remarks>
+class CGattCoalescingWriter
+{
+	DISABLE_COPY(CGattCoalescingWriter);
+
+private:
+	typedef struct
+	{
+		wclGattCharacteristic		Characteristic;
+		std::vector<unsigned char>	Value;
+		// A value is waiting to be sent.
+		bool						Pending;
+		// A send thread is writing the characteristic.
+		bool						Busy;
+		int							Error;
+	} SLOT;
+	typedef std::unordered_map<unsigned short, SLOT*> SLOTS;
+	typedef std::deque<SLOT*> QUEUE;
+	typedef std::vector<HANDLE> THREADS;
+
+	unsigned long			FInFlight;
+	CConnectionTuner*		FTuner;
+	wclGattProtectionLevel	FProtection;
+	wclGattWriteKind		FWriteKind;
+
+	CwclGattClient*			FClient;
+	CwclCriticalSection*	FCS;
+	SLOTS					FSlots;
+	// Characteristics with a pending value that is not being sent.
+	QUEUE					FQueue;
+	unsigned long			FBusy;
+	CwclAutoResetEvent*		FEvent;
+	CwclAutoResetEvent*		FIdleEvent;
+	volatile LONG			FTerminated;
+	THREADS					FThreads;
+
+	GattCoalesceStatistics	FStatistics;
+
+	void Free();
+	void FreeSlots();
+
+	static UINT __stdcall _SendThreadProc(LPVOID lpParam);
+	void SendThreadProc();
+
+public:
+	/// <summary> Creates new coalescing writer. </summary>
+	CGattCoalescingWriter();
+	/// <summary> Frees the coalescing writer. </summary>
+	virtual ~CGattCoalescingWriter();
+
+	/// <summary> Opens the writer. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="WriteKind"> The write operation mode. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Open(CwclGattClient* const Client, const wclGattProtectionLevel Protection = plNone,
+		const wclGattWriteKind WriteKind = wkAuto);
+	/// <summary> Closes the writer. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The pending values are dropped. Call <c>Flush</c> first to
+	///   send them. </remarks>
+	int Close();
+
+	/// <summary> Queues the characteristic value. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Value"> The value. It is copied. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The write result is available from
+	///   <c>GetWriteError</c>. </remarks>
+	int Write(const wclGattCharacteristic& Characteristic, const unsigned char* const Value,
+		const unsigned long Length);
+	/// <summary> Waits until all the pending values are sent. </summary>
+	/// <param name="Timeout"> The maximum wait time in milliseconds. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Flush(const unsigned long Timeout = WCL_WAIT_INFINITE);
+
+	/// <summary> Gets the result of the last write to the
+	///   characteristic. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <returns> The write result. <c>WCL_E_SUCCESS</c> if nothing has been
+	///   written to the characteristic. </returns>
+	int GetWriteError(const unsigned short Handle) const;
+
+	/// <summary> Gets the writer counters. </summary>
+	/// <param name="Statistics"> On output the counters. </param>
+	void GetStatistics(GattCoalesceStatistics& Statistics) const;
+	/// <summary> Resets the writer counters. </summary>
+	void ResetStatistics();
+
+	/// <summary> Gets the writer state. </summary>
+	/// <returns> <c>true</c> if the writer is opened. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the writer state. </summary>
+	/// <value> <c>true</c> if the writer is opened. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> Gets the maximum number of the outstanding writes. </summary>
+	/// <returns> The number of the send threads. </returns>
+	unsigned long GetInFlight() const;
+	/// <summary> Sets the maximum number of the outstanding writes. </summary>
+	/// <param name="Value"> The number of the send threads. The default value
+	///   is 1. Can be changed only when the writer is closed. </param>
+	void SetInFlight(const unsigned long Value);
+	/// <summary> Gets and sets the maximum number of the outstanding
+	///   writes. </summary>
+	/// <value> The number of the send threads. </value>
+	__declspec(property(get = GetInFlight, put = SetInFlight)) unsigned long InFlight;
+
+	/// <summary> Gets the connection tuner. </summary>
+	/// <returns> The tuner the traffic is reported to or <c>NULL</c>. </returns>
+	CConnectionTuner* GetTuner() const;
+	/// <summary> Sets the connection tuner. </summary>
+	/// <param name="Value"> The tuner the traffic is reported to or
+	///   <c>NULL</c>. Can be changed only when the writer is closed. </param>
+	void SetTuner(CConnectionTuner* const Value);
+	/// <summary> Gets and sets the connection tuner. </summary>
+	/// <value> The tuner the traffic is reported to or <c>NULL</c>. </value>
+	__declspec(property(get = GetTuner, put = SetTuner)) CConnectionTuner* Tuner;
+};
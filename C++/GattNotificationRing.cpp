@@ -0,0 +1,278 @@
+// GattNotificationRing.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattNotificationRing.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// Slots are aligned so the timestamps are never split.
+static const unsigned long RING_ALIGNMENT = 8;
+
+
+// CGattNotificationRing
+
+CGattNotificationRing::CGattNotificationRing(const unsigned short Handle,
+	const unsigned long Capacity, const unsigned long MaxLength)
+{
+	FHandle = Handle;
+	FCapacity = max(Capacity, 1UL);
+	FMaxLength = MaxLength;
+	FStride = (sizeof(SLOT) + FMaxLength + RING_ALIGNMENT - 1) & ~(RING_ALIGNMENT - 1);
+	FBuffer = new unsigned char[FCapacity * FStride];
+
+	FHead = 0;
+	FTail = 0;
+
+	FPushed = 0;
+	FOverruns = 0;
+	FTruncated = 0;
+}
+
+CGattNotificationRing::~CGattNotificationRing()
+{
+	delete[] FBuffer;
+}
+
+CGattNotificationRing::SLOT* CGattNotificationRing::GetSlot(const LONG Index) const
+{
+	return reinterpret_cast<SLOT*>(FBuffer +
+		(static_cast<unsigned long>(Index) % FCapacity) * FStride);
+}
+
+bool CGattNotificationRing::Push(const unsigned char* const Value,
+	const unsigned long Length, const unsigned __int64 Timestamp)
+{
+	LONG Head = FHead;
+	if (static_cast<unsigned long>(Head - FTail) >= FCapacity)
+	{
+		InterlockedIncrement(&FOverruns);
+		return false;
+	}
+
+	SLOT* Slot = GetSlot(Head);
+	Slot->Timestamp = Timestamp;
+	Slot->Length = min(Length, FMaxLength);
+	if (Slot->Length > 0)
+		CopyMemory(reinterpret_cast<unsigned char*>(Slot + 1), Value, Slot->Length);
+	if (Length > FMaxLength)
+		InterlockedIncrement(&FTruncated);
+
+	// The interlocked increment publishes the slot to the consumer.
+	InterlockedIncrement(&FHead);
+	InterlockedIncrement(&FPushed);
+	return true;
+}
+
+unsigned long CGattNotificationRing::Peek(GattNotification* const Items,
+	const unsigned long Count) const
+{
+	if (Items == NULL)
+		return 0;
+
+	LONG Tail = FTail;
+	unsigned long Available = static_cast<unsigned long>(FHead - Tail);
+	unsigned long Result = min(Available, Count);
+	for (unsigned long i = 0; i < Result; i++)
+	{
+		const SLOT* Slot = GetSlot(Tail + static_cast<LONG>(i));
+		Items[i].Timestamp = Slot->Timestamp;
+		Items[i].Handle = FHandle;
+		Items[i].Length = Slot->Length;
+		Items[i].Value = reinterpret_cast<const unsigned char*>(Slot + 1);
+	}
+	return Result;
+}
+
+void CGattNotificationRing::Consume(const unsigned long Count)
+{
+	unsigned long Available = static_cast<unsigned long>(FHead - FTail);
+	InterlockedExchangeAdd(&FTail, static_cast<LONG>(min(Available, Count)));
+}
+
+unsigned short CGattNotificationRing::GetHandle() const
+{
+	return FHandle;
+}
+
+unsigned long CGattNotificationRing::GetCapacity() const
+{
+	return FCapacity;
+}
+
+unsigned long CGattNotificationRing::GetMaxLength() const
+{
+	return FMaxLength;
+}
+
+unsigned long CGattNotificationRing::GetPending() const
+{
+	return static_cast<unsigned long>(FHead - FTail);
+}
+
+unsigned long CGattNotificationRing::GetPushed() const
+{
+	return static_cast<unsigned long>(FPushed);
+}
+
+unsigned long CGattNotificationRing::GetOverruns() const
+{
+	return static_cast<unsigned long>(FOverruns);
+}
+
+unsigned long CGattNotificationRing::GetTruncated() const
+{
+	return static_cast<unsigned long>(FTruncated);
+}
+
+
+// CGattNotificationQueue
+
+CGattNotificationQueue::CGattNotificationQueue()
+{
+	FClient = NULL;
+	FUnrouted = 0;
+}
+
+CGattNotificationQueue::~CGattNotificationQueue()
+{
+	Detach();
+	Clear();
+}
+
+void CGattNotificationQueue::ClientCharacteristicChanged(void* Sender,
+	const unsigned short Handle, const unsigned char* const Value, const unsigned long Length)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	CGattNotificationRing* Ring = Find(Handle);
+	if (Ring != NULL)
+		Ring->Push(Value, Length, CMessageStats::Now());
+	else
+	{
+		InterlockedIncrement(&FUnrouted);
+		DoCharacteristicChanged(Handle, Value, Length);
+	}
+}
+
+void CGattNotificationQueue::DoCharacteristicChanged(const unsigned short Handle,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	__raise OnCharacteristicChanged(this, Handle, Value, Length);
+}
+
+int CGattNotificationQueue::Add(const unsigned short Handle, const unsigned long Capacity,
+	const unsigned long MaxLength)
+{
+	if (FClient != NULL)
+		return APP_E_GATT_RING_ATTACHED;
+	if (Capacity == 0)
+		return WCL_E_INVALID_ARGUMENT;
+	if (Find(Handle) != NULL)
+		return APP_E_GATT_RING_EXISTS;
+
+	CGattNotificationRing* Ring = new CGattNotificationRing(Handle, Capacity, MaxLength);
+	FRings.push_back(Ring);
+	if (Handle >= FByHandle.size())
+		FByHandle.resize(static_cast<size_t>(Handle) + 1, NULL);
+	FByHandle[Handle] = Ring;
+	return WCL_E_SUCCESS;
+}
+
+int CGattNotificationQueue::Add(const wclGattCharacteristic& Characteristic,
+	const unsigned long Capacity, const unsigned long MaxLength)
+{
+	// Notifications are reported with the value handle.
+	return Add(Characteristic.ValueHandle, Capacity, MaxLength);
+}
+
+int CGattNotificationQueue::Remove(const unsigned short Handle)
+{
+	if (FClient != NULL)
+		return APP_E_GATT_RING_ATTACHED;
+
+	CGattNotificationRing* Ring = Find(Handle);
+	if (Ring == NULL)
+		return APP_E_GATT_RING_NOT_FOUND;
+
+	for (RINGS::iterator r = FRings.begin(); r != FRings.end(); r++)
+	{
+		if (*r == Ring)
+		{
+			FRings.erase(r);
+			break;
+		}
+	}
+	FByHandle[Handle] = NULL;
+	delete Ring;
+	return WCL_E_SUCCESS;
+}
+
+int CGattNotificationQueue::Clear()
+{
+	if (FClient != NULL)
+		return APP_E_GATT_RING_ATTACHED;
+
+	for (RINGS::iterator r = FRings.begin(); r != FRings.end(); r++)
+		delete *r;
+	FRings.clear();
+	FByHandle.clear();
+	return WCL_E_SUCCESS;
+}
+
+int CGattNotificationQueue::Attach(CwclGattClient* const Client)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+	if (FClient != NULL)
+		return APP_E_GATT_RING_ATTACHED;
+
+	FClient = Client;
+	__hook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CGattNotificationQueue::ClientCharacteristicChanged);
+	return WCL_E_SUCCESS;
+}
+
+int CGattNotificationQueue::Detach()
+{
+	if (FClient == NULL)
+		return APP_E_GATT_RING_NOT_ATTACHED;
+
+	__unhook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CGattNotificationQueue::ClientCharacteristicChanged);
+	FClient = NULL;
+	return WCL_E_SUCCESS;
+}
+
+CGattNotificationRing* CGattNotificationQueue::Find(const unsigned short Handle) const
+{
+	if (Handle >= FByHandle.size())
+		return NULL;
+	return FByHandle[Handle];
+}
+
+CGattNotificationRing* CGattNotificationQueue::GetItem(const unsigned long Index) const
+{
+	if (Index >= FRings.size())
+		return NULL;
+	return FRings[Index];
+}
+
+unsigned long CGattNotificationQueue::GetCount() const
+{
+	return static_cast<unsigned long>(FRings.size());
+}
+
+CwclGattClient* CGattNotificationQueue::GetClient() const
+{
+	return FClient;
+}
+
+unsigned long CGattNotificationQueue::GetUnrouted() const
+{
+	return static_cast<unsigned long>(FUnrouted);
+}
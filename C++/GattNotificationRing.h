@@ -0,0 +1,304 @@
+// GattNotificationRing.h : per-handle notification rings
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclBluetooth.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the notification ring error codes. </summary>
+const int APP_E_GATT_RING_BASE = 0x00F03000;
+/// <summary> A ring for the handle already exists. </summary>
+const int APP_E_GATT_RING_EXISTS = APP_E_GATT_RING_BASE + 0x0000;
+/// <summary> There is no ring for the handle. </summary>
+const int APP_E_GATT_RING_NOT_FOUND = APP_E_GATT_RING_BASE + 0x0001;
+/// <summary> The rings can not be changed while the queue is attached to a
+///   client. </summary>
+const int APP_E_GATT_RING_ATTACHED = APP_E_GATT_RING_BASE + 0x0002;
+/// <summary> The queue is not attached to a client. </summary>
+const int APP_E_GATT_RING_NOT_ATTACHED = APP_E_GATT_RING_BASE + 0x0003;
+
+/// <summary> The default ring capacity in notifications. </summary>
+const unsigned long GATT_RING_DEFAULT_CAPACITY = 256;
+/// <summary> The default maximum notification length: the largest payload
+///   of a single LE Data Length Extension packet. </summary>
+const unsigned long GATT_RING_DEFAULT_LENGTH = 244;
+
+/// <summary> A notification stored in the
+///   <see cref="CGattNotificationRing" />. </summary>
+typedef struct
+{
+	/// <summary> The time the notification was received in
+	///   microseconds. </summary>
+	unsigned __int64 Timestamp;
+	/// <summary> The characteristic value handle. </summary>
+	unsigned short Handle;
+	/// <summary> The value length in bytes. </summary>
+	unsigned long Length;
+	/// <summary> The pointer to the value in the ring. </summary>
+	const unsigned char* Value;
+} GattNotification;
+
+/// <summary> The single producer, single consumer ring of the notifications
+///   of one characteristic. </summary>
+/// <remarks> <para> The notification thread appends the values with
+///   <c>Push</c>; the application thread reads them in bulk with
+///   <c>Peek</c> and releases them with <c>Consume</c>. Neither side takes a
+///   lock or allocates memory. </para>
+///   <para> When the ring is full the new notification is dropped and counted
+///   as an overrun. Values longer than <c>MaxLength</c> are truncated. </para>
+///   </remarks>
+class CGattNotificationRing
+{
+	DISABLE_COPY(CGattNotificationRing);
+
+private:
+	typedef struct
+	{
+		unsigned __int64	Timestamp;
+		unsigned long		Length;
+	} SLOT;
+
+	unsigned short		FHandle;
+	unsigned long		FCapacity;
+	unsigned long		FMaxLength;
+	unsigned long		FStride;
+	unsigned char*		FBuffer;
+
+	// Pushed slots. Only the producer changes it.
+	volatile LONG		FHead;
+	// Consumed slots. Only the consumer changes it.
+	volatile LONG		FTail;
+
+	volatile LONG		FPushed;
+	volatile LONG		FOverruns;
+	volatile LONG		FTruncated;
+
+	SLOT* GetSlot(const LONG Index) const;
+
+public:
+	/// <summary> Creates new ring. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Capacity"> The maximum number of the
+	///   notifications. </param>
+	/// <param name="MaxLength"> The maximum value length in bytes. </param>
+	CGattNotificationRing(const unsigned short Handle, const unsigned long Capacity,
+		const unsigned long MaxLength);
+	/// <summary> Frees the ring. </summary>
+	virtual ~CGattNotificationRing();
+
+	/// <summary> Appends the notification. </summary>
+	/// <param name="Value"> The value. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	/// <param name="Timestamp"> The receive time in microseconds. </param>
+	/// <returns> <c>false</c> if the ring is full and the notification has
+	///   been dropped. </returns>
+	/// <remarks> Must be called by the producer thread only. </remarks>
+	bool Push(const unsigned char* const Value, const unsigned long Length,
+		const unsigned __int64 Timestamp);
+
+	/// <summary> Gets the oldest notifications without removing
+	///   them. </summary>
+	/// <param name="Items"> The array that receives the
+	///   notifications. </param>
+	/// <param name="Count"> The array size. </param>
+	/// <returns> The number of the notifications copied to the array. </returns>
+	/// <remarks> The values stay valid until they are released by
+	///   <c>Consume</c>. Must be called by the consumer thread only. </remarks>
+	unsigned long Peek(GattNotification* const Items, const unsigned long Count) const;
+	/// <summary> Releases the oldest notifications. </summary>
+	/// <param name="Count"> The number of the notifications to release. </param>
+	/// <remarks> Must be called by the consumer thread only. </remarks>
+	void Consume(const unsigned long Count);
+
+	/// <summary> Gets the characteristic value handle. </summary>
+	/// <returns> The handle. </returns>
+	unsigned short GetHandle() const;
+	/// <summary> Gets the characteristic value handle. </summary>
+	/// <value> The handle. </value>
+	__declspec(property(get = GetHandle)) unsigned short Handle;
+
+	/// <summary> Gets the ring capacity. </summary>
+	/// <returns> The maximum number of the notifications. </returns>
+	unsigned long GetCapacity() const;
+	/// <summary> Gets the ring capacity. </summary>
+	/// <value> The maximum number of the notifications. </value>
+	__declspec(property(get = GetCapacity)) unsigned long Capacity;
+
+	/// <summary> Gets the maximum value length. </summary>
+	/// <returns> The maximum value length in bytes. </returns>
+	unsigned long GetMaxLength() const;
+	/// <summary> Gets the maximum value length. </summary>
+	/// <value> The maximum value length in bytes. </value>
+	__declspec(property(get = GetMaxLength)) unsigned long MaxLength;
+
+	/// <summary> Gets the number of the queued notifications. </summary>
+	/// <returns> The number of the notifications not consumed yet. </returns>
+	unsigned long GetPending() const;
+	/// <summary> Gets the number of the queued notifications. </summary>
+	/// <value> The number of the notifications not consumed yet. </value>
+	__declspec(property(get = GetPending)) unsigned long Pending;
+
+	/// <summary> Gets the number of the appended notifications. </summary>
+	/// <returns> The number of the notifications. </returns>
+	unsigned long GetPushed() const;
+	/// <summary> Gets the number of the appended notifications. </summary>
+	/// <value> The number of the notifications. </value>
+	__declspec(property(get = GetPushed)) unsigned long Pushed;
+
+	/// <summary> Gets the number of the dropped notifications. </summary>
+	/// <returns> The number of the notifications dropped because the ring
+	///   was full. </returns>
+	unsigned long GetOverruns() const;
+	/// <summary> Gets the number of the dropped notifications. </summary>
+	/// <value> The number of the notifications dropped because the ring was
+	///   full. </value>
+	__declspec(property(get = GetOverruns)) unsigned long Overruns;
+
+	/// <summary> Gets the number of the truncated notifications. </summary>
+	/// <returns> The number of the values longer than
+	///   <c>MaxLength</c>. </returns>
+	unsigned long GetTruncated() const;
+	/// <summary> Gets the number of the truncated notifications. </summary>
+	/// <value> The number of the values longer than <c>MaxLength</c>. </value>
+	__declspec(property(get = GetTruncated)) unsigned long Truncated;
+};
+
+/// <summary> Routes the notifications of a GATT client to the per-handle
+///   rings. </summary>
+/// <remarks> <para> The queue hooks the client's
+///   <c>OnCharacteristicChanged</c> event. Notifications of the handles that
+///   have a ring are appended to it with a timestamp; the application drains
+///   the rings from its own thread whenever it wants. Notifications of the
+///   other handles are passed to the queue's own
+///   <c>OnCharacteristicChanged</c> event. </para>
+///   <para> The rings must be added before the queue is attached. A client
+///   fires its events from a single thread, so every ring has exactly one
+///   producer. </para> </remarks>
+class CGattNotificationQueue
+{
+	DISABLE_COPY(CGattNotificationQueue);
+
+private:
+	typedef std::vector<CGattNotificationRing*> RINGS;
+
+	CwclGattClient*		FClient;
+	RINGS				FRings;
+	// Dense handle index.
+	RINGS				FByHandle;
+	volatile LONG		FUnrouted;
+
+	void ClientCharacteristicChanged(void* Sender, const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+
+protected:
+	/// <summary> Fires the <c>OnCharacteristicChanged</c> event. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Value"> The value. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	virtual void DoCharacteristicChanged(const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+
+public:
+	/// <summary> Creates new notification queue. </summary>
+	CGattNotificationQueue();
+	/// <summary> Frees the notification queue. </summary>
+	virtual ~CGattNotificationQueue();
+
+	/// <summary> Adds the ring for the characteristic. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Capacity"> The maximum number of the queued
+	///   notifications. </param>
+	/// <param name="MaxLength"> The maximum value length in bytes. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Add(const unsigned short Handle,
+		const unsigned long Capacity = GATT_RING_DEFAULT_CAPACITY,
+		const unsigned long MaxLength = GATT_RING_DEFAULT_LENGTH);
+	/// <summary> Adds the ring for the characteristic. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Capacity"> The maximum number of the queued
+	///   notifications. </param>
+	/// <param name="MaxLength"> The maximum value length in bytes. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Add(const wclGattCharacteristic& Characteristic,
+		const unsigned long Capacity = GATT_RING_DEFAULT_CAPACITY,
+		const unsigned long MaxLength = GATT_RING_DEFAULT_LENGTH);
+	/// <summary> Removes the ring of the characteristic. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Remove(const unsigned short Handle);
+	/// <summary> Removes all the rings. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Clear();
+
+	/// <summary> Starts routing the client notifications. </summary>
+	/// <param name="Client"> The <c>CwclGattClient</c>. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Attach(CwclGattClient* const Client);
+	/// <summary> Stops routing the client notifications. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The queued notifications are kept. </remarks>
+	int Detach();
+
+	/// <summary> Finds the ring of the characteristic. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <returns> The ring or <c>NULL</c> if there is no ring for the
+	///   handle. </returns>
+	CGattNotificationRing* Find(const unsigned short Handle) const;
+
+	/// <summary> Gets the ring by index. </summary>
+	/// <param name="Index"> The ring index. </param>
+	/// <returns> The ring. </returns>
+	CGattNotificationRing* GetItem(const unsigned long Index) const;
+	/// <summary> Gets the number of the rings. </summary>
+	/// <returns> The number of the rings. </returns>
+	unsigned long GetCount() const;
+	/// <summary> Gets the number of the rings. </summary>
+	/// <value> The number of the rings. </value>
+	__declspec(property(get = GetCount)) unsigned long Count;
+
+	/// <summary> Gets the attached client. </summary>
+	/// <returns> The client or <c>NULL</c> if the queue is not
+	///   attached. </returns>
+	CwclGattClient* GetClient() const;
+	/// <summary> Gets the attached client. </summary>
+	/// <value> The client or <c>NULL</c> if the queue is not
+	///   attached. </value>
+	__declspec(property(get = GetClient)) CwclGattClient* Client;
+
+	/// <summary> Gets the number of the notifications without a
+	///   ring. </summary>
+	/// <returns> The number of the notifications passed to the
+	///   <c>OnCharacteristicChanged</c> event. </returns>
+	unsigned long GetUnrouted() const;
+	/// <summary> Gets the number of the notifications without a
+	///   ring. </summary>
+	/// <value> The number of the notifications passed to the
+	///   <c>OnCharacteristicChanged</c> event. </value>
+	__declspec(property(get = GetUnrouted)) unsigned long Unrouted;
+
+	/// <summary> The event fires for the notifications of the handles that
+	///   have no ring. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Value"> The value. Valid only inside the event
+	///   handler. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	wclGattCharacteristicChangedEvent(OnCharacteristicChanged);
+};
@@ -0,0 +1,632 @@
+// GattProvisioner.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattProvisioner.h"
+
+#include "BatchPairing.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The stage deadline check period in milliseconds.
+static const unsigned long PROVISION_TICK_INTERVAL = 250;
+
+
+// CGattProvisioner
+
+CGattProvisioner::CGattProvisioner(CwclBluetoothManager* const Manager)
+{
+	FManager = Manager;
+	FParallelism = 4;
+	FPairTimeout = 30000;
+
+	FRadio = NULL;
+	FReceiver = NULL;
+	FRunning = false;
+	FStopping = false;
+
+	FTimerEvent = NULL;
+	FTimerTerminated = 0;
+	FTimerThread = NULL;
+	FTickPending = 0;
+
+	__hook(&CwclBluetoothManager::OnAuthenticationCompleted, FManager,
+		&CGattProvisioner::ManagerAuthenticationCompleted);
+}
+
+CGattProvisioner::~CGattProvisioner()
+{
+	__unhook(&CwclBluetoothManager::OnAuthenticationCompleted, FManager,
+		&CGattProvisioner::ManagerAuthenticationCompleted);
+
+	StopTimer();
+	FreeSlots();
+
+	if (FReceiver != NULL)
+	{
+		__unhook(&CwclMessageReceiver::OnMessage, FReceiver,
+			&CGattProvisioner::ReceiverMessage);
+		FReceiver->Close();
+		delete FReceiver;
+	}
+}
+
+CGattProvisioner::SLOT* CGattProvisioner::FindSlot(void* const Client) const
+{
+	for (SLOTS::const_iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		if ((*s)->Busy && static_cast<void*>((*s)->Client) == Client)
+			return *s;
+	}
+	return NULL;
+}
+
+CGattProvisioner::SLOT* CGattProvisioner::FindSlot(const __int64 Address) const
+{
+	for (SLOTS::const_iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		if ((*s)->Busy && (*s)->Result.Address == Address)
+			return *s;
+	}
+	return NULL;
+}
+
+unsigned long CGattProvisioner::BusyCount() const
+{
+	unsigned long Count = 0;
+	for (SLOTS::const_iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		if ((*s)->Busy)
+			Count++;
+	}
+	return Count;
+}
+
+void CGattProvisioner::CreateSlots()
+{
+	if (FSlots.size() == FParallelism)
+		return;
+
+	FreeSlots();
+	for (unsigned long i = 0; i < FParallelism; i++)
+	{
+		SLOT* Slot = new SLOT;
+		Slot->Owner = this;
+		Slot->Client = new CwclGattClient();
+		Slot->Busy = false;
+		Slot->Paired = false;
+		Slot->Stage = psConnect;
+		Slot->Started = 0;
+		Slot->StageStarted = 0;
+		ZeroMemory(&Slot->Result, sizeof(Slot->Result));
+		Slot->Thread = NULL;
+		Slot->Discovered = 0;
+		Slot->DiscoverError = WCL_E_SUCCESS;
+		Slot->DiscoverServices = 0;
+
+		__hook(&CwclGattClient::OnConnect, Slot->Client, &CGattProvisioner::ClientConnect);
+		__hook(&CwclGattClient::OnDisconnect, Slot->Client,
+			&CGattProvisioner::ClientDisconnect);
+
+		FSlots.push_back(Slot);
+	}
+}
+
+void CGattProvisioner::FreeSlots()
+{
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		SLOT* Slot = *s;
+		if (Slot->Thread != NULL)
+		{
+			// Disconnecting aborts the pending discovery request.
+			Slot->Client->Disconnect();
+			wclWaitAndCloseThread(Slot->Thread);
+		}
+		__unhook(&CwclGattClient::OnConnect, Slot->Client, &CGattProvisioner::ClientConnect);
+		__unhook(&CwclGattClient::OnDisconnect, Slot->Client,
+			&CGattProvisioner::ClientDisconnect);
+		delete Slot->Client;
+		delete Slot;
+	}
+	FSlots.clear();
+}
+
+void CGattProvisioner::Launch()
+{
+	if (!FRunning)
+		return;
+
+	SLOTS::iterator s = FSlots.begin();
+	while (!FQueue.empty() && s != FSlots.end())
+	{
+		SLOT* Slot = *s;
+		if (Slot->Busy)
+		{
+			s++;
+			continue;
+		}
+
+		__int64 Address = FQueue.front();
+		FQueue.pop_front();
+
+		Slot->Busy = true;
+		Slot->Paired = false;
+		ZeroMemory(&Slot->Result, sizeof(Slot->Result));
+		Slot->Result.Address = Address;
+		Slot->Result.Error = WCL_E_SUCCESS;
+		Slot->Started = CMessageStats::Now();
+
+		StartStage(Slot, psConnect);
+		Slot->Client->Address = Address;
+		int Res = Slot->Client->Connect(FRadio);
+		if (Res != WCL_E_SUCCESS)
+		{
+			// The slot is free again. Try the next device on it.
+			StageCompleted(Slot, Res);
+			Fail(Slot, Res);
+			Complete(Slot);
+		}
+	}
+
+	if (FQueue.empty() && BusyCount() == 0)
+	{
+		StopTimer();
+		FRunning = false;
+		FStopping = false;
+		DoCompleted();
+	}
+}
+
+void CGattProvisioner::Complete(SLOT* const Slot)
+{
+	Slot->Result.Total = static_cast<unsigned long>(CMessageStats::Now() - Slot->Started);
+	Slot->Busy = false;
+	DoDeviceCompleted(Slot->Result);
+}
+
+void CGattProvisioner::Fail(SLOT* const Slot, const int Error)
+{
+	// Keep the first error: the following stages only clean up.
+	if (Slot->Result.Error == WCL_E_SUCCESS)
+	{
+		Slot->Result.Error = Error;
+		Slot->Result.Stage = Slot->Stage;
+	}
+}
+
+void CGattProvisioner::StartStage(SLOT* const Slot, const GattProvisionStage Stage)
+{
+	Slot->Stage = Stage;
+	Slot->StageStarted = CMessageStats::Now();
+}
+
+void CGattProvisioner::StageCompleted(SLOT* const Slot, const int Error)
+{
+	unsigned long Time = static_cast<unsigned long>(CMessageStats::Now() - Slot->StageStarted);
+	Slot->Result.Times[Slot->Stage] = Time;
+	if (Error == WCL_E_SUCCESS)
+		FStageTimes[Slot->Stage].Record(Time);
+	DoStageCompleted(Slot->Result.Address, Slot->Stage, Error, Time);
+}
+
+UINT __stdcall CGattProvisioner::_TimerThreadProc(LPVOID lpParam)
+{
+	static_cast<CGattProvisioner*>(lpParam)->TimerThreadProc();
+	return 0;
+}
+
+void CGattProvisioner::TimerThreadProc()
+{
+	while (FTimerTerminated == 0)
+	{
+		FTimerEvent->WaitOne(PROVISION_TICK_INTERVAL);
+		if (FTimerTerminated != 0)
+			break;
+
+		// Never queue more than one tick.
+		if (InterlockedExchange(&FTickPending, 1) != 0)
+			continue;
+
+		CwclMessage* Msg = new CwclMessage(APP_MSG_ID_PROVISION_TICK, mcUser);
+		FReceiver->Post(Msg);
+		Msg->Release();
+	}
+}
+
+int CGattProvisioner::StartTimer()
+{
+	FTimerEvent = new CwclAutoResetEvent();
+	int Res = FTimerEvent->Create();
+	if (Res != WCL_E_SUCCESS)
+	{
+		delete FTimerEvent;
+		FTimerEvent = NULL;
+		return Res;
+	}
+
+	FTimerTerminated = 0;
+	FTickPending = 0;
+	FTimerThread = wclCreateThread(_TimerThreadProc, this);
+	if (FTimerThread == NULL)
+	{
+		delete FTimerEvent;
+		FTimerEvent = NULL;
+		return WCL_E_BLUETOOTH_UNABLE_START_THREAD;
+	}
+	return WCL_E_SUCCESS;
+}
+
+void CGattProvisioner::StopTimer()
+{
+	if (FTimerThread == NULL)
+		return;
+
+	InterlockedExchange(&FTimerTerminated, 1);
+	FTimerEvent->SetEvent();
+	wclWaitAndCloseThread(FTimerThread);
+	FTimerThread = NULL;
+	delete FTimerEvent;
+	FTimerEvent = NULL;
+}
+
+void CGattProvisioner::CheckDeadlines()
+{
+	unsigned __int64 Now = CMessageStats::Now();
+	unsigned __int64 Timeout = static_cast<unsigned __int64>(FPairTimeout) * 1000;
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		SLOT* Slot = *s;
+		if (Slot->Busy && Slot->Stage == psPair && Now - Slot->StageStarted >= Timeout)
+		{
+			// A late OnAuthenticationCompleted finds the slot in the next
+			// stage and is ignored.
+			StageCompleted(Slot, APP_E_PAIRING_TIMEOUT);
+			Fail(Slot, APP_E_PAIRING_TIMEOUT);
+			Disconnect(Slot);
+		}
+	}
+}
+
+UINT __stdcall CGattProvisioner::_DiscoverThreadProc(LPVOID lpParam)
+{
+	SLOT* Slot = static_cast<SLOT*>(lpParam);
+	Slot->Owner->DiscoverThreadProc(Slot);
+	return 0;
+}
+
+void CGattProvisioner::DiscoverThreadProc(SLOT* const Slot)
+{
+	wclGattServices Services;
+	Slot->DiscoverError = Slot->Client->ReadServices(goNone, Services);
+	Slot->DiscoverServices = static_cast<unsigned long>(Services.size());
+	InterlockedExchange(&Slot->Discovered, 1);
+
+	CwclMessage* Msg = new CwclMessage(APP_MSG_ID_PROVISION_DISCOVERED, mcUser);
+	FReceiver->Post(Msg);
+	Msg->Release();
+}
+
+void CGattProvisioner::Discover(SLOT* const Slot)
+{
+	StartStage(Slot, psDiscover);
+	Slot->Discovered = 0;
+	Slot->Thread = wclCreateThread(_DiscoverThreadProc, Slot);
+	if (Slot->Thread == NULL)
+	{
+		StageCompleted(Slot, WCL_E_BLUETOOTH_UNABLE_START_THREAD);
+		Fail(Slot, WCL_E_BLUETOOTH_UNABLE_START_THREAD);
+		Disconnect(Slot);
+	}
+}
+
+void CGattProvisioner::DiscoverCompleted(SLOT* const Slot)
+{
+	// The worker has posted its last message; the wait is short.
+	wclWaitAndCloseThread(Slot->Thread);
+	Slot->Thread = NULL;
+	Slot->Discovered = 0;
+
+	// The connection has dropped during the discovery: its stage is already
+	// closed and the slot only waited for the worker.
+	if (Slot->Stage != psDiscover)
+	{
+		Unpair(Slot);
+		return;
+	}
+
+	int Res = Slot->DiscoverError;
+	if (Res == WCL_E_SUCCESS)
+		Slot->Result.Services = Slot->DiscoverServices;
+	StageCompleted(Slot, Res);
+	if (Res != WCL_E_SUCCESS)
+		Fail(Slot, Res);
+	Disconnect(Slot);
+}
+
+void CGattProvisioner::Disconnect(SLOT* const Slot)
+{
+	StartStage(Slot, psUnpair);
+	// If the client is already disconnected no event fires. Unpair
+	// immediately.
+	if (Slot->Client->Disconnect() != WCL_E_SUCCESS)
+		Unpair(Slot);
+}
+
+void CGattProvisioner::Unpair(SLOT* const Slot)
+{
+	int Res = WCL_E_SUCCESS;
+	if (Slot->Paired)
+		Res = FRadio->RemoteUnpair(Slot->Result.Address);
+	StageCompleted(Slot, Res);
+	if (Res != WCL_E_SUCCESS)
+		Fail(Slot, Res);
+	Complete(Slot);
+}
+
+void CGattProvisioner::ReceiverMessage(const CwclMessage* const Message)
+{
+	if (Message->Category != mcUser)
+		return;
+
+	if (Message->Id == APP_MSG_ID_PROVISION_TICK)
+	{
+		InterlockedExchange(&FTickPending, 0);
+		if (FRunning)
+		{
+			CheckDeadlines();
+			Launch();
+		}
+		return;
+	}
+	if (Message->Id != APP_MSG_ID_PROVISION_DISCOVERED)
+		return;
+
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		SLOT* Slot = *s;
+		if (Slot->Thread != NULL && Slot->Discovered != 0)
+			DiscoverCompleted(Slot);
+	}
+	Launch();
+}
+
+void CGattProvisioner::ClientConnect(void* Sender, const int Error)
+{
+	SLOT* Slot = FindSlot(Sender);
+	if (Slot == NULL || Slot->Stage != psConnect)
+		return;
+
+	StageCompleted(Slot, Error);
+	if (Error != WCL_E_SUCCESS)
+	{
+		Fail(Slot, Error);
+		Complete(Slot);
+		Launch();
+	}
+	else
+	{
+		// Stop has been called while connecting.
+		if (Slot->Result.Error != WCL_E_SUCCESS)
+			Disconnect(Slot);
+		else
+		{
+			StartStage(Slot, psPair);
+			int Res = FRadio->RemotePair(Slot->Result.Address);
+			if (Res == WCL_E_BLUETOOTH_ALREADY_PAIRED || Res == WCL_E_BLUETOOTH_LE_ALREADY_PAIRED)
+			{
+				Slot->Paired = true;
+				StageCompleted(Slot, WCL_E_SUCCESS);
+				Discover(Slot);
+			}
+			else
+			{
+				if (Res != WCL_E_SUCCESS)
+				{
+					StageCompleted(Slot, Res);
+					Fail(Slot, Res);
+					Disconnect(Slot);
+				}
+			}
+		}
+
+		if (!Slot->Busy)
+			Launch();
+	}
+}
+
+void CGattProvisioner::ClientDisconnect(void* Sender, const int Reason)
+{
+	SLOT* Slot = FindSlot(Sender);
+	if (Slot == NULL)
+		return;
+
+	if (Slot->Stage != psUnpair)
+	{
+		// The device has dropped the connection in the middle of the stage.
+		int Error = Reason;
+		if (Error == WCL_E_SUCCESS)
+			Error = WCL_E_BLUETOOTH_CLIENT_NOT_CONNECTED;
+		StageCompleted(Slot, Error);
+		Fail(Slot, Error);
+		StartStage(Slot, psUnpair);
+	}
+
+	// The client is still used by the discovery worker. The slot is
+	// finished when the worker reports back.
+	if (Slot->Thread != NULL)
+		return;
+
+	Unpair(Slot);
+	Launch();
+}
+
+void CGattProvisioner::ManagerAuthenticationCompleted(void* Sender,
+	CwclBluetoothRadio* const Radio, const __int64 Address, const int Error)
+{
+	UNREFERENCED_PARAMETER(Sender);
+	UNREFERENCED_PARAMETER(Radio);
+
+	SLOT* Slot = FindSlot(Address);
+	if (Slot == NULL || Slot->Stage != psPair)
+		return;
+
+	StageCompleted(Slot, Error);
+	if (Error != WCL_E_SUCCESS)
+	{
+		Fail(Slot, Error);
+		Disconnect(Slot);
+	}
+	else
+	{
+		Slot->Paired = true;
+		// Stop has been called while pairing.
+		if (Slot->Result.Error != WCL_E_SUCCESS)
+			Disconnect(Slot);
+		else
+			Discover(Slot);
+	}
+
+	if (!Slot->Busy)
+		Launch();
+}
+
+void CGattProvisioner::DoStageCompleted(const __int64 Address,
+	const GattProvisionStage Stage, const int Error, const unsigned long Time)
+{
+	__raise OnStageCompleted(this, Address, Stage, Error, Time);
+}
+
+void CGattProvisioner::DoDeviceCompleted(const GattProvisionResult& Result)
+{
+	__raise OnDeviceCompleted(this, Result);
+}
+
+void CGattProvisioner::DoCompleted()
+{
+	__raise OnCompleted(this);
+}
+
+int CGattProvisioner::Start(CwclBluetoothRadio* const Radio,
+	const wclBluetoothAddresses& Addresses)
+{
+	if (FRunning)
+		return WCL_E_MR_OPENED;
+	if (Radio == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	if (FReceiver == NULL)
+	{
+		// Delivers the discovery results and the deadline ticks to the
+		// thread that owns the provisioner.
+		FReceiver = new CwclMessageReceiver();
+		__hook(&CwclMessageReceiver::OnMessage, FReceiver,
+			&CGattProvisioner::ReceiverMessage);
+		int Res = FReceiver->Open(mpSync);
+		if (Res != WCL_E_SUCCESS)
+		{
+			__unhook(&CwclMessageReceiver::OnMessage, FReceiver,
+				&CGattProvisioner::ReceiverMessage);
+			delete FReceiver;
+			FReceiver = NULL;
+			return Res;
+		}
+	}
+
+	int Res = StartTimer();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	CreateSlots();
+
+	FQueue.assign(Addresses.begin(), Addresses.end());
+	for (unsigned long i = 0; i < GATT_PROVISION_STAGES; i++)
+		FStageTimes[i].Reset();
+
+	FRadio = Radio;
+	FRunning = true;
+	FStopping = false;
+	Launch();
+
+	return WCL_E_SUCCESS;
+}
+
+int CGattProvisioner::Stop()
+{
+	if (!FRunning)
+		return WCL_E_MR_CLOSED;
+	if (FStopping)
+		return WCL_E_SUCCESS;
+
+	FStopping = true;
+	FQueue.clear();
+
+	for (SLOTS::iterator s = FSlots.begin(); s != FSlots.end(); s++)
+	{
+		SLOT* Slot = *s;
+		if (Slot->Busy && Slot->Stage != psUnpair)
+		{
+			Fail(Slot, WCL_E_BLUETOOTH_CANCELLED_BY_USER);
+			// Disconnecting aborts a pending connection, pairing or
+			// discovery. The slot is finished by the OnConnect or
+			// OnDisconnect event that follows.
+			Slot->Client->Disconnect();
+		}
+	}
+
+	Launch();
+	return WCL_E_SUCCESS;
+}
+
+int CGattProvisioner::Add(const __int64 Address)
+{
+	if (!FRunning || FStopping)
+		return WCL_E_MR_CLOSED;
+
+	FQueue.push_back(Address);
+	Launch();
+	return WCL_E_SUCCESS;
+}
+
+void CGattProvisioner::GetStageSummary(const GattProvisionStage Stage,
+	LatencySummary& Summary) const
+{
+	if (static_cast<unsigned long>(Stage) < GATT_PROVISION_STAGES)
+		FStageTimes[Stage].GetSummary(Summary);
+	else
+		ZeroMemory(&Summary, sizeof(Summary));
+}
+
+unsigned long CGattProvisioner::GetParallelism() const
+{
+	return FParallelism;
+}
+
+void CGattProvisioner::SetParallelism(const unsigned long Value)
+{
+	if (!FRunning && Value > 0)
+		FParallelism = Value;
+}
+
+unsigned long CGattProvisioner::GetPairTimeout() const
+{
+	return FPairTimeout;
+}
+
+void CGattProvisioner::SetPairTimeout(const unsigned long Value)
+{
+	if (!FRunning && Value > 0)
+		FPairTimeout = Value;
+}
+
+unsigned long CGattProvisioner::GetPending() const
+{
+	return static_cast<unsigned long>(FQueue.size());
+}
+
+bool CGattProvisioner::GetRunning() const
+{
+	return FRunning;
+}
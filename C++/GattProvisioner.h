@@ -0,0 +1,287 @@
+// GattProvisioner.h : concurrent connect, pair and discover pipeline
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+#include "MessageStats.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The service discovery completed message ID. The message
+///   category is <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_PROVISION_DISCOVERED = 9;
+/// <summary> The stage deadline check message ID. The message category is
+///   <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_PROVISION_TICK = 10;
+
+/// <summary> The provisioning stages. </summary>
+typedef enum
+{
+	/// <summary> Connecting to the device. </summary>
+	psConnect,
+	/// <summary> Pairing with the connected device. </summary>
+	psPair,
+	/// <summary> Reading the device services. </summary>
+	psDiscover,
+	/// <summary> Disconnecting and unpairing the device. </summary>
+	psUnpair
+} GattProvisionStage;
+
+/// <summary> The number of the provisioning stages. </summary>
+const unsigned long GATT_PROVISION_STAGES = psUnpair + 1;
+
+/// <summary> The provisioning result of a single device. </summary>
+typedef struct
+{
+	/// <summary> The device MAC address. </summary>
+	__int64 Address;
+	/// <summary> The first error. <c>WCL_E_SUCCESS</c> if the device has
+	///   been provisioned. </summary>
+	int Error;
+	/// <summary> The stage the error happened at. Valid only if <c>Error</c>
+	///   is not <c>WCL_E_SUCCESS</c>. </summary>
+	GattProvisionStage Stage;
+	/// <summary> The stage durations in microseconds. 0 for the stages that
+	///   have not been executed. </summary>
+	unsigned long Times[GATT_PROVISION_STAGES];
+	/// <summary> The total provisioning time in microseconds. </summary>
+	unsigned long Total;
+	/// <summary> The number of the services found. </summary>
+	unsigned long Services;
+} GattProvisionResult;
+
+/// <summary> The <c>OnStageCompleted</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Address"> The device MAC address. </param>
+/// <param name="Stage"> The completed stage. </param>
+/// <param name="Error"> The stage result. </param>
+/// <param name="Time"> The stage duration in microseconds. </param>
+#define GattProvisionStageEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const __int64 Address, \
+		const GattProvisionStage Stage, const int Error, const unsigned long Time)
+/// <summary> The <c>OnDeviceCompleted</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Result"> The device provisioning result. </param>
+#define GattProvisionDeviceEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const GattProvisionResult& Result)
+
+/// <summary> Provisions many GATT devices concurrently. </summary>
+/// <remarks> <para> The provisioner owns a pool of <c>CwclGattClient</c>
+///   objects and runs the connect, pair, service discovery and unpair stages
+///   for every queued address. Up to <c>Parallelism</c> devices are in
+///   progress at the same time; a slot is refilled from the queue as soon as
+///   its device is done. </para>
+///   <para> The stages are driven by the same framework events the single
+///   client uses: <c>OnConnect</c> and <c>OnDisconnect</c> of the clients and
+///   <c>OnAuthenticationCompleted</c> of the Bluetooth Manager. Pairing
+///   prompts (<c>OnConfirm</c>, <c>OnNumericComparison</c> and so on) are
+///   still handled by the application. A device that has not finished
+///   pairing in <c>PairTimeout</c> milliseconds fails with
+///   <see cref="APP_E_PAIRING_TIMEOUT" /> and frees its slot. </para>
+///   <para> Service discovery is a blocking client call, so every slot runs
+///   it on its own worker thread. The result is passed back through a
+///   <c>CwclMessageReceiver</c>, so the event thread is never blocked and
+///   the devices discover concurrently. </para>
+///   <para> The provisioner must be used from the thread that created it and
+///   it must be destroyed before the Bluetooth Manager. </para> </remarks>
+class CGattProvisioner
+{
+	DISABLE_COPY(CGattProvisioner);
+
+private:
+	typedef struct
+	{
+		CGattProvisioner*	Owner;
+		CwclGattClient*		Client;
+		bool				Busy;
+		bool				Paired;
+		GattProvisionStage	Stage;
+		unsigned __int64	Started;
+		unsigned __int64	StageStarted;
+		GattProvisionResult	Result;
+
+		// The service discovery worker. Set while the discovery runs.
+		HANDLE				Thread;
+		volatile LONG		Discovered;
+		int					DiscoverError;
+		unsigned long		DiscoverServices;
+	} SLOT;
+	typedef std::vector<SLOT*> SLOTS;
+	typedef std::deque<__int64> ADDRESSES;
+
+	CwclBluetoothManager*	FManager;
+	unsigned long			FParallelism;
+
+	unsigned long			FPairTimeout;
+
+	ADDRESSES				FQueue;
+	CwclBluetoothRadio*		FRadio;
+	CwclMessageReceiver*	FReceiver;
+	bool					FRunning;
+	bool					FStopping;
+	SLOTS					FSlots;
+	CLatencyHistogram		FStageTimes[GATT_PROVISION_STAGES];
+
+	// The deadline timer. Runs while the provisioning runs.
+	CwclAutoResetEvent*		FTimerEvent;
+	volatile LONG			FTimerTerminated;
+	HANDLE					FTimerThread;
+	// Set while a tick message is in the receiver queue.
+	volatile LONG			FTickPending;
+
+	SLOT* FindSlot(void* const Client) const;
+	SLOT* FindSlot(const __int64 Address) const;
+	unsigned long BusyCount() const;
+
+	void CreateSlots();
+	void FreeSlots();
+
+	// Starts queued devices while there are free slots.
+	void Launch();
+	void Complete(SLOT* const Slot);
+	void Fail(SLOT* const Slot, const int Error);
+	// Closes the stage, records its time and fires OnStageCompleted.
+	void StageCompleted(SLOT* const Slot, const int Error);
+	void StartStage(SLOT* const Slot, const GattProvisionStage Stage);
+
+	static UINT __stdcall _TimerThreadProc(LPVOID lpParam);
+	void TimerThreadProc();
+	int StartTimer();
+	void StopTimer();
+	// Fails the devices that have been pairing longer than PairTimeout.
+	void CheckDeadlines();
+
+	static UINT __stdcall _DiscoverThreadProc(LPVOID lpParam);
+	void DiscoverThreadProc(SLOT* const Slot);
+
+	// Starts the service discovery worker of the slot.
+	void Discover(SLOT* const Slot);
+	void DiscoverCompleted(SLOT* const Slot);
+	// Starts the last stage: disconnect and then unpair.
+	void Disconnect(SLOT* const Slot);
+	void Unpair(SLOT* const Slot);
+
+	// Event handlers.
+	void ReceiverMessage(const CwclMessage* const Message);
+	void ClientConnect(void* Sender, const int Error);
+	void ClientDisconnect(void* Sender, const int Reason);
+	void ManagerAuthenticationCompleted(void* Sender, CwclBluetoothRadio* const Radio,
+		const __int64 Address, const int Error);
+
+protected:
+	/// <summary> Fires the <c>OnStageCompleted</c> event. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="Stage"> The completed stage. </param>
+	/// <param name="Error"> The stage result. </param>
+	/// <param name="Time"> The stage duration in microseconds. </param>
+	virtual void DoStageCompleted(const __int64 Address, const GattProvisionStage Stage,
+		const int Error, const unsigned long Time);
+	/// <summary> Fires the <c>OnDeviceCompleted</c> event. </summary>
+	/// <param name="Result"> The device provisioning result. </param>
+	virtual void DoDeviceCompleted(const GattProvisionResult& Result);
+	/// <summary> Fires the <c>OnCompleted</c> event. </summary>
+	virtual void DoCompleted();
+
+public:
+	/// <summary> Creates new provisioner. </summary>
+	/// <param name="Manager"> The opened <c>CwclBluetoothManager</c> object
+	///   that reports the pairing results. </param>
+	CGattProvisioner(CwclBluetoothManager* const Manager);
+	/// <summary> Frees the provisioner. </summary>
+	virtual ~CGattProvisioner();
+
+	/// <summary> Starts provisioning. </summary>
+	/// <param name="Radio"> The <see cref="CwclBluetoothRadio" /> object used
+	///   to communicate with the devices. </param>
+	/// <param name="Addresses"> The devices to provision. More devices can be
+	///   added later by the <c>Add</c> method. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Start(CwclBluetoothRadio* const Radio, const wclBluetoothAddresses& Addresses);
+	/// <summary> Stops provisioning. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The queued devices are dropped. The devices in progress are
+	///   disconnected and unpaired and reported with the
+	///   <c>WCL_E_BLUETOOTH_CANCELLED_BY_USER</c> error. </remarks>
+	int Stop();
+	/// <summary> Adds the device to the queue. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Add(const __int64 Address);
+
+	/// <summary> Gets the stage time summary. </summary>
+	/// <param name="Stage"> The provisioning stage. </param>
+	/// <param name="Summary"> On output contains the summary of the stage
+	///   durations of all the devices since the last <c>Start</c>. </param>
+	void GetStageSummary(const GattProvisionStage Stage, LatencySummary& Summary) const;
+
+	/// <summary> Gets the parallelism cap. </summary>
+	/// <returns> The maximum number of devices in progress. </returns>
+	unsigned long GetParallelism() const;
+	/// <summary> Sets the parallelism cap. </summary>
+	/// <param name="Value"> The maximum number of devices in progress. The
+	///   default value is 4. Can be changed only when the provisioner is not
+	///   running. </param>
+	void SetParallelism(const unsigned long Value);
+	/// <summary> Gets and sets the parallelism cap. </summary>
+	/// <value> The maximum number of devices in progress. </value>
+	__declspec(property(get = GetParallelism, put = SetParallelism))
+		unsigned long Parallelism;
+
+	/// <summary> Gets the pairing stage timeout. </summary>
+	/// <returns> The pairing stage timeout in milliseconds. </returns>
+	unsigned long GetPairTimeout() const;
+	/// <summary> Sets the pairing stage timeout. </summary>
+	/// <param name="Value"> The pairing stage timeout in milliseconds. The
+	///   default value is 30000. Can be changed only when the provisioner is
+	///   not running. </param>
+	void SetPairTimeout(const unsigned long Value);
+	/// <summary> Gets and sets the pairing stage timeout. </summary>
+	/// <value> The pairing stage timeout in milliseconds. </value>
+	__declspec(property(get = GetPairTimeout, put = SetPairTimeout))
+		unsigned long PairTimeout;
+
+	/// <summary> Gets the number of the queued devices. </summary>
+	/// <returns> The number of the devices waiting for a free slot. </returns>
+	unsigned long GetPending() const;
+	/// <summary> Gets the number of the queued devices. </summary>
+	/// <value> The number of the devices waiting for a free slot. </value>
+	__declspec(property(get = GetPending)) unsigned long Pending;
+
+	/// <summary> Gets the provisioner state. </summary>
+	/// <returns> <c>True</c> if the provisioning is running. </returns>
+	bool GetRunning() const;
+	/// <summary> Gets the provisioner state. </summary>
+	/// <value> <c>True</c> if the provisioning is running. </value>
+	__declspec(property(get = GetRunning)) bool Running;
+
+	/// <summary> The event fires when a device finishes a stage. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="Stage"> The completed stage. </param>
+	/// <param name="Error"> The stage result. </param>
+	/// <param name="Time"> The stage duration in microseconds. </param>
+	GattProvisionStageEvent(OnStageCompleted);
+	/// <summary> The event fires when a device has been provisioned or has
+	///   failed. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Result"> The device provisioning result. </param>
+	GattProvisionDeviceEvent(OnDeviceCompleted);
+	/// <summary> The event fires when the queue is empty and no device is in
+	///   progress. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	wclNotifyEvent(OnCompleted);
+};
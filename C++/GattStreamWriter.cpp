@@ -0,0 +1,351 @@
+// GattStreamWriter.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattStreamWriter.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static const unsigned long STREAM_DEFAULT_CREDITS = 32;
+static const unsigned long STREAM_MAX_CREDITS = 1024;
+
+// A busy chunk is repeated with the growing delay up to this many times.
+static const unsigned long STREAM_MAX_RETRIES = 100;
+static const DWORD STREAM_MAX_RETRY_DELAY = 16;
+
+// The errors the stacks report when the controller buffers are full.
+static bool IsBusy(const int Error)
+{
+	return (Error == WCL_E_BLUETOOTH_LE_INSUFFICIENT_RESOURCES ||
+		Error == WCL_E_BLUETOOTH_NO_SYSTEM_RESOURCES || Error == WCL_E_BLUETOOTH_DRIVER_BUSY);
+}
+
+
+// CGattStreamWriter
+
+CGattStreamWriter::CGattStreamWriter()
+{
+	FCredits = STREAM_DEFAULT_CREDITS;
+	FTuner = NULL;
+
+	FClient = NULL;
+	ZeroMemory(&FCharacteristic, sizeof(FCharacteristic));
+	FProtection = plNone;
+	FWriteKind = wkWithoutResponse;
+
+	FBuffer = NULL;
+	FChunkSize = 0;
+	FLengths = NULL;
+	FHead = 0;
+	FTail = 0;
+
+	FDataEvent = NULL;
+	FSpaceEvent = NULL;
+	FSenderSleeping = 0;
+	FWriterSleeping = 0;
+	FError = WCL_E_SUCCESS;
+	FTerminated = 0;
+	FThread = NULL;
+
+	ResetStatistics();
+}
+
+CGattStreamWriter::~CGattStreamWriter()
+{
+	Close();
+}
+
+void CGattStreamWriter::Free()
+{
+	if (FSpaceEvent != NULL)
+	{
+		delete FSpaceEvent;
+		FSpaceEvent = NULL;
+	}
+	if (FDataEvent != NULL)
+	{
+		delete FDataEvent;
+		FDataEvent = NULL;
+	}
+	if (FLengths != NULL)
+	{
+		delete[] FLengths;
+		FLengths = NULL;
+	}
+	if (FBuffer != NULL)
+	{
+		delete[] FBuffer;
+		FBuffer = NULL;
+	}
+	FChunkSize = 0;
+	FClient = NULL;
+}
+
+int CGattStreamWriter::Send(const unsigned char* const Data, const unsigned long Length)
+{
+	DWORD Delay = 1;
+	int Res = FClient->WriteCharacteristicValue(FCharacteristic, Data, Length, FProtection,
+		FWriteKind);
+	for (unsigned long i = 0; IsBusy(Res) && i < STREAM_MAX_RETRIES && FTerminated == 0; i++)
+	{
+		InterlockedIncrement(&FRetries);
+		Sleep(Delay);
+		Delay = min(Delay * 2, STREAM_MAX_RETRY_DELAY);
+
+		Res = FClient->WriteCharacteristicValue(FCharacteristic, Data, Length, FProtection,
+			FWriteKind);
+	}
+	return Res;
+}
+
+UINT __stdcall CGattStreamWriter::_SendThreadProc(LPVOID lpParam)
+{
+	static_cast<CGattStreamWriter*>(lpParam)->SendThreadProc();
+	return 0;
+}
+
+void CGattStreamWriter::SendThreadProc()
+{
+	while (FTerminated == 0)
+	{
+		if (FTail == FHead)
+		{
+			// Announce the sleep first and re-check the ring then, exactly as
+			// the message dispatcher does.
+			InterlockedExchange(&FSenderSleeping, 1);
+			if (FTail == FHead)
+				FDataEvent->WaitOne();
+			else
+				InterlockedExchange(&FSenderSleeping, 0);
+			continue;
+		}
+
+		unsigned long Slot = static_cast<unsigned long>(FTail) % FCredits;
+		// After an error the queued chunks are dropped but still returned as
+		// credits, so the writing thread never hangs.
+		if (FError == WCL_E_SUCCESS)
+		{
+			unsigned long Length = FLengths[Slot];
+			int Res = Send(FBuffer + Slot * FChunkSize, Length);
+			if (Res != WCL_E_SUCCESS)
+				InterlockedCompareExchange(&FError, Res, WCL_E_SUCCESS);
+			else
+			{
+				InterlockedExchangeAdd64(&FBytes, Length);
+				InterlockedIncrement(&FChunks);
+				InterlockedExchange64(&FFinished, static_cast<LONG64>(CMessageStats::Now()));
+			}
+		}
+
+		InterlockedIncrement(&FTail);
+		if (InterlockedExchange(&FWriterSleeping, 0) != 0)
+			FSpaceEvent->SetEvent();
+	}
+}
+
+int CGattStreamWriter::WaitSpace(const unsigned long Limit, const DWORD Started,
+	const unsigned long Timeout, bool& Stalled)
+{
+	while (static_cast<unsigned long>(FHead - FTail) >= Limit)
+	{
+		if (FError != WCL_E_SUCCESS)
+			return FError;
+
+		DWORD Wait = INFINITE;
+		if (Timeout != WCL_WAIT_INFINITE)
+		{
+			DWORD Elapsed = GetTickCount() - Started;
+			if (Elapsed >= Timeout)
+				return WCL_E_BLUETOOTH_TIMEOUT;
+			Wait = Timeout - Elapsed;
+		}
+
+		Stalled = true;
+		InterlockedExchange(&FWriterSleeping, 1);
+		if (static_cast<unsigned long>(FHead - FTail) >= Limit)
+			FSpaceEvent->WaitOne(Wait);
+		else
+			InterlockedExchange(&FWriterSleeping, 0);
+	}
+	return WCL_E_SUCCESS;
+}
+
+int CGattStreamWriter::Open(CwclGattClient* const Client,
+	const wclGattCharacteristic& Characteristic, const wclGattProtectionLevel Protection,
+	const wclGattWriteKind WriteKind)
+{
+	if (FThread != NULL)
+		return APP_E_GATT_STREAM_OPENED;
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	unsigned short Payload = 0;
+	int Res = Client->GetMaxPayloadSize(Payload);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+	if (Payload == 0)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FClient = Client;
+	FCharacteristic = Characteristic;
+	FProtection = Protection;
+	FWriteKind = WriteKind;
+
+	FChunkSize = Payload;
+	FBuffer = new unsigned char[FCredits * FChunkSize];
+	FLengths = new unsigned long[FCredits];
+	FHead = 0;
+	FTail = 0;
+
+	FSenderSleeping = 0;
+	FWriterSleeping = 0;
+	FError = WCL_E_SUCCESS;
+	FTerminated = 0;
+
+	FDataEvent = CwclAutoResetEvent::Create();
+	FSpaceEvent = CwclAutoResetEvent::Create();
+	if (FDataEvent == NULL || FSpaceEvent == NULL)
+		Res = WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+	else
+	{
+		FThread = wclCreateThread(_SendThreadProc, this);
+		if (FThread == NULL)
+			Res = WCL_E_MR_UNABLE_SYNCHRONIZE;
+	}
+
+	if (Res != WCL_E_SUCCESS)
+		Free();
+	return Res;
+}
+
+int CGattStreamWriter::Close()
+{
+	if (FThread == NULL)
+		return APP_E_GATT_STREAM_NOT_OPENED;
+
+	InterlockedExchange(&FTerminated, 1);
+	FDataEvent->SetEvent();
+	wclWaitAndCloseThread(FThread);
+	Free();
+
+	return WCL_E_SUCCESS;
+}
+
+int CGattStreamWriter::Write(const unsigned char* const Data, const unsigned long Length,
+	const unsigned long Timeout)
+{
+	if (FThread == NULL)
+		return APP_E_GATT_STREAM_NOT_OPENED;
+	if (Data == NULL && Length > 0)
+		return WCL_E_INVALID_ARGUMENT;
+	if (FError != WCL_E_SUCCESS)
+		return FError;
+
+	if (FStarted == 0 && Length > 0)
+		FStarted = CMessageStats::Now();
+
+	DWORD Started = GetTickCount();
+	unsigned long Offset = 0;
+	while (Offset < Length)
+	{
+		bool Stalled = false;
+		int Res = WaitSpace(FCredits, Started, Timeout, Stalled);
+		if (Stalled)
+			InterlockedIncrement(&FStalls);
+		if (Res != WCL_E_SUCCESS)
+			return Res;
+
+		unsigned long Slot = static_cast<unsigned long>(FHead) % FCredits;
+		unsigned long Chunk = min(Length - Offset, FChunkSize);
+		CopyMemory(FBuffer + Slot * FChunkSize, Data + Offset, Chunk);
+		FLengths[Slot] = Chunk;
+		Offset += Chunk;
+
+		InterlockedIncrement(&FHead);
+		if (InterlockedExchange(&FSenderSleeping, 0) != 0)
+			FDataEvent->SetEvent();
+		if (FTuner != NULL)
+			FTuner->ReportDepth(static_cast<unsigned long>(FHead - FTail));
+	}
+	return WCL_E_SUCCESS;
+}
+
+int CGattStreamWriter::Flush(const unsigned long Timeout)
+{
+	if (FThread == NULL)
+		return APP_E_GATT_STREAM_NOT_OPENED;
+
+	bool Stalled = false;
+	int Res = WaitSpace(1, GetTickCount(), Timeout, Stalled);
+	if (Res == WCL_E_SUCCESS)
+		Res = FError;
+	return Res;
+}
+
+void CGattStreamWriter::GetStatistics(GattStreamStatistics& Statistics) const
+{
+	Statistics.Bytes = static_cast<unsigned __int64>(FBytes);
+	Statistics.Chunks = static_cast<unsigned long>(FChunks);
+	Statistics.Retries = static_cast<unsigned long>(FRetries);
+	Statistics.Stalls = static_cast<unsigned long>(FStalls);
+
+	unsigned __int64 Finished = static_cast<unsigned __int64>(FFinished);
+	if (FStarted == 0 || Finished <= FStarted)
+		Statistics.Elapsed = 0;
+	else
+		Statistics.Elapsed = Finished - FStarted;
+
+	if (Statistics.Elapsed == 0)
+		Statistics.Throughput = 0;
+	else
+	{
+		Statistics.Throughput = static_cast<unsigned long>(Statistics.Bytes * 1000000 /
+			Statistics.Elapsed);
+	}
+}
+
+void CGattStreamWriter::ResetStatistics()
+{
+	InterlockedExchange64(&FBytes, 0);
+	InterlockedExchange(&FChunks, 0);
+	InterlockedExchange(&FRetries, 0);
+	InterlockedExchange(&FStalls, 0);
+	FStarted = 0;
+	InterlockedExchange64(&FFinished, 0);
+}
+
+bool CGattStreamWriter::GetActive() const
+{
+	return (FThread != NULL);
+}
+
+unsigned long CGattStreamWriter::GetChunkSize() const
+{
+	return FChunkSize;
+}
+
+unsigned long CGattStreamWriter::GetCredits() const
+{
+	return FCredits;
+}
+
+void CGattStreamWriter::SetCredits(const unsigned long Value)
+{
+	if (FThread == NULL && Value > 0 && Value <= STREAM_MAX_CREDITS)
+		FCredits = Value;
+}
+
+CConnectionTuner* CGattStreamWriter::GetTuner() const
+{
+	return FTuner;
+}
+
+void CGattStreamWriter::SetTuner(CConnectionTuner* const Value)
+{
+	if (FThread == NULL)
+		FTuner = Value;
+}
@@ -0,0 +1,200 @@
+// GattStreamWriter.h : pipelined write without response streaming
+//
+
+#pragma once
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+#include "ConnectionTuner.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the stream writer error codes. </summary>
+const int APP_E_GATT_STREAM_BASE = 0x00F02000;
+/// <summary> The stream is not opened. </summary>
+const int APP_E_GATT_STREAM_NOT_OPENED = APP_E_GATT_STREAM_BASE + 0x0000;
+/// <summary> The stream is already opened. </summary>
+const int APP_E_GATT_STREAM_OPENED = APP_E_GATT_STREAM_BASE + 0x0001;
+
+/// <summary> The stream writer counters. </summary>
+typedef struct
+{
+	/// <summary> The number of bytes sent. </summary>
+	unsigned __int64 Bytes;
+	/// <summary> The number of write operations (chunks) sent. </summary>
+	unsigned long Chunks;
+	/// <summary> The number of write operations repeated because the
+	///   Bluetooth stack was out of buffers. </summary>
+	unsigned long Retries;
+	/// <summary> The number of times the writing thread had to wait for a
+	///   credit. </summary>
+	unsigned long Stalls;
+	/// <summary> The time in microseconds from the first queued chunk to the
+	///   last sent one. </summary>
+	unsigned __int64 Elapsed;
+	/// <summary> The achieved throughput in bytes per second. </summary>
+	unsigned long Throughput;
+} GattStreamStatistics;
+
+/// <summary> Streams large data to a characteristic with pipelined Write
+///   Without Response operations. </summary>
+/// <remarks> <para> <c>Write</c> splits the data to chunks of the maximum
+///   payload size of the connection and queues them to a ring of
+///   <c>Credits</c> slots. A dedicated send thread writes the chunks back to
+///   back, so the Bluetooth stack always has the next packet while the
+///   application prepares more data. A chunk takes a credit when it is queued
+///   and returns it when the stack has accepted it; <c>Write</c> blocks when
+///   no credit is left. </para>
+///   <para> If the stack reports it is out of resources the chunk is
+///   repeated after a short delay. Any other error stops the stream and is
+///   returned by the next <c>Write</c> or <c>Flush</c>. </para>
+///   <para> With the <c>Tuner</c> property set every queued chunk reports
+///   the number of the queued chunks to the connection tuner. </para>
+///   <para> <c>Write</c> and <c>Flush</c> must be called by one thread at a
+///   time. </para> </remarks>
+class CGattStreamWriter
+{
+	DISABLE_COPY(CGattStreamWriter);
+
+private:
+	unsigned long			FCredits;
+	CConnectionTuner*		FTuner;
+
+	CwclGattClient*			FClient;
+	wclGattCharacteristic	FCharacteristic;
+	wclGattProtectionLevel	FProtection;
+	wclGattWriteKind		FWriteKind;
+
+	unsigned char*			FBuffer;
+	unsigned long			FChunkSize;
+	// Chunk lengths by slot.
+	unsigned long*			FLengths;
+	// Slots queued by Write. Only the writing thread changes it.
+	volatile LONG			FHead;
+	// Slots sent. Only the send thread changes it.
+	volatile LONG			FTail;
+
+	CwclAutoResetEvent*		FDataEvent;
+	CwclAutoResetEvent*		FSpaceEvent;
+	volatile LONG			FSenderSleeping;
+	volatile LONG			FWriterSleeping;
+	volatile LONG			FError;
+	volatile LONG			FTerminated;
+	HANDLE					FThread;
+
+	volatile LONG64			FBytes;
+	volatile LONG			FChunks;
+	volatile LONG			FRetries;
+	volatile LONG			FStalls;
+	unsigned __int64		FStarted;
+	volatile LONG64			FFinished;
+
+	void Free();
+
+	// Waits until less than Limit chunks are queued.
+	int WaitSpace(const unsigned long Limit, const DWORD Started,
+		const unsigned long Timeout, bool& Stalled);
+	// Sends a single chunk, repeating it while the stack is busy.
+	int Send(const unsigned char* const Data, const unsigned long Length);
+
+	static UINT __stdcall _SendThreadProc(LPVOID lpParam);
+	void SendThreadProc();
+
+public:
+	/// <summary> Creates new stream writer. </summary>
+	CGattStreamWriter();
+	/// <summary> Frees the stream writer. </summary>
+	/// <remarks> The data that has not been sent is dropped. </remarks>
+	virtual ~CGattStreamWriter();
+
+	/// <summary> Opens the stream. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. It must
+	///   stay connected while the stream is opened. </param>
+	/// <param name="Characteristic"> The characteristic the data is written
+	///   to. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="WriteKind"> The write operation mode. Streaming is fast
+	///   only with <c>wkWithoutResponse</c>. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The chunk size is read from the client once, so the stream
+	///   must be re-opened if the MTU changes. </remarks>
+	int Open(CwclGattClient* const Client, const wclGattCharacteristic& Characteristic,
+		const wclGattProtectionLevel Protection = plNone,
+		const wclGattWriteKind WriteKind = wkWithoutResponse);
+	/// <summary> Closes the stream. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The data that has not been sent is dropped. Call
+	///   <c>Flush</c> first to send it. </remarks>
+	int Close();
+
+	/// <summary> Queues the data. </summary>
+	/// <param name="Data"> The data. It is copied and can be reused when the
+	///   method returns. </param>
+	/// <param name="Length"> The data length in bytes. </param>
+	/// <param name="Timeout"> The maximum time in milliseconds to wait for a
+	///   credit. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. If no credit became available in time
+	///   the method returns <see cref="WCL_E_BLUETOOTH_TIMEOUT" /> and the
+	///   data is queued partially. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	int Write(const unsigned char* const Data, const unsigned long Length,
+		const unsigned long Timeout = WCL_WAIT_INFINITE);
+	/// <summary> Waits until all the queued data is sent. </summary>
+	/// <param name="Timeout"> The maximum wait time in milliseconds. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns the first
+	///   write error or one of the WCL error codes. </returns>
+	int Flush(const unsigned long Timeout = WCL_WAIT_INFINITE);
+
+	/// <summary> Gets the stream counters. </summary>
+	/// <param name="Statistics"> On output the counters. </param>
+	void GetStatistics(GattStreamStatistics& Statistics) const;
+	/// <summary> Resets the stream counters. </summary>
+	/// <remarks> Call it when no data is queued. </remarks>
+	void ResetStatistics();
+
+	/// <summary> Gets the stream state. </summary>
+	/// <returns> <c>true</c> if the stream is opened. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the stream state. </summary>
+	/// <value> <c>true</c> if the stream is opened. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> Gets the chunk size. </summary>
+	/// <returns> The maximum payload size of a single write in bytes. 0 if
+	///   the stream is closed. </returns>
+	unsigned long GetChunkSize() const;
+	/// <summary> Gets the chunk size. </summary>
+	/// <value> The maximum payload size of a single write in bytes. </value>
+	__declspec(property(get = GetChunkSize)) unsigned long ChunkSize;
+
+	/// <summary> Gets the number of credits. </summary>
+	/// <returns> The maximum number of queued chunks. </returns>
+	unsigned long GetCredits() const;
+	/// <summary> Sets the number of credits. </summary>
+	/// <param name="Value"> The maximum number of queued chunks. The default
+	///   value is 32. Can be changed only when the stream is closed. </param>
+	void SetCredits(const unsigned long Value);
+	/// <summary> Gets and sets the number of credits. </summary>
+	/// <value> The maximum number of queued chunks. </value>
+	__declspec(property(get = GetCredits, put = SetCredits)) unsigned long Credits;
+
+	/// <summary> Gets the connection tuner. </summary>
+	/// <returns> The tuner the traffic is reported to or <c>NULL</c>. </returns>
+	CConnectionTuner* GetTuner() const;
+	/// <summary> Sets the connection tuner. </summary>
+	/// <param name="Value"> The tuner the queue depth is reported to or
+	///   <c>NULL</c>. Can be changed only when the stream is closed. </param>
+	void SetTuner(CConnectionTuner* const Value);
+	/// <summary> Gets and sets the connection tuner. </summary>
+	/// <value> The tuner the traffic is reported to or <c>NULL</c>. </value>
+	__declspec(property(get = GetTuner, put = SetTuner)) CConnectionTuner* Tuner;
+};
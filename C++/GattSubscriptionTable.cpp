@@ -0,0 +1,257 @@
+// GattSubscriptionTable.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattSubscriptionTable.h"
+
+#include "MessageDispatcher.h"
+#include "MessagePool.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CGattSubscriptionTable
+
+CGattSubscriptionTable::CGattSubscriptionTable()
+{
+	FClient = NULL;
+	ZeroMemory(FPages, sizeof(FPages));
+	FCount = 0;
+	FUnrouted = 0;
+}
+
+CGattSubscriptionTable::~CGattSubscriptionTable()
+{
+	Detach();
+
+	for (unsigned long i = 0; i < PAGES; i++)
+	{
+		if (FPages[i] != NULL)
+			delete[] FPages[i];
+	}
+}
+
+CGattSubscriptionTable::ROUTE* CGattSubscriptionTable::Find(const unsigned short Handle) const
+{
+	ROUTE* Page = FPages[Handle / PAGE_SIZE];
+	if (Page == NULL)
+		return NULL;
+
+	ROUTE* Route = Page + Handle % PAGE_SIZE;
+	if (Route->Callback == NULL && Route->Dispatcher == NULL)
+		return NULL;
+	return Route;
+}
+
+void CGattSubscriptionTable::ClientCharacteristicChanged(void* Sender,
+	const unsigned short Handle, const unsigned char* const Value, const unsigned long Length)
+{
+	UNREFERENCED_PARAMETER(Sender);
+
+	ROUTE* Route = Find(Handle);
+	if (Route != NULL)
+	{
+		Route->Notifications++;
+		if (Route->Dispatcher == NULL)
+			Route->Callback(Route->Context, Route->Characteristic, Value, Length);
+		else
+		{
+			// The message comes from the slab; the dispatcher takes its own
+			// reference.
+			CwclMessage* Msg = new CCharacteristicChangedMessage(FClient->Address, Handle,
+				Value, Length);
+			Route->Dispatcher->Post(Msg);
+			Msg->Release();
+		}
+	}
+	else
+	{
+		FUnrouted++;
+		DoCharacteristicChanged(Handle, Value, Length);
+	}
+}
+
+void CGattSubscriptionTable::DoCharacteristicChanged(const unsigned short Handle,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	__raise OnCharacteristicChanged(this, Handle, Value, Length);
+}
+
+int CGattSubscriptionTable::Attach(CwclGattClient* const Client)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+	if (FClient != NULL)
+		return APP_E_GATT_ROUTE_ATTACHED;
+
+	FClient = Client;
+	__hook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CGattSubscriptionTable::ClientCharacteristicChanged);
+	return WCL_E_SUCCESS;
+}
+
+int CGattSubscriptionTable::Detach()
+{
+	if (FClient == NULL)
+		return APP_E_GATT_ROUTE_NOT_ATTACHED;
+
+	__unhook(&CwclGattClient::OnCharacteristicChanged, FClient,
+		&CGattSubscriptionTable::ClientCharacteristicChanged);
+	FClient = NULL;
+	return WCL_E_SUCCESS;
+}
+
+int CGattSubscriptionTable::AddRoute(const wclGattCharacteristic& Characteristic,
+	const GattNotificationCallback Callback, void* const Context,
+	CMessageDispatcher* const Dispatcher)
+{
+	// Notifications are reported with the value handle.
+	unsigned short Handle = Characteristic.ValueHandle;
+	if (Find(Handle) != NULL)
+		return APP_E_GATT_ROUTE_EXISTS;
+
+	ROUTE*& Page = FPages[Handle / PAGE_SIZE];
+	if (Page == NULL)
+	{
+		Page = new ROUTE[PAGE_SIZE];
+		ZeroMemory(Page, sizeof(ROUTE) * PAGE_SIZE);
+	}
+
+	ROUTE* Route = Page + Handle % PAGE_SIZE;
+	Route->Characteristic = Characteristic;
+	Route->Callback = Callback;
+	Route->Context = Context;
+	Route->Dispatcher = Dispatcher;
+	Route->Notifications = 0;
+	FCount++;
+	return WCL_E_SUCCESS;
+}
+
+int CGattSubscriptionTable::SubscribeRouted(const wclGattCharacteristic& Characteristic,
+	const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind)
+{
+	int Res = FClient->SubscribeForNotifications(Characteristic, goNone, Protection,
+		SubscribeKind);
+	if (Res != WCL_E_SUCCESS)
+		Unbind(Characteristic.ValueHandle);
+	return Res;
+}
+
+int CGattSubscriptionTable::Bind(const wclGattCharacteristic& Characteristic,
+	const GattNotificationCallback Callback, void* const Context)
+{
+	if (Callback == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+	return AddRoute(Characteristic, Callback, Context, NULL);
+}
+
+int CGattSubscriptionTable::Bind(const wclGattCharacteristic& Characteristic,
+	CMessageDispatcher* const Dispatcher)
+{
+	if (Dispatcher == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+	return AddRoute(Characteristic, NULL, NULL, Dispatcher);
+}
+
+int CGattSubscriptionTable::Unbind(const unsigned short Handle)
+{
+	ROUTE* Route = Find(Handle);
+	if (Route == NULL)
+		return APP_E_GATT_ROUTE_NOT_FOUND;
+
+	// Pages are kept: a handle that has been bound once is likely to be bound
+	// again after reconnection.
+	ZeroMemory(Route, sizeof(ROUTE));
+	FCount--;
+	return WCL_E_SUCCESS;
+}
+
+void CGattSubscriptionTable::Clear()
+{
+	for (unsigned long i = 0; i < PAGES; i++)
+	{
+		if (FPages[i] != NULL)
+			ZeroMemory(FPages[i], sizeof(ROUTE) * PAGE_SIZE);
+	}
+	FCount = 0;
+}
+
+int CGattSubscriptionTable::Subscribe(const wclGattCharacteristic& Characteristic,
+	const GattNotificationCallback Callback, void* const Context,
+	const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind)
+{
+	if (FClient == NULL)
+		return APP_E_GATT_ROUTE_NOT_ATTACHED;
+
+	// Bind first: the first notification may arrive before the
+	// subscription call returns.
+	int Res = Bind(Characteristic, Callback, Context);
+	if (Res == WCL_E_SUCCESS)
+		Res = SubscribeRouted(Characteristic, Protection, SubscribeKind);
+	return Res;
+}
+
+int CGattSubscriptionTable::Subscribe(const wclGattCharacteristic& Characteristic,
+	CMessageDispatcher* const Dispatcher, const wclGattProtectionLevel Protection,
+	const wclGattSubscribeKind SubscribeKind)
+{
+	if (FClient == NULL)
+		return APP_E_GATT_ROUTE_NOT_ATTACHED;
+
+	int Res = Bind(Characteristic, Dispatcher);
+	if (Res == WCL_E_SUCCESS)
+		Res = SubscribeRouted(Characteristic, Protection, SubscribeKind);
+	return Res;
+}
+
+int CGattSubscriptionTable::Unsubscribe(const wclGattCharacteristic& Characteristic,
+	const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind)
+{
+	if (FClient == NULL)
+		return APP_E_GATT_ROUTE_NOT_ATTACHED;
+
+	int Res = FClient->UnsubscribeFromNotifications(Characteristic, goNone, Protection,
+		SubscribeKind);
+	int UnbindRes = Unbind(Characteristic.ValueHandle);
+	if (Res == WCL_E_SUCCESS)
+		Res = UnbindRes;
+	return Res;
+}
+
+int CGattSubscriptionTable::GetContext(const unsigned short Handle, void*& Context) const
+{
+	ROUTE* Route = Find(Handle);
+	if (Route == NULL)
+	{
+		Context = NULL;
+		return APP_E_GATT_ROUTE_NOT_FOUND;
+	}
+
+	Context = Route->Context;
+	return WCL_E_SUCCESS;
+}
+
+unsigned long CGattSubscriptionTable::GetNotifications(const unsigned short Handle) const
+{
+	ROUTE* Route = Find(Handle);
+	if (Route == NULL)
+		return 0;
+	return Route->Notifications;
+}
+
+CwclGattClient* CGattSubscriptionTable::GetClient() const
+{
+	return FClient;
+}
+
+unsigned long CGattSubscriptionTable::GetCount() const
+{
+	return FCount;
+}
+
+unsigned long CGattSubscriptionTable::GetUnrouted() const
+{
+	return FUnrouted;
+}
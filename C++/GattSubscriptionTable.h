@@ -0,0 +1,236 @@
+// GattSubscriptionTable.h : handle-indexed notification routing
+//
+
+#pragma once
+
+#include "wclBluetooth.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+class CMessageDispatcher;
+
+/// <summary> The base value of the subscription table error codes. </summary>
+const int APP_E_GATT_ROUTE_BASE = 0x00F04000;
+/// <summary> The handle is already bound. </summary>
+const int APP_E_GATT_ROUTE_EXISTS = APP_E_GATT_ROUTE_BASE + 0x0000;
+/// <summary> The handle is not bound. </summary>
+const int APP_E_GATT_ROUTE_NOT_FOUND = APP_E_GATT_ROUTE_BASE + 0x0001;
+/// <summary> The table is already attached to a client. </summary>
+const int APP_E_GATT_ROUTE_ATTACHED = APP_E_GATT_ROUTE_BASE + 0x0002;
+/// <summary> The table is not attached to a client. </summary>
+const int APP_E_GATT_ROUTE_NOT_ATTACHED = APP_E_GATT_ROUTE_BASE + 0x0003;
+
+/// <summary> The notification callback prototype. </summary>
+/// <param name="Context"> The application context bound to the
+///   handle. </param>
+/// <param name="Characteristic"> The characteristic bound to the
+///   handle. </param>
+/// <param name="Value"> The value. Valid only inside the callback. </param>
+/// <param name="Length"> The value length in bytes. </param>
+typedef void (*GattNotificationCallback)(void* const Context,
+	const wclGattCharacteristic& Characteristic, const unsigned char* const Value,
+	const unsigned long Length);
+
+/// <summary> Routes the client notifications to the per-handle
+///   callbacks. </summary>
+/// <remarks> <para> The table is indexed by the 16 bit value handle: the
+///   high byte selects a page of 256 routes that is allocated on the first
+///   bind. A notification costs two array lookups, no search and no map on the
+///   application side. Every route keeps the characteristic, so the callback
+///   gets it without its own lookup. </para>
+///   <para> A route either calls a callback on the client event thread or
+///   posts a pooled <see cref="CCharacteristicChangedMessage" /> to a
+///   <see cref="CMessageDispatcher" />, which moves the processing to the
+///   dispatcher thread without a heap allocation per notification. </para>
+///   <para> Notifications of the handles that are not bound are passed to
+///   the table's <c>OnCharacteristicChanged</c> event. </para>
+///   <para> The table must be used from the thread that receives the client
+///   events. </para> </remarks>
+class CGattSubscriptionTable
+{
+	DISABLE_COPY(CGattSubscriptionTable);
+
+private:
+	typedef struct
+	{
+		wclGattCharacteristic		Characteristic;
+		GattNotificationCallback	Callback;
+		void*						Context;
+		CMessageDispatcher*			Dispatcher;
+		unsigned long				Notifications;
+	} ROUTE;
+
+	static const unsigned long PAGE_SIZE = 256;
+	static const unsigned long PAGES = 256;
+
+	CwclGattClient*		FClient;
+	ROUTE*				FPages[PAGES];
+	unsigned long		FCount;
+	unsigned long		FUnrouted;
+
+	ROUTE* Find(const unsigned short Handle) const;
+	int AddRoute(const wclGattCharacteristic& Characteristic,
+		const GattNotificationCallback Callback, void* const Context,
+		CMessageDispatcher* const Dispatcher);
+	int SubscribeRouted(const wclGattCharacteristic& Characteristic,
+		const wclGattProtectionLevel Protection, const wclGattSubscribeKind SubscribeKind);
+
+	void ClientCharacteristicChanged(void* Sender, const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+
+protected:
+	/// <summary> Fires the <c>OnCharacteristicChanged</c> event. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Value"> The value. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	virtual void DoCharacteristicChanged(const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+
+public:
+	/// <summary> Creates new subscription table. </summary>
+	CGattSubscriptionTable();
+	/// <summary> Frees the subscription table. </summary>
+	virtual ~CGattSubscriptionTable();
+
+	/// <summary> Starts routing the client notifications. </summary>
+	/// <param name="Client"> The <c>CwclGattClient</c>. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Attach(CwclGattClient* const Client);
+	/// <summary> Stops routing the client notifications. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The routes are kept. </remarks>
+	int Detach();
+
+	/// <summary> Binds the characteristic to the callback. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Callback"> The notification callback. </param>
+	/// <param name="Context"> The application context passed to the
+	///   callback. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The method only routes the notifications. Use
+	///   <c>Subscribe</c> to subscribe and bind at once. </remarks>
+	int Bind(const wclGattCharacteristic& Characteristic,
+		const GattNotificationCallback Callback, void* const Context);
+	/// <summary> Binds the characteristic to the message dispatcher. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Dispatcher"> The dispatcher that receives a
+	///   <see cref="CCharacteristicChangedMessage" /> per notification. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The notification is dropped if the dispatcher does not
+	///   accept the message. </remarks>
+	int Bind(const wclGattCharacteristic& Characteristic,
+		CMessageDispatcher* const Dispatcher);
+	/// <summary> Removes the route of the characteristic. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Unbind(const unsigned short Handle);
+	/// <summary> Removes all the routes. </summary>
+	void Clear();
+
+	/// <summary> Subscribes to the characteristic and binds it to the
+	///   callback. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Callback"> The notification callback. </param>
+	/// <param name="Context"> The application context passed to the
+	///   callback. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="SubscribeKind"> The notification method. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Subscribe(const wclGattCharacteristic& Characteristic,
+		const GattNotificationCallback Callback, void* const Context,
+		const wclGattProtectionLevel Protection = plNone,
+		const wclGattSubscribeKind SubscribeKind = skManual);
+	/// <summary> Subscribes to the characteristic and binds it to the
+	///   message dispatcher. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Dispatcher"> The dispatcher that receives a
+	///   <see cref="CCharacteristicChangedMessage" /> per notification. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="SubscribeKind"> The notification method. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Subscribe(const wclGattCharacteristic& Characteristic,
+		CMessageDispatcher* const Dispatcher,
+		const wclGattProtectionLevel Protection = plNone,
+		const wclGattSubscribeKind SubscribeKind = skManual);
+	/// <summary> Unsubscribes from the characteristic and removes its
+	///   route. </summary>
+	/// <param name="Characteristic"> The characteristic. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <param name="SubscribeKind"> The notification method. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The route is removed even if the device could not be
+	///   unsubscribed. </remarks>
+	int Unsubscribe(const wclGattCharacteristic& Characteristic,
+		const wclGattProtectionLevel Protection = plNone,
+		const wclGattSubscribeKind SubscribeKind = skManual);
+
+	/// <summary> Gets the context bound to the handle. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Context"> On output the bound context. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int GetContext(const unsigned short Handle, void*& Context) const;
+	/// <summary> Gets the number of the notifications routed to the
+	///   handle. </summary>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <returns> The number of the notifications. 0 if the handle is not
+	///   bound. </returns>
+	unsigned long GetNotifications(const unsigned short Handle) const;
+
+	/// <summary> Gets the attached client. </summary>
+	/// <returns> The client or <c>NULL</c> if the table is not
+	///   attached. </returns>
+	CwclGattClient* GetClient() const;
+	/// <summary> Gets the attached client. </summary>
+	/// <value> The client or <c>NULL</c> if the table is not
+	///   attached. </value>
+	__declspec(property(get = GetClient)) CwclGattClient* Client;
+
+	/// <summary> Gets the number of the routes. </summary>
+	/// <returns> The number of the bound handles. </returns>
+	unsigned long GetCount() const;
+	/// <summary> Gets the number of the routes. </summary>
+	/// <value> The number of the bound handles. </value>
+	__declspec(property(get = GetCount)) unsigned long Count;
+
+	/// <summary> Gets the number of the notifications without a
+	///   route. </summary>
+	/// <returns> The number of the notifications passed to the
+	///   <c>OnCharacteristicChanged</c> event. </returns>
+	unsigned long GetUnrouted() const;
+	/// <summary> Gets the number of the notifications without a
+	///   route. </summary>
+	/// <value> The number of the notifications passed to the
+	///   <c>OnCharacteristicChanged</c> event. </value>
+	__declspec(property(get = GetUnrouted)) unsigned long Unrouted;
+
+	/// <summary> The event fires for the notifications of the handles that
+	///   are not bound. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Value"> The value. Valid only inside the event
+	///   handler. </param>
+	/// <param name="Length"> The value length in bytes. </param>
+	wclGattCharacteristicChangedEvent(OnCharacteristicChanged);
+};
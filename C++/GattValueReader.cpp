@@ -0,0 +1,136 @@
+// GattValueReader.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "GattValueReader.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CGattValueReader
+
+CGattValueReader::CGattValueReader(const unsigned long ScratchSize)
+	: FScratch(ScratchSize)
+{
+}
+
+CGattValueReader::~CGattValueReader()
+{
+}
+
+int CGattValueReader::CopyValue(const unsigned char* const Value, const unsigned long Length,
+	unsigned char* const Buffer, const unsigned long Size, unsigned long& Needed)
+{
+	Needed = Length;
+	if (Length > Size)
+		return APP_E_GATT_BUFFER_TOO_SMALL;
+	if (Length > 0)
+		CopyMemory(Buffer, Value, Length);
+	return WCL_E_SUCCESS;
+}
+
+int CGattValueReader::ReadCharacteristicValue(CwclGattClient* const Client,
+	const wclGattCharacteristic& Characteristic, const wclGattOperationFlag Flag,
+	unsigned char* const Buffer, const unsigned long Size, unsigned long& Length,
+	const wclGattProtectionLevel Protection)
+{
+	Length = 0;
+	if (Client == NULL || (Buffer == NULL && Size > 0))
+		return WCL_E_INVALID_ARGUMENT;
+
+	unsigned char* Value = NULL;
+	unsigned long ValueLength = 0;
+	int Res = Client->ReadCharacteristicValue(Characteristic, Flag, Value, ValueLength,
+		Protection);
+	if (Res == WCL_E_SUCCESS)
+	{
+		Res = CopyValue(Value, ValueLength, Buffer, Size, Length);
+		if (Value != NULL)
+			delete[] Value;
+	}
+	return Res;
+}
+
+int CGattValueReader::ReadDescriptorValue(CwclGattClient* const Client,
+	const wclGattDescriptor& Descriptor, const wclGattOperationFlag Flag,
+	wclGattDescriptorValue& Value, unsigned char* const Buffer, const unsigned long Size,
+	unsigned long& Length, const wclGattProtectionLevel Protection)
+{
+	Length = 0;
+	if (Client == NULL || (Buffer == NULL && Size > 0))
+		return WCL_E_INVALID_ARGUMENT;
+
+	int Res = Client->ReadDescriptorValue(Descriptor, Flag, Value, Protection);
+	if (Res == WCL_E_SUCCESS)
+	{
+		unsigned char* Data = Value.Data;
+		Res = CopyValue(Data, Value.Length, Buffer, Size, Length);
+		if (Data != NULL)
+			delete[] Data;
+
+		// The typed members are already decoded: only the raw data moves to
+		// the caller buffer.
+		if (Res == WCL_E_SUCCESS && Length > 0)
+			Value.Data = Buffer;
+		else
+		{
+			Value.Data = NULL;
+			Value.Length = 0;
+		}
+	}
+	return Res;
+}
+
+int CGattValueReader::ReadCharacteristicValue(CwclGattClient* const Client,
+	const wclGattCharacteristic& Characteristic, const wclGattOperationFlag Flag,
+	const unsigned char*& Value, unsigned long& Length,
+	const wclGattProtectionLevel Protection)
+{
+	Value = NULL;
+	Length = 0;
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	unsigned char* Data = NULL;
+	unsigned long DataLength = 0;
+	int Res = Client->ReadCharacteristicValue(Characteristic, Flag, Data, DataLength,
+		Protection);
+	if (Res == WCL_E_SUCCESS)
+	{
+		FScratch.Reset(1);
+		Res = FScratch.Store(0, Data, DataLength);
+		if (Data != NULL)
+			delete[] Data;
+		if (Res == WCL_E_SUCCESS)
+			Res = FScratch.GetValue(0, Value, Length);
+	}
+	return Res;
+}
+
+int CGattValueReader::ReadDescriptorValue(CwclGattClient* const Client,
+	const wclGattDescriptor& Descriptor, const wclGattOperationFlag Flag,
+	wclGattDescriptorValue& Value, const wclGattProtectionLevel Protection)
+{
+	if (Client == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	int Res = Client->ReadDescriptorValue(Descriptor, Flag, Value, Protection);
+	if (Res == WCL_E_SUCCESS)
+	{
+		unsigned char* Data = Value.Data;
+		FScratch.Reset(1);
+		Res = FScratch.Store(0, Data, Value.Length);
+		if (Data != NULL)
+			delete[] Data;
+
+		const unsigned char* Scratch = NULL;
+		unsigned long Length = 0;
+		if (Res == WCL_E_SUCCESS)
+			Res = FScratch.GetValue(0, Scratch, Length);
+		Value.Data = const_cast<unsigned char*>(Scratch);
+		Value.Length = Length;
+	}
+	return Res;
+}
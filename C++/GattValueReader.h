@@ -0,0 +1,123 @@
+// GattValueReader.h : characteristic and descriptor reads into caller memory
+//
+
+#pragma once
+
+#include "wclBluetooth.h"
+
+#include "GattBatchReader.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The caller buffer is too small for the value. </summary>
+const int APP_E_GATT_BUFFER_TOO_SMALL = APP_E_GATT_BATCH_BASE + 0x0002;
+
+/// <summary> The maximum length of an attribute value defined by the
+///   Bluetooth specification. </summary>
+const unsigned long GATT_MAX_VALUE_LENGTH = 512;
+
+/// <summary> Reads characteristic and descriptor values into the caller
+///   memory. </summary>
+/// <remarks> <para> The <c>CwclGattClient</c> read methods return values
+///   allocated for every read that the caller must free. The static methods
+///   of this class copy the value into the caller buffer and free the
+///   framework allocation at once, so the caller never owns any dynamic
+///   memory. A buffer of <c>GATT_MAX_VALUE_LENGTH</c> bytes fits any
+///   value. </para>
+///   <para> The instance methods return the value in the reader's scratch
+///   arena. The value is valid until the next read by the same reader. Use
+///   one reader per client and per thread. </para> </remarks>
+class CGattValueReader
+{
+	DISABLE_COPY(CGattValueReader);
+
+private:
+	CGattValueArena	FScratch;
+
+	static int CopyValue(const unsigned char* const Value, const unsigned long Length,
+		unsigned char* const Buffer, const unsigned long Size, unsigned long& Needed);
+
+public:
+	/// <summary> Creates new value reader. </summary>
+	/// <param name="ScratchSize"> The scratch arena size in bytes. </param>
+	explicit CGattValueReader(const unsigned long ScratchSize = GATT_MAX_VALUE_LENGTH);
+	/// <summary> Frees the value reader. </summary>
+	virtual ~CGattValueReader();
+
+	/// <summary> Reads the characteristic value into the caller
+	///   buffer. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Characteristic"> The
+	///   <see cref="wclGattCharacteristic" />. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Buffer"> The buffer that receives the value. </param>
+	/// <param name="Size"> The buffer size in bytes. </param>
+	/// <param name="Length"> On output the value length in bytes. If the
+	///   buffer is too small it is the required size. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. If the buffer is too small the method
+	///   returns <c>APP_E_GATT_BUFFER_TOO_SMALL</c> and the value is lost.
+	///   Otherwise the method returns one of the WCL error codes. </returns>
+	static int ReadCharacteristicValue(CwclGattClient* const Client,
+		const wclGattCharacteristic& Characteristic, const wclGattOperationFlag Flag,
+		unsigned char* const Buffer, const unsigned long Size, unsigned long& Length,
+		const wclGattProtectionLevel Protection = plNone);
+	/// <summary> Reads the descriptor value into the caller buffer. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Descriptor"> The <see cref="wclGattDescriptor" />. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Value"> On output contains the descriptor value. Its
+	///   <c>Data</c> member points to the <c>Buffer</c> and must not be
+	///   freed. </param>
+	/// <param name="Buffer"> The buffer that receives the raw value. </param>
+	/// <param name="Size"> The buffer size in bytes. </param>
+	/// <param name="Length"> On output the raw value length in bytes. If the
+	///   buffer is too small it is the required size. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. If the buffer is too small the method
+	///   returns <c>APP_E_GATT_BUFFER_TOO_SMALL</c>. Otherwise the method
+	///   returns one of the WCL error codes. </returns>
+	static int ReadDescriptorValue(CwclGattClient* const Client,
+		const wclGattDescriptor& Descriptor, const wclGattOperationFlag Flag,
+		wclGattDescriptorValue& Value, unsigned char* const Buffer, const unsigned long Size,
+		unsigned long& Length, const wclGattProtectionLevel Protection = plNone);
+
+	/// <summary> Reads the characteristic value into the scratch
+	///   arena. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Characteristic"> The
+	///   <see cref="wclGattCharacteristic" />. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Value"> On output the pointer to the value. Valid until the
+	///   next read. </param>
+	/// <param name="Length"> On output the value length in bytes. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadCharacteristicValue(CwclGattClient* const Client,
+		const wclGattCharacteristic& Characteristic, const wclGattOperationFlag Flag,
+		const unsigned char*& Value, unsigned long& Length,
+		const wclGattProtectionLevel Protection = plNone);
+	/// <summary> Reads the descriptor value into the scratch arena. </summary>
+	/// <param name="Client"> The connected <c>CwclGattClient</c>. </param>
+	/// <param name="Descriptor"> The <see cref="wclGattDescriptor" />. </param>
+	/// <param name="Flag"> Operation behavior flag. </param>
+	/// <param name="Value"> On output contains the descriptor value. Its
+	///   <c>Data</c> member points to the scratch arena, must not be freed and
+	///   is valid until the next read. </param>
+	/// <param name="Protection"> Describes the required protection
+	///   level. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int ReadDescriptorValue(CwclGattClient* const Client,
+		const wclGattDescriptor& Descriptor, const wclGattOperationFlag Flag,
+		wclGattDescriptorValue& Value, const wclGattProtectionLevel Protection = plNone);
+};
@@ -0,0 +1,194 @@
+// MessageBus.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "MessageBus.h"
+
+#include <algorithm>
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+
+// CMessageBus
+
+CMessageBus::CMessageBus()
+{
+	FCS = new CwclCriticalSection();
+
+	FTable = new TABLE;
+	FEpoch = 0;
+	FReaders[0] = 0;
+	FReaders[1] = 0;
+}
+
+CMessageBus::~CMessageBus()
+{
+	delete FTable;
+	delete FCS;
+}
+
+// The routing table is protected by two reader counters. A reader registers
+// itself in the counter of the current epoch before it loads the table. A
+// writer publishes a new table, flips the epoch and waits for the readers of
+// the previous epoch to leave before it frees the old table. Readers never
+// wait for writers and never write to a shared location other than their
+// epoch counter.
+
+LONG CMessageBus::EnterRead()
+{
+	while (true)
+	{
+		LONG Epoch = FEpoch;
+		InterlockedIncrement(&FReaders[Epoch]);
+		if (Epoch == FEpoch)
+			return Epoch;
+		// The writer flipped the epoch in between. Try again.
+		InterlockedDecrement(&FReaders[Epoch]);
+	}
+}
+
+void CMessageBus::LeaveRead(const LONG Epoch)
+{
+	InterlockedDecrement(&FReaders[Epoch]);
+}
+
+void CMessageBus::AddRoute(DISPATCHERS& Routes, CMessageDispatcher* const Dispatcher)
+{
+	// A dispatcher subscribed for both MSG_ID_ANY and the ID gets the message
+	// once.
+	if (std::find(Routes.begin(), Routes.end(), Dispatcher) == Routes.end())
+		Routes.push_back(Dispatcher);
+}
+
+void CMessageBus::Publish()
+{
+	// Must be called inside the critical section.
+	TABLE* Table = new TABLE;
+	for (SUBSCRIPTIONS::const_iterator s = FSubscriptions.begin();
+		s != FSubscriptions.end(); s++)
+	{
+		DISPATCHERS* Routes = Table->Routes[(*s).Category];
+		if ((*s).Id == MSG_ID_ANY)
+		{
+			for (unsigned long i = 0; i < IDS; i++)
+				AddRoute(Routes[i], (*s).Dispatcher);
+		}
+		else
+			AddRoute(Routes[(*s).Id], (*s).Dispatcher);
+	}
+
+	TABLE* Old = static_cast<TABLE*>(InterlockedExchangePointer(
+		reinterpret_cast<PVOID volatile*>(&FTable), Table));
+
+	LONG Epoch = FEpoch;
+	InterlockedExchange(&FEpoch, 1 - Epoch);
+	while (FReaders[Epoch] != 0)
+		SwitchToThread();
+
+	delete Old;
+}
+
+int CMessageBus::Subscribe(CMessageDispatcher* const Dispatcher,
+	const wclMessageCategory Category, const int Id)
+{
+	if (Dispatcher == NULL || static_cast<unsigned long>(Category) >= CATEGORIES)
+		return WCL_E_INVALID_ARGUMENT;
+	if (Id != MSG_ID_ANY && (Id < 0 || Id >= static_cast<int>(IDS)))
+		return WCL_E_INVALID_ARGUMENT;
+
+	int Res = WCL_E_SUCCESS;
+	FCS->Enter();
+	for (SUBSCRIPTIONS::const_iterator s = FSubscriptions.begin();
+		s != FSubscriptions.end(); s++)
+	{
+		if ((*s).Dispatcher == Dispatcher && (*s).Category == Category && (*s).Id == Id)
+		{
+			Res = WCL_E_MB_RECEIVER_ALREADY_SUBSCRIBED;
+			break;
+		}
+	}
+	if (Res == WCL_E_SUCCESS)
+	{
+		SUBSCRIPTION Subscription;
+		Subscription.Dispatcher = Dispatcher;
+		Subscription.Category = Category;
+		Subscription.Id = Id;
+		FSubscriptions.push_back(Subscription);
+
+		Publish();
+	}
+	FCS->Leave();
+	return Res;
+}
+
+int CMessageBus::Unsubscribe(CMessageDispatcher* const Dispatcher,
+	const wclMessageCategory Category, const int Id)
+{
+	if (Dispatcher == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	int Res = WCL_E_MB_RECEIVER_NOT_SUBSCRIBED;
+	FCS->Enter();
+	for (SUBSCRIPTIONS::iterator s = FSubscriptions.begin(); s != FSubscriptions.end(); s++)
+	{
+		if ((*s).Dispatcher == Dispatcher && (*s).Category == Category && (*s).Id == Id)
+		{
+			FSubscriptions.erase(s);
+			Publish();
+			Res = WCL_E_SUCCESS;
+			break;
+		}
+	}
+	FCS->Leave();
+	return Res;
+}
+
+int CMessageBus::Unsubscribe(CMessageDispatcher* const Dispatcher)
+{
+	if (Dispatcher == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	int Res = WCL_E_MB_RECEIVER_NOT_SUBSCRIBED;
+	FCS->Enter();
+	SUBSCRIPTIONS::iterator s = FSubscriptions.begin();
+	while (s != FSubscriptions.end())
+	{
+		if ((*s).Dispatcher == Dispatcher)
+		{
+			s = FSubscriptions.erase(s);
+			Res = WCL_E_SUCCESS;
+		}
+		else
+			s++;
+	}
+	if (Res == WCL_E_SUCCESS)
+		Publish();
+	FCS->Leave();
+	return Res;
+}
+
+int CMessageBus::Broadcast(CwclMessage* const Message)
+{
+	if (Message == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	unsigned long Category = static_cast<unsigned long>(Message->Category);
+	if (Category >= CATEGORIES)
+		return WCL_E_INVALID_ARGUMENT;
+
+	LONG Epoch = EnterRead();
+	const DISPATCHERS& Routes = FTable->Routes[Category][Message->Id];
+	for (DISPATCHERS::const_iterator d = Routes.begin(); d != Routes.end(); d++)
+	{
+		// Never wait inside the read epoch: a full queue would stall every
+		// Subscribe and Unsubscribe until its dispatcher catches up.
+		MessageOverflowPolicy Overflow = (*d)->Overflow;
+		if (Overflow == opBlock)
+			Overflow = opDropNewest;
+		(*d)->Post(Message, Overflow);
+	}
+	LeaveRead(Epoch);
+	return WCL_E_SUCCESS;
+}
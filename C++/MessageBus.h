@@ -0,0 +1,118 @@
+// MessageBus.h : filtered broadcast of messages to dispatchers
+//
+
+#pragma once
+
+#include <list>
+#include <vector>
+
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+#include "MessageDispatcher.h"
+
+using namespace wclCommon;
+
+/// <summary> Subscribes a dispatcher to all the IDs of a category. </summary>
+const int MSG_ID_ANY = -1;
+
+/// <summary> The message bus broadcasts messages only to the dispatchers
+///   subscribed for the message kind. </summary>
+/// <remarks> <para> Subscriptions are filtered by the message category and,
+///   optionally, by the message ID. The bus keeps an immutable routing table
+///   with the ready list of dispatchers for every category and ID. Broadcast
+///   looks the list up and posts to it without taking a lock, so any number of
+///   threads can broadcast concurrently. </para>
+///   <para> Subscribe and Unsubscribe build a new table and publish it. The
+///   old table is freed once all the broadcasts that may still use it have
+///   finished. When <c>Unsubscribe</c> returns no broadcast can still post to
+///   the removed dispatcher, so it is safe to destroy it. </para> </remarks>
+class CMessageBus
+{
+	DISABLE_COPY(CMessageBus);
+
+private:
+	static const unsigned long CATEGORIES = mcWiiRemote + 1;
+	static const unsigned long IDS = 256;
+
+	typedef std::vector<CMessageDispatcher*> DISPATCHERS;
+
+	typedef struct
+	{
+		DISPATCHERS		Routes[CATEGORIES][IDS];
+	} TABLE;
+
+	typedef struct
+	{
+		CMessageDispatcher*	Dispatcher;
+		wclMessageCategory	Category;
+		int					Id;
+	} SUBSCRIPTION;
+	typedef std::list<SUBSCRIPTION> SUBSCRIPTIONS;
+
+	// Writers.
+	CwclCriticalSection*	FCS;
+	SUBSCRIPTIONS			FSubscriptions;
+
+	// Readers.
+	TABLE* volatile			FTable;
+	volatile LONG			FEpoch;
+	volatile LONG			FReaders[2];
+
+	static void AddRoute(DISPATCHERS& Routes, CMessageDispatcher* const Dispatcher);
+	void Publish();
+
+	LONG EnterRead();
+	void LeaveRead(const LONG Epoch);
+
+public:
+	/// <summary> Creates new message bus. </summary>
+	CMessageBus();
+	/// <summary> Frees the message bus. </summary>
+	virtual ~CMessageBus();
+
+	/// <summary> Subscribes the dispatcher for the messages. </summary>
+	/// <param name="Dispatcher"> The <see cref="CMessageDispatcher" />
+	///   object. </param>
+	/// <param name="Category"> The message category. </param>
+	/// <param name="Id"> The message ID or <c>MSG_ID_ANY</c> to receive all
+	///   the messages of the category. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Subscribe(CMessageDispatcher* const Dispatcher, const wclMessageCategory Category,
+		const int Id = MSG_ID_ANY);
+	/// <summary> Removes the dispatcher subscription. </summary>
+	/// <param name="Dispatcher"> The <see cref="CMessageDispatcher" />
+	///   object. </param>
+	/// <param name="Category"> The message category. </param>
+	/// <param name="Id"> The message ID or <c>MSG_ID_ANY</c>. Must be the same
+	///   as used for the <c>Subscribe</c> call. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Unsubscribe(CMessageDispatcher* const Dispatcher, const wclMessageCategory Category,
+		const int Id = MSG_ID_ANY);
+	/// <summary> Removes all the dispatcher subscriptions. </summary>
+	/// <param name="Dispatcher"> The <see cref="CMessageDispatcher" />
+	///   object. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Unsubscribe(CMessageDispatcher* const Dispatcher);
+
+	/// <summary> Broadcasts the message to the subscribed dispatchers. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object. A caller
+	///   is responsible to free the <c>Message</c> object after the
+	///   call. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> <para> The method can be called from any thread. It is not an
+	///   error if no dispatcher is subscribed for the message. </para>
+	///   <para> The method never waits for a full dispatcher queue. A
+	///   dispatcher with the <c>opBlock</c> policy drops the message as with
+	///   <c>opDropNewest</c> and counts it in its <c>DroppedNewest</c>
+	///   counter. </para> </remarks>
+	int Broadcast(CwclMessage* const Message);
+};
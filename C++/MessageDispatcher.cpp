@@ -0,0 +1,598 @@
+// MessageDispatcher.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "MessageDispatcher.h"
+
+#include "DispatchPool.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// How long a blocked producer sleeps before it re-checks the queue. Protects
+// against a missed space notification when several producers are blocked.
+static const unsigned long DISPATCHER_BLOCK_TIMEOUT = 10;
+
+// The maximum queue capacity. Positions are 32 bit and wrap around, so the
+// capacity must stay far below 2^31.
+static const unsigned long DISPATCHER_MAX_CAPACITY = 0x00100000;
+
+
+// CMessageDispatcher
+
+CMessageDispatcher::CMessageDispatcher()
+{
+	FTail = 0;
+	FHead = 0;
+
+	FCells = NULL;
+	FMask = 0;
+
+	FBatch = NULL;
+	FBatchQueued = NULL;
+	FBatchSize = 1;
+	FBatchTime = 0;
+
+	FPosted = 0;
+	FDispatched = 0;
+	FDroppedOldest = 0;
+	FDroppedNewest = 0;
+	FBlocked = 0;
+	FWakeups = 0;
+	FBatches = 0;
+
+	FListening = 0;
+	FOverflow = opBlock;
+	FStats = NULL;
+	FPool = NULL;
+
+	FEvent = NULL;
+	FSpaceEvent = NULL;
+	FProducers = 0;
+	FSleeping = 0;
+	FScheduled = 0;
+	FRunning = 0;
+	FWaiting = 0;
+	FTerminated = 0;
+	FThread = NULL;
+}
+
+CMessageDispatcher::~CMessageDispatcher()
+{
+	Close();
+}
+
+// The queue is the bounded MPMC ring by D. Vyukov. Each cell carries a
+// sequence number that tells whether the cell is free for the producer at
+// position N (Sequence == N) or holds the message for the consumer at
+// position N (Sequence == N + 1). The producers and the consumer only
+// contend on the position counters, never on a lock. The dequeue side uses
+// CAS too so a producer can evict the oldest message with the
+// opDropOldest policy.
+
+bool CMessageDispatcher::Enqueue(CwclMessage* const Message)
+{
+	CELL* Cell;
+	LONG Pos = FTail;
+	while (true)
+	{
+		Cell = &FCells[Pos & FMask];
+		LONG Dif = Cell->Sequence - Pos;
+		if (Dif == 0)
+		{
+			if (InterlockedCompareExchange(&FTail, Pos + 1, Pos) == Pos)
+				break;
+			Pos = FTail;
+		}
+		else
+		{
+			if (Dif < 0)
+				return false;
+			Pos = FTail;
+		}
+	}
+
+	Cell->Message = Message;
+	if (FStats == NULL)
+		Cell->Queued = 0;
+	else
+	{
+		Cell->Queued = CMessageStats::Now();
+		FStats->RecordDepth(static_cast<unsigned long>(Pos + 1 - FHead));
+	}
+	InterlockedExchange(&Cell->Sequence, Pos + 1);
+	return true;
+}
+
+bool CMessageDispatcher::Dequeue(CwclMessage*& Message, unsigned __int64& Queued)
+{
+	CELL* Cell;
+	LONG Pos = FHead;
+	while (true)
+	{
+		Cell = &FCells[Pos & FMask];
+		LONG Dif = Cell->Sequence - (Pos + 1);
+		if (Dif == 0)
+		{
+			if (InterlockedCompareExchange(&FHead, Pos + 1, Pos) == Pos)
+				break;
+			Pos = FHead;
+		}
+		else
+		{
+			if (Dif < 0)
+				return false;
+			Pos = FHead;
+		}
+	}
+
+	Message = Cell->Message;
+	Queued = Cell->Queued;
+	InterlockedExchange(&Cell->Sequence, Pos + FMask + 1);
+	return true;
+}
+
+bool CMessageDispatcher::Empty() const
+{
+	LONG Pos = FHead;
+	return (FCells[Pos & FMask].Sequence != Pos + 1);
+}
+
+void CMessageDispatcher::Wakeup()
+{
+	if (FPool != NULL)
+	{
+		// Schedule the dispatcher only once. The pool thread that runs it
+		// re-schedules it if new messages arrive while it drains the queue.
+		if (InterlockedCompareExchange(&FScheduled, 1, 0) == 0)
+		{
+			InterlockedIncrement(&FWakeups);
+			// The pool has been closed before the dispatcher. The messages
+			// stay queued until Close releases them, and Close must not wait
+			// for a run that never comes.
+			if (FPool->Schedule(this) != WCL_E_SUCCESS)
+				InterlockedExchange(&FScheduled, 0);
+		}
+	}
+	else
+	{
+		// Only pay for the kernel call when the dispatch thread is really
+		// sleeping.
+		if (InterlockedExchange(&FSleeping, 0) != 0)
+			FEvent->SetEvent();
+	}
+}
+
+void CMessageDispatcher::ReleaseQueued()
+{
+	CwclMessage* Message;
+	unsigned __int64 Queued;
+	while (Dequeue(Message, Queued))
+		Message->Release();
+}
+
+bool CMessageDispatcher::DispatchSingle(const unsigned __int64 Deadline)
+{
+	CwclMessage* Message;
+	unsigned __int64 Queued;
+	while (FTerminated == 0 && Dequeue(Message, Queued))
+	{
+		if (FWaiting > 0)
+			FSpaceEvent->SetEvent();
+
+		if (FStats == NULL)
+			DoMessage(Message);
+		else
+		{
+			unsigned __int64 Started = CMessageStats::Now();
+			DoMessage(Message);
+			unsigned __int64 Finished = CMessageStats::Now();
+			FStats->Record(Message, static_cast<unsigned long>(Started - Queued),
+				static_cast<unsigned long>(Finished - Started));
+		}
+		Message->Release();
+		InterlockedIncrement(&FDispatched);
+
+		if (Deadline > 0 && CMessageStats::Now() >= Deadline)
+			return Empty();
+	}
+	return true;
+}
+
+bool CMessageDispatcher::DispatchBatch(const unsigned __int64 Deadline)
+{
+	unsigned long Size = min(FBatchSize, static_cast<unsigned long>(FMask) + 1);
+	while (FTerminated == 0)
+	{
+		unsigned long Count = 0;
+		while (Count < Size && Dequeue(FBatch[Count], FBatchQueued[Count]))
+			Count++;
+		if (Count == 0)
+			break;
+
+		if (FWaiting > 0)
+			FSpaceEvent->SetEvent();
+
+		if (FStats == NULL)
+			DoMessages(FBatch, Count);
+		else
+		{
+			unsigned __int64 Started = CMessageStats::Now();
+			DoMessages(FBatch, Count);
+			unsigned long Handler = static_cast<unsigned long>(
+				(CMessageStats::Now() - Started) / Count);
+			for (unsigned long i = 0; i < Count; i++)
+			{
+				FStats->Record(FBatch[i],
+					static_cast<unsigned long>(Started - FBatchQueued[i]), Handler);
+			}
+		}
+		for (unsigned long i = 0; i < Count; i++)
+			FBatch[i]->Release();
+		InterlockedExchangeAdd(&FDispatched, static_cast<LONG>(Count));
+		InterlockedIncrement(&FBatches);
+
+		if (Deadline > 0 && CMessageStats::Now() >= Deadline)
+			return Empty();
+	}
+	return true;
+}
+
+UINT __stdcall CMessageDispatcher::_DispatchThreadProc(LPVOID lpParam)
+{
+	static_cast<CMessageDispatcher*>(lpParam)->DispatchThreadProc();
+	return 0;
+}
+
+void CMessageDispatcher::DispatchThreadProc()
+{
+	while (FTerminated == 0)
+	{
+		unsigned __int64 Deadline = 0;
+		if (FBatchTime > 0)
+			Deadline = CMessageStats::Now() + FBatchTime;
+
+		bool Drained;
+		if (FBatchSize > 1)
+			Drained = DispatchBatch(Deadline);
+		else
+			Drained = DispatchSingle(Deadline);
+
+		if (FTerminated == 0)
+		{
+			if (!Drained)
+			{
+				// The budget is exhausted: let the producers run and continue
+				// without going to sleep.
+				SwitchToThread();
+				continue;
+			}
+
+			// Announce the sleep first and re-check the queue then. A producer
+			// that enqueued a message in between either sees the flag and
+			// signals the event or its message is seen here.
+			InterlockedExchange(&FSleeping, 1);
+			if (Empty())
+			{
+				FEvent->WaitOne();
+				InterlockedIncrement(&FWakeups);
+			}
+			else
+				InterlockedExchange(&FSleeping, 0);
+		}
+	}
+}
+
+void CMessageDispatcher::PoolRun()
+{
+	// Close waits for this counter. It must be the first and the last access
+	// to the dispatcher here.
+	InterlockedIncrement(&FRunning);
+
+	if (FTerminated == 0)
+	{
+		unsigned long Slice = FBatchTime;
+		if (Slice == 0)
+			Slice = FPool->Slice;
+		unsigned __int64 Deadline = CMessageStats::Now() + Slice;
+
+		if (FBatchSize > 1)
+			DispatchBatch(Deadline);
+		else
+			DispatchSingle(Deadline);
+	}
+
+	// Messages posted after the queue was drained but before the flag is
+	// cleared did not schedule the dispatcher. Check for them here.
+	InterlockedExchange(&FScheduled, 0);
+	if (FTerminated == 0 && !Empty())
+	{
+		if (InterlockedCompareExchange(&FScheduled, 1, 0) == 0)
+		{
+			if (FPool->Schedule(this) != WCL_E_SUCCESS)
+				InterlockedExchange(&FScheduled, 0);
+		}
+	}
+
+	InterlockedDecrement(&FRunning);
+}
+
+void CMessageDispatcher::DoMessage(const CwclMessage* const Message)
+{
+	__raise OnMessage(Message);
+}
+
+void CMessageDispatcher::DoMessages(const CwclMessage* const* const Messages,
+	const unsigned long Count)
+{
+	__raise OnMessages(Messages, Count);
+}
+
+int CMessageDispatcher::Open(const unsigned long Capacity)
+{
+	if (FListening != 0)
+		return WCL_E_MR_OPENED;
+	if (Capacity == 0 || Capacity > DISPATCHER_MAX_CAPACITY)
+		return WCL_E_INVALID_ARGUMENT;
+	if (FPool != NULL && !FPool->Active)
+		return WCL_E_MR_UNABLE_SYNCHRONIZE;
+
+	LONG Size = 1;
+	while (static_cast<unsigned long>(Size) < Capacity)
+		Size <<= 1;
+
+	FCells = new CELL[Size];
+	for (LONG i = 0; i < Size; i++)
+	{
+		FCells[i].Sequence = i;
+		FCells[i].Message = NULL;
+	}
+	FMask = Size - 1;
+	FBatch = new CwclMessage*[Size];
+	FBatchQueued = new unsigned __int64[Size];
+	FTail = 0;
+	FHead = 0;
+
+	int Res = WCL_E_SUCCESS;
+	FEvent = CwclAutoResetEvent::Create();
+	FSpaceEvent = CwclAutoResetEvent::Create();
+	if (FEvent == NULL || FSpaceEvent == NULL)
+		Res = WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+	else
+	{
+		FSleeping = 0;
+		FScheduled = 0;
+		FRunning = 0;
+		FWaiting = 0;
+		FTerminated = 0;
+		if (FPool == NULL)
+		{
+			FThread = wclCreateThread(_DispatchThreadProc, this);
+			if (FThread == NULL)
+				Res = WCL_E_MR_UNABLE_SYNCHRONIZE;
+		}
+	}
+
+	if (Res != WCL_E_SUCCESS)
+	{
+		if (FSpaceEvent != NULL)
+		{
+			delete FSpaceEvent;
+			FSpaceEvent = NULL;
+		}
+		if (FEvent != NULL)
+		{
+			delete FEvent;
+			FEvent = NULL;
+		}
+		delete[] FBatchQueued;
+		FBatchQueued = NULL;
+		delete[] FBatch;
+		FBatch = NULL;
+		delete[] FCells;
+		FCells = NULL;
+		FMask = 0;
+	}
+	else
+		InterlockedExchange(&FListening, 1);
+	return Res;
+}
+
+int CMessageDispatcher::Close()
+{
+	if (InterlockedExchange(&FListening, 0) == 0)
+		return WCL_E_MR_CLOSED;
+
+	InterlockedExchange(&FTerminated, 1);
+	if (FPool == NULL)
+	{
+		FEvent->SetEvent();
+		wclWaitAndCloseThread(FThread);
+	}
+
+	// Producers that are inside the Post see the listening flag and give up.
+	// Wait for them before the queue is freed.
+	while (FProducers > 0)
+	{
+		FSpaceEvent->SetEvent();
+		Sleep(0);
+	}
+
+	// The pool may still hold the dispatcher in its run queue or run it. The
+	// terminated dispatcher is not re-scheduled so both flags drop soon.
+	while (FScheduled != 0 || FRunning != 0)
+		SwitchToThread();
+
+	ReleaseQueued();
+
+	delete FSpaceEvent;
+	FSpaceEvent = NULL;
+	delete FEvent;
+	FEvent = NULL;
+
+	delete[] FBatchQueued;
+	FBatchQueued = NULL;
+	delete[] FBatch;
+	FBatch = NULL;
+	delete[] FCells;
+	FCells = NULL;
+	FMask = 0;
+	return WCL_E_SUCCESS;
+}
+
+int CMessageDispatcher::Post(CwclMessage* const Message)
+{
+	return Post(Message, FOverflow);
+}
+
+int CMessageDispatcher::Post(CwclMessage* const Message, const MessageOverflowPolicy Overflow)
+{
+	if (Message == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	InterlockedIncrement(&FProducers);
+	if (FListening == 0)
+	{
+		InterlockedDecrement(&FProducers);
+		return WCL_E_MR_CLOSED;
+	}
+
+	Message->AddRef();
+
+	bool Waited = false;
+	while (!Enqueue(Message))
+	{
+		switch (Overflow)
+		{
+			case opDropOldest:
+				{
+					CwclMessage* Oldest;
+					unsigned __int64 Queued;
+					if (Dequeue(Oldest, Queued))
+					{
+						Oldest->Release();
+						InterlockedIncrement(&FDroppedOldest);
+					}
+				}
+				break;
+
+			case opDropNewest:
+				Message->Release();
+				InterlockedIncrement(&FDroppedNewest);
+				InterlockedDecrement(&FProducers);
+				return WCL_E_OUT_OF_MEMORY;
+
+			default:
+				if (!Waited)
+				{
+					InterlockedIncrement(&FBlocked);
+					Waited = true;
+				}
+
+				InterlockedIncrement(&FWaiting);
+				if (FListening != 0)
+					FSpaceEvent->WaitOne(DISPATCHER_BLOCK_TIMEOUT);
+				InterlockedDecrement(&FWaiting);
+
+				if (FListening == 0)
+				{
+					Message->Release();
+					InterlockedDecrement(&FProducers);
+					return WCL_E_MR_CLOSED;
+				}
+				break;
+		}
+	}
+
+	InterlockedIncrement(&FPosted);
+	Wakeup();
+	InterlockedDecrement(&FProducers);
+	return WCL_E_SUCCESS;
+}
+
+void CMessageDispatcher::GetCounters(MessageDispatcherCounters& Counters) const
+{
+	Counters.Posted = static_cast<unsigned long>(FPosted);
+	Counters.Dispatched = static_cast<unsigned long>(FDispatched);
+	Counters.DroppedOldest = static_cast<unsigned long>(FDroppedOldest);
+	Counters.DroppedNewest = static_cast<unsigned long>(FDroppedNewest);
+	Counters.Blocked = static_cast<unsigned long>(FBlocked);
+	Counters.Wakeups = static_cast<unsigned long>(FWakeups);
+	Counters.Batches = static_cast<unsigned long>(FBatches);
+}
+
+void CMessageDispatcher::ResetCounters()
+{
+	InterlockedExchange(&FPosted, 0);
+	InterlockedExchange(&FDispatched, 0);
+	InterlockedExchange(&FDroppedOldest, 0);
+	InterlockedExchange(&FDroppedNewest, 0);
+	InterlockedExchange(&FBlocked, 0);
+	InterlockedExchange(&FWakeups, 0);
+	InterlockedExchange(&FBatches, 0);
+}
+
+unsigned long CMessageDispatcher::GetBatchSize() const
+{
+	return FBatchSize;
+}
+
+void CMessageDispatcher::SetBatchSize(const unsigned long Value)
+{
+	FBatchSize = max(Value, 1UL);
+}
+
+unsigned long CMessageDispatcher::GetBatchTime() const
+{
+	return FBatchTime;
+}
+
+void CMessageDispatcher::SetBatchTime(const unsigned long Value)
+{
+	FBatchTime = Value;
+}
+
+CDispatchPool* CMessageDispatcher::GetPool() const
+{
+	return FPool;
+}
+
+void CMessageDispatcher::SetPool(CDispatchPool* const Value)
+{
+	if (FListening == 0)
+		FPool = Value;
+}
+
+CMessageStats* CMessageDispatcher::GetStats() const
+{
+	return FStats;
+}
+
+void CMessageDispatcher::SetStats(CMessageStats* const Value)
+{
+	if (FListening == 0)
+		FStats = Value;
+}
+
+unsigned long CMessageDispatcher::GetCapacity() const
+{
+	if (FCells == NULL)
+		return 0;
+	return static_cast<unsigned long>(FMask) + 1;
+}
+
+bool CMessageDispatcher::GetListening() const
+{
+	return (FListening != 0);
+}
+
+MessageOverflowPolicy CMessageDispatcher::GetOverflow() const
+{
+	return FOverflow;
+}
+
+void CMessageDispatcher::SetOverflow(const MessageOverflowPolicy Value)
+{
+	FOverflow = Value;
+}
@@ -0,0 +1,326 @@
+// MessageDispatcher.h : lock-free asynchronous message dispatcher
+//
+
+#pragma once
+
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+#include "MessageStats.h"
+
+using namespace wclCommon;
+
+/// <summary> Describes what the dispatcher does when a message is posted to
+///   the full queue. </summary>
+typedef enum
+{
+	/// <summary> The posting thread waits until the dispatch thread frees a
+	///   slot. </summary>
+	opBlock,
+	/// <summary> The oldest queued message is dropped to make room for the
+	///   new one. </summary>
+	opDropOldest,
+	/// <summary> The new message is dropped. </summary>
+	opDropNewest
+} MessageOverflowPolicy;
+
+/// <summary> The dispatcher counters. </summary>
+typedef struct
+{
+	/// <summary> The number of messages placed to the queue. </summary>
+	unsigned long Posted;
+	/// <summary> The number of messages delivered to the handler. </summary>
+	unsigned long Dispatched;
+	/// <summary> The number of queued messages dropped by the
+	///   <c>opDropOldest</c> policy. </summary>
+	unsigned long DroppedOldest;
+	/// <summary> The number of new messages dropped by the
+	///   <c>opDropNewest</c> policy. </summary>
+	unsigned long DroppedNewest;
+	/// <summary> The number of times a posting thread had to wait for a free
+	///   slot with the <c>opBlock</c> policy. </summary>
+	unsigned long Blocked;
+	/// <summary> The number of times the dispatch thread was woken up. </summary>
+	unsigned long Wakeups;
+	/// <summary> The number of batches delivered in the batch mode. </summary>
+	unsigned long Batches;
+} MessageDispatcherCounters;
+
+/// <summary> The batch message event handler prototype. </summary>
+/// <param name="Messages"> The array of the <see cref="CwclMessage" /> objects
+///   in the order they were posted. </param>
+/// <param name="Count"> The number of messages in the array. </param>
+/// <remarks> The array and the messages are valid only inside an event
+///   handler. </remarks>
+#define MessageBatchEvent(_event_name_) \
+	__event void _event_name_(const CwclMessage* const* const Messages, \
+		const unsigned long Count)
+
+class CDispatchPool;
+
+/// <summary> The asynchronous message dispatcher with a bounded lock-free
+///   queue. </summary>
+/// <remarks> <para> The dispatcher is the replacement for the
+///   <c>CwclMessageReceiver</c> opened with the <c>mpAsync</c> method. Instead
+///   of a list protected by a critical section it uses a fixed size ring of
+///   message pointers. Any number of threads may post messages without taking
+///   a lock and without allocating memory. The messages are delivered by the
+///   single dispatch thread. </para>
+///   <para> The dispatch thread is signaled only when it is going to sleep,
+///   so a burst of messages costs a single wake up. </para> </remarks>
+class CMessageDispatcher
+{
+	DISABLE_COPY(CMessageDispatcher);
+
+private:
+	friend class CDispatchPool;
+
+	typedef struct
+	{
+		volatile LONG		Sequence;
+		CwclMessage*		Message;
+		unsigned __int64	Queued;
+	} CELL;
+
+	// The producers and the consumer positions live on their own cache lines.
+	volatile LONG			FTail;
+	char					FTailPad[64 - sizeof(LONG)];
+	volatile LONG			FHead;
+	char					FHeadPad[64 - sizeof(LONG)];
+
+	CELL*					FCells;
+	LONG					FMask;
+
+	// Batch mode.
+	CwclMessage**			FBatch;
+	unsigned __int64*		FBatchQueued;
+	unsigned long			FBatchSize;
+	unsigned long			FBatchTime;
+
+	volatile LONG			FPosted;
+	volatile LONG			FDispatched;
+	volatile LONG			FDroppedOldest;
+	volatile LONG			FDroppedNewest;
+	volatile LONG			FBlocked;
+	volatile LONG			FWakeups;
+	volatile LONG			FBatches;
+
+	volatile LONG			FListening;
+	MessageOverflowPolicy	FOverflow;
+	CMessageStats*			FStats;
+	CDispatchPool*			FPool;
+
+	// New message/thread termination event.
+	CwclAutoResetEvent*		FEvent;
+	// The number of threads that are inside the Post method.
+	volatile LONG			FProducers;
+	// Signaled by the dispatch thread when a slot is freed.
+	CwclAutoResetEvent*		FSpaceEvent;
+	// Non zero when the dispatch thread waits for the new message.
+	volatile LONG			FSleeping;
+	// Non zero when the dispatcher is in the pool run queue or is running.
+	volatile LONG			FScheduled;
+	// Number of the pool threads inside PoolRun.
+	volatile LONG			FRunning;
+	// The number of producers that are waiting for a free slot.
+	volatile LONG			FWaiting;
+	volatile LONG			FTerminated;
+	HANDLE					FThread;
+
+	bool Enqueue(CwclMessage* const Message);
+	bool Dequeue(CwclMessage*& Message, unsigned __int64& Queued);
+	bool Empty() const;
+
+	void Wakeup();
+	void ReleaseQueued();
+
+	// Both return false when the wake up budget is exhausted and the queue is
+	// still not empty.
+	bool DispatchSingle(const unsigned __int64 Deadline);
+	bool DispatchBatch(const unsigned __int64 Deadline);
+
+	static UINT __stdcall _DispatchThreadProc(LPVOID lpParam);
+	void DispatchThreadProc();
+
+	// Called by the pool thread.
+	void PoolRun();
+
+protected:
+	/// <summary> Calls the <c>OnMessage</c> event. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object. </param>
+	/// <remarks> The method is called from the dispatch thread. The
+	///   <c>Message</c> parameter is valid only inside the method. </remarks>
+	virtual void DoMessage(const CwclMessage* const Message);
+	/// <summary> Calls the <c>OnMessages</c> event. </summary>
+	/// <param name="Messages"> The array of the <see cref="CwclMessage" />
+	///   objects. </param>
+	/// <param name="Count"> The number of messages in the array. </param>
+	/// <remarks> The method is called from the dispatch thread in the batch
+	///   mode. A derived class may override it to amortise the per message
+	///   work. The messages are valid only inside the method. </remarks>
+	virtual void DoMessages(const CwclMessage* const* const Messages,
+		const unsigned long Count);
+
+public:
+	/// <summary> Creates new message dispatcher. </summary>
+	CMessageDispatcher();
+	/// <summary> Frees the message dispatcher. </summary>
+	virtual ~CMessageDispatcher();
+
+	/// <summary> Opens the dispatcher and starts the dispatch thread. </summary>
+	/// <param name="Capacity"> The queue capacity. The value is rounded up to
+	///   the next power of two. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Open(const unsigned long Capacity = 1024);
+	/// <summary> Closes the dispatcher. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> Messages that were not dispatched yet are discarded. </remarks>
+	int Close();
+
+	/// <summary> Places a message to the queue. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object. A caller
+	///   is responsible to dispose the message object passed into the
+	///   method. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. If the queue is full and the overflow
+	///   policy is <c>opDropNewest</c> the method returns
+	///   <see cref="WCL_E_OUT_OF_MEMORY" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The method can be called from any thread. </remarks>
+	int Post(CwclMessage* const Message);
+	/// <summary> Places a message to the queue using the given overflow
+	///   policy instead of the dispatcher's one. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object. A caller
+	///   is responsible to dispose the message object passed into the
+	///   method. </param>
+	/// <param name="Overflow"> The overflow policy for this call. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. If the queue is full and the overflow
+	///   policy is <c>opDropNewest</c> the method returns
+	///   <see cref="WCL_E_OUT_OF_MEMORY" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> Use <c>opDropNewest</c> when the caller must never
+	///   wait. </remarks>
+	int Post(CwclMessage* const Message, const MessageOverflowPolicy Overflow);
+
+	/// <summary> Gets the dispatcher counters. </summary>
+	/// <param name="Counters"> On output contains the counters
+	///   snapshot. </param>
+	void GetCounters(MessageDispatcherCounters& Counters) const;
+	/// <summary> Resets the dispatcher counters. </summary>
+	void ResetCounters();
+
+	/// <summary> Gets the batch size. </summary>
+	/// <returns> The maximum number of messages delivered by the single
+	///   <c>OnMessages</c> event. </returns>
+	unsigned long GetBatchSize() const;
+	/// <summary> Sets the batch size. </summary>
+	/// <param name="Value"> The maximum number of messages delivered by the
+	///   single <c>OnMessages</c> event. 0 or 1 turns the batch mode off. The
+	///   default value is 1. The value is limited by the queue
+	///   capacity. </param>
+	void SetBatchSize(const unsigned long Value);
+	/// <summary> Gets and sets the batch size. </summary>
+	/// <value> The maximum number of messages per batch. </value>
+	__declspec(property(get = GetBatchSize, put = SetBatchSize))
+		unsigned long BatchSize;
+
+	/// <summary> Gets the wake up time budget. </summary>
+	/// <returns> The time budget in microseconds. </returns>
+	unsigned long GetBatchTime() const;
+	/// <summary> Sets the wake up time budget. </summary>
+	/// <param name="Value"> The maximum time in microseconds the dispatch
+	///   thread spends delivering messages on a single wake up. When the budget
+	///   is exhausted the thread yields the processor to the producers before it
+	///   continues. 0 means no limit (default). </param>
+	void SetBatchTime(const unsigned long Value);
+	/// <summary> Gets and sets the wake up time budget. </summary>
+	/// <value> The time budget in microseconds. </value>
+	__declspec(property(get = GetBatchTime, put = SetBatchTime))
+		unsigned long BatchTime;
+
+	/// <summary> Gets the dispatch pool. </summary>
+	/// <returns> The <see cref="CDispatchPool" /> object or <c>NULL</c> if the
+	///   dispatcher uses its own thread. </returns>
+	CDispatchPool* GetPool() const;
+	/// <summary> Sets the dispatch pool. </summary>
+	/// <param name="Value"> The <see cref="CDispatchPool" /> object or
+	///   <c>NULL</c> to use a dedicated thread (default). The pool must be
+	///   opened before the dispatcher and closed after it. The dispatcher does
+	///   not own the pool. </param>
+	/// <remarks> The pool can be changed only when the dispatcher is
+	///   closed. The <c>Close</c> method must not be called from the message
+	///   handler. </remarks>
+	void SetPool(CDispatchPool* const Value);
+	/// <summary> Gets and sets the dispatch pool. </summary>
+	/// <value> The <see cref="CDispatchPool" /> object. </value>
+	__declspec(property(get = GetPool, put = SetPool)) CDispatchPool* Pool;
+
+	/// <summary> Gets the statistics collector. </summary>
+	/// <returns> The <see cref="CMessageStats" /> object or <c>NULL</c> if the
+	///   instrumentation is off. </returns>
+	CMessageStats* GetStats() const;
+	/// <summary> Sets the statistics collector. </summary>
+	/// <param name="Value"> The <see cref="CMessageStats" /> object or
+	///   <c>NULL</c> to turn the instrumentation off (default). The dispatcher
+	///   does not own the object. </param>
+	/// <remarks> When the collector is set the dispatcher records the queue
+	///   wait and the handler time of every message and the queue depth. In
+	///   the batch mode the handler time of a batch is divided evenly between
+	///   its messages. The collector can be changed only when the dispatcher
+	///   is closed. </remarks>
+	void SetStats(CMessageStats* const Value);
+	/// <summary> Gets and sets the statistics collector. </summary>
+	/// <value> The <see cref="CMessageStats" /> object. </value>
+	__declspec(property(get = GetStats, put = SetStats)) CMessageStats* Stats;
+
+	/// <summary> Gets the queue capacity. </summary>
+	/// <returns> The queue capacity. 0 if the dispatcher is closed. </returns>
+	unsigned long GetCapacity() const;
+	/// <summary> Gets the queue capacity. </summary>
+	/// <value> The queue capacity. </value>
+	__declspec(property(get = GetCapacity)) unsigned long Capacity;
+
+	/// <summary> Gets the dispatcher status. </summary>
+	/// <returns> <c>True</c> if the dispatcher is opened. </returns>
+	bool GetListening() const;
+	/// <summary> Gets the dispatcher status. </summary>
+	/// <value> <c>True</c> if the dispatcher is opened. </value>
+	__declspec(property(get = GetListening)) bool Listening;
+
+	/// <summary> Gets the overflow policy. </summary>
+	/// <returns> The overflow policy. </returns>
+	/// <seealso cref="MessageOverflowPolicy" />
+	MessageOverflowPolicy GetOverflow() const;
+	/// <summary> Sets the overflow policy. </summary>
+	/// <param name="Value"> The overflow policy. The default value is
+	///   <c>opBlock</c>. </param>
+	/// <seealso cref="MessageOverflowPolicy" />
+	void SetOverflow(const MessageOverflowPolicy Value);
+	/// <summary> Gets and sets the overflow policy. </summary>
+	/// <value> The overflow policy. </value>
+	/// <seealso cref="MessageOverflowPolicy" />
+	__declspec(property(get = GetOverflow, put = SetOverflow))
+		MessageOverflowPolicy Overflow;
+
+	/// <summary> The event called when new message was received. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object represented
+	///   a message. </param>
+	/// <remarks> <para> The event fires in the dispatch thread. An application
+	///   is responsible for the synchronization with UI thread. </para>
+	///   <para> The <c>Message</c> object is valid only inside an event
+	///   handler. </para> </remarks>
+	wclMessageEvent(OnMessage);
+	/// <summary> The event called with the batch of the received messages in
+	///   the batch mode. </summary>
+	/// <param name="Messages"> The array of the <see cref="CwclMessage" />
+	///   objects in the order they were posted. </param>
+	/// <param name="Count"> The number of messages in the array. </param>
+	/// <remarks> The event fires in the dispatch thread. The array and the
+	///   messages are valid only inside an event handler. </remarks>
+	MessageBatchEvent(OnMessages);
+};
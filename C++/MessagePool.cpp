@@ -0,0 +1,297 @@
+// MessagePool.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "MessagePool.h"
+
+// DEBUG_NEW is not used here: the pooled messages define their own operator
+// new and the macro would break those definitions.
+
+// The number of message blocks allocated at once when a slab grows.
+static const unsigned long POOL_CHUNK_BLOCKS = 256;
+
+
+// CMessageSlab
+
+CMessageSlab::CMessageSlab(const unsigned long BlockSize, const unsigned long ChunkBlocks)
+{
+	// A free block holds the list entry, so it must be large and aligned
+	// enough for it.
+	unsigned long Size = max(BlockSize, static_cast<unsigned long>(sizeof(SLIST_ENTRY)));
+	FBlockSize = (Size + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(MEMORY_ALLOCATION_ALIGNMENT - 1);
+	FChunkBlocks = max(ChunkBlocks, 1UL);
+	FCS = new CwclCriticalSection();
+
+	FFree = static_cast<PSLIST_HEADER>(_aligned_malloc(sizeof(SLIST_HEADER),
+		MEMORY_ALLOCATION_ALIGNMENT));
+	if (FFree != NULL)
+		InitializeSListHead(FFree);
+
+	FCapacity = 0;
+	FInUse = 0;
+	FAllocations = 0;
+	FGrows = 0;
+}
+
+CMessageSlab::~CMessageSlab()
+{
+	for (CHUNKS::iterator i = FChunks.begin(); i != FChunks.end(); i++)
+		_aligned_free(*i);
+	FChunks.clear();
+
+	if (FFree != NULL)
+		_aligned_free(FFree);
+	delete FCS;
+}
+
+bool CMessageSlab::Grow()
+{
+	unsigned char* Chunk = static_cast<unsigned char*>(_aligned_malloc(
+		FBlockSize * FChunkBlocks, MEMORY_ALLOCATION_ALIGNMENT));
+	if (Chunk == NULL)
+		return false;
+
+	FChunks.push_back(Chunk);
+	for (unsigned long i = 0; i < FChunkBlocks; i++)
+		InterlockedPushEntrySList(FFree, reinterpret_cast<PSLIST_ENTRY>(Chunk + i * FBlockSize));
+
+	InterlockedExchangeAdd(&FCapacity, static_cast<LONG>(FChunkBlocks));
+	InterlockedIncrement(&FGrows);
+	return true;
+}
+
+void* CMessageSlab::Allocate()
+{
+	if (FFree == NULL)
+		return NULL;
+
+	PSLIST_ENTRY Entry = InterlockedPopEntrySList(FFree);
+	if (Entry == NULL)
+	{
+		// Only one thread grows the slab. Others may have already done it
+		// while we were waiting.
+		FCS->Enter();
+		Entry = InterlockedPopEntrySList(FFree);
+		if (Entry == NULL && Grow())
+			Entry = InterlockedPopEntrySList(FFree);
+		FCS->Leave();
+
+		if (Entry == NULL)
+			return NULL;
+	}
+
+	InterlockedIncrement(&FInUse);
+	InterlockedIncrement(&FAllocations);
+	return Entry;
+}
+
+void CMessageSlab::Free(void* const Block)
+{
+	if (Block == NULL)
+		return;
+
+	InterlockedPushEntrySList(FFree, static_cast<PSLIST_ENTRY>(Block));
+	InterlockedDecrement(&FInUse);
+}
+
+void CMessageSlab::GetStatistics(MessageSlabStatistics& Statistics) const
+{
+	Statistics.BlockSize = FBlockSize;
+	Statistics.Capacity = static_cast<unsigned long>(FCapacity);
+	Statistics.InUse = static_cast<unsigned long>(FInUse);
+	Statistics.Allocations = static_cast<unsigned long>(FAllocations);
+	Statistics.Grows = static_cast<unsigned long>(FGrows);
+}
+
+
+// CAdvertisementMessage
+
+CAdvertisementMessage::CAdvertisementMessage(const __int64 Address,
+	const __int64 Timestamp, const char Rssi, const unsigned char* const Data,
+	const unsigned long Length)
+	: CwclMessage(APP_MSG_ID_ADVERTISEMENT, mcUser)
+{
+	FAddress = Address;
+	FRssi = Rssi;
+	FTimestamp = Timestamp;
+
+	if (Data == NULL)
+		FLength = 0;
+	else
+		FLength = Length;
+	if (FLength <= APP_ADV_INLINE_SIZE)
+		FData = FInline;
+	else
+		FData = new unsigned char[FLength];
+	if (FLength > 0)
+		CopyMemory(FData, Data, FLength);
+}
+
+CAdvertisementMessage::~CAdvertisementMessage()
+{
+	if (FData != FInline)
+		delete[] FData;
+}
+
+CMessageSlab& CAdvertisementMessage::Slab()
+{
+	static CMessageSlab Slab(sizeof(CAdvertisementMessage), POOL_CHUNK_BLOCKS);
+	return Slab;
+}
+
+void* CAdvertisementMessage::operator new(size_t Size)
+{
+	UNREFERENCED_PARAMETER(Size);
+
+	void* Block = Slab().Allocate();
+	if (Block == NULL)
+		AfxThrowMemoryException();
+	return Block;
+}
+
+void CAdvertisementMessage::operator delete(void* Block)
+{
+	Slab().Free(Block);
+}
+
+#ifdef _DEBUG
+void* CAdvertisementMessage::operator new(size_t Size, LPCSTR lpszFileName, int nLine)
+{
+	UNREFERENCED_PARAMETER(lpszFileName);
+	UNREFERENCED_PARAMETER(nLine);
+
+	return operator new(Size);
+}
+
+void CAdvertisementMessage::operator delete(void* Block, LPCSTR lpszFileName, int nLine)
+{
+	UNREFERENCED_PARAMETER(lpszFileName);
+	UNREFERENCED_PARAMETER(nLine);
+
+	operator delete(Block);
+}
+#endif
+
+void CAdvertisementMessage::GetStatistics(MessageSlabStatistics& Statistics)
+{
+	Slab().GetStatistics(Statistics);
+}
+
+__int64 CAdvertisementMessage::GetAddress() const
+{
+	return FAddress;
+}
+
+const unsigned char* CAdvertisementMessage::GetData() const
+{
+	return FData;
+}
+
+unsigned long CAdvertisementMessage::GetLength() const
+{
+	return FLength;
+}
+
+char CAdvertisementMessage::GetRssi() const
+{
+	return FRssi;
+}
+
+__int64 CAdvertisementMessage::GetTimestamp() const
+{
+	return FTimestamp;
+}
+
+
+// CCharacteristicChangedMessage
+
+CCharacteristicChangedMessage::CCharacteristicChangedMessage(const __int64 Address,
+	const unsigned short Handle, const unsigned char* const Value,
+	const unsigned long Length)
+	: CwclMessage(APP_MSG_ID_CHARACTERISTIC_CHANGED, mcUser)
+{
+	FAddress = Address;
+	FHandle = Handle;
+
+	if (Value == NULL)
+		FLength = 0;
+	else
+		FLength = Length;
+	if (FLength <= APP_ATT_INLINE_SIZE)
+		FValue = FInline;
+	else
+		FValue = new unsigned char[FLength];
+	if (FLength > 0)
+		CopyMemory(FValue, Value, FLength);
+}
+
+CCharacteristicChangedMessage::~CCharacteristicChangedMessage()
+{
+	if (FValue != FInline)
+		delete[] FValue;
+}
+
+CMessageSlab& CCharacteristicChangedMessage::Slab()
+{
+	static CMessageSlab Slab(sizeof(CCharacteristicChangedMessage), POOL_CHUNK_BLOCKS);
+	return Slab;
+}
+
+void* CCharacteristicChangedMessage::operator new(size_t Size)
+{
+	UNREFERENCED_PARAMETER(Size);
+
+	void* Block = Slab().Allocate();
+	if (Block == NULL)
+		AfxThrowMemoryException();
+	return Block;
+}
+
+void CCharacteristicChangedMessage::operator delete(void* Block)
+{
+	Slab().Free(Block);
+}
+
+#ifdef _DEBUG
+void* CCharacteristicChangedMessage::operator new(size_t Size, LPCSTR lpszFileName, int nLine)
+{
+	UNREFERENCED_PARAMETER(lpszFileName);
+	UNREFERENCED_PARAMETER(nLine);
+
+	return operator new(Size);
+}
+
+void CCharacteristicChangedMessage::operator delete(void* Block, LPCSTR lpszFileName,
+	int nLine)
+{
+	UNREFERENCED_PARAMETER(lpszFileName);
+	UNREFERENCED_PARAMETER(nLine);
+
+	operator delete(Block);
+}
+#endif
+
+void CCharacteristicChangedMessage::GetStatistics(MessageSlabStatistics& Statistics)
+{
+	Slab().GetStatistics(Statistics);
+}
+
+__int64 CCharacteristicChangedMessage::GetAddress() const
+{
+	return FAddress;
+}
+
+unsigned short CCharacteristicChangedMessage::GetHandle() const
+{
+	return FHandle;
+}
+
+unsigned long CCharacteristicChangedMessage::GetLength() const
+{
+	return FLength;
+}
+
+const unsigned char* CCharacteristicChangedMessage::GetValue() const
+{
+	return FValue;
+}
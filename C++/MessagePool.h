@@ -0,0 +1,250 @@
+// MessagePool.h : pooled allocation-free messages for the hot message paths
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+using namespace wclCommon;
+
+/// <summary> The pooled advertisement message ID. The message category is
+///   <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_ADVERTISEMENT = 1;
+/// <summary> The pooled characteristic changed message ID. The message
+///   category is <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_CHARACTERISTIC_CHANGED = 2;
+
+/// <summary> The maximum legacy advertising payload size stored inline. </summary>
+const unsigned long APP_ADV_INLINE_SIZE = 31;
+/// <summary> The maximum ATT value size stored inline. </summary>
+const unsigned long APP_ATT_INLINE_SIZE = 247;
+
+/// <summary> The message slab statistics. </summary>
+typedef struct
+{
+	/// <summary> The size of a single block in bytes. </summary>
+	unsigned long BlockSize;
+	/// <summary> The total number of blocks in the slab. </summary>
+	unsigned long Capacity;
+	/// <summary> The number of blocks currently in use. </summary>
+	unsigned long InUse;
+	/// <summary> The total number of allocations served. </summary>
+	unsigned long Allocations;
+	/// <summary> The number of times the slab had to grow. </summary>
+	unsigned long Grows;
+} MessageSlabStatistics;
+
+/// <summary> The fixed size block allocator used by the pooled
+///   messages. </summary>
+/// <remarks> <para> Free blocks are kept in a lock-free interlocked singly
+///   linked list so allocation and release from any thread cost a single
+///   interlocked operation. Blocks are carved from chunks that are never
+///   returned to the system until the slab is destroyed. </para>
+///   <para> Only growing the slab takes a lock. </para> </remarks>
+class CMessageSlab
+{
+	DISABLE_COPY(CMessageSlab);
+
+private:
+	typedef std::vector<void*> CHUNKS;
+
+	unsigned long			FBlockSize;
+	unsigned long			FChunkBlocks;
+	CHUNKS					FChunks;
+	CwclCriticalSection*	FCS;
+	PSLIST_HEADER			FFree;
+
+	volatile LONG			FCapacity;
+	volatile LONG			FInUse;
+	volatile LONG			FAllocations;
+	volatile LONG			FGrows;
+
+	bool Grow();
+
+public:
+	/// <summary> Creates new slab. </summary>
+	/// <param name="BlockSize"> The block size in bytes. </param>
+	/// <param name="ChunkBlocks"> The number of blocks allocated at once when
+	///   the slab grows. </param>
+	CMessageSlab(const unsigned long BlockSize, const unsigned long ChunkBlocks);
+	/// <summary> Frees the slab and all its chunks. </summary>
+	/// <remarks> All the blocks must be released before the slab is
+	///   destroyed. </remarks>
+	virtual ~CMessageSlab();
+
+	/// <summary> Allocates a block. </summary>
+	/// <returns> The pointer to the block or <c>NULL</c> if there is no
+	///   memory. </returns>
+	void* Allocate();
+	/// <summary> Returns the block to the slab. </summary>
+	/// <param name="Block"> The block allocated by the <c>Allocate</c>
+	///   method. </param>
+	void Free(void* const Block);
+
+	/// <summary> Gets the slab statistics. </summary>
+	/// <param name="Statistics"> On output contains the statistics
+	///   snapshot. </param>
+	void GetStatistics(MessageSlabStatistics& Statistics) const;
+};
+
+/// <summary> The pooled Bluetooth LE advertisement message. </summary>
+/// <remarks> <para> The message object is allocated from its own slab and is
+///   returned there by the final <c>Release</c>. Legacy advertising payloads
+///   of up to <c>APP_ADV_INLINE_SIZE</c> bytes are stored inline so
+///   posting an advertisement does not touch the heap at all. Larger
+///   (extended advertising) payloads fall back to a heap copy. </para>
+///   <para> The message category is <c>mcUser</c> and the ID is
+///   <c>APP_MSG_ID_ADVERTISEMENT</c>. </para> </remarks>
+class CAdvertisementMessage final : public CwclMessage
+{
+	DISABLE_COPY(CAdvertisementMessage);
+
+private:
+	__int64			FAddress;
+	unsigned char*	FData;
+	unsigned char	FInline[APP_ADV_INLINE_SIZE];
+	unsigned long	FLength;
+	char			FRssi;
+	__int64			FTimestamp;
+
+	static CMessageSlab& Slab();
+
+public:
+	/// <summary> Creates new advertisement message. </summary>
+	/// <param name="Address"> The advertiser MAC address. </param>
+	/// <param name="Timestamp"> The advertisement timestamp. </param>
+	/// <param name="Rssi"> The advertisement RSSI. </param>
+	/// <param name="Data"> The raw advertisement data. </param>
+	/// <param name="Length"> The raw advertisement data length. </param>
+	CAdvertisementMessage(const __int64 Address, const __int64 Timestamp,
+		const char Rssi, const unsigned char* const Data, const unsigned long Length);
+	/// <summary> Frees the message. </summary>
+	virtual ~CAdvertisementMessage();
+
+	/// <summary> Allocates the message object from the slab. </summary>
+	static void* operator new(size_t Size);
+	/// <summary> Returns the message object to the slab. </summary>
+	static void operator delete(void* Block);
+#ifdef _DEBUG
+	static void* operator new(size_t Size, LPCSTR lpszFileName, int nLine);
+	static void operator delete(void* Block, LPCSTR lpszFileName, int nLine);
+#endif
+
+	/// <summary> Gets the advertisement message slab statistics. </summary>
+	/// <param name="Statistics"> On output contains the statistics
+	///   snapshot. </param>
+	static void GetStatistics(MessageSlabStatistics& Statistics);
+
+	/// <summary> Gets the advertiser MAC address. </summary>
+	/// <returns> The MAC address. </returns>
+	__int64 GetAddress() const;
+	/// <summary> Gets the advertiser MAC address. </summary>
+	/// <value> The MAC address. </value>
+	__declspec(property(get = GetAddress)) __int64 Address;
+
+	/// <summary> Gets the raw advertisement data. </summary>
+	/// <returns> The pointer to the data. </returns>
+	const unsigned char* GetData() const;
+	/// <summary> Gets the raw advertisement data. </summary>
+	/// <value> The pointer to the data. </value>
+	__declspec(property(get = GetData)) const unsigned char* Data;
+
+	/// <summary> Gets the raw advertisement data length. </summary>
+	/// <returns> The data length in bytes. </returns>
+	unsigned long GetLength() const;
+	/// <summary> Gets the raw advertisement data length. </summary>
+	/// <value> The data length in bytes. </value>
+	__declspec(property(get = GetLength)) unsigned long Length;
+
+	/// <summary> Gets the advertisement RSSI. </summary>
+	/// <returns> The RSSI value. </returns>
+	char GetRssi() const;
+	/// <summary> Gets the advertisement RSSI. </summary>
+	/// <value> The RSSI value. </value>
+	__declspec(property(get = GetRssi)) char Rssi;
+
+	/// <summary> Gets the advertisement timestamp. </summary>
+	/// <returns> The timestamp. </returns>
+	__int64 GetTimestamp() const;
+	/// <summary> Gets the advertisement timestamp. </summary>
+	/// <value> The timestamp. </value>
+	__declspec(property(get = GetTimestamp)) __int64 Timestamp;
+};
+
+/// <summary> The pooled GATT characteristic changed message. </summary>
+/// <remarks> <para> The message object is allocated from its own slab and is
+///   returned there by the final <c>Release</c>. Values of up to
+///   <c>APP_ATT_INLINE_SIZE</c> bytes are stored inline. Larger values fall
+///   back to a heap copy. </para>
+///   <para> The message category is <c>mcUser</c> and the ID is
+///   <c>APP_MSG_ID_CHARACTERISTIC_CHANGED</c>. </para> </remarks>
+class CCharacteristicChangedMessage final : public CwclMessage
+{
+	DISABLE_COPY(CCharacteristicChangedMessage);
+
+private:
+	__int64			FAddress;
+	unsigned short	FHandle;
+	unsigned long	FLength;
+	unsigned char*	FValue;
+	unsigned char	FInline[APP_ATT_INLINE_SIZE];
+
+	static CMessageSlab& Slab();
+
+public:
+	/// <summary> Creates new characteristic changed message. </summary>
+	/// <param name="Address"> The GATT server MAC address. </param>
+	/// <param name="Handle"> The characteristic value handle. </param>
+	/// <param name="Value"> The characteristic value. </param>
+	/// <param name="Length"> The characteristic value length. </param>
+	CCharacteristicChangedMessage(const __int64 Address, const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+	/// <summary> Frees the message. </summary>
+	virtual ~CCharacteristicChangedMessage();
+
+	/// <summary> Allocates the message object from the slab. </summary>
+	static void* operator new(size_t Size);
+	/// <summary> Returns the message object to the slab. </summary>
+	static void operator delete(void* Block);
+#ifdef _DEBUG
+	static void* operator new(size_t Size, LPCSTR lpszFileName, int nLine);
+	static void operator delete(void* Block, LPCSTR lpszFileName, int nLine);
+#endif
+
+	/// <summary> Gets the characteristic changed message slab
+	///   statistics. </summary>
+	/// <param name="Statistics"> On output contains the statistics
+	///   snapshot. </param>
+	static void GetStatistics(MessageSlabStatistics& Statistics);
+
+	/// <summary> Gets the GATT server MAC address. </summary>
+	/// <returns> The MAC address. </returns>
+	__int64 GetAddress() const;
+	/// <summary> Gets the GATT server MAC address. </summary>
+	/// <value> The MAC address. </value>
+	__declspec(property(get = GetAddress)) __int64 Address;
+
+	/// <summary> Gets the characteristic value handle. </summary>
+	/// <returns> The characteristic value handle. </returns>
+	unsigned short GetHandle() const;
+	/// <summary> Gets the characteristic value handle. </summary>
+	/// <value> The characteristic value handle. </value>
+	__declspec(property(get = GetHandle)) unsigned short Handle;
+
+	/// <summary> Gets the characteristic value length. </summary>
+	/// <returns> The value length in bytes. </returns>
+	unsigned long GetLength() const;
+	/// <summary> Gets the characteristic value length. </summary>
+	/// <value> The value length in bytes. </value>
+	__declspec(property(get = GetLength)) unsigned long Length;
+
+	/// <summary> Gets the characteristic value. </summary>
+	/// <returns> The pointer to the value. </returns>
+	const unsigned char* GetValue() const;
+	/// <summary> Gets the characteristic value. </summary>
+	/// <value> The pointer to the value. </value>
+	__declspec(property(get = GetValue)) const unsigned char* Value;
+};
@@ -0,0 +1,276 @@
+// MessageStats.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static const LPCTSTR CATEGORY_NAMES[] = {
+	_T("Audio"), _T("Bluetooth"), _T("Connection"), _T("Power"), _T("Serial"),
+	_T("System"), _T("Usb"), _T("User"), _T("WiFi"), _T("WiiRemote") };
+
+static LPCTSTR CategoryName(const wclMessageCategory Category)
+{
+	if (static_cast<unsigned long>(Category) < _countof(CATEGORY_NAMES))
+		return CATEGORY_NAMES[Category];
+	return _T("Unknown");
+}
+
+
+// CLatencyHistogram
+
+CLatencyHistogram::CLatencyHistogram()
+{
+	Reset();
+}
+
+unsigned long CLatencyHistogram::BucketIndex(const unsigned long Value)
+{
+	if (Value < 32)
+		return Value;
+
+	unsigned long Msb;
+	_BitScanReverse(&Msb, Value);
+	return 32 + (Msb - 5) * 16 + ((Value >> (Msb - 4)) & 15);
+}
+
+unsigned long CLatencyHistogram::BucketValue(const unsigned long Index)
+{
+	if (Index < 32)
+		return Index;
+
+	unsigned long Group = (Index - 32) / 16;
+	unsigned long Sub = (Index - 32) % 16;
+	return (16 + Sub) << (Group + 1);
+}
+
+unsigned long CLatencyHistogram::Percentile(const LONG* const Counts,
+	const unsigned long Count, const unsigned long Percent) const
+{
+	if (Count == 0)
+		return 0;
+
+	unsigned __int64 Target = (static_cast<unsigned __int64>(Count) * Percent + 99) / 100;
+	unsigned __int64 Seen = 0;
+	for (unsigned long i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		Seen += Counts[i];
+		if (Seen >= Target)
+			return BucketValue(i);
+	}
+	return BucketValue(LATENCY_BUCKETS - 1);
+}
+
+void CLatencyHistogram::Record(const unsigned long Value)
+{
+	InterlockedIncrement(&FCounts[BucketIndex(Value)]);
+	InterlockedIncrement(&FCount);
+	InterlockedExchangeAdd64(&FSum, Value);
+
+	LONG Max = FMax;
+	while (static_cast<unsigned long>(Max) < Value)
+	{
+		LONG Prev = InterlockedCompareExchange(&FMax, static_cast<LONG>(Value), Max);
+		if (Prev == Max)
+			break;
+		Max = Prev;
+	}
+}
+
+void CLatencyHistogram::Reset()
+{
+	for (unsigned long i = 0; i < LATENCY_BUCKETS; i++)
+		FCounts[i] = 0;
+	FCount = 0;
+	FSum = 0;
+	FMax = 0;
+}
+
+void CLatencyHistogram::GetSummary(LatencySummary& Summary) const
+{
+	// Take a copy first: other threads may record while we count.
+	LONG Counts[LATENCY_BUCKETS];
+	unsigned long Count = 0;
+	for (unsigned long i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		Counts[i] = FCounts[i];
+		Count += Counts[i];
+	}
+
+	Summary.Count = Count;
+	LONG Samples = FCount;
+	if (Samples == 0)
+		Summary.Mean = 0;
+	else
+		Summary.Mean = static_cast<unsigned long>(FSum / Samples);
+	Summary.P50 = Percentile(Counts, Count, 50);
+	Summary.P90 = Percentile(Counts, Count, 90);
+	Summary.P99 = Percentile(Counts, Count, 99);
+	Summary.Max = static_cast<unsigned long>(FMax);
+}
+
+
+// CMessageStats
+
+CMessageStats::CMessageStats()
+{
+	for (unsigned long c = 0; c < CATEGORIES; c++)
+	{
+		for (unsigned long i = 0; i < IDS; i++)
+			FEntries[c][i] = NULL;
+	}
+	FHighWater = 0;
+}
+
+CMessageStats::~CMessageStats()
+{
+	for (unsigned long c = 0; c < CATEGORIES; c++)
+	{
+		for (unsigned long i = 0; i < IDS; i++)
+			delete FEntries[c][i];
+	}
+}
+
+CMessageStats::ENTRY* CMessageStats::GetEntry(const CwclMessage* const Message)
+{
+	unsigned long Category = static_cast<unsigned long>(Message->Category);
+	if (Category >= CATEGORIES)
+		return NULL;
+
+	ENTRY* volatile* Slot = &FEntries[Category][Message->Id];
+	ENTRY* Entry = *Slot;
+	if (Entry == NULL)
+	{
+		// First sample of this message kind. If another thread wins the race
+		// use its entry.
+		ENTRY* New = new ENTRY;
+		Entry = static_cast<ENTRY*>(InterlockedCompareExchangePointer(
+			reinterpret_cast<PVOID volatile*>(Slot), New, NULL));
+		if (Entry == NULL)
+			Entry = New;
+		else
+			delete New;
+	}
+	return Entry;
+}
+
+unsigned __int64 CMessageStats::Now()
+{
+	static LARGE_INTEGER Frequency = { 0 };
+	if (Frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&Frequency);
+
+	LARGE_INTEGER Counter;
+	QueryPerformanceCounter(&Counter);
+	// Split the conversion: Counter * 1000000 overflows after a few weeks of
+	// uptime on a 10 MHz counter.
+	unsigned __int64 Ticks = static_cast<unsigned __int64>(Counter.QuadPart);
+	unsigned __int64 Freq = static_cast<unsigned __int64>(Frequency.QuadPart);
+	return (Ticks / Freq) * 1000000 + (Ticks % Freq) * 1000000 / Freq;
+}
+
+void CMessageStats::Record(const CwclMessage* const Message, const unsigned long Wait,
+	const unsigned long Handler)
+{
+	if (Message == NULL)
+		return;
+
+	ENTRY* Entry = GetEntry(Message);
+	if (Entry != NULL)
+	{
+		Entry->Wait.Record(Wait);
+		Entry->Handler.Record(Handler);
+	}
+}
+
+void CMessageStats::RecordReceived(const CwclMessage* const Message)
+{
+	if (Message == NULL || Message->Queued == 0)
+		return;
+
+	ENTRY* Entry = GetEntry(Message);
+	if (Entry != NULL)
+		Entry->Wait.Record((GetTickCount() - Message->Queued) * 1000);
+}
+
+void CMessageStats::RecordDepth(const unsigned long Depth)
+{
+	LONG HighWater = FHighWater;
+	while (static_cast<unsigned long>(HighWater) < Depth)
+	{
+		LONG Prev = InterlockedCompareExchange(&FHighWater, static_cast<LONG>(Depth),
+			HighWater);
+		if (Prev == HighWater)
+			break;
+		HighWater = Prev;
+	}
+}
+
+void CMessageStats::Reset()
+{
+	for (unsigned long c = 0; c < CATEGORIES; c++)
+	{
+		for (unsigned long i = 0; i < IDS; i++)
+		{
+			ENTRY* Entry = FEntries[c][i];
+			if (Entry != NULL)
+			{
+				Entry->Wait.Reset();
+				Entry->Handler.Reset();
+			}
+		}
+	}
+	FHighWater = 0;
+}
+
+void CMessageStats::GetSnapshot(MessageStatsSnapshot& Snapshot) const
+{
+	Snapshot.HighWater = static_cast<unsigned long>(FHighWater);
+	Snapshot.Messages.clear();
+
+	for (unsigned long c = 0; c < CATEGORIES; c++)
+	{
+		for (unsigned long i = 0; i < IDS; i++)
+		{
+			ENTRY* Entry = FEntries[c][i];
+			if (Entry != NULL)
+			{
+				MessageLatency Latency;
+				Latency.Category = static_cast<wclMessageCategory>(c);
+				Latency.Id = static_cast<unsigned char>(i);
+				Entry->Wait.GetSummary(Latency.Wait);
+				Entry->Handler.GetSummary(Latency.Handler);
+				if (Latency.Wait.Count > 0 || Latency.Handler.Count > 0)
+					Snapshot.Messages.push_back(Latency);
+			}
+		}
+	}
+}
+
+tstring CMessageStats::ToText() const
+{
+	MessageStatsSnapshot Snapshot;
+	GetSnapshot(Snapshot);
+
+	TCHAR Line[256];
+	_stprintf_s(Line, _countof(Line), _T("Queue high-water: %u\r\n"), Snapshot.HighWater);
+	tstring Text = Line;
+	Text += _T("Category    Id   Count      Wait us p50/p90/p99/max")
+		_T("            Handler us p50/p90/p99/max\r\n");
+
+	for (MessageLatencies::const_iterator m = Snapshot.Messages.begin();
+		m != Snapshot.Messages.end(); m++)
+	{
+		const MessageLatency& l = *m;
+		_stprintf_s(Line, _countof(Line),
+			_T("%-10s %3u %7u %8u/%u/%u/%u %12u/%u/%u/%u\r\n"),
+			CategoryName(l.Category), l.Id, max(l.Wait.Count, l.Handler.Count),
+			l.Wait.P50, l.Wait.P90, l.Wait.P99, l.Wait.Max,
+			l.Handler.P50, l.Handler.P90, l.Handler.P99, l.Handler.Max);
+		Text += Line;
+	}
+	return Text;
+}
@@ -0,0 +1,159 @@
+// MessageStats.h : message latency instrumentation
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclMessaging.h"
+
+using namespace wclCommon;
+
+/// <summary> The number of the latency histogram buckets. </summary>
+/// <remarks> Values below 32 microseconds have their own buckets. Every
+///   following power of two is split into 16 buckets, so the relative error
+///   stays below 6.25% up to 2^32 microseconds. </remarks>
+const unsigned long LATENCY_BUCKETS = 32 + 27 * 16;
+
+/// <summary> The summary of a latency histogram. </summary>
+typedef struct
+{
+	/// <summary> The number of recorded samples. </summary>
+	unsigned long Count;
+	/// <summary> The mean value in microseconds. </summary>
+	unsigned long Mean;
+	/// <summary> The median in microseconds. </summary>
+	unsigned long P50;
+	/// <summary> The 90th percentile in microseconds. </summary>
+	unsigned long P90;
+	/// <summary> The 99th percentile in microseconds. </summary>
+	unsigned long P99;
+	/// <summary> The maximum value in microseconds. </summary>
+	unsigned long Max;
+} LatencySummary;
+
+/// <summary> The latency statistics of a single message kind. </summary>
+typedef struct
+{
+	/// <summary> The message category. </summary>
+	wclMessageCategory Category;
+	/// <summary> The message ID. </summary>
+	unsigned char Id;
+	/// <summary> The time the messages spent in the queue. </summary>
+	LatencySummary Wait;
+	/// <summary> The time the messages spent in the handler. </summary>
+	LatencySummary Handler;
+} MessageLatency;
+/// <summary> The list of the message latency statistics. </summary>
+typedef std::vector<MessageLatency> MessageLatencies;
+
+/// <summary> The message statistics snapshot. </summary>
+typedef struct
+{
+	/// <summary> The maximum queue depth seen. </summary>
+	unsigned long HighWater;
+	/// <summary> The statistics per message kind. Only kinds with recorded
+	///   samples are included. </summary>
+	MessageLatencies Messages;
+} MessageStatsSnapshot;
+
+/// <summary> The lock-free log-linear latency histogram. </summary>
+class CLatencyHistogram
+{
+	DISABLE_COPY(CLatencyHistogram);
+
+private:
+	volatile LONG		FCounts[LATENCY_BUCKETS];
+	volatile LONG		FCount;
+	volatile LONGLONG	FSum;
+	volatile LONG		FMax;
+
+	static unsigned long BucketIndex(const unsigned long Value);
+	static unsigned long BucketValue(const unsigned long Index);
+
+	unsigned long Percentile(const LONG* const Counts, const unsigned long Count,
+		const unsigned long Percent) const;
+
+public:
+	/// <summary> Creates new empty histogram. </summary>
+	CLatencyHistogram();
+
+	/// <summary> Records the sample. </summary>
+	/// <param name="Value"> The sample value in microseconds. </param>
+	/// <remarks> The method can be called from any thread. </remarks>
+	void Record(const unsigned long Value);
+	/// <summary> Clears the histogram. </summary>
+	void Reset();
+
+	/// <summary> Gets the histogram summary. </summary>
+	/// <param name="Summary"> On output contains the summary. </param>
+	void GetSummary(LatencySummary& Summary) const;
+};
+
+/// <summary> The message latency statistics collector. </summary>
+/// <remarks> <para> The collector keeps a queue wait and a handler time
+///   histogram per message category and ID, plus the queue depth high-water
+///   mark. Histograms are created on the first sample of the message kind;
+///   recording itself takes no lock. </para>
+///   <para> Assign the collector to the <c>CMessageDispatcher.Stats</c>
+///   property to instrument a dispatcher, or call <c>RecordReceived</c> from
+///   the <c>CwclMessageReceiver</c> message handler. </para> </remarks>
+class CMessageStats
+{
+	DISABLE_COPY(CMessageStats);
+
+private:
+	static const unsigned long CATEGORIES = mcWiiRemote + 1;
+	static const unsigned long IDS = 256;
+
+	typedef struct
+	{
+		CLatencyHistogram	Wait;
+		CLatencyHistogram	Handler;
+	} ENTRY;
+
+	ENTRY* volatile	FEntries[CATEGORIES][IDS];
+	volatile LONG	FHighWater;
+
+	ENTRY* GetEntry(const CwclMessage* const Message);
+
+public:
+	/// <summary> Creates new statistics collector. </summary>
+	CMessageStats();
+	/// <summary> Frees the statistics collector. </summary>
+	virtual ~CMessageStats();
+
+	/// <summary> Gets the current timestamp. </summary>
+	/// <returns> The timestamp in microseconds. </returns>
+	static unsigned __int64 Now();
+
+	/// <summary> Records the message processing times. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object. </param>
+	/// <param name="Wait"> The time the message spent in the queue in
+	///   microseconds. </param>
+	/// <param name="Handler"> The time the message spent in the handler in
+	///   microseconds. </param>
+	void Record(const CwclMessage* const Message, const unsigned long Wait,
+		const unsigned long Handler);
+	/// <summary> Records the queue wait of the message delivered by the
+	///   <c>CwclMessageReceiver</c>. </summary>
+	/// <param name="Message"> The <see cref="CwclMessage" /> object. </param>
+	/// <remarks> The method must be called from the receiver's
+	///   <c>OnMessage</c> event handler. The wait is calculated from the message
+	///   <c>Queued</c> timestamp so its resolution is the system tick. </remarks>
+	void RecordReceived(const CwclMessage* const Message);
+	/// <summary> Records the queue depth. </summary>
+	/// <param name="Depth"> The current queue depth. </param>
+	void RecordDepth(const unsigned long Depth);
+
+	/// <summary> Clears all the statistics. </summary>
+	void Reset();
+
+	/// <summary> Gets the statistics snapshot. </summary>
+	/// <param name="Snapshot"> On output contains the snapshot. </param>
+	void GetSnapshot(MessageStatsSnapshot& Snapshot) const;
+	/// <summary> Formats the statistics snapshot as text. </summary>
+	/// <returns> The multi-line text table. One line per message
+	///   kind. </returns>
+	tstring ToText() const;
+};
@@ -0,0 +1,340 @@
+// PairingPolicy.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "PairingPolicy.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The number of the bits in a MAC address.
+static const unsigned char POLICY_ADDRESS_BITS = 48;
+// Find result: a matching rule needs the device address type.
+static const int POLICY_NEED_ADDRESS_TYPE = -2;
+// The requests answered with values only: they can not be rejected.
+static const unsigned long POLICY_NO_REJECT_REQUESTS = PAIRING_REQUEST_PASSKEY |
+	PAIRING_REQUEST_IO_CAPABILITY | PAIRING_REQUEST_PROTECTION_LEVEL;
+
+
+// CPairingPolicy
+
+CPairingPolicy::CPairingPolicy()
+{
+	FCS = new CwclCriticalSection();
+	FLogNext = 0;
+	FLogSize = 64;
+}
+
+CPairingPolicy::~CPairingPolicy()
+{
+	delete FCS;
+}
+
+bool CPairingPolicy::Matches(const PairingRule& Rule, const __int64 Address)
+{
+	if (Rule.PrefixBits == 0)
+		return true;
+
+	unsigned __int64 Mask = ((1ULL << Rule.PrefixBits) - 1) <<
+		(POLICY_ADDRESS_BITS - Rule.PrefixBits);
+	return ((static_cast<unsigned __int64>(Address) & Mask) ==
+		(static_cast<unsigned __int64>(Rule.Address) & Mask));
+}
+
+int CPairingPolicy::Find(const __int64 Address, const PairingRequest Request,
+	const bool TypeRead, const wclBluetoothAddressType* const AddressType) const
+{
+	unsigned long Flag = 1UL << Request;
+	for (size_t i = 0; i < FRules.size(); i++)
+	{
+		const PairingRule& Rule = FRules[i];
+		if ((Rule.Requests & Flag) == 0 || !Matches(Rule, Address))
+			continue;
+
+		if (Rule.MatchAddressType)
+		{
+			if (!TypeRead)
+				return POLICY_NEED_ADDRESS_TYPE;
+			if (AddressType == NULL || *AddressType != Rule.AddressType)
+				continue;
+		}
+		return static_cast<int>(i);
+	}
+	return -1;
+}
+
+int CPairingPolicy::Lookup(CwclBluetoothRadio* const Radio, const __int64 Address,
+	const PairingRequest Request)
+{
+	FCS->Enter();
+	int Rule = Find(Address, Request, false, NULL);
+	if (Rule == POLICY_NEED_ADDRESS_TYPE)
+	{
+		// The address type is a driver call: never made inside the lock.
+		// The rules may change meanwhile, so they are checked again.
+		FCS->Leave();
+		wclBluetoothAddressType AddressType;
+		bool TypeValid = (Radio->GetRemoteAddressType(Address, AddressType) == WCL_E_SUCCESS);
+		FCS->Enter();
+		Rule = Find(Address, Request, true, TypeValid ? &AddressType : NULL);
+	}
+	return Rule;
+}
+
+void CPairingPolicy::Log(const __int64 Address, const PairingRequest Request,
+	const int Rule, const PairingAction Action, const unsigned __int64 Time)
+{
+	if (FLogSize == 0)
+		return;
+
+	PairingDecision Decision;
+	Decision.Address = Address;
+	Decision.Request = Request;
+	Decision.Rule = Rule;
+	Decision.Action = Action;
+	Decision.Time = Time;
+	Decision.Duration = static_cast<unsigned long>(CMessageStats::Now() - Time);
+
+	if (FLog.size() < FLogSize)
+		FLog.push_back(Decision);
+	else
+		FLog[FLogNext] = Decision;
+	FLogNext = (FLogNext + 1) % FLogSize;
+}
+
+void CPairingPolicy::CopyLog(PairingDecisions& Decisions) const
+{
+	Decisions.clear();
+	Decisions.reserve(FLog.size());
+	// Once the ring is full the oldest decision is at the next position.
+	size_t First = (FLog.size() < FLogSize ? 0 : FLogNext);
+	for (size_t i = 0; i < FLog.size(); i++)
+		Decisions.push_back(FLog[(First + i) % FLog.size()]);
+}
+
+int CPairingPolicy::Add(const PairingRule& Rule)
+{
+	if (Rule.PrefixBits > POLICY_ADDRESS_BITS || (Rule.Requests & PAIRING_REQUEST_ALL) == 0)
+		return WCL_E_INVALID_ARGUMENT;
+	if (Rule.Action == paReject && (Rule.Requests & POLICY_NO_REJECT_REQUESTS) != 0)
+		return APP_E_POLICY_REJECT_NOT_SUPPORTED;
+
+	FCS->Enter();
+	FRules.push_back(Rule);
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+void CPairingPolicy::Clear()
+{
+	FCS->Enter();
+	FRules.clear();
+	FCS->Leave();
+}
+
+void CPairingPolicy::GetRules(PairingRules& Rules) const
+{
+	FCS->Enter();
+	Rules = FRules;
+	FCS->Leave();
+}
+
+bool CPairingPolicy::DecideConfirm(CwclBluetoothRadio* const Radio,
+	const __int64 Address, const PairingRequest Request, bool& Confirm)
+{
+	unsigned __int64 Time = CMessageStats::Now();
+
+	int Rule = Lookup(Radio, Address, Request);
+	PairingAction Action = (Rule == -1 ? paDefer : FRules[Rule].Action);
+	Log(Address, Request, Rule, Action, Time);
+	FCS->Leave();
+
+	if (Action == paDefer)
+		return false;
+	Confirm = (Action == paAccept);
+	return true;
+}
+
+bool CPairingPolicy::DecidePasskey(CwclBluetoothRadio* const Radio,
+	const __int64 Address, unsigned long& Passkey)
+{
+	unsigned __int64 Time = CMessageStats::Now();
+
+	int Rule = Lookup(Radio, Address, prPasskeyRequest);
+	PairingAction Action = paDefer;
+	if (Rule != -1 && FRules[Rule].Action == paAccept)
+	{
+		Action = paAccept;
+		Passkey = FRules[Rule].Passkey;
+	}
+	Log(Address, prPasskeyRequest, Rule, Action, Time);
+	FCS->Leave();
+
+	return (Action == paAccept);
+}
+
+bool CPairingPolicy::DecidePin(CwclBluetoothRadio* const Radio, const __int64 Address,
+	tstring& Pin)
+{
+	unsigned __int64 Time = CMessageStats::Now();
+
+	int Rule = Lookup(Radio, Address, prPinRequest);
+	PairingAction Action = (Rule == -1 ? paDefer : FRules[Rule].Action);
+	if (Action == paAccept)
+		Pin = FRules[Rule].Pin;
+	else if (Action == paReject)
+		Pin.clear(); // An empty PIN rejects the pairing.
+	Log(Address, prPinRequest, Rule, Action, Time);
+	FCS->Leave();
+
+	return (Action != paDefer);
+}
+
+bool CPairingPolicy::DecideIoCapability(CwclBluetoothRadio* const Radio,
+	const __int64 Address, wclBluetoothMitmProtection& Mitm,
+	wclBluetoothIoCapability& IoCapability, bool& OobPresent)
+{
+	unsigned __int64 Time = CMessageStats::Now();
+
+	int Rule = Lookup(Radio, Address, prIoCapabilityRequest);
+	PairingAction Action = paDefer;
+	if (Rule != -1 && FRules[Rule].Action == paAccept)
+	{
+		Action = paAccept;
+		Mitm = FRules[Rule].Mitm;
+		IoCapability = FRules[Rule].IoCapability;
+		OobPresent = false;
+	}
+	Log(Address, prIoCapabilityRequest, Rule, Action, Time);
+	FCS->Leave();
+
+	return (Action == paAccept);
+}
+
+bool CPairingPolicy::DecideProtectionLevel(CwclBluetoothRadio* const Radio,
+	const __int64 Address, wclBluetoothLeProtectionLevel& Protection)
+{
+	unsigned __int64 Time = CMessageStats::Now();
+
+	int Rule = Lookup(Radio, Address, prProtectionLevelRequest);
+	PairingAction Action = paDefer;
+	if (Rule != -1 && FRules[Rule].Action == paAccept)
+	{
+		Action = paAccept;
+		Protection = FRules[Rule].Protection;
+	}
+	Log(Address, prProtectionLevelRequest, Rule, Action, Time);
+	FCS->Leave();
+
+	return (Action == paAccept);
+}
+
+void CPairingPolicy::GetLog(PairingDecisions& Decisions) const
+{
+	FCS->Enter();
+	CopyLog(Decisions);
+	FCS->Leave();
+}
+
+void CPairingPolicy::TakeLog(PairingDecisions& Decisions)
+{
+	FCS->Enter();
+	CopyLog(Decisions);
+	FLog.clear();
+	FLogNext = 0;
+	FCS->Leave();
+}
+
+void CPairingPolicy::ClearLog()
+{
+	FCS->Enter();
+	FLog.clear();
+	FLogNext = 0;
+	FCS->Leave();
+}
+
+unsigned long CPairingPolicy::GetLogSize() const
+{
+	return FLogSize;
+}
+
+void CPairingPolicy::SetLogSize(const unsigned long Value)
+{
+	FCS->Enter();
+	FLogSize = Value;
+	FLog.clear();
+	FLogNext = 0;
+	FCS->Leave();
+}
+
+
+// CPolicyBluetoothManager
+
+CPolicyBluetoothManager::CPolicyBluetoothManager()
+	: CwclBluetoothManager()
+{
+	FPolicy = NULL;
+}
+
+void CPolicyBluetoothManager::DoConfirm(CwclBluetoothRadio* const Radio,
+	const __int64 Address, bool& Confirm)
+{
+	if (FPolicy == NULL || !FPolicy->DecideConfirm(Radio, Address, prConfirm, Confirm))
+		CwclBluetoothManager::DoConfirm(Radio, Address, Confirm);
+}
+
+void CPolicyBluetoothManager::DoIoCapabilityRequest(CwclBluetoothRadio* const Radio,
+	const __int64 Address, wclBluetoothMitmProtection& Mitm,
+	wclBluetoothIoCapability& IoCapability, bool& OobPresent)
+{
+	if (FPolicy == NULL || !FPolicy->DecideIoCapability(Radio, Address, Mitm,
+		IoCapability, OobPresent))
+	{
+		CwclBluetoothManager::DoIoCapabilityRequest(Radio, Address, Mitm,
+			IoCapability, OobPresent);
+	}
+}
+
+void CPolicyBluetoothManager::DoNumericComparison(CwclBluetoothRadio* const Radio,
+	const __int64 Address, const unsigned long Number, bool& Confirm)
+{
+	if (FPolicy == NULL || !FPolicy->DecideConfirm(Radio, Address,
+		prNumericComparison, Confirm))
+	{
+		CwclBluetoothManager::DoNumericComparison(Radio, Address, Number, Confirm);
+	}
+}
+
+void CPolicyBluetoothManager::DoPasskeyRequest(CwclBluetoothRadio* const Radio,
+	const __int64 Address, unsigned long& Passkey)
+{
+	if (FPolicy == NULL || !FPolicy->DecidePasskey(Radio, Address, Passkey))
+		CwclBluetoothManager::DoPasskeyRequest(Radio, Address, Passkey);
+}
+
+void CPolicyBluetoothManager::DoPinRequest(CwclBluetoothRadio* const Radio,
+	const __int64 Address, tstring& Pin)
+{
+	if (FPolicy == NULL || !FPolicy->DecidePin(Radio, Address, Pin))
+		CwclBluetoothManager::DoPinRequest(Radio, Address, Pin);
+}
+
+void CPolicyBluetoothManager::DoProtectionLevelRequest(CwclBluetoothRadio* const Radio,
+	const __int64 Address, wclBluetoothLeProtectionLevel& Protection)
+{
+	if (FPolicy == NULL || !FPolicy->DecideProtectionLevel(Radio, Address, Protection))
+		CwclBluetoothManager::DoProtectionLevelRequest(Radio, Address, Protection);
+}
+
+CPairingPolicy* CPolicyBluetoothManager::GetPolicy() const
+{
+	return FPolicy;
+}
+
+void CPolicyBluetoothManager::SetPolicy(CPairingPolicy* const Value)
+{
+	FPolicy = Value;
+}
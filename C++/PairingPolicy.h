@@ -0,0 +1,299 @@
+// PairingPolicy.h : rule based answers to the pairing requests
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the pairing policy error codes. </summary>
+const int APP_E_POLICY_BASE = 0x00F0D000;
+/// <summary> The rule rejects a request that can not be rejected: a
+///   passkey, IO capability or protection level request. </summary>
+const int APP_E_POLICY_REJECT_NOT_SUPPORTED = APP_E_POLICY_BASE + 0x0000;
+
+/// <summary> The pairing requests a rule applies to. </summary>
+typedef enum
+{
+	/// <summary> The Just Works confirmation (<c>OnConfirm</c>). </summary>
+	prConfirm,
+	/// <summary> The numeric comparison
+	///   (<c>OnNumericComparison</c>). </summary>
+	prNumericComparison,
+	/// <summary> The passkey entry (<c>OnPasskeyRequest</c>). </summary>
+	prPasskeyRequest,
+	/// <summary> The legacy PIN entry (<c>OnPinRequest</c>). </summary>
+	prPinRequest,
+	/// <summary> The IO capability exchange
+	///   (<c>OnIoCapabilityRequest</c>). </summary>
+	prIoCapabilityRequest,
+	/// <summary> The LE protection level
+	///   (<c>OnProtectionLevelRequest</c>). </summary>
+	prProtectionLevelRequest
+} PairingRequest;
+
+/// <summary> The rule applies to the confirmation requests. </summary>
+const unsigned long PAIRING_REQUEST_CONFIRM = 0x00000001;
+/// <summary> The rule applies to the numeric comparison requests. </summary>
+const unsigned long PAIRING_REQUEST_NUMERIC_COMPARISON = 0x00000002;
+/// <summary> The rule applies to the passkey requests. </summary>
+const unsigned long PAIRING_REQUEST_PASSKEY = 0x00000004;
+/// <summary> The rule applies to the PIN requests. </summary>
+const unsigned long PAIRING_REQUEST_PIN = 0x00000008;
+/// <summary> The rule applies to the IO capability requests. </summary>
+const unsigned long PAIRING_REQUEST_IO_CAPABILITY = 0x00000010;
+/// <summary> The rule applies to the protection level requests. </summary>
+const unsigned long PAIRING_REQUEST_PROTECTION_LEVEL = 0x00000020;
+/// <summary> The rule applies to all the requests. </summary>
+const unsigned long PAIRING_REQUEST_ALL = 0x0000003F;
+
+/// <summary> The decision of a rule. </summary>
+typedef enum
+{
+	/// <summary> Accept the request with the rule values. </summary>
+	paAccept,
+	/// <summary> Reject the confirmation requests. A PIN request gets an
+	///   empty PIN. The other requests have no answer that rejects them, so
+	///   <c>Add</c> refuses such a rule for them. </summary>
+	paReject,
+	/// <summary> Pass the request to the <c>CwclBluetoothManager</c>
+	///   events. </summary>
+	paDefer
+} PairingAction;
+
+/// <summary> A pairing policy rule. </summary>
+typedef struct
+{
+	/// <summary> The device MAC address prefix. </summary>
+	__int64 Address;
+	/// <summary> The number of the leading address bits that must match,
+	///   from 0 (any device) to 48 (a single device). 24 matches the
+	///   vendor. </summary>
+	unsigned char PrefixBits;
+	/// <summary> <c>true</c> if the rule applies to the
+	///   <c>AddressType</c> devices only. </summary>
+	bool MatchAddressType;
+	/// <summary> The device address type. </summary>
+	wclBluetoothAddressType AddressType;
+	/// <summary> The requests the rule applies to: a combination of the
+	///   <c>PAIRING_REQUEST_*</c> flags. </summary>
+	unsigned long Requests;
+	/// <summary> The decision. </summary>
+	PairingAction Action;
+	/// <summary> The passkey for the passkey requests. </summary>
+	unsigned long Passkey;
+	/// <summary> The PIN for the PIN requests. </summary>
+	tstring Pin;
+	/// <summary> The MITM protection for the IO capability
+	///   requests. </summary>
+	wclBluetoothMitmProtection Mitm;
+	/// <summary> The IO capability for the IO capability requests. </summary>
+	wclBluetoothIoCapability IoCapability;
+	/// <summary> The protection level for the protection level
+	///   requests. </summary>
+	wclBluetoothLeProtectionLevel Protection;
+} PairingRule;
+/// <summary> The pairing policy rules. </summary>
+typedef std::vector<PairingRule> PairingRules;
+
+/// <summary> A logged policy decision. </summary>
+typedef struct
+{
+	/// <summary> The device MAC address. </summary>
+	__int64 Address;
+	/// <summary> The request. </summary>
+	PairingRequest Request;
+	/// <summary> The index of the matched rule or -1 if no rule
+	///   matched. </summary>
+	int Rule;
+	/// <summary> The decision. </summary>
+	PairingAction Action;
+	/// <summary> The time the request has arrived at, in
+	///   microseconds. </summary>
+	unsigned __int64 Time;
+	/// <summary> The time spent on the decision in microseconds. </summary>
+	unsigned long Duration;
+} PairingDecision;
+/// <summary> The logged policy decisions. </summary>
+typedef std::vector<PairingDecision> PairingDecisions;
+
+/// <summary> Answers the pairing requests from a rule table. </summary>
+/// <remarks> <para> The rules are checked in the order they have been added
+///   and the first rule that matches the device address prefix, the address
+///   type and the request decides. When no rule matches the request goes to
+///   the <c>CwclBluetoothManager</c> events as before. </para>
+///   <para> The device address type is read from the radio only when a rule
+///   asks for it. </para>
+///   <para> Every decision is logged with its duration into a ring of
+///   <c>LogSize</c> entries. The policy is thread safe: the rules may be
+///   changed while the radio consults them. </para> </remarks>
+/// <seealso cref="CPolicyBluetoothManager" />
+class CPairingPolicy
+{
+	DISABLE_COPY(CPairingPolicy);
+
+private:
+	CwclCriticalSection*	FCS;
+	PairingDecisions		FLog;
+	// The ring position of the next logged decision.
+	unsigned long			FLogNext;
+	unsigned long			FLogSize;
+	PairingRules			FRules;
+
+	static bool Matches(const PairingRule& Rule, const __int64 Address);
+
+	// Must be called inside the critical section. AddressType is NULL if it
+	// could not be read.
+	int Find(const __int64 Address, const PairingRequest Request, const bool TypeRead,
+		const wclBluetoothAddressType* const AddressType) const;
+	// Enters the critical section and finds the rule. The caller leaves the
+	// critical section.
+	int Lookup(CwclBluetoothRadio* const Radio, const __int64 Address,
+		const PairingRequest Request);
+	void Log(const __int64 Address, const PairingRequest Request, const int Rule,
+		const PairingAction Action, const unsigned __int64 Time);
+	// Must be called inside the critical section.
+	void CopyLog(PairingDecisions& Decisions) const;
+
+public:
+	/// <summary> Creates new pairing policy. </summary>
+	CPairingPolicy();
+	/// <summary> Frees the pairing policy. </summary>
+	virtual ~CPairingPolicy();
+
+	/// <summary> Adds the rule at the end of the rule table. </summary>
+	/// <param name="Rule"> The rule. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Add(const PairingRule& Rule);
+	/// <summary> Removes all the rules. </summary>
+	void Clear();
+	/// <summary> Gets the rules. </summary>
+	/// <param name="Rules"> On output the rules in the check order. </param>
+	void GetRules(PairingRules& Rules) const;
+
+	/// <summary> Decides a confirmation request. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Address"> The remote device MAC address. </param>
+	/// <param name="Request"> <c>prConfirm</c> or
+	///   <c>prNumericComparison</c>. </param>
+	/// <param name="Confirm"> On output the decision if the method returns
+	///   <c>true</c>. </param>
+	/// <returns> <c>true</c> if the policy has decided the request. </returns>
+	bool DecideConfirm(CwclBluetoothRadio* const Radio, const __int64 Address,
+		const PairingRequest Request, bool& Confirm);
+	/// <summary> Decides a passkey request. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Address"> The remote device MAC address. </param>
+	/// <param name="Passkey"> On output the passkey if the method returns
+	///   <c>true</c>. </param>
+	/// <returns> <c>true</c> if the policy has decided the request. </returns>
+	bool DecidePasskey(CwclBluetoothRadio* const Radio, const __int64 Address,
+		unsigned long& Passkey);
+	/// <summary> Decides a PIN request. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Address"> The remote device MAC address. </param>
+	/// <param name="Pin"> On output the PIN if the method returns
+	///   <c>true</c>. </param>
+	/// <returns> <c>true</c> if the policy has decided the request. </returns>
+	bool DecidePin(CwclBluetoothRadio* const Radio, const __int64 Address, tstring& Pin);
+	/// <summary> Decides an IO capability request. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Address"> The remote device MAC address. </param>
+	/// <param name="Mitm"> On output the MITM protection if the method
+	///   returns <c>true</c>. </param>
+	/// <param name="IoCapability"> On output the IO capability if the method
+	///   returns <c>true</c>. </param>
+	/// <param name="OobPresent"> On output <c>false</c> if the method returns
+	///   <c>true</c>. </param>
+	/// <returns> <c>true</c> if the policy has decided the request. </returns>
+	bool DecideIoCapability(CwclBluetoothRadio* const Radio,
+		const __int64 Address, wclBluetoothMitmProtection& Mitm,
+		wclBluetoothIoCapability& IoCapability, bool& OobPresent);
+	/// <summary> Decides a protection level request. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Address"> The remote device MAC address. </param>
+	/// <param name="Protection"> On output the protection level if the method
+	///   returns <c>true</c>. </param>
+	/// <returns> <c>true</c> if the policy has decided the request. </returns>
+	bool DecideProtectionLevel(CwclBluetoothRadio* const Radio,
+		const __int64 Address, wclBluetoothLeProtectionLevel& Protection);
+
+	/// <summary> Gets the logged decisions. </summary>
+	/// <param name="Decisions"> On output the decisions from the oldest to
+	///   the newest. </param>
+	void GetLog(PairingDecisions& Decisions) const;
+	/// <summary> Gets the logged decisions and clears the log. </summary>
+	/// <remarks> Unlike <c>GetLog</c> followed by <c>ClearLog</c> it never
+	///   loses a decision logged between the calls. </remarks>
+	/// <param name="Decisions"> On output the decisions from the oldest to
+	///   the newest. </param>
+	void TakeLog(PairingDecisions& Decisions);
+	/// <summary> Clears the decision log. </summary>
+	void ClearLog();
+
+	/// <summary> Gets the decision log size. </summary>
+	/// <returns> The maximum number of the logged decisions. </returns>
+	unsigned long GetLogSize() const;
+	/// <summary> Sets the decision log size. </summary>
+	/// <param name="Value"> The maximum number of the logged decisions. 0
+	///   disables the log. The log is cleared. </param>
+	void SetLogSize(const unsigned long Value);
+	/// <summary> Gets and sets the decision log size. </summary>
+	/// <value> The maximum number of the logged decisions. </value>
+	__declspec(property(get = GetLogSize, put = SetLogSize)) unsigned long LogSize;
+};
+
+/// <summary> The Bluetooth Manager that answers the pairing requests from a
+///   <see cref="CPairingPolicy" />. </summary>
+/// <remarks> The policy is consulted in the <c>Do*</c> methods, before the
+///   events are raised, in the thread the manager processes the radio
+///   messages in. A request the policy decides never reaches the event
+///   handlers, so with the <c>mpAsync</c> message processing unattended
+///   pairing does not wait for the UI thread at all. The
+///   <c>Policy</c> of a <see cref="CBatchPairing" /> answers from the events,
+///   so it decides only the requests no rule matches. </remarks>
+class CPolicyBluetoothManager : public CwclBluetoothManager
+{
+	DISABLE_COPY(CPolicyBluetoothManager);
+
+private:
+	CPairingPolicy*	FPolicy;
+
+protected:
+	virtual void DoConfirm(CwclBluetoothRadio* const Radio, const __int64 Address,
+		bool& Confirm) override;
+	virtual void DoIoCapabilityRequest(CwclBluetoothRadio* const Radio,
+		const __int64 Address, wclBluetoothMitmProtection& Mitm,
+		wclBluetoothIoCapability& IoCapability, bool& OobPresent) override;
+	virtual void DoNumericComparison(CwclBluetoothRadio* const Radio,
+		const __int64 Address, const unsigned long Number, bool& Confirm) override;
+	virtual void DoPasskeyRequest(CwclBluetoothRadio* const Radio,
+		const __int64 Address, unsigned long& Passkey) override;
+	virtual void DoPinRequest(CwclBluetoothRadio* const Radio, const __int64 Address,
+		tstring& Pin) override;
+	virtual void DoProtectionLevelRequest(CwclBluetoothRadio* const Radio,
+		const __int64 Address, wclBluetoothLeProtectionLevel& Protection) override;
+
+public:
+	/// <summary> Creates new Bluetooth Manager. </summary>
+	CPolicyBluetoothManager();
+
+	/// <summary> Gets the pairing policy. </summary>
+	/// <returns> The policy or <c>NULL</c>. </returns>
+	CPairingPolicy* GetPolicy() const;
+	/// <summary> Sets the pairing policy. </summary>
+	/// <param name="Value"> The policy or <c>NULL</c> to pass all the
+	///   requests to the events. The manager does not own the
+	///   policy. </param>
+	void SetPolicy(CPairingPolicy* const Value);
+	/// <summary> Gets and sets the pairing policy. </summary>
+	/// <value> The policy or <c>NULL</c>. </value>
+	__declspec(property(get = GetPolicy, put = SetPolicy)) CPairingPolicy* Policy;
+};
@@ -0,0 +1,297 @@
+// RemoteInfoResolver.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "RemoteInfoResolver.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+static const unsigned long REMOTE_INFO_MAX_PARALLELISM = 32;
+
+
+// CRemoteInfoMessage
+
+CRemoteInfoMessage::CRemoteInfoMessage(const RemoteInfo& Info)
+	: CwclMessage(APP_MSG_ID_REMOTE_INFO, mcUser)
+{
+	FInfo = Info;
+}
+
+const RemoteInfo& CRemoteInfoMessage::GetInfo() const
+{
+	return FInfo;
+}
+
+
+// CRemoteInfoResolver
+
+CRemoteInfoResolver::CRemoteInfoResolver()
+{
+	FParallelism = 4;
+
+	FBusy = 0;
+	FCS = new CwclCriticalSection();
+	FEvent = NULL;
+	FReceiver = NULL;
+	FTerminated = 0;
+}
+
+CRemoteInfoResolver::~CRemoteInfoResolver()
+{
+	Close();
+
+	delete FCS;
+}
+
+UINT __stdcall CRemoteInfoResolver::_ResolveThreadProc(LPVOID lpParam)
+{
+	static_cast<CRemoteInfoResolver*>(lpParam)->ResolveThreadProc();
+	return 0;
+}
+
+void CRemoteInfoResolver::ResolveThreadProc()
+{
+	while (true)
+	{
+		FCS->Enter();
+		while (FJobs.empty() && FTerminated == 0)
+		{
+			FCS->Leave();
+			FEvent->WaitOne();
+			FCS->Enter();
+		}
+		if (FTerminated != 0)
+		{
+			FCS->Leave();
+			// Wake the next resolver thread up.
+			FEvent->SetEvent();
+			break;
+		}
+
+		JOB Job = FJobs.front();
+		FJobs.pop_front();
+		FBusy++;
+		bool More = !FJobs.empty();
+		FCS->Leave();
+
+		if (More)
+			FEvent->SetEvent();
+
+		RemoteInfo Info;
+		Resolve(Job, Info);
+
+		CwclMessage* Msg = new CRemoteInfoMessage(Info);
+		FReceiver->Post(Msg);
+		Msg->Release();
+
+		FCS->Enter();
+		FBusy--;
+		bool Completed = (FJobs.empty() && FBusy == 0 && FTerminated == 0);
+		FCS->Leave();
+
+		if (Completed)
+		{
+			// Posted after the last result, so the receiver delivers it
+			// last.
+			Msg = new CwclMessage(APP_MSG_ID_REMOTE_INFO_COMPLETED, mcUser);
+			FReceiver->Post(Msg);
+			Msg->Release();
+		}
+	}
+}
+
+void CRemoteInfoResolver::Resolve(const JOB& Job, RemoteInfo& Info)
+{
+	Info.Address = Job.Address;
+	Info.Fields = Job.Fields;
+
+	Info.Paired = false;
+	Info.AddressType = atPublic;
+	Info.DeviceType = dtBle;
+	Info.Rssi = 0;
+
+	Info.NameError = WCL_E_SUCCESS;
+	Info.PairedError = WCL_E_SUCCESS;
+	Info.AddressTypeError = WCL_E_SUCCESS;
+	Info.DeviceTypeError = WCL_E_SUCCESS;
+	Info.RssiError = WCL_E_SUCCESS;
+
+	if ((Job.Fields & REMOTE_INFO_NAME) != 0)
+		Info.NameError = Job.Radio->GetRemoteName(Job.Address, Info.Name);
+	if ((Job.Fields & REMOTE_INFO_PAIRED) != 0)
+		Info.PairedError = Job.Radio->GetRemotePaired(Job.Address, Info.Paired);
+	if ((Job.Fields & REMOTE_INFO_ADDRESS_TYPE) != 0)
+		Info.AddressTypeError = Job.Radio->GetRemoteAddressType(Job.Address, Info.AddressType);
+	if ((Job.Fields & REMOTE_INFO_DEVICE_TYPE) != 0)
+		Info.DeviceTypeError = Job.Radio->GetRemoteDeviceType(Job.Address, Info.DeviceType);
+	if ((Job.Fields & REMOTE_INFO_RSSI) != 0)
+		Info.RssiError = Job.Radio->GetRemoteRssi(Job.Address, Info.Rssi);
+}
+
+void CRemoteInfoResolver::Free()
+{
+	if (FReceiver != NULL)
+	{
+		__unhook(&CwclMessageReceiver::OnMessage, FReceiver,
+			&CRemoteInfoResolver::ReceiverMessage);
+		FReceiver->Close();
+		delete FReceiver;
+		FReceiver = NULL;
+	}
+	if (FEvent != NULL)
+	{
+		delete FEvent;
+		FEvent = NULL;
+	}
+}
+
+void CRemoteInfoResolver::ReceiverMessage(const CwclMessage* const Message)
+{
+	if (Message->Category != mcUser)
+		return;
+
+	switch (Message->Id)
+	{
+		case APP_MSG_ID_REMOTE_INFO:
+			DoResolved(static_cast<const CRemoteInfoMessage*>(Message)->Info);
+			break;
+
+		case APP_MSG_ID_REMOTE_INFO_COMPLETED:
+			DoCompleted();
+			break;
+	}
+}
+
+void CRemoteInfoResolver::DoResolved(const RemoteInfo& Info)
+{
+	__raise OnResolved(this, Info);
+}
+
+void CRemoteInfoResolver::DoCompleted()
+{
+	__raise OnCompleted(this);
+}
+
+int CRemoteInfoResolver::Open(const wclMessageProcessingMethod Method)
+{
+	if (FThreads.size() > 0)
+		return APP_E_REMOTE_INFO_OPENED;
+
+	FTerminated = 0;
+	FEvent = CwclAutoResetEvent::Create();
+	if (FEvent == NULL)
+		return WCL_E_MR_UNABLE_CREATE_SYNC_OBJ;
+
+	FReceiver = new CwclMessageReceiver();
+	__hook(&CwclMessageReceiver::OnMessage, FReceiver, &CRemoteInfoResolver::ReceiverMessage);
+	int Res = FReceiver->Open(Method);
+	if (Res != WCL_E_SUCCESS)
+	{
+		Free();
+		return Res;
+	}
+
+	for (unsigned long i = 0; i < FParallelism; i++)
+	{
+		HANDLE Thread = wclCreateThread(_ResolveThreadProc, this);
+		if (Thread == NULL)
+		{
+			Close();
+			return WCL_E_MR_UNABLE_SYNCHRONIZE;
+		}
+		FThreads.push_back(Thread);
+	}
+	return WCL_E_SUCCESS;
+}
+
+int CRemoteInfoResolver::Close()
+{
+	if (FEvent == NULL)
+		return APP_E_REMOTE_INFO_NOT_OPENED;
+
+	InterlockedExchange(&FTerminated, 1);
+	FEvent->SetEvent();
+	for (THREADS::iterator t = FThreads.begin(); t != FThreads.end(); t++)
+		wclWaitAndCloseThread(*t);
+	FThreads.clear();
+
+	FCS->Enter();
+	FJobs.clear();
+	FBusy = 0;
+	FCS->Leave();
+
+	Free();
+	return WCL_E_SUCCESS;
+}
+
+int CRemoteInfoResolver::Resolve(CwclBluetoothRadio* const Radio,
+	const wclBluetoothAddresses& Addresses, const unsigned long Fields)
+{
+	if (FThreads.size() == 0)
+		return APP_E_REMOTE_INFO_NOT_OPENED;
+	if (Radio == NULL || (Fields & REMOTE_INFO_ALL) == 0)
+		return WCL_E_INVALID_ARGUMENT;
+	if (Addresses.size() == 0)
+		return WCL_E_SUCCESS;
+
+	JOB Job;
+	Job.Radio = Radio;
+	Job.Fields = Fields & REMOTE_INFO_ALL;
+
+	FCS->Enter();
+	for (wclBluetoothAddresses::const_iterator a = Addresses.begin(); a != Addresses.end(); a++)
+	{
+		Job.Address = *a;
+		FJobs.push_back(Job);
+	}
+	FCS->Leave();
+
+	FEvent->SetEvent();
+	return WCL_E_SUCCESS;
+}
+
+int CRemoteInfoResolver::Cancel()
+{
+	if (FThreads.size() == 0)
+		return APP_E_REMOTE_INFO_NOT_OPENED;
+
+	FCS->Enter();
+	bool Completed = (FJobs.size() > 0 && FBusy == 0);
+	FJobs.clear();
+	FCS->Leave();
+
+	// No resolver thread is left to report the completion.
+	if (Completed)
+	{
+		CwclMessage* Msg = new CwclMessage(APP_MSG_ID_REMOTE_INFO_COMPLETED, mcUser);
+		FReceiver->Post(Msg);
+		Msg->Release();
+	}
+	return WCL_E_SUCCESS;
+}
+
+bool CRemoteInfoResolver::GetActive() const
+{
+	return (FThreads.size() > 0);
+}
+
+unsigned long CRemoteInfoResolver::GetPending() const
+{
+	FCS->Enter();
+	unsigned long Pending = static_cast<unsigned long>(FJobs.size()) + FBusy;
+	FCS->Leave();
+	return Pending;
+}
+
+unsigned long CRemoteInfoResolver::GetParallelism() const
+{
+	return FParallelism;
+}
+
+void CRemoteInfoResolver::SetParallelism(const unsigned long Value)
+{
+	if (FThreads.size() == 0 && Value > 0 && Value <= REMOTE_INFO_MAX_PARALLELISM)
+		FParallelism = Value;
+}
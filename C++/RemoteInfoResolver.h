@@ -0,0 +1,241 @@
+// RemoteInfoResolver.h : parallel remote device information lookup
+//
+
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclMessaging.h"
+#include "wclSync.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The resolved remote information message ID. The message
+///   category is <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_REMOTE_INFO = 4;
+/// <summary> The resolving completed message ID. The message category is
+///   <c>mcUser</c>. </summary>
+const unsigned char APP_MSG_ID_REMOTE_INFO_COMPLETED = 5;
+
+/// <summary> The base value of the remote information resolver error
+///   codes. </summary>
+const int APP_E_REMOTE_INFO_BASE = 0x00F08000;
+/// <summary> The resolver is not opened. </summary>
+const int APP_E_REMOTE_INFO_NOT_OPENED = APP_E_REMOTE_INFO_BASE + 0x0000;
+/// <summary> The resolver is already opened. </summary>
+const int APP_E_REMOTE_INFO_OPENED = APP_E_REMOTE_INFO_BASE + 0x0001;
+
+/// <summary> The remote device name. </summary>
+const unsigned long REMOTE_INFO_NAME = 0x00000001;
+/// <summary> The remote device paired state. </summary>
+const unsigned long REMOTE_INFO_PAIRED = 0x00000002;
+/// <summary> The remote device address type. </summary>
+const unsigned long REMOTE_INFO_ADDRESS_TYPE = 0x00000004;
+/// <summary> The remote device type. </summary>
+const unsigned long REMOTE_INFO_DEVICE_TYPE = 0x00000008;
+/// <summary> The remote device RSSI. </summary>
+const unsigned long REMOTE_INFO_RSSI = 0x00000010;
+/// <summary> All remote device information. </summary>
+const unsigned long REMOTE_INFO_ALL = 0x0000001F;
+
+/// <summary> The remote device information. </summary>
+/// <remarks> Every field has its own result: a device may report its name
+///   but not its RSSI. The fields that have not been requested keep the
+///   <c>WCL_E_SUCCESS</c> result and zero values. </remarks>
+typedef struct
+{
+	/// <summary> The remote device MAC address. </summary>
+	__int64 Address;
+	/// <summary> The requested fields. </summary>
+	unsigned long Fields;
+
+	/// <summary> The remote device name. </summary>
+	tstring Name;
+	/// <summary> The name request result. </summary>
+	int NameError;
+	/// <summary> The remote device paired state. </summary>
+	bool Paired;
+	/// <summary> The paired state request result. </summary>
+	int PairedError;
+	/// <summary> The remote device address type. </summary>
+	wclBluetoothAddressType AddressType;
+	/// <summary> The address type request result. </summary>
+	int AddressTypeError;
+	/// <summary> The remote device type. </summary>
+	wclBluetoothDeviceType DeviceType;
+	/// <summary> The device type request result. </summary>
+	int DeviceTypeError;
+	/// <summary> The remote device RSSI. </summary>
+	char Rssi;
+	/// <summary> The RSSI request result. </summary>
+	int RssiError;
+} RemoteInfo;
+
+/// <summary> The message that carries the resolved remote device
+///   information. </summary>
+class CRemoteInfoMessage final : public CwclMessage
+{
+	DISABLE_COPY(CRemoteInfoMessage);
+
+private:
+	RemoteInfo	FInfo;
+
+public:
+	/// <summary> Creates new remote information message. </summary>
+	/// <param name="Info"> The remote device information. </param>
+	CRemoteInfoMessage(const RemoteInfo& Info);
+
+	/// <summary> Gets the remote device information. </summary>
+	/// <returns> The remote device information. </returns>
+	const RemoteInfo& GetInfo() const;
+	/// <summary> Gets the remote device information. </summary>
+	/// <value> The remote device information. </value>
+	__declspec(property(get = GetInfo)) const RemoteInfo& Info;
+};
+
+/// <summary> The <c>OnResolved</c> event handler prototype. </summary>
+/// <param name="Sender"> The object that initiated the event. </param>
+/// <param name="Info"> The remote device information. </param>
+#define RemoteInfoEvent(_event_name_) \
+	__event void _event_name_(void* Sender, const RemoteInfo& Info)
+
+/// <summary> Reads the information of many remote devices in
+///   parallel. </summary>
+/// <remarks> <para> Every remote device query of the <c>CwclBluetoothRadio</c>
+///   is a blocking driver call, so reading the names of a few hundred
+///   discovered devices one by one takes seconds. The resolver runs the
+///   queries for up to <c>Parallelism</c> devices at once. </para>
+///   <para> Each device is reported by the <c>OnResolved</c> event as soon as
+///   its queries are done, so results arrive in completion order, not in
+///   request order. <c>OnCompleted</c> fires when all the requested devices
+///   have been reported. </para>
+///   <para> The events fire the way the <c>CwclMessageReceiver</c> opened
+///   with the method passed to <c>Open</c> delivers messages: with
+///   <c>mpSync</c> in the thread that called <c>Open</c>, so a UI can update
+///   its controls directly. </para> </remarks>
+class CRemoteInfoResolver
+{
+	DISABLE_COPY(CRemoteInfoResolver);
+
+private:
+	typedef struct
+	{
+		CwclBluetoothRadio*	Radio;
+		__int64				Address;
+		unsigned long		Fields;
+	} JOB;
+	typedef std::deque<JOB> JOBS;
+	typedef std::vector<HANDLE> THREADS;
+
+	unsigned long			FParallelism;
+
+	// The number of the jobs being resolved.
+	unsigned long			FBusy;
+	CwclCriticalSection*	FCS;
+	CwclAutoResetEvent*		FEvent;
+	JOBS					FJobs;
+	CwclMessageReceiver*	FReceiver;
+	volatile LONG			FTerminated;
+	THREADS					FThreads;
+
+	static UINT __stdcall _ResolveThreadProc(LPVOID lpParam);
+	void ResolveThreadProc();
+
+	static void Resolve(const JOB& Job, RemoteInfo& Info);
+
+	void Free();
+
+	void ReceiverMessage(const CwclMessage* const Message);
+
+protected:
+	/// <summary> Fires the <c>OnResolved</c> event. </summary>
+	/// <param name="Info"> The remote device information. </param>
+	virtual void DoResolved(const RemoteInfo& Info);
+	/// <summary> Fires the <c>OnCompleted</c> event. </summary>
+	virtual void DoCompleted();
+
+public:
+	/// <summary> Creates new resolver. </summary>
+	CRemoteInfoResolver();
+	/// <summary> Frees the resolver. </summary>
+	virtual ~CRemoteInfoResolver();
+
+	/// <summary> Starts the resolver threads. </summary>
+	/// <param name="Method"> The message processing method used to deliver
+	///   the events. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Open(const wclMessageProcessingMethod Method = mpSync);
+	/// <summary> Stops the resolver threads. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The devices that have not been resolved yet are dropped
+	///   without events. </remarks>
+	int Close();
+
+	/// <summary> Queues the remote devices. </summary>
+	/// <param name="Radio"> The radio the devices have been found
+	///   with. </param>
+	/// <param name="Addresses"> The remote device MAC addresses. </param>
+	/// <param name="Fields"> The information to read: a combination of the
+	///   <c>REMOTE_INFO_*</c> flags. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The method returns at once. The devices are added to the
+	///   ones that are still being resolved. </remarks>
+	int Resolve(CwclBluetoothRadio* const Radio, const wclBluetoothAddresses& Addresses,
+		const unsigned long Fields = REMOTE_INFO_ALL);
+	/// <summary> Drops the devices that have not been resolved
+	///   yet. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	/// <remarks> The devices being resolved are still reported. </remarks>
+	int Cancel();
+
+	/// <summary> Gets the active state. </summary>
+	/// <returns> <c>true</c> if the resolver is opened. </returns>
+	bool GetActive() const;
+	/// <summary> Gets the active state. </summary>
+	/// <value> <c>true</c> if the resolver is opened. </value>
+	__declspec(property(get = GetActive)) bool Active;
+
+	/// <summary> Gets the number of the devices that have not been reported
+	///   yet. </summary>
+	/// <returns> The number of the devices. </returns>
+	unsigned long GetPending() const;
+	/// <summary> Gets the number of the devices that have not been reported
+	///   yet. </summary>
+	/// <value> The number of the devices. </value>
+	__declspec(property(get = GetPending)) unsigned long Pending;
+
+	/// <summary> Gets the maximum number of the devices resolved at
+	///   once. </summary>
+	/// <returns> The number of the resolver threads. </returns>
+	unsigned long GetParallelism() const;
+	/// <summary> Sets the maximum number of the devices resolved at
+	///   once. </summary>
+	/// <param name="Value"> The number of the resolver threads from 1 to
+	///   32. Can be changed only when the resolver is closed. </param>
+	void SetParallelism(const unsigned long Value);
+	/// <summary> Gets and sets the maximum number of the devices resolved at
+	///   once. </summary>
+	/// <value> The number of the resolver threads. </value>
+	__declspec(property(get = GetParallelism, put = SetParallelism))
+		unsigned long Parallelism;
+
+	/// <summary> The event fires when a device has been resolved. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	/// <param name="Info"> The remote device information. </param>
+	RemoteInfoEvent(OnResolved);
+	/// <summary> The event fires when all queued devices have been
+	///   resolved. </summary>
+	/// <param name="Sender"> The object that initiated the event. </param>
+	wclNotifyEvent(OnCompleted);
+};
@@ -0,0 +1,356 @@
+// RssiTracker.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "RssiTracker.h"
+
+#include "MessageStats.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The end of an entry list.
+static const unsigned long RSSI_NONE = 0xFFFFFFFF;
+// The minimum number of the index slots. Must be a power of 2.
+static const unsigned long RSSI_MIN_SLOTS = 16;
+
+
+// CRssiTracker
+
+CRssiTracker::CRssiTracker(const unsigned long Capacity, const unsigned long Window)
+{
+	FAlpha = 0.2;
+	FMeasurementNoise = 4.0;
+	FProcessNoise = 0.1;
+
+	FCapacity = max(Capacity, 1UL);
+	FWindow = min(max(Window, 1UL), RSSI_MAX_WINDOW);
+
+	// Keep the index at most half full so the probe sequences stay short
+	// without ever growing it.
+	unsigned long Slots = RSSI_MIN_SLOTS;
+	while (Slots < FCapacity * 2)
+		Slots *= 2;
+
+	FCS = new CwclCriticalSection();
+	FEntries.resize(FCapacity);
+	FIndex.resize(Slots);
+	FSamples.resize(FCapacity * FWindow);
+	FEvictions = 0;
+	Reset();
+}
+
+CRssiTracker::~CRssiTracker()
+{
+	delete FCS;
+}
+
+unsigned long CRssiTracker::Lookup(const __int64 Address) const
+{
+	unsigned long Mask = static_cast<unsigned long>(FIndex.size()) - 1;
+	unsigned long i = Hash(Address) & Mask;
+	while (FIndex[i] != 0 && FEntries[FIndex[i] - 1].Address != Address)
+		i = (i + 1) & Mask;
+	return i;
+}
+
+bool CRssiTracker::IsSlotUsed(const unsigned long Slot) const
+{
+	return (FIndex[Slot] != 0);
+}
+
+__int64 CRssiTracker::GetSlotAddress(const unsigned long Slot) const
+{
+	return FEntries[FIndex[Slot] - 1].Address;
+}
+
+void CRssiTracker::MoveSlot(const unsigned long To, const unsigned long From)
+{
+	FIndex[To] = FIndex[From];
+}
+
+void CRssiTracker::ClearSlot(const unsigned long Slot)
+{
+	FIndex[Slot] = 0;
+}
+
+void CRssiTracker::Unlink(const unsigned long Entry)
+{
+	ENTRY& e = FEntries[Entry];
+	if (e.Prev != RSSI_NONE)
+		FEntries[e.Prev].Next = e.Next;
+	else
+		FHead = e.Next;
+	if (e.Next != RSSI_NONE)
+		FEntries[e.Next].Prev = e.Prev;
+	else
+		FTail = e.Prev;
+}
+
+void CRssiTracker::LinkFirst(const unsigned long Entry)
+{
+	ENTRY& e = FEntries[Entry];
+	e.Prev = RSSI_NONE;
+	e.Next = FHead;
+	if (FHead != RSSI_NONE)
+		FEntries[FHead].Prev = Entry;
+	else
+		FTail = Entry;
+	FHead = Entry;
+}
+
+void CRssiTracker::Release(const unsigned long Entry)
+{
+	EraseSlot(static_cast<unsigned long>(FIndex.size()) - 1,
+		Lookup(FEntries[Entry].Address));
+	Unlink(Entry);
+	FEntries[Entry].Next = FFree;
+	FFree = Entry;
+	FCount--;
+}
+
+void CRssiTracker::GetState(const unsigned long Entry, RssiState& State) const
+{
+	const ENTRY& e = FEntries[Entry];
+	State.Address = e.Address;
+	State.Samples = e.Samples;
+	State.Count = e.Count;
+	State.Last = e.Last;
+	State.Mean = static_cast<double>(e.Sum) / e.Count;
+	State.Ema = e.Ema;
+	State.Kalman = e.Estimate;
+	State.LastSeen = e.LastSeen;
+}
+
+void CRssiTracker::Reset()
+{
+	for (INDEX::iterator i = FIndex.begin(); i != FIndex.end(); i++)
+		*i = 0;
+	for (unsigned long i = 0; i < FCapacity; i++)
+		FEntries[i].Next = (i + 1 < FCapacity ? i + 1 : RSSI_NONE);
+	FCount = 0;
+	FFree = 0;
+	FHead = RSSI_NONE;
+	FTail = RSSI_NONE;
+}
+
+void CRssiTracker::Add(const __int64 Address, const char Rssi)
+{
+	unsigned __int64 Now = CMessageStats::Now();
+
+	FCS->Enter();
+	unsigned long Slot = Lookup(Address);
+	unsigned long Entry;
+	if (FIndex[Slot] != 0)
+	{
+		Entry = FIndex[Slot] - 1;
+		Unlink(Entry);
+	}
+	else
+	{
+		if (FFree == RSSI_NONE)
+		{
+			Release(FTail);
+			FEvictions++;
+			// The erase may have shifted the probe sequence.
+			Slot = Lookup(Address);
+		}
+
+		Entry = FFree;
+		FFree = FEntries[Entry].Next;
+
+		ENTRY& e = FEntries[Entry];
+		e.Address = Address;
+		e.Samples = 0;
+		e.Count = 0;
+		e.Head = 0;
+		e.Sum = 0;
+		FIndex[Slot] = Entry + 1;
+		FCount++;
+	}
+	LinkFirst(Entry);
+
+	ENTRY& e = FEntries[Entry];
+	char* Samples = &FSamples[Entry * FWindow];
+	if (e.Count == FWindow)
+		e.Sum -= Samples[e.Head];
+	else
+		e.Count++;
+	Samples[e.Head] = Rssi;
+	e.Head = (e.Head + 1) % FWindow;
+	e.Sum += Rssi;
+
+	if (e.Samples == 0)
+	{
+		e.Ema = Rssi;
+		e.Estimate = Rssi;
+		e.Variance = FMeasurementNoise;
+	}
+	else
+	{
+		e.Ema += FAlpha * (Rssi - e.Ema);
+
+		e.Variance += FProcessNoise;
+		double Gain = e.Variance / (e.Variance + FMeasurementNoise);
+		e.Estimate += Gain * (Rssi - e.Estimate);
+		e.Variance *= 1.0 - Gain;
+	}
+
+	e.Samples++;
+	e.Last = Rssi;
+	e.LastSeen = Now;
+	FCS->Leave();
+}
+
+int CRssiTracker::Read(CwclBluetoothRadio* const Radio, const __int64 Address)
+{
+	if (Radio == NULL)
+		return WCL_E_INVALID_ARGUMENT;
+
+	char Rssi;
+	int Res = Radio->GetRemoteRssi(Address, Rssi);
+	if (Res == WCL_E_SUCCESS)
+		Add(Address, Rssi);
+	return Res;
+}
+
+int CRssiTracker::Remove(const __int64 Address)
+{
+	int Res = APP_E_RSSI_NOT_FOUND;
+	FCS->Enter();
+	unsigned long Slot = Lookup(Address);
+	if (FIndex[Slot] != 0)
+	{
+		Release(FIndex[Slot] - 1);
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+void CRssiTracker::Clear()
+{
+	FCS->Enter();
+	Reset();
+	FCS->Leave();
+}
+
+int CRssiTracker::GetDevice(const __int64 Address, RssiState& State) const
+{
+	int Res = APP_E_RSSI_NOT_FOUND;
+	FCS->Enter();
+	unsigned long Slot = Lookup(Address);
+	if (FIndex[Slot] != 0)
+	{
+		GetState(FIndex[Slot] - 1, State);
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+int CRssiTracker::GetSamples(const __int64 Address, RssiSamples& Samples) const
+{
+	Samples.clear();
+
+	int Res = APP_E_RSSI_NOT_FOUND;
+	FCS->Enter();
+	unsigned long Slot = Lookup(Address);
+	if (FIndex[Slot] != 0)
+	{
+		unsigned long Entry = FIndex[Slot] - 1;
+		const ENTRY& e = FEntries[Entry];
+		const char* Window = &FSamples[Entry * FWindow];
+
+		Samples.reserve(e.Count);
+		unsigned long First = (e.Head + FWindow - e.Count) % FWindow;
+		for (unsigned long i = 0; i < e.Count; i++)
+			Samples.push_back(Window[(First + i) % FWindow]);
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+void CRssiTracker::GetSnapshot(RssiStates& States) const
+{
+	States.clear();
+	FCS->Enter();
+	States.resize(FCount);
+	size_t i = 0;
+	for (unsigned long Entry = FHead; Entry != RSSI_NONE; Entry = FEntries[Entry].Next)
+		GetState(Entry, States[i++]);
+	FCS->Leave();
+}
+
+unsigned long CRssiTracker::GetCapacity() const
+{
+	return FCapacity;
+}
+
+unsigned long CRssiTracker::GetCount() const
+{
+	FCS->Enter();
+	unsigned long Count = FCount;
+	FCS->Leave();
+	return Count;
+}
+
+unsigned long CRssiTracker::GetEvictions() const
+{
+	FCS->Enter();
+	unsigned long Evictions = FEvictions;
+	FCS->Leave();
+	return Evictions;
+}
+
+unsigned long CRssiTracker::GetWindow() const
+{
+	return FWindow;
+}
+
+double CRssiTracker::GetAlpha() const
+{
+	return FAlpha;
+}
+
+void CRssiTracker::SetAlpha(const double Value)
+{
+	if (Value > 0.0 && Value <= 1.0)
+	{
+		FCS->Enter();
+		FAlpha = Value;
+		FCS->Leave();
+	}
+}
+
+double CRssiTracker::GetMeasurementNoise() const
+{
+	return FMeasurementNoise;
+}
+
+void CRssiTracker::SetMeasurementNoise(const double Value)
+{
+	if (Value > 0.0)
+	{
+		FCS->Enter();
+		FMeasurementNoise = Value;
+		FCS->Leave();
+	}
+}
+
+double CRssiTracker::GetProcessNoise() const
+{
+	return FProcessNoise;
+}
+
+void CRssiTracker::SetProcessNoise(const double Value)
+{
+	if (Value >= 0.0)
+	{
+		FCS->Enter();
+		FProcessNoise = Value;
+		FCS->Leave();
+	}
+}
@@ -0,0 +1,247 @@
+// RssiTracker.h : per device RSSI history and smoothing
+//
+
+#pragma once
+
+#include <vector>
+
+#include "wclBluetooth.h"
+#include "wclSync.h"
+
+#include "AddressIndex.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The base value of the RSSI tracker error codes. </summary>
+const int APP_E_RSSI_BASE = 0x00F0C000;
+/// <summary> The device is not tracked. </summary>
+const int APP_E_RSSI_NOT_FOUND = APP_E_RSSI_BASE + 0x0000;
+
+/// <summary> The default maximum number of the tracked devices. </summary>
+const unsigned long RSSI_DEFAULT_CAPACITY = 1024;
+/// <summary> The default number of the samples kept per device. </summary>
+const unsigned long RSSI_DEFAULT_WINDOW = 16;
+/// <summary> The maximum number of the samples kept per device. </summary>
+const unsigned long RSSI_MAX_WINDOW = 256;
+
+/// <summary> The RSSI state of a tracked device. </summary>
+typedef struct
+{
+	/// <summary> The device MAC address. </summary>
+	__int64 Address;
+	/// <summary> The number of the samples since the device is
+	///   tracked. </summary>
+	unsigned long Samples;
+	/// <summary> The number of the samples in the window. </summary>
+	unsigned long Count;
+	/// <summary> The last sample in dBm. </summary>
+	char Last;
+	/// <summary> The mean of the window in dBm. </summary>
+	double Mean;
+	/// <summary> The exponential moving average in dBm. </summary>
+	double Ema;
+	/// <summary> The Kalman filter estimate in dBm. </summary>
+	double Kalman;
+	/// <summary> The time of the last sample in microseconds. </summary>
+	unsigned __int64 LastSeen;
+} RssiState;
+/// <summary> The RSSI states of the tracked devices. </summary>
+typedef std::vector<RssiState> RssiStates;
+/// <summary> The RSSI samples of a device. </summary>
+typedef std::vector<char> RssiSamples;
+
+/// <summary> Keeps the recent RSSI samples of many remote devices and
+///   smooths them. </summary>
+/// <remarks> <para> Every device gets a circular window of <c>Window</c>
+///   samples. A sample updates the window sum, an exponential moving average
+///   and a one dimensional Kalman filter in constant time, so the smoothed
+///   values are ready without walking the window. </para>
+///   <para> All the memory is allocated by the constructor: the devices,
+///   their windows and a fixed open addressing index sized for
+///   <c>Capacity</c> devices. When the tracker is full a new device
+///   replaces the device that has not been sampled for the longest time.
+///   </para>
+///   <para> The samples come from any source: the <c>Rssi</c> of the beacon
+///   watcher frames passed to <c>Add</c>, or <c>Read</c> that queries the
+///   radio. The tracker is thread safe. </para> </remarks>
+class CRssiTracker : private CAddressIndex
+{
+	DISABLE_COPY(CRssiTracker);
+
+private:
+	typedef struct
+	{
+		__int64				Address;
+		// The recently used list links.
+		unsigned long		Prev;
+		unsigned long		Next;
+		unsigned long		Samples;
+		unsigned long		Count;
+		// The window position of the next sample.
+		unsigned long		Head;
+		long				Sum;
+		char				Last;
+		double				Ema;
+		double				Estimate;
+		double				Variance;
+		unsigned __int64	LastSeen;
+	} ENTRY;
+	typedef std::vector<ENTRY> ENTRIES;
+	// Entry index + 1 per slot, 0 marks an empty slot.
+	typedef std::vector<unsigned long> INDEX;
+
+	double					FAlpha;
+	double					FMeasurementNoise;
+	double					FProcessNoise;
+
+	unsigned long			FCapacity;
+	unsigned long			FCount;
+	CwclCriticalSection*	FCS;
+	ENTRIES					FEntries;
+	unsigned long			FEvictions;
+	// The head of the unused entries list.
+	unsigned long			FFree;
+	// The most recently sampled entry.
+	unsigned long			FHead;
+	INDEX					FIndex;
+	RssiSamples				FSamples;
+	// The least recently sampled entry.
+	unsigned long			FTail;
+	unsigned long			FWindow;
+
+	// Must be called inside the critical section.
+	unsigned long Lookup(const __int64 Address) const;
+	void Unlink(const unsigned long Entry);
+	void LinkFirst(const unsigned long Entry);
+	void Release(const unsigned long Entry);
+	void GetState(const unsigned long Entry, RssiState& State) const;
+	void Reset();
+
+	// CAddressIndex.
+	virtual bool IsSlotUsed(const unsigned long Slot) const;
+	virtual __int64 GetSlotAddress(const unsigned long Slot) const;
+	virtual void MoveSlot(const unsigned long To, const unsigned long From);
+	virtual void ClearSlot(const unsigned long Slot);
+
+public:
+	/// <summary> Creates new RSSI tracker. </summary>
+	/// <param name="Capacity"> The maximum number of the tracked
+	///   devices. </param>
+	/// <param name="Window"> The number of the samples kept per device from
+	///   1 to <see cref="RSSI_MAX_WINDOW" />. </param>
+	CRssiTracker(const unsigned long Capacity = RSSI_DEFAULT_CAPACITY,
+		const unsigned long Window = RSSI_DEFAULT_WINDOW);
+	/// <summary> Frees the RSSI tracker. </summary>
+	virtual ~CRssiTracker();
+
+	/// <summary> Adds a sample. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="Rssi"> The RSSI in dBm. </param>
+	void Add(const __int64 Address, const char Rssi);
+	/// <summary> Reads the device RSSI from the radio and adds it. </summary>
+	/// <param name="Radio"> The radio. </param>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Read(CwclBluetoothRadio* const Radio, const __int64 Address);
+	/// <summary> Stops tracking the device. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int Remove(const __int64 Address);
+	/// <summary> Stops tracking all devices. </summary>
+	void Clear();
+
+	/// <summary> Gets the device state. </summary>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="State"> On output the device state. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int GetDevice(const __int64 Address, RssiState& State) const;
+	/// <summary> Gets the samples in the device window. </summary>
+	/// <remarks> The window minimum and maximum are not kept by the tracker,
+	///   so <c>GetSnapshot</c> never walks the windows under the lock. Compute
+	///   them from the returned samples. </remarks>
+	/// <param name="Address"> The device MAC address. </param>
+	/// <param name="Samples"> On output the samples from the oldest to the
+	///   newest. </param>
+	/// <returns> If the function succeed the return value is
+	///   <see cref="WCL_E_SUCCESS" />. Otherwise the method returns one of
+	///   the WCL error codes. </returns>
+	int GetSamples(const __int64 Address, RssiSamples& Samples) const;
+	/// <summary> Gets the states of all devices. </summary>
+	/// <param name="States"> On output the device states from the most
+	///   recently sampled. </param>
+	void GetSnapshot(RssiStates& States) const;
+
+	/// <summary> Gets the maximum number of the tracked devices. </summary>
+	/// <returns> The maximum number of the devices. </returns>
+	unsigned long GetCapacity() const;
+	/// <summary> Gets the maximum number of the tracked devices. </summary>
+	/// <value> The maximum number of the devices. </value>
+	__declspec(property(get = GetCapacity)) unsigned long Capacity;
+
+	/// <summary> Gets the number of the tracked devices. </summary>
+	/// <returns> The number of the devices. </returns>
+	unsigned long GetCount() const;
+	/// <summary> Gets the number of the tracked devices. </summary>
+	/// <value> The number of the devices. </value>
+	__declspec(property(get = GetCount)) unsigned long Count;
+
+	/// <summary> Gets the number of the devices replaced because the
+	///   tracker was full. </summary>
+	/// <returns> The number of the replaced devices. </returns>
+	unsigned long GetEvictions() const;
+	/// <summary> Gets the number of the devices replaced because the
+	///   tracker was full. </summary>
+	/// <value> The number of the replaced devices. </value>
+	__declspec(property(get = GetEvictions)) unsigned long Evictions;
+
+	/// <summary> Gets the number of the samples kept per device. </summary>
+	/// <returns> The window size. </returns>
+	unsigned long GetWindow() const;
+	/// <summary> Gets the number of the samples kept per device. </summary>
+	/// <value> The window size. </value>
+	__declspec(property(get = GetWindow)) unsigned long Window;
+
+	/// <summary> Gets the moving average smoothing factor. </summary>
+	/// <returns> The weight of a new sample. </returns>
+	double GetAlpha() const;
+	/// <summary> Sets the moving average smoothing factor. </summary>
+	/// <param name="Value"> The weight of a new sample, greater than 0 and
+	///   not greater than 1. </param>
+	void SetAlpha(const double Value);
+	/// <summary> Gets and sets the moving average smoothing factor. </summary>
+	/// <value> The weight of a new sample. </value>
+	__declspec(property(get = GetAlpha, put = SetAlpha)) double Alpha;
+
+	/// <summary> Gets the Kalman filter measurement noise. </summary>
+	/// <returns> The RSSI variance of a sample in dBm^2. </returns>
+	double GetMeasurementNoise() const;
+	/// <summary> Sets the Kalman filter measurement noise. </summary>
+	/// <param name="Value"> The RSSI variance of a sample in dBm^2. Must be
+	///   greater than 0. </param>
+	void SetMeasurementNoise(const double Value);
+	/// <summary> Gets and sets the Kalman filter measurement noise. </summary>
+	/// <value> The RSSI variance of a sample in dBm^2. </value>
+	__declspec(property(get = GetMeasurementNoise, put = SetMeasurementNoise))
+		double MeasurementNoise;
+
+	/// <summary> Gets the Kalman filter process noise. </summary>
+	/// <returns> The RSSI variance growth between the samples in
+	///   dBm^2. </returns>
+	double GetProcessNoise() const;
+	/// <summary> Sets the Kalman filter process noise. </summary>
+	/// <param name="Value"> The RSSI variance growth between the samples in
+	///   dBm^2. Larger values follow a moving device faster. </param>
+	void SetProcessNoise(const double Value);
+	/// <summary> Gets and sets the Kalman filter process noise. </summary>
+	/// <value> The RSSI variance growth between the samples in
+	///   dBm^2. </value>
+	__declspec(property(get = GetProcessNoise, put = SetProcessNoise))
+		double ProcessNoise;
+};
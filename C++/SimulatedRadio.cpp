@@ -0,0 +1,2118 @@
+// SimulatedRadio.cpp : implementation file
+//
+
+#include "stdafx.h"
+#include "SimulatedRadio.h"
+
+#include "wclBluetoothMessages.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The simulated radio reports itself as the Microsoft driver so the framework
+// processes its messages the same way it does for the real hardware.
+static const wclBluetoothApi SIM_API = baMicrosoft;
+
+// The delay between discovering start request and start notification.
+static const unsigned long SIM_DISCOVERING_START_DELAY = 10;
+
+static wclGattUuid SimShortUuid(const unsigned short Uuid)
+{
+	wclGattUuid Result;
+	ZeroMemory(&Result, sizeof(Result));
+	Result.IsShortUuid = true;
+	Result.ShortUuid = Uuid;
+	return Result;
+}
+
+static HANDLE SimHandleToHdl(const unsigned short Handle)
+{
+	return reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(Handle));
+}
+
+static unsigned short SimHdlToHandle(const HANDLE Hdl)
+{
+	return static_cast<unsigned short>(reinterpret_cast<ULONG_PTR>(Hdl));
+}
+
+
+// CSimulatedGattClientConnection
+
+CSimulatedGattClientConnection::CSimulatedGattClientConnection(CSimulatedRadio* const Radio)
+	: CwclGattClientConnection(Radio)
+{
+	FConnected = false;
+	FParams.Interval = 24; // 30 ms.
+	FParams.Latency = 0;
+	FParams.LinkTimeout = 400; // 4 seconds.
+	FSimRadio = Radio;
+}
+
+CSimulatedGattClientConnection::~CSimulatedGattClientConnection()
+{
+	if (FConnected)
+		FSimRadio->UnregisterConnection(this);
+}
+
+int CSimulatedGattClientConnection::AttRequest()
+{
+	if (!FConnected)
+		return WCL_E_BLUETOOTH_CLIENT_NOT_CONNECTED;
+
+	CSimulatedRadio::PEER_PARAMS Params;
+	int Res = FSimRadio->PeerRequest(Address, Params);
+	if (Res == WCL_E_SUCCESS && Params.AttLatency > 0)
+		Sleep(Params.AttLatency);
+	return Res;
+}
+
+const SimGattCharacteristic* CSimulatedGattClientConnection::FindDescriptorOwner(
+	const wclGattDescriptor& Descriptor) const
+{
+	CSimulatedRadio::PEERS::const_iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer == FSimRadio->FPeers.end())
+		return NULL;
+
+	const SimGattServices& Services = Peer->second.Services;
+	for (SimGattServices::const_iterator s = Services.begin(); s != Services.end(); s++)
+	{
+		for (SimGattCharacteristics::const_iterator c = (*s).Characteristics.begin();
+			c != (*s).Characteristics.end(); c++)
+		{
+			if ((*c).Characteristic.Handle != Descriptor.CharacteristicHandle)
+				continue;
+
+			for (wclGattDescriptors::const_iterator d = (*c).Descriptors.begin();
+				d != (*c).Descriptors.end(); d++)
+			{
+				if ((*d).Handle == Descriptor.Handle)
+					return &(*c);
+			}
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+int CSimulatedGattClientConnection::HalConnect(CwclEvent* const Event)
+{
+	int Res = CwclGattClientConnection::HalConnect(Event);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::PEERS::iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer == FSimRadio->FPeers.end() || !Peer->second.InRange)
+		Res = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	else
+	{
+		if (FSimRadio->FConnections.find(Address) != FSimRadio->FConnections.end())
+			Res = WCL_E_BLUETOOTH_CLIENT_CONNECTED;
+	}
+	unsigned long Latency = 0;
+	bool Lost = false;
+	if (Res == WCL_E_SUCCESS)
+	{
+		Latency = Peer->second.Latency;
+		Lost = FSimRadio->Lost(Peer->second);
+	}
+	FSimRadio->FCS->Leave();
+
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	// The event is signaled when the application terminates the connection.
+	if (Event->WaitOne(Latency) == WCL_WAIT_OBJECT_0)
+		return WCL_E_BLUETOOTH_CONNECTION_TERMINATED_BY_USER;
+	if (Lost)
+		return WCL_E_BLUETOOTH_TIMEOUT;
+
+	FSimRadio->RegisterConnection(this);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalDisconnect()
+{
+	if (FConnected)
+		FSimRadio->UnregisterConnection(this);
+	return CwclGattClientConnection::HalDisconnect();
+}
+
+int CSimulatedGattClientConnection::HalReadCharacteristics(const wclGattService& Service,
+	const wclGattOperationFlag Flag, wclGattCharacteristics& Characteristics)
+{
+	UNREFERENCED_PARAMETER(Flag);
+
+	Characteristics.clear();
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	Res = WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::PEERS::const_iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer != FSimRadio->FPeers.end())
+	{
+		const SimGattServices& Services = Peer->second.Services;
+		for (SimGattServices::const_iterator s = Services.begin(); s != Services.end(); s++)
+		{
+			if ((*s).Service.Handle == Service.Handle)
+			{
+				Characteristics.reserve((*s).Characteristics.size());
+				for (SimGattCharacteristics::const_iterator c = (*s).Characteristics.begin();
+					c != (*s).Characteristics.end(); c++)
+				{
+					Characteristics.push_back((*c).Characteristic);
+				}
+				Res = WCL_E_SUCCESS;
+				break;
+			}
+		}
+	}
+	FSimRadio->FCS->Leave();
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalReadCharacteristicValue(
+	const wclGattCharacteristic& Characteristic, const wclGattOperationFlag Flag,
+	const wclGattProtectionLevel Protection, unsigned char*& Value, unsigned long& Length)
+{
+	UNREFERENCED_PARAMETER(Flag);
+	UNREFERENCED_PARAMETER(Protection);
+
+	Value = NULL;
+	Length = 0;
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	Res = WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::PEERS::const_iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer != FSimRadio->FPeers.end())
+	{
+		const SimGattServices& Services = Peer->second.Services;
+		for (SimGattServices::const_iterator s = Services.begin();
+			s != Services.end() && Res != WCL_E_SUCCESS; s++)
+		{
+			for (SimGattCharacteristics::const_iterator c = (*s).Characteristics.begin();
+				c != (*s).Characteristics.end(); c++)
+			{
+				if ((*c).Characteristic.Handle == Characteristic.Handle)
+				{
+					if (!(*c).Characteristic.IsReadable)
+						Res = WCL_E_BLUETOOTH_ACCESS_DENIED;
+					else
+					{
+						Length = static_cast<unsigned long>((*c).Value.size());
+						if (Length > 0)
+						{
+							Value = new unsigned char[Length];
+							CopyMemory(Value, &(*c).Value[0], Length);
+						}
+						Res = WCL_E_SUCCESS;
+					}
+					break;
+				}
+			}
+		}
+	}
+	FSimRadio->FCS->Leave();
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalReadDescriptors(
+	const wclGattCharacteristic& Characteristic, const wclGattOperationFlag Flag,
+	wclGattDescriptors& Descriptors)
+{
+	UNREFERENCED_PARAMETER(Flag);
+
+	Descriptors.clear();
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	Res = WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::PEERS::const_iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer != FSimRadio->FPeers.end())
+	{
+		const SimGattServices& Services = Peer->second.Services;
+		for (SimGattServices::const_iterator s = Services.begin();
+			s != Services.end() && Res != WCL_E_SUCCESS; s++)
+		{
+			for (SimGattCharacteristics::const_iterator c = (*s).Characteristics.begin();
+				c != (*s).Characteristics.end(); c++)
+			{
+				if ((*c).Characteristic.Handle == Characteristic.Handle)
+				{
+					Descriptors = (*c).Descriptors;
+					Res = WCL_E_SUCCESS;
+					break;
+				}
+			}
+		}
+	}
+	FSimRadio->FCS->Leave();
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalReadDescriptorValue(const wclGattDescriptor& Descriptor,
+	const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+	wclGattDescriptorValue& Value)
+{
+	UNREFERENCED_PARAMETER(Flag);
+	UNREFERENCED_PARAMETER(Protection);
+
+	Value.AType = Descriptor.DescriptorType;
+	Value.Uuid = Descriptor.Uuid;
+	Value.Data = NULL;
+	Value.Length = 0;
+	ZeroMemory(&Value.CharacteristicExtendedProperties,
+		sizeof(Value.CharacteristicExtendedProperties));
+	ZeroMemory(&Value.ClientCharacteristicConfiguration,
+		sizeof(Value.ClientCharacteristicConfiguration));
+	ZeroMemory(&Value.ServerCharacteristicConfiguration,
+		sizeof(Value.ServerCharacteristicConfiguration));
+	ZeroMemory(&Value.CharacteristicFormat, sizeof(Value.CharacteristicFormat));
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	FSimRadio->FCS->Enter();
+	const SimGattCharacteristic* Owner = FindDescriptorOwner(Descriptor);
+	if (Owner == NULL)
+		Res = WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+	else
+	{
+		if (Descriptor.DescriptorType == dtClientCharacteristicConfiguration)
+		{
+			Value.ClientCharacteristicConfiguration.IsSubscribeToNotification =
+				(FSubscribed.find(Owner->Characteristic.ValueHandle) != FSubscribed.end());
+		}
+	}
+	FSimRadio->FCS->Leave();
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalReadIncludedServices(const wclGattService& Service,
+	const wclGattOperationFlag Flag, wclGattServices& Services)
+{
+	UNREFERENCED_PARAMETER(Service);
+	UNREFERENCED_PARAMETER(Flag);
+
+	// Simulated peers do not have included services.
+	Services.clear();
+	return AttRequest();
+}
+
+int CSimulatedGattClientConnection::HalReadServices(const wclGattOperationFlag Flag,
+	wclGattServices& Services)
+{
+	UNREFERENCED_PARAMETER(Flag);
+
+	Services.clear();
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::PEERS::const_iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer == FSimRadio->FPeers.end())
+		Res = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	else
+	{
+		const SimGattServices& PeerServices = Peer->second.Services;
+		Services.reserve(PeerServices.size());
+		for (SimGattServices::const_iterator s = PeerServices.begin(); s != PeerServices.end(); s++)
+			Services.push_back((*s).Service);
+	}
+	FSimRadio->FCS->Leave();
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalWriteCharacteristicValue(
+	const wclGattCharacteristic& Characteristic, const wclGattProtectionLevel Protection,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	UNREFERENCED_PARAMETER(Protection);
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	Res = WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::PEERS::iterator Peer = FSimRadio->FPeers.find(Address);
+	if (Peer != FSimRadio->FPeers.end())
+	{
+		SimGattServices& Services = Peer->second.Services;
+		for (SimGattServices::iterator s = Services.begin();
+			s != Services.end() && Res != WCL_E_SUCCESS; s++)
+		{
+			for (SimGattCharacteristics::iterator c = (*s).Characteristics.begin();
+				c != (*s).Characteristics.end(); c++)
+			{
+				if ((*c).Characteristic.Handle == Characteristic.Handle)
+				{
+					if (!(*c).Characteristic.IsWritable &&
+						!(*c).Characteristic.IsWritableWithoutResponse)
+					{
+						Res = WCL_E_BLUETOOTH_ACCESS_DENIED;
+					}
+					else
+					{
+						(*c).Value.assign(Value, Value + Length);
+						Res = WCL_E_SUCCESS;
+					}
+					break;
+				}
+			}
+		}
+	}
+	FSimRadio->FCS->Leave();
+
+	// The framework passes the write kind in the characteristic properties:
+	// the kind that is not used is cleared.
+	if (Res == WCL_E_SUCCESS && Address == FSimRadio->FAddress)
+	{
+		Res = FSimRadio->ServerWrite(Characteristic.ValueHandle, Value, Length,
+			!Characteristic.IsWritableWithoutResponse);
+	}
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalWriteDescriptorValue(const wclGattDescriptor& Descriptor,
+	const wclGattProtectionLevel Protection, const wclGattDescriptorValue& Value)
+{
+	UNREFERENCED_PARAMETER(Protection);
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	bool Cccd = false;
+	bool Subscribed = false;
+	unsigned short ValueHandle = 0;
+	FSimRadio->FCS->Enter();
+	const SimGattCharacteristic* Owner = FindDescriptorOwner(Descriptor);
+	if (Owner == NULL)
+		Res = WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+	else
+	{
+		if (Descriptor.DescriptorType == dtClientCharacteristicConfiguration)
+		{
+			Cccd = true;
+			Subscribed = (Value.ClientCharacteristicConfiguration.IsSubscribeToNotification ||
+				Value.ClientCharacteristicConfiguration.IsSubscribeToIndication);
+			ValueHandle = Owner->Characteristic.ValueHandle;
+			if (Subscribed)
+				FSubscribed.insert(ValueHandle);
+			else
+				FSubscribed.erase(ValueHandle);
+		}
+	}
+	FSimRadio->FCS->Leave();
+
+	if (Cccd && Address == FSimRadio->FAddress)
+		FSimRadio->ServerSubscribed(ValueHandle, Subscribed);
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalAbortReliableWrite()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalBeginReliableWrite(
+	const wclGattCharacteristic& Characteristic)
+{
+	UNREFERENCED_PARAMETER(Characteristic);
+
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalEndReliableWrite()
+{
+	return AttRequest();
+}
+
+int CSimulatedGattClientConnection::HalSubscribe(const wclGattCharacteristic& Characteristic,
+	HANDLE& Hdl)
+{
+	Hdl = NULL;
+	if (!Characteristic.IsNotifiable && !Characteristic.IsIndicatable)
+		return WCL_E_BLUETOOTH_ACCESS_DENIED;
+
+	int Res = AttRequest();
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	FSimRadio->FCS->Enter();
+	FSubscribed.insert(Characteristic.ValueHandle);
+	FSimRadio->FCS->Leave();
+
+	if (Address == FSimRadio->FAddress)
+		FSimRadio->ServerSubscribed(Characteristic.ValueHandle, true);
+
+	Hdl = SimHandleToHdl(Characteristic.ValueHandle);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalUnsubscribe(const HANDLE Hdl)
+{
+	FSimRadio->FCS->Enter();
+	FSubscribed.erase(SimHdlToHandle(Hdl));
+	FSimRadio->FCS->Leave();
+
+	if (Address == FSimRadio->FAddress)
+		FSimRadio->ServerSubscribed(SimHdlToHandle(Hdl), false);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalGetConnectionParams(
+	wclBluetoothLeConnectionParameters& Params)
+{
+	FSimRadio->FCS->Enter();
+	Params = FParams;
+	FSimRadio->FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalSetConnectionParams(
+	const wclBluetoothLeConnectionParametersType Params)
+{
+	wclBluetoothLeConnectionParametersValue Value;
+	Value.Latency = 0;
+	switch (Params)
+	{
+		case ppPowerOptimized:
+			Value.MinInterval = 72; // 90 ms.
+			Value.MaxInterval = 72;
+			Value.LinkTimeout = 600;
+			break;
+
+		case ppThroughputOptimized:
+			Value.MinInterval = 6; // 7.5 ms.
+			Value.MaxInterval = 6;
+			Value.LinkTimeout = 300;
+			break;
+
+		default:
+			Value.MinInterval = 24; // 30 ms.
+			Value.MaxInterval = 24;
+			Value.LinkTimeout = 400;
+			break;
+	}
+	return HalSetConnectionParams(Value);
+}
+
+int CSimulatedGattClientConnection::HalSetConnectionParams(
+	const wclBluetoothLeConnectionParametersValue& Params)
+{
+	if (Params.MinInterval > Params.MaxInterval)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FSimRadio->FCS->Enter();
+	FParams.Interval = Params.MaxInterval;
+	FParams.Latency = Params.Latency;
+	FParams.LinkTimeout = Params.LinkTimeout;
+	FSimRadio->FCS->Leave();
+
+	CwclMessage* Msg = new CwclBluetoothLeConnectionParamsChangedMessage(SIM_API, Address);
+	FSimRadio->Schedule(Receiver, Msg, 0);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattClientConnection::HalGetMaxPduSize(unsigned short& Size)
+{
+	Size = 23;
+
+	CSimulatedRadio::PEER_PARAMS Params;
+	int Res = FSimRadio->PeerRequest(Address, Params);
+	if (Res == WCL_E_SUCCESS)
+		Size = Params.MaxPduSize;
+	return Res;
+}
+
+int CSimulatedGattClientConnection::HalGetConnectionPhyInfo(wclBluetoothLeConnectionPhy& Info)
+{
+	ZeroMemory(&Info, sizeof(Info));
+	Info.Receive.IsUncoded1MPhy = true;
+	Info.Transmit.IsUncoded1MPhy = true;
+	return WCL_E_SUCCESS;
+}
+
+
+// CSimulatedGattWriteRequest
+
+CSimulatedGattWriteRequest::CSimulatedGattWriteRequest(void* const Data,
+	const unsigned long Size, const bool WithResponse, int* const Result)
+	: CwclGattLocalCharacteristicWriteRequest(static_cast<__int64>(GetTickCount64()), 0,
+		Data, Size, WithResponse)
+{
+	FResult = Result;
+}
+
+int CSimulatedGattWriteRequest::HalRespond()
+{
+	*FResult = WCL_E_SUCCESS;
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattWriteRequest::HalRespondWithError(const int Error)
+{
+	*FResult = Error;
+	return WCL_E_SUCCESS;
+}
+
+
+// CSimulatedGattServerClient
+
+CSimulatedGattServerClient::CSimulatedGattServerClient(const __int64 Address,
+	CwclGattServerConnection* const Connection, CSimulatedRadio* const Radio)
+	: CwclGattServerClient(Address, Connection)
+{
+	FSimRadio = Radio;
+}
+
+int CSimulatedGattServerClient::HalDisconnect()
+{
+	return FSimRadio->HalRemoteDisconnect(Address);
+}
+
+int CSimulatedGattServerClient::HalGetConnectionParams(
+	wclBluetoothLeConnectionParameters& Params)
+{
+	// Both sides share the link of the client connection.
+	int Res = WCL_E_BLUETOOTH_DEVICE_NOT_CONNECTED;
+	FSimRadio->FCS->Enter();
+	CSimulatedRadio::CONNECTIONS::const_iterator i = FSimRadio->FConnections.find(Address);
+	if (i != FSimRadio->FConnections.end())
+	{
+		Params = i->second->FParams;
+		Res = WCL_E_SUCCESS;
+	}
+	FSimRadio->FCS->Leave();
+	return Res;
+}
+
+int CSimulatedGattServerClient::HalSetConnectionParams(
+	const wclBluetoothLeConnectionParametersType Params)
+{
+	UNREFERENCED_PARAMETER(Params);
+
+	// The connection parameters are managed by the central.
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedGattServerClient::HalSetConnectionParams(
+	const wclBluetoothLeConnectionParametersValue& Params)
+{
+	UNREFERENCED_PARAMETER(Params);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedGattServerClient::HalGetMaxNotificationSize(unsigned short& Size)
+{
+	unsigned short PduSize;
+	int Res = HalGetMaxPduSize(PduSize);
+	// The ATT Handle Value Notification header is 3 bytes.
+	Size = (Res == WCL_E_SUCCESS ? PduSize - 3 : 20);
+	return Res;
+}
+
+int CSimulatedGattServerClient::HalGetMaxPduSize(unsigned short& Size)
+{
+	Size = 23;
+
+	CSimulatedRadio::PEER_PARAMS Params;
+	int Res = FSimRadio->PeerRequest(Address, Params);
+	if (Res == WCL_E_SUCCESS)
+		Size = Params.MaxPduSize;
+	return Res;
+}
+
+int CSimulatedGattServerClient::HalGetConnectionPhyInfo(wclBluetoothLeConnectionPhy& Info)
+{
+	ZeroMemory(&Info, sizeof(Info));
+	Info.Receive.IsUncoded1MPhy = true;
+	Info.Transmit.IsUncoded1MPhy = true;
+	return WCL_E_SUCCESS;
+}
+
+
+// CSimulatedGattLocalCharacteristic
+
+CSimulatedGattLocalCharacteristic::CSimulatedGattLocalCharacteristic(
+	CwclGattLocalService* const Service, const wclGattUuid& Uuid,
+	const wclGattLocalCharacteristicParameters& Params, CSimulatedRadio* const Radio)
+	: CwclGattLocalCharacteristic(Service, Uuid, Params)
+{
+	FSimRadio = Radio;
+	FValueHandle = 0;
+}
+
+int CSimulatedGattLocalCharacteristic::HalAdd()
+{
+	FSimRadio->AddLocalCharacteristic(this);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattLocalCharacteristic::HalRemove()
+{
+	FSimRadio->RemoveLocalCharacteristic(this);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattLocalCharacteristic::HalNotify(const __int64 Address,
+	const unsigned char* const Data, const unsigned long Size) const
+{
+	// The radio is the only client, so 0 (all clients) means the radio too.
+	if (Address != 0 && Address != FSimRadio->FAddress)
+		return WCL_E_BLUETOOTH_DEVICE_NOT_CONNECTED;
+
+	FSimRadio->FCS->Enter();
+	unsigned short Handle = FValueHandle;
+	FSimRadio->FCS->Leave();
+
+	return FSimRadio->Notify(FSimRadio->FAddress, Handle, Data, Size);
+}
+
+
+// CSimulatedGattLocalService
+
+CSimulatedGattLocalService::CSimulatedGattLocalService(CwclGattServerConnection* const Server,
+	const wclGattUuid& Uuid, CSimulatedRadio* const Radio)
+	: CwclGattLocalService(Server, Uuid)
+{
+	FSimRadio = Radio;
+}
+
+int CSimulatedGattLocalService::HalAdd()
+{
+	// The service appears in the peer database with its first
+	// characteristic.
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattLocalService::HalCreate()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattLocalService::HalDestroy()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattLocalService::HalRemove()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattLocalService::HalCreateCharacteristic(const wclGattUuid& Uuid,
+	const wclGattLocalCharacteristicParameters& Params,
+	CwclGattLocalCharacteristic*& Characteristic)
+{
+	Characteristic = new CSimulatedGattLocalCharacteristic(this, Uuid, Params, FSimRadio);
+	return WCL_E_SUCCESS;
+}
+
+
+// CSimulatedGattServerConnection
+
+CSimulatedGattServerConnection::CSimulatedGattServerConnection(CSimulatedRadio* const Radio)
+	: CwclGattServerConnection(Radio)
+{
+	FSimRadio = Radio;
+}
+
+int CSimulatedGattServerConnection::HalInitialize()
+{
+	return FSimRadio->RegisterServer(this);
+}
+
+int CSimulatedGattServerConnection::HalUninitialize()
+{
+	FSimRadio->UnregisterServer(this);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedGattServerConnection::HalCreateService(const wclGattUuid& Uuid,
+	CwclGattLocalService*& Service)
+{
+	Service = new CSimulatedGattLocalService(this, Uuid, FSimRadio);
+	return WCL_E_SUCCESS;
+}
+
+CwclGattServerClient* CSimulatedGattServerConnection::HalCreateClient(const __int64 Address)
+{
+	return new CSimulatedGattServerClient(Address, this, FSimRadio);
+}
+
+
+// CSimulatedRadio
+
+CSimulatedRadio::CSimulatedRadio(CwclBluetoothManager* const Manager)
+	: CwclBluetoothRadio(Manager)
+{
+	FAddress = 0x00000000005AFE00;
+	FCod = 0;
+	FConnectable = true;
+	FDiscoverable = false;
+	FDiscoveryDuration = 0;
+	FName = _T("Simulated Radio");
+	FSimplePairing = true;
+
+	FCS = new CwclCriticalSection();
+	FDiscovering = false;
+	FSeed = 0x2545F491;
+
+	FServer = NULL;
+
+	FPostCS = new CwclCriticalSection();
+	FScheduleEvent = NULL;
+	FTerminated = false;
+	FThread = NULL;
+}
+
+CSimulatedRadio::~CSimulatedRadio()
+{
+	StopScheduler();
+
+	delete FPostCS;
+	delete FCS;
+}
+
+UINT __stdcall CSimulatedRadio::_SchedulerThreadProc(LPVOID lpParam)
+{
+	static_cast<CSimulatedRadio*>(lpParam)->SchedulerThreadProc();
+	return 0;
+}
+
+void CSimulatedRadio::SchedulerThreadProc()
+{
+	while (true)
+	{
+		unsigned long Timeout = WCL_WAIT_INFINITE;
+		SCHEDULED Item;
+		Item.Message = NULL;
+
+		FPostCS->Enter();
+		FCS->Enter();
+		if (FTerminated)
+		{
+			FCS->Leave();
+			FPostCS->Leave();
+			break;
+		}
+		if (FSchedule.size() > 0)
+		{
+			SCHEDULE::iterator First = FSchedule.begin();
+			unsigned __int64 Current = Now();
+			if (First->first <= Current)
+			{
+				Item = First->second;
+				FSchedule.erase(First);
+			}
+			else
+				Timeout = static_cast<unsigned long>(First->first - Current);
+		}
+		FCS->Leave();
+
+		if (Item.Message != NULL)
+		{
+			if (Item.Message->Category == mcBluetooth &&
+				Item.Message->Id == WCL_MSG_ID_BLUETOOTH_DISCOVERING_COMPLETED)
+			{
+				FCS->Enter();
+				FDiscovering = false;
+				FCS->Leave();
+			}
+
+			if (Item.Receiver == Receiver)
+			{
+				// The manager never opens the simulated radio, so the radio
+				// processes its own messages here.
+				FPostCS->Leave();
+				MessageReceived(Item.Message);
+			}
+			else
+			{
+				Item.Receiver->Post(Item.Message);
+				FPostCS->Leave();
+			}
+			Item.Message->Release();
+		}
+		else
+		{
+			FPostCS->Leave();
+			FScheduleEvent->WaitOne(Timeout);
+		}
+	}
+}
+
+int CSimulatedRadio::StartScheduler()
+{
+	if (FThread != NULL)
+		return WCL_E_SUCCESS;
+
+	FScheduleEvent = CwclAutoResetEvent::Create();
+	if (FScheduleEvent == NULL)
+		return WCL_E_BLUETOOTH_UNABLE_CREATE_EVENT;
+
+	FTerminated = false;
+	FThread = wclCreateThread(_SchedulerThreadProc, this);
+	if (FThread == NULL)
+	{
+		delete FScheduleEvent;
+		FScheduleEvent = NULL;
+		return WCL_E_BLUETOOTH_UNABLE_START_THREAD;
+	}
+	return WCL_E_SUCCESS;
+}
+
+void CSimulatedRadio::StopScheduler()
+{
+	if (FThread == NULL)
+		return;
+
+	FCS->Enter();
+	FTerminated = true;
+	FCS->Leave();
+	FScheduleEvent->SetEvent();
+	wclWaitAndCloseThread(FThread);
+
+	delete FScheduleEvent;
+	FScheduleEvent = NULL;
+
+	for (SCHEDULE::iterator i = FSchedule.begin(); i != FSchedule.end(); i++)
+		i->second.Message->Release();
+	FSchedule.clear();
+	FDiscovering = false;
+}
+
+void CSimulatedRadio::Schedule(CwclMessageReceiver* const Receiver,
+	CwclMessage* const Message, const unsigned long Delay, const bool Discovery)
+{
+	SCHEDULED Item;
+	Item.Receiver = Receiver;
+	Item.Message = Message;
+	Item.Discovery = Discovery;
+
+	FCS->Enter();
+	if (FThread == NULL || FTerminated)
+	{
+		FCS->Leave();
+		Message->Release();
+	}
+	else
+	{
+		FSchedule.insert(SCHEDULE::value_type(Now() + Delay, Item));
+		FCS->Leave();
+		FScheduleEvent->SetEvent();
+	}
+}
+
+void CSimulatedRadio::Unschedule(CwclMessageReceiver* const Receiver)
+{
+	// Waits for the message that is being posted right now: once the method
+	// returns nothing refers to the receiver.
+	FPostCS->Enter();
+	FCS->Enter();
+	SCHEDULE::iterator i = FSchedule.begin();
+	while (i != FSchedule.end())
+	{
+		if (i->second.Receiver == Receiver)
+		{
+			i->second.Message->Release();
+			i = FSchedule.erase(i);
+		}
+		else
+			i++;
+	}
+	FCS->Leave();
+	FPostCS->Leave();
+}
+
+void CSimulatedRadio::UnscheduleDiscovery()
+{
+	FCS->Enter();
+	SCHEDULE::iterator i = FSchedule.begin();
+	while (i != FSchedule.end())
+	{
+		if (i->second.Discovery)
+		{
+			i->second.Message->Release();
+			i = FSchedule.erase(i);
+		}
+		else
+			i++;
+	}
+	FCS->Leave();
+}
+
+unsigned __int64 CSimulatedRadio::Now()
+{
+	static LARGE_INTEGER Frequency = { 0 };
+	if (Frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&Frequency);
+
+	LARGE_INTEGER Counter;
+	QueryPerformanceCounter(&Counter);
+	return static_cast<unsigned __int64>(Counter.QuadPart * 1000 / Frequency.QuadPart);
+}
+
+unsigned long CSimulatedRadio::Random(const unsigned long Range)
+{
+	if (Range == 0)
+		return 0;
+
+	// Xorshift32. Must be called inside the critical section.
+	FSeed ^= FSeed << 13;
+	FSeed ^= FSeed >> 17;
+	FSeed ^= FSeed << 5;
+	return FSeed % Range;
+}
+
+bool CSimulatedRadio::Lost(const SimPeer& Peer)
+{
+	return (Peer.Loss > 0 && Random(100) < Peer.Loss);
+}
+
+int CSimulatedRadio::PeerRequest(const __int64 Address, PEER_PARAMS& Params)
+{
+	FCS->Enter();
+	PEERS::const_iterator i = FPeers.find(Address);
+	if (i == FPeers.end() || !i->second.InRange)
+	{
+		FCS->Leave();
+		return WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	}
+	const SimPeer& Peer = i->second;
+	Params.Latency = Peer.Latency;
+	Params.AttLatency = Peer.AttLatency;
+	Params.MaxPduSize = Peer.MaxPduSize;
+	Params.AddressType = Peer.AddressType;
+	Params.DeviceType = Peer.DeviceType;
+	Params.Cod = Peer.Cod;
+	Params.Rssi = Peer.Rssi;
+	Params.RssiJitter = Peer.RssiJitter;
+	bool IsLost = Lost(Peer);
+	FCS->Leave();
+
+	if (IsLost)
+	{
+		// Lost request is reported after the link supervision timeout. Keep it
+		// short: the simulation must not block longer than the peer latency.
+		Sleep(Params.Latency);
+		return WCL_E_BLUETOOTH_TIMEOUT;
+	}
+	return WCL_E_SUCCESS;
+}
+
+void CSimulatedRadio::CompletePairing(const __int64 Address, const bool Confirm)
+{
+	int Error = WCL_E_SUCCESS;
+	unsigned long Latency = 0;
+
+	FCS->Enter();
+	FPairing.erase(Address);
+	PEERS::iterator Peer = FPeers.find(Address);
+	if (Peer == FPeers.end())
+		Error = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	else
+	{
+		Latency = Peer->second.Latency;
+		if (!Confirm)
+			Error = WCL_E_BLUETOOTH_AUTHENTICATION_FAILED;
+		else
+		{
+			if (Lost(Peer->second))
+				Error = WCL_E_BLUETOOTH_TIMEOUT;
+			else
+				Peer->second.Paired = true;
+		}
+	}
+	FCS->Leave();
+
+	CwclMessage* Msg = new CwclBluetoothAuthenticationCompletedMessage(SIM_API, Address, Error);
+	Schedule(Receiver, Msg, Latency);
+}
+
+void CSimulatedRadio::RegisterConnection(CSimulatedGattClientConnection* const Connection)
+{
+	FCS->Enter();
+	FConnections[Connection->Address] = Connection;
+	Connection->FConnected = true;
+	FCS->Leave();
+
+	if (Connection->Address == FAddress)
+	{
+		PostServer(new CwclBluetoothLeGattServerClientConnectedMessage(SIM_API, FAddress,
+			NULL));
+	}
+}
+
+void CSimulatedRadio::UnregisterConnection(CSimulatedGattClientConnection* const Connection)
+{
+	FCS->Enter();
+	CONNECTIONS::iterator i = FConnections.find(Connection->Address);
+	if (i != FConnections.end() && i->second == Connection)
+		FConnections.erase(i);
+	Connection->FConnected = false;
+	Connection->FSubscribed.clear();
+	FCS->Leave();
+
+	Unschedule(Connection->Receiver);
+
+	if (Connection->Address == FAddress)
+		PostServer(new CwclBluetoothLeGattServerClientDisconnectedMessage(SIM_API, FAddress));
+}
+
+int CSimulatedRadio::RegisterServer(CSimulatedGattServerConnection* const Server)
+{
+	int Res = WCL_E_SUCCESS;
+	FCS->Enter();
+	if (FServer != NULL)
+		Res = WCL_E_BLUETOOTH_LE_GATT_SERVER_RUNNING;
+	else
+		FServer = Server;
+	FCS->Leave();
+	return Res;
+}
+
+void CSimulatedRadio::UnregisterServer(CSimulatedGattServerConnection* const Server)
+{
+	// Waits for the message that is being posted right now: once the method
+	// returns nothing refers to the server receiver.
+	FPostCS->Enter();
+	FCS->Enter();
+	if (FServer == Server)
+		FServer = NULL;
+	FCS->Leave();
+	FPostCS->Leave();
+}
+
+void CSimulatedRadio::AddLocalCharacteristic(
+	CSimulatedGattLocalCharacteristic* const Characteristic)
+{
+	FCS->Enter();
+	FLocal.push_back(Characteristic);
+	UpdateServerPeer();
+	FCS->Leave();
+}
+
+void CSimulatedRadio::RemoveLocalCharacteristic(
+	CSimulatedGattLocalCharacteristic* const Characteristic)
+{
+	FCS->Enter();
+	for (LOCAL_CHARACTERISTICS::iterator i = FLocal.begin(); i != FLocal.end(); i++)
+	{
+		if (*i == Characteristic)
+		{
+			FLocal.erase(i);
+			break;
+		}
+	}
+	Characteristic->FValueHandle = 0;
+	UpdateServerPeer();
+	FCS->Leave();
+}
+
+void CSimulatedRadio::UpdateServerPeer()
+{
+	if (FLocal.size() == 0)
+	{
+		FPeers.erase(FAddress);
+		return;
+	}
+
+	SimPeer Peer = DefaultPeer(FAddress);
+	Peer.Name = FName;
+	Peer.AttLatency = 0;
+	Peer.Services.clear();
+
+	// The handles are assigned in the order the characteristics were added:
+	// service, characteristic, value and the CCCD of a notifiable one.
+	std::vector<CwclGattLocalService*> Owners;
+	unsigned short Handle = 0x0001;
+	for (LOCAL_CHARACTERISTICS::iterator i = FLocal.begin(); i != FLocal.end(); i++)
+	{
+		CSimulatedGattLocalCharacteristic* Local = *i;
+
+		size_t s = 0;
+		while (s < Owners.size() && Owners[s] != Local->Service)
+			s++;
+		if (s == Owners.size())
+		{
+			SimGattService Service;
+			Service.Service.Uuid = Local->Service->Uuid;
+			Service.Service.Handle = Handle++;
+			Peer.Services.push_back(Service);
+			Owners.push_back(Local->Service);
+		}
+		SimGattService& Service = Peer.Services[s];
+
+		wclGattLocalCharacteristicParameters Params = Local->Params;
+		SimGattCharacteristic Char;
+		ZeroMemory(&Char.Characteristic, sizeof(Char.Characteristic));
+		Char.Characteristic.ServiceHandle = Service.Service.Handle;
+		Char.Characteristic.Uuid = Local->Uuid;
+		Char.Characteristic.Handle = Handle++;
+		Char.Characteristic.ValueHandle = Handle++;
+		Char.Characteristic.IsReadable = (Params.Props.count(cpReadable) > 0);
+		Char.Characteristic.IsWritable = (Params.Props.count(cpWritable) > 0);
+		Char.Characteristic.IsWritableWithoutResponse =
+			(Params.Props.count(cpWritableWithoutResponse) > 0);
+		Char.Characteristic.IsNotifiable = (Params.Props.count(cpNotifiable) > 0);
+		Char.Characteristic.IsIndicatable = (Params.Props.count(cpIndicatable) > 0);
+		if (Char.Characteristic.IsNotifiable || Char.Characteristic.IsIndicatable)
+		{
+			wclGattDescriptor Cccd;
+			Cccd.ServiceHandle = Service.Service.Handle;
+			Cccd.CharacteristicHandle = Char.Characteristic.Handle;
+			Cccd.DescriptorType = dtClientCharacteristicConfiguration;
+			Cccd.Uuid = SimShortUuid(0x2902);
+			Cccd.Handle = Handle++;
+			Char.Descriptors.push_back(Cccd);
+		}
+		Service.Characteristics.push_back(Char);
+
+		Local->FValueHandle = Char.Characteristic.ValueHandle;
+	}
+
+	FPeers[FAddress] = Peer;
+}
+
+CSimulatedGattLocalCharacteristic* CSimulatedRadio::FindLocalCharacteristic(
+	const unsigned short Handle) const
+{
+	for (LOCAL_CHARACTERISTICS::const_iterator i = FLocal.begin(); i != FLocal.end(); i++)
+	{
+		if ((*i)->FValueHandle == Handle)
+			return *i;
+	}
+	return NULL;
+}
+
+bool CSimulatedRadio::PostServer(CwclMessage* const Message)
+{
+	FPostCS->Enter();
+	FCS->Enter();
+	CwclMessageReceiver* ServerReceiver = NULL;
+	if (FServer != NULL)
+		ServerReceiver = FServer->Receiver;
+	FCS->Leave();
+
+	if (ServerReceiver != NULL)
+		ServerReceiver->Post(Message);
+	FPostCS->Leave();
+	Message->Release();
+	return (ServerReceiver != NULL);
+}
+
+int CSimulatedRadio::ServerWrite(const unsigned short Handle,
+	const unsigned char* const Value, const unsigned long Length, const bool WithResponse)
+{
+	FCS->Enter();
+	CSimulatedGattLocalCharacteristic* Local = FindLocalCharacteristic(Handle);
+	FCS->Leave();
+	if (Local == NULL)
+		return WCL_E_BLUETOOTH_SERVICE_NOT_FOUND;
+
+	CwclAutoResetEvent* Event = CwclAutoResetEvent::Create();
+	if (Event == NULL)
+		return WCL_E_BLUETOOTH_UNABLE_CREATE_EVENT;
+
+	// A write the server does not respond to times out on a real link.
+	int Result = (WithResponse ? WCL_E_BLUETOOTH_TIMEOUT : WCL_E_SUCCESS);
+	// The request copies the value. The framework signals the event once the
+	// server has processed the message, the same way a driver waits for
+	// the application to handle the request.
+	CwclGattLocalCharacteristicWriteRequest* Request = new CSimulatedGattWriteRequest(
+		const_cast<unsigned char*>(Value), Length, WithResponse, &Result);
+	CwclMessage* Msg = new CwclBluetoothLeGattServerWriteMessage(SIM_API, FAddress, NULL,
+		Local, Event, Request);
+	if (PostServer(Msg))
+		Event->WaitOne(WCL_WAIT_INFINITE);
+	else
+		Result = WCL_E_BLUETOOTH_LE_GATT_SERVER_NOT_RUNNING;
+
+	delete Event;
+	return Result;
+}
+
+void CSimulatedRadio::ServerSubscribed(const unsigned short Handle, const bool Subscribed)
+{
+	FCS->Enter();
+	CSimulatedGattLocalCharacteristic* Local = FindLocalCharacteristic(Handle);
+	FCS->Leave();
+	if (Local == NULL)
+		return;
+
+	CwclMessage* Msg;
+	if (Subscribed)
+	{
+		Msg = new CwclBluetoothLeGattServerClientSubscribedMessage(SIM_API, FAddress, NULL,
+			Local);
+	}
+	else
+		Msg = new CwclBluetoothLeGattServerClientUnsubscribedMessage(SIM_API, FAddress, Local);
+	PostServer(Msg);
+}
+
+int CSimulatedRadio::HalGetFunctions()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalInitialize()
+{
+	return StartScheduler();
+}
+
+int CSimulatedRadio::HalLoadApi()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalRegisterCallbacks()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalSetGlobalInstance()
+{
+	return WCL_E_SUCCESS;
+}
+
+void CSimulatedRadio::HalClearFunctions()
+{
+}
+
+void CSimulatedRadio::HalClearGlobalInstance()
+{
+}
+
+void CSimulatedRadio::HalTerminateOperations()
+{
+	FCS->Enter();
+	FPairing.clear();
+	FCS->Leave();
+
+	HalTerminate();
+}
+
+void CSimulatedRadio::HalUninitialize()
+{
+	StopScheduler();
+}
+
+void CSimulatedRadio::HalUnloadApi()
+{
+}
+
+void CSimulatedRadio::HalUnregisterCallbacks()
+{
+}
+
+int CSimulatedRadio::HalGetAddress(__int64& Address)
+{
+	FCS->Enter();
+	Address = FAddress;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetCod(unsigned long& Cod)
+{
+	FCS->Enter();
+	Cod = FCod;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetConnectable(bool& Connectable)
+{
+	FCS->Enter();
+	Connectable = FConnectable;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetDiscoverable(bool& Discoverable)
+{
+	FCS->Enter();
+	Discoverable = FDiscoverable;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetHciVersion(unsigned char& Version, unsigned short& Revision)
+{
+	Version = 9; // Bluetooth 5.0
+	Revision = 0;
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetLmpVersion(unsigned char& Version, unsigned short& Subversion)
+{
+	Version = 9; // Bluetooth 5.0
+	Subversion = 0;
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetManufacturer(unsigned short& Manu)
+{
+	Manu = 0xFFFF; // Reserved for internal use by the Bluetooth SIG.
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetName(tstring& Name)
+{
+	FCS->Enter();
+	Name = FName;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalSetCod(const unsigned long Cod)
+{
+	FCS->Enter();
+	FCod = Cod;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalSetConnectable(const bool Connectable)
+{
+	FCS->Enter();
+	FConnectable = Connectable;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalSetDiscoverable(const bool Discoverable)
+{
+	FCS->Enter();
+	FDiscoverable = Discoverable;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalSetName(const tstring& Name)
+{
+	FCS->Enter();
+	FName = Name;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalTurnOn()
+{
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalTurnOff()
+{
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalDiscoverClassic(const unsigned char Timeout)
+{
+	UNREFERENCED_PARAMETER(Timeout);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalDiscoverBle(const unsigned char Timeout)
+{
+	FCS->Enter();
+	if (FDiscovering)
+	{
+		FCS->Leave();
+		return WCL_E_BLUETOOTH_DISCOVERING_RUNNING;
+	}
+
+	unsigned long Duration = FDiscoveryDuration;
+	if (Duration == 0)
+		Duration = static_cast<unsigned long>(Timeout) * 1000;
+	FDiscovering = true;
+
+	// Build the schedule under the lock so the found devices order depends only
+	// on the seed.
+	typedef std::vector<std::pair<__int64, unsigned long> > FOUND;
+	FOUND Found;
+	Found.reserve(FPeers.size());
+	for (PEERS::const_iterator i = FPeers.begin(); i != FPeers.end(); i++)
+	{
+		// The radio does not discover its own GATT server.
+		const SimPeer& Peer = i->second;
+		if (Peer.Address != FAddress && Peer.InRange && !Lost(Peer))
+		{
+			unsigned long Delay = SIM_DISCOVERING_START_DELAY + Random(Duration);
+			if (Peer.Latency < Duration)
+				Delay = max(Delay, Peer.Latency);
+			Found.push_back(FOUND::value_type(Peer.Address, Delay));
+		}
+	}
+	FCS->Leave();
+
+	Schedule(Receiver, new CwclBluetoothDiscoveringStartedMessage(SIM_API),
+		SIM_DISCOVERING_START_DELAY, true);
+	for (FOUND::const_iterator i = Found.begin(); i != Found.end(); i++)
+	{
+		Schedule(Receiver, new CwclBluetoothDeviceFoundMessage(SIM_API, i->first),
+			i->second, true);
+	}
+	Schedule(Receiver, new CwclBluetoothDiscoveringCompletedMessage(SIM_API, WCL_E_SUCCESS),
+		SIM_DISCOVERING_START_DELAY + Duration, true);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalTerminate()
+{
+	FCS->Enter();
+	bool Discovering = FDiscovering;
+	FCS->Leave();
+	if (!Discovering)
+		return WCL_E_BLUETOOTH_DISCOVERING_NOT_RUNNING;
+
+	UnscheduleDiscovery();
+	Schedule(Receiver, new CwclBluetoothDiscoveringCompletedMessage(SIM_API, WCL_E_SUCCESS), 0);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalEnumPairedDevices(wclBluetoothAddresses& Devices)
+{
+	Devices.clear();
+
+	FCS->Enter();
+	for (PEERS::const_iterator i = FPeers.begin(); i != FPeers.end(); i++)
+	{
+		if (i->second.Paired)
+			Devices.push_back(i->first);
+	}
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalEnumConnectedDevices(wclBluetoothAddresses& Devices)
+{
+	Devices.clear();
+
+	FCS->Enter();
+	Devices.reserve(FConnections.size());
+	for (CONNECTIONS::const_iterator i = FConnections.begin(); i != FConnections.end(); i++)
+		Devices.push_back(i->first);
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalEnumRemoteServices(const __int64 Address, const GUID* const Uuid,
+	wclBluetoothServices& Services)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Uuid);
+
+	Services.clear();
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalIsRemoteDeviceInRange(const __int64 Address, bool& InRange)
+{
+	PEER_PARAMS Params;
+	int Res = PeerRequest(Address, Params);
+	InRange = (Res == WCL_E_SUCCESS);
+	if (Res == WCL_E_BLUETOOTH_DEVICE_NOT_FOUND)
+		Res = WCL_E_SUCCESS;
+	return Res;
+}
+
+int CSimulatedRadio::HalRemoteDisconnect(const __int64 Address)
+{
+	// Queue the message before the lock is released: UnregisterConnection
+	// removes the connection first and then drops its queued messages, so
+	// the receiver can not be freed under a queued message.
+	int Res = WCL_E_BLUETOOTH_DEVICE_NOT_CONNECTED;
+	FCS->Enter();
+	CONNECTIONS::const_iterator i = FConnections.find(Address);
+	if (i != FConnections.end())
+	{
+		Schedule(i->second->Receiver,
+			new CwclBluetoothLeDeviceDisconnectedMessage(SIM_API, Address), 0);
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+int CSimulatedRadio::HalGetRemoteAddressType(const __int64 Address,
+	wclBluetoothAddressType& AddrType)
+{
+	AddrType = atUnspecified;
+
+	PEER_PARAMS Params;
+	int Res = PeerRequest(Address, Params);
+	if (Res == WCL_E_SUCCESS)
+		AddrType = Params.AddressType;
+	return Res;
+}
+
+int CSimulatedRadio::HalGetRemoteCod(const __int64 Address, unsigned long& Cod)
+{
+	Cod = 0;
+
+	PEER_PARAMS Params;
+	int Res = PeerRequest(Address, Params);
+	if (Res == WCL_E_SUCCESS)
+		Cod = Params.Cod;
+	return Res;
+}
+
+int CSimulatedRadio::HalGetRemoteDeviceType(const __int64 Address,
+	wclBluetoothDeviceType& DevType)
+{
+	DevType = dtUnknown;
+
+	PEER_PARAMS Params;
+	int Res = PeerRequest(Address, Params);
+	if (Res == WCL_E_SUCCESS)
+		DevType = Params.DeviceType;
+	return Res;
+}
+
+int CSimulatedRadio::HalGetRemoteName(const __int64 Address, tstring& Name)
+{
+	Name = _T("");
+
+	PEER_PARAMS Params;
+	int Res = PeerRequest(Address, Params);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	Sleep(Params.Latency);
+	FCS->Enter();
+	PEERS::const_iterator i = FPeers.find(Address);
+	if (i == FPeers.end())
+		Res = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	else
+		Name = i->second.Name;
+	FCS->Leave();
+	return Res;
+}
+
+int CSimulatedRadio::HalGetRemotePaired(const __int64 Address, bool& Paired)
+{
+	Paired = false;
+
+	FCS->Enter();
+	PEERS::const_iterator i = FPeers.find(Address);
+	int Res = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	if (i != FPeers.end())
+	{
+		Paired = i->second.Paired;
+		Res = WCL_E_SUCCESS;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+int CSimulatedRadio::HalGetRemoteConnectedStatus(const __int64 Address, bool& Connected)
+{
+	FCS->Enter();
+	Connected = (FConnections.find(Address) != FConnections.end());
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalGetRemoteRssi(const __int64 Address, char& Rssi)
+{
+	Rssi = 0;
+
+	PEER_PARAMS Params;
+	int Res = PeerRequest(Address, Params);
+	if (Res != WCL_E_SUCCESS)
+		return Res;
+
+	FCS->Enter();
+	int Value = Params.Rssi;
+	if (Params.RssiJitter > 0)
+		Value += static_cast<int>(Random(Params.RssiJitter * 2 + 1)) - Params.RssiJitter;
+	FCS->Leave();
+
+	Rssi = static_cast<char>(max(-127, min(20, Value)));
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalConfirmReply(const __int64 Address, const bool Confirm)
+{
+	FCS->Enter();
+	bool Pairing = (FPairing.find(Address) != FPairing.end());
+	FCS->Leave();
+	if (!Pairing)
+		return WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+
+	CompletePairing(Address, Confirm);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalIoCapabilityReply(const __int64 Address,
+	const wclBluetoothMitmProtection Mitm,
+	const wclBluetoothIoCapability IoCapability, const bool OobPresent)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Mitm);
+	UNREFERENCED_PARAMETER(IoCapability);
+	UNREFERENCED_PARAMETER(OobPresent);
+
+	// Simulated peers never ask for IO capabilities.
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalNumericComparisonReply(const __int64 Address,
+	const unsigned long Value, const bool Confirm)
+{
+	UNREFERENCED_PARAMETER(Value);
+
+	return HalConfirmReply(Address, Confirm);
+}
+
+int CSimulatedRadio::HalOobDataReply(const __int64 Address,
+	const wclBluetoothOobData& OobData)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(OobData);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalPasskeyReply(const __int64 Address, const unsigned long Passkey)
+{
+	FCS->Enter();
+	bool Pairing = (FPairing.find(Address) != FPairing.end());
+	PEERS::const_iterator i = FPeers.find(Address);
+	bool Match = (i != FPeers.end() && i->second.Passkey == Passkey);
+	FCS->Leave();
+	if (!Pairing)
+		return WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+
+	CompletePairing(Address, Match);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalPinReply(const __int64 Address, const tstring& Pin)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Pin);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalProtectionLevelReply(const __int64 Address,
+	const wclBluetoothLeProtectionLevel Protection)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Protection);
+
+	// Simulated peers accept any protection level.
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalRemotePair(const __int64 Address,
+	const wclBluetoothPairingMethod Method)
+{
+	if (Method == pmClassic)
+		return WCL_E_BLUETOOTH_INVALID_PAIRING_METHOD;
+
+	FCS->Enter();
+	PEERS::const_iterator i = FPeers.find(Address);
+	if (i == FPeers.end() || !i->second.InRange)
+	{
+		FCS->Leave();
+		return WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	}
+	if (i->second.Paired)
+	{
+		FCS->Leave();
+		return WCL_E_BLUETOOTH_ALREADY_PAIRED;
+	}
+	if (FPairing.find(Address) != FPairing.end())
+	{
+		FCS->Leave();
+		return WCL_E_BLUETOOTH_PAIRING;
+	}
+
+	SimPeer Peer = i->second;
+	FPairing.insert(Address);
+	FCS->Leave();
+
+	CwclMessage* Msg;
+	switch (Peer.Pairing)
+	{
+		case pkNumericComparison:
+			Msg = new CwclBluetoothNumericComparisonMessage(SIM_API, Address, Peer.Passkey);
+			break;
+
+		case pkPasskeyEntry:
+			Msg = new CwclBluetoothPasskeyRequestMessage(SIM_API, Address);
+			break;
+
+		default:
+			Msg = new CwclBluetoothConfirmOnlyMessage(SIM_API, Address);
+			break;
+	}
+	Schedule(Receiver, Msg, Peer.Latency);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalRemoteUnpair(const __int64 Address,
+	const wclBluetoothPairingMethod Method)
+{
+	UNREFERENCED_PARAMETER(Method);
+
+	FCS->Enter();
+	PEERS::iterator i = FPeers.find(Address);
+	int Res = WCL_E_SUCCESS;
+	if (i == FPeers.end())
+		Res = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	else
+	{
+		if (!i->second.Paired)
+			Res = WCL_E_BLUETOOTH_DEVICE_NOT_PAIRED;
+		else
+			i->second.Paired = false;
+	}
+	FCS->Leave();
+	return Res;
+}
+
+int CSimulatedRadio::HalGetSimplePairingMode(bool& Enabled)
+{
+	FCS->Enter();
+	Enabled = FSimplePairing;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalSetSimplePairingMode(const bool Enable)
+{
+	FCS->Enter();
+	FSimplePairing = Enable;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::HalCreateConnection(const wclBluetoothConnectionType ConnectionType,
+	CwclCustomConnection*& Connection)
+{
+	Connection = NULL;
+	switch (ConnectionType)
+	{
+		case ctGattClient:
+			Connection = new CSimulatedGattClientConnection(this);
+			return WCL_E_SUCCESS;
+
+		case ctGattServer:
+			Connection = new CSimulatedGattServerConnection(this);
+			return WCL_E_SUCCESS;
+
+		default:
+			return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+	}
+}
+
+int CSimulatedRadio::HalCreateComPort(const __int64 Address, const GUID& Service,
+	unsigned short& Number)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Service);
+
+	Number = 0;
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalDestroyComPort(const unsigned short Number)
+{
+	UNREFERENCED_PARAMETER(Number);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalEnumComPorts(wclVirtualComPorts& ComPorts)
+{
+	ComPorts.clear();
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalEnumInstalledServices(const __int64 Address,
+	wclBluetoothInstalledServices& Services)
+{
+	UNREFERENCED_PARAMETER(Address);
+
+	Services.clear();
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalInstallDevice(const __int64 Address, const GUID& Service)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Service);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+int CSimulatedRadio::HalUninstallDevice(const __int64 Address, const GUID& Service)
+{
+	UNREFERENCED_PARAMETER(Address);
+	UNREFERENCED_PARAMETER(Service);
+
+	return WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED;
+}
+
+wclBluetoothApi CSimulatedRadio::HalGetApi() const
+{
+	return SIM_API;
+}
+
+tstring CSimulatedRadio::HalGetApiName() const
+{
+	return _T("Simulated");
+}
+
+bool CSimulatedRadio::HalGetAvailable() const
+{
+	return true;
+}
+
+bool CSimulatedRadio::HalGetPlugged() const
+{
+	return true;
+}
+
+int CSimulatedRadio::Open()
+{
+	return StartScheduler();
+}
+
+void CSimulatedRadio::Close()
+{
+	HalTerminateOperations();
+	StopScheduler();
+}
+
+int CSimulatedRadio::AddPeer(const SimPeer& Peer)
+{
+	if (Peer.Address == 0 || Peer.Loss > 100)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FCS->Enter();
+	FPeers[Peer.Address] = Peer;
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::AddPeers(const SimPeer& Template, const unsigned long Count)
+{
+	if (Template.Address == 0 || Template.Loss > 100)
+		return WCL_E_INVALID_ARGUMENT;
+
+	SimPeer Peer = Template;
+	FCS->Enter();
+	for (unsigned long i = 0; i < Count; i++)
+	{
+		TCHAR Index[16];
+		_stprintf_s(Index, _countof(Index), _T(" %u"), i);
+
+		Peer.Address = Template.Address + i;
+		Peer.Name = Template.Name + Index;
+		FPeers[Peer.Address] = Peer;
+	}
+	FCS->Leave();
+	return WCL_E_SUCCESS;
+}
+
+void CSimulatedRadio::ClearPeers()
+{
+	wclBluetoothAddresses Connected;
+	HalEnumConnectedDevices(Connected);
+	for (wclBluetoothAddresses::const_iterator i = Connected.begin(); i != Connected.end(); i++)
+		HalRemoteDisconnect(*i);
+
+	FCS->Enter();
+	FPeers.clear();
+	FPairing.clear();
+	// The local GATT server is not a scripted peer.
+	UpdateServerPeer();
+	FCS->Leave();
+}
+
+int CSimulatedRadio::RemovePeer(const __int64 Address)
+{
+	HalRemoteDisconnect(Address);
+
+	FCS->Enter();
+	int Res = WCL_E_SUCCESS;
+	if (FPeers.erase(Address) == 0)
+		Res = WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	FPairing.erase(Address);
+	FCS->Leave();
+	return Res;
+}
+
+int CSimulatedRadio::SetPeerInRange(const __int64 Address, const bool InRange)
+{
+	FCS->Enter();
+	PEERS::iterator i = FPeers.find(Address);
+	if (i == FPeers.end())
+	{
+		FCS->Leave();
+		return WCL_E_BLUETOOTH_DEVICE_NOT_FOUND;
+	}
+	i->second.InRange = InRange;
+	FCS->Leave();
+
+	if (!InRange)
+		HalRemoteDisconnect(Address);
+	return WCL_E_SUCCESS;
+}
+
+int CSimulatedRadio::Notify(const __int64 Address, const unsigned short Handle,
+	const unsigned char* const Value, const unsigned long Length)
+{
+	if (Value == NULL && Length > 0)
+		return WCL_E_INVALID_ARGUMENT;
+
+	FPostCS->Enter();
+	FCS->Enter();
+	CONNECTIONS::const_iterator i = FConnections.find(Address);
+	if (i == FConnections.end())
+	{
+		FCS->Leave();
+		FPostCS->Leave();
+		return WCL_E_BLUETOOTH_DEVICE_NOT_CONNECTED;
+	}
+	CSimulatedGattClientConnection* Connection = i->second;
+	if (Connection->FSubscribed.find(Handle) == Connection->FSubscribed.end())
+	{
+		FCS->Leave();
+		FPostCS->Leave();
+		return WCL_E_BLUETOOTH_ACCESS_DENIED;
+	}
+	CwclMessageReceiver* ConnectionReceiver = Connection->Receiver;
+	PEERS::const_iterator Peer = FPeers.find(Address);
+	bool IsLost = (Peer == FPeers.end() || Lost(Peer->second));
+	FCS->Leave();
+
+	// Lost notification is not an error for the peer: it is just never
+	// delivered.
+	if (IsLost)
+	{
+		FPostCS->Leave();
+		return WCL_E_SUCCESS;
+	}
+
+	CwclMessage* Msg = new CwclBluetoothLeCharacteristicChangedMessage(SIM_API, Handle,
+		Value, Length);
+	ConnectionReceiver->Post(Msg);
+	FPostCS->Leave();
+	Msg->Release();
+	return WCL_E_SUCCESS;
+}
+
+SimPeer CSimulatedRadio::DefaultPeer(const __int64 Address)
+{
+	SimPeer Peer;
+	Peer.Address = Address;
+	Peer.Name = _T("Simulated Device");
+	Peer.AddressType = atPublic;
+	Peer.DeviceType = dtBle;
+	Peer.Cod = 0;
+	Peer.Rssi = -60;
+	Peer.RssiJitter = 4;
+	Peer.Latency = 50;
+	Peer.AttLatency = 30;
+	Peer.Loss = 0;
+	Peer.Pairing = pkJustWorks;
+	Peer.Passkey = 123456;
+	Peer.Paired = false;
+	Peer.InRange = true;
+	Peer.MaxPduSize = 247;
+
+	// Generic Access service: handles 0x0001 - 0x0003.
+	SimGattService Gap;
+	Gap.Service.Uuid = SimShortUuid(0x1800);
+	Gap.Service.Handle = 0x0001;
+
+	SimGattCharacteristic Name;
+	ZeroMemory(&Name.Characteristic, sizeof(Name.Characteristic));
+	Name.Characteristic.ServiceHandle = Gap.Service.Handle;
+	Name.Characteristic.Uuid = SimShortUuid(0x2A00);
+	Name.Characteristic.Handle = 0x0002;
+	Name.Characteristic.ValueHandle = 0x0003;
+	Name.Characteristic.IsReadable = true;
+	std::string AnsiName = wclUnicodeToAnsi(Peer.Name);
+	Name.Value.assign(AnsiName.begin(), AnsiName.end());
+	Gap.Characteristics.push_back(Name);
+	Peer.Services.push_back(Gap);
+
+	// Battery service: handles 0x0010 - 0x0013.
+	SimGattService Battery;
+	Battery.Service.Uuid = SimShortUuid(0x180F);
+	Battery.Service.Handle = 0x0010;
+
+	SimGattCharacteristic Level;
+	ZeroMemory(&Level.Characteristic, sizeof(Level.Characteristic));
+	Level.Characteristic.ServiceHandle = Battery.Service.Handle;
+	Level.Characteristic.Uuid = SimShortUuid(0x2A19);
+	Level.Characteristic.Handle = 0x0011;
+	Level.Characteristic.ValueHandle = 0x0012;
+	Level.Characteristic.IsReadable = true;
+	Level.Characteristic.IsNotifiable = true;
+	Level.Value.push_back(100);
+
+	wclGattDescriptor Cccd;
+	Cccd.ServiceHandle = Battery.Service.Handle;
+	Cccd.CharacteristicHandle = Level.Characteristic.Handle;
+	Cccd.DescriptorType = dtClientCharacteristicConfiguration;
+	Cccd.Uuid = SimShortUuid(0x2902);
+	Cccd.Handle = 0x0013;
+	Level.Descriptors.push_back(Cccd);
+
+	Battery.Characteristics.push_back(Level);
+	Peer.Services.push_back(Battery);
+
+	return Peer;
+}
+
+unsigned long CSimulatedRadio::GetDiscoveryDuration() const
+{
+	return FDiscoveryDuration;
+}
+
+void CSimulatedRadio::SetDiscoveryDuration(const unsigned long Value)
+{
+	FDiscoveryDuration = Value;
+}
+
+unsigned long CSimulatedRadio::GetSeed() const
+{
+	return FSeed;
+}
+
+void CSimulatedRadio::SetSeed(const unsigned long Value)
+{
+	FCS->Enter();
+	// Xorshift must never be seeded with zero.
+	FSeed = (Value == 0 ? 0x2545F491 : Value);
+	FCS->Leave();
+}
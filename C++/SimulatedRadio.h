@@ -0,0 +1,681 @@
+// SimulatedRadio.h : simulated Bluetooth LE radio used for hardware-free testing
+//
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "wclBluetooth.h"
+
+using namespace wclCommon;
+using namespace wclBluetooth;
+
+/// <summary> The pairing method a simulated peer asks for. </summary>
+typedef enum
+{
+	/// <summary> Just Works pairing (confirmation only). </summary>
+	pkJustWorks,
+	/// <summary> Numeric Comparison pairing. </summary>
+	pkNumericComparison,
+	/// <summary> Passkey Entry pairing. </summary>
+	pkPasskeyEntry
+} SimPairingKind;
+
+/// <summary> A characteristic of a simulated peer GATT database. </summary>
+typedef struct
+{
+	/// <summary> The characteristic declaration. </summary>
+	wclGattCharacteristic Characteristic;
+	/// <summary> The characteristic descriptors. </summary>
+	wclGattDescriptors Descriptors;
+	/// <summary> The current characteristic value. </summary>
+	std::vector<unsigned char> Value;
+} SimGattCharacteristic;
+typedef std::vector<SimGattCharacteristic> SimGattCharacteristics;
+
+/// <summary> A primary service of a simulated peer GATT database. </summary>
+typedef struct
+{
+	/// <summary> The service declaration. </summary>
+	wclGattService Service;
+	/// <summary> The service characteristics. </summary>
+	SimGattCharacteristics Characteristics;
+} SimGattService;
+typedef std::vector<SimGattService> SimGattServices;
+
+/// <summary> A virtual remote device served by the simulated radio. </summary>
+typedef struct
+{
+	/// <summary> The peer MAC address. </summary>
+	__int64 Address;
+	/// <summary> The peer name. </summary>
+	tstring Name;
+	/// <summary> The peer address type. </summary>
+	wclBluetoothAddressType AddressType;
+	/// <summary> The peer device type. </summary>
+	wclBluetoothDeviceType DeviceType;
+	/// <summary> The peer class of device. </summary>
+	unsigned long Cod;
+	/// <summary> The mean RSSI of the peer in dBm. </summary>
+	char Rssi;
+	/// <summary> The maximum RSSI deviation from the mean value. </summary>
+	unsigned char RssiJitter;
+	/// <summary> The latency of radio level operations in
+	///   milliseconds. </summary>
+	unsigned long Latency;
+	/// <summary> The latency of a single ATT request in
+	///   milliseconds. </summary>
+	unsigned long AttLatency;
+	/// <summary> The probability (in percents) that an operation with the peer
+	///   is lost. </summary>
+	unsigned char Loss;
+	/// <summary> The pairing method the peer asks for. </summary>
+	SimPairingKind Pairing;
+	/// <summary> The numeric comparison value or the passkey. </summary>
+	unsigned long Passkey;
+	/// <summary> <c>true</c> if the peer is paired. </summary>
+	bool Paired;
+	/// <summary> <c>true</c> if the peer is in range. </summary>
+	bool InRange;
+	/// <summary> The ATT PDU size negotiated with the peer. </summary>
+	unsigned short MaxPduSize;
+	/// <summary> The peer GATT database. </summary>
+	SimGattServices Services;
+} SimPeer;
+typedef std::vector<SimPeer> SimPeers;
+
+class CSimulatedRadio;
+
+/// <summary> The GATT client connection to a simulated peer. </summary>
+/// <remarks> The connection is created by the <see cref="CSimulatedRadio" />
+///   when a <c>CwclGattClient</c> connects through it. An application must
+///   never create this class directly. </remarks>
+class CSimulatedGattClientConnection : public CwclGattClientConnection
+{
+	DISABLE_COPY(CSimulatedGattClientConnection);
+
+private:
+	friend class CSimulatedGattServerClient;
+	friend class CSimulatedRadio;
+
+	bool						FConnected;
+	wclBluetoothLeConnectionParameters	FParams;
+	CSimulatedRadio*			FSimRadio;
+	// The value handles of the subscribed characteristics.
+	std::set<unsigned short>	FSubscribed;
+
+	// Sleeps for the peer ATT latency and simulates the packet loss.
+	int AttRequest();
+	// Finds the characteristic that owns the descriptor. Returns NULL if the
+	// peer has no such descriptor. Must be called inside the radio critical
+	// section.
+	const SimGattCharacteristic* FindDescriptorOwner(
+		const wclGattDescriptor& Descriptor) const;
+
+protected:
+	virtual int HalConnect(CwclEvent* const Event) override;
+	virtual int HalDisconnect() override;
+
+	virtual int HalReadCharacteristics(const wclGattService& Service,
+		const wclGattOperationFlag Flag, wclGattCharacteristics& Characteristics) override;
+	virtual int HalReadCharacteristicValue(const wclGattCharacteristic& Characteristic,
+		const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+		unsigned char*& Value, unsigned long& Length) override;
+	virtual int HalReadDescriptors(const wclGattCharacteristic& Characteristic,
+		const wclGattOperationFlag Flag, wclGattDescriptors& Descriptors) override;
+	virtual int HalReadDescriptorValue(const wclGattDescriptor& Descriptor,
+		const wclGattOperationFlag Flag, const wclGattProtectionLevel Protection,
+		wclGattDescriptorValue& Value) override;
+	virtual int HalReadIncludedServices(const wclGattService& Service,
+		const wclGattOperationFlag Flag, wclGattServices& Services) override;
+	virtual int HalReadServices(const wclGattOperationFlag Flag,
+		wclGattServices& Services) override;
+
+	virtual int HalWriteCharacteristicValue(const wclGattCharacteristic& Characteristic,
+		const wclGattProtectionLevel Protection, const unsigned char* const Value,
+		const unsigned long Length) override;
+	virtual int HalWriteDescriptorValue(const wclGattDescriptor& Descriptor,
+		const wclGattProtectionLevel Protection,
+		const wclGattDescriptorValue& Value) override;
+
+	virtual int HalAbortReliableWrite() override;
+	virtual int HalBeginReliableWrite(const wclGattCharacteristic& Characteristic) override;
+	virtual int HalEndReliableWrite() override;
+
+	virtual int HalSubscribe(const wclGattCharacteristic& Characteristic,
+		HANDLE& Hdl) override;
+	virtual int HalUnsubscribe(const HANDLE Hdl) override;
+
+	virtual int HalGetConnectionParams(wclBluetoothLeConnectionParameters& Params) override;
+	virtual int HalSetConnectionParams(
+		const wclBluetoothLeConnectionParametersType Params) override;
+	virtual int HalSetConnectionParams(
+		const wclBluetoothLeConnectionParametersValue& Params) override;
+
+	virtual int HalGetMaxPduSize(unsigned short& Size) override;
+
+	virtual int HalGetConnectionPhyInfo(wclBluetoothLeConnectionPhy& Info) override;
+
+public:
+	/// <summary> Creates new simulated GATT client connection. </summary>
+	/// <param name="Radio"> The owner simulated radio. </param>
+	CSimulatedGattClientConnection(CSimulatedRadio* const Radio);
+	/// <summary> Frees the connection. </summary>
+	virtual ~CSimulatedGattClientConnection();
+};
+
+/// <summary> The write request a simulated GATT client sends to the local
+///   GATT server. </summary>
+/// <remarks> The request is created by the <see cref="CSimulatedRadio" />.
+///   An application must never create this class directly. </remarks>
+class CSimulatedGattWriteRequest : public CwclGattLocalCharacteristicWriteRequest
+{
+	DISABLE_COPY(CSimulatedGattWriteRequest);
+
+private:
+	// The server response. Owned by the client write that waits for the
+	// request to be processed.
+	int*	FResult;
+
+protected:
+	virtual int HalRespond() override;
+	virtual int HalRespondWithError(const int Error) override;
+
+public:
+	/// <summary> Creates new simulated write request. </summary>
+	/// <param name="Data"> The written value. </param>
+	/// <param name="Size"> The value size. </param>
+	/// <param name="WithResponse"> <c>true</c> if the client waits for the
+	///   response. </param>
+	/// <param name="Result"> On output the server response. </param>
+	CSimulatedGattWriteRequest(void* const Data, const unsigned long Size,
+		const bool WithResponse, int* const Result);
+};
+
+/// <summary> A GATT client connected to the simulated local GATT
+///   server. </summary>
+/// <remarks> The only client is the radio itself: a <c>CwclGattClient</c>
+///   connected to the radio address. An application must never create this
+///   class directly. </remarks>
+class CSimulatedGattServerClient : public CwclGattServerClient
+{
+	DISABLE_COPY(CSimulatedGattServerClient);
+
+private:
+	CSimulatedRadio*	FSimRadio;
+
+protected:
+	virtual int HalDisconnect() override;
+
+	virtual int HalGetConnectionParams(wclBluetoothLeConnectionParameters& Params) override;
+	virtual int HalSetConnectionParams(
+		const wclBluetoothLeConnectionParametersType Params) override;
+	virtual int HalSetConnectionParams(
+		const wclBluetoothLeConnectionParametersValue& Params) override;
+
+	virtual int HalGetMaxNotificationSize(unsigned short& Size) override;
+	virtual int HalGetMaxPduSize(unsigned short& Size) override;
+
+	virtual int HalGetConnectionPhyInfo(wclBluetoothLeConnectionPhy& Info) override;
+
+public:
+	/// <summary> Creates new simulated GATT server client. </summary>
+	/// <param name="Address"> The client MAC address. </param>
+	/// <param name="Connection"> The owner GATT server connection. </param>
+	/// <param name="Radio"> The simulated radio. </param>
+	CSimulatedGattServerClient(const __int64 Address,
+		CwclGattServerConnection* const Connection, CSimulatedRadio* const Radio);
+};
+
+/// <summary> A characteristic of the simulated local GATT server. </summary>
+/// <remarks> The characteristic is created by the
+///   <see cref="CSimulatedGattLocalService" />. An application must never
+///   create this class directly. </remarks>
+class CSimulatedGattLocalCharacteristic : public CwclGattLocalCharacteristic
+{
+	DISABLE_COPY(CSimulatedGattLocalCharacteristic);
+
+private:
+	friend class CSimulatedRadio;
+
+	CSimulatedRadio*	FSimRadio;
+	// The value handle in the server peer database. Assigned by the radio
+	// when the characteristic is added.
+	unsigned short		FValueHandle;
+
+protected:
+	virtual int HalAdd() override;
+	virtual int HalRemove() override;
+	virtual int HalNotify(const __int64 Address, const unsigned char* const Data,
+		const unsigned long Size) const override;
+
+public:
+	/// <summary> Creates new simulated local characteristic. </summary>
+	/// <param name="Service"> The owner service. </param>
+	/// <param name="Uuid"> The characteristic UUID. </param>
+	/// <param name="Params"> The characteristic parameters. </param>
+	/// <param name="Radio"> The simulated radio. </param>
+	CSimulatedGattLocalCharacteristic(CwclGattLocalService* const Service,
+		const wclGattUuid& Uuid, const wclGattLocalCharacteristicParameters& Params,
+		CSimulatedRadio* const Radio);
+};
+
+/// <summary> A service of the simulated local GATT server. </summary>
+/// <remarks> The service is created by the
+///   <see cref="CSimulatedGattServerConnection" />. An application must never
+///   create this class directly. </remarks>
+class CSimulatedGattLocalService : public CwclGattLocalService
+{
+	DISABLE_COPY(CSimulatedGattLocalService);
+
+private:
+	CSimulatedRadio*	FSimRadio;
+
+protected:
+	virtual int HalAdd() override;
+	virtual int HalCreate() override;
+	virtual int HalDestroy() override;
+	virtual int HalRemove() override;
+
+	virtual int HalCreateCharacteristic(const wclGattUuid& Uuid,
+		const wclGattLocalCharacteristicParameters& Params,
+		CwclGattLocalCharacteristic*& Characteristic) override;
+
+public:
+	/// <summary> Creates new simulated local service. </summary>
+	/// <param name="Server"> The owner GATT server connection. </param>
+	/// <param name="Uuid"> The service UUID. </param>
+	/// <param name="Radio"> The simulated radio. </param>
+	CSimulatedGattLocalService(CwclGattServerConnection* const Server,
+		const wclGattUuid& Uuid, CSimulatedRadio* const Radio);
+};
+
+/// <summary> The simulated local GATT server connection. </summary>
+/// <remarks> The connection is created by the <see cref="CSimulatedRadio" />
+///   when a <c>CwclGattServer</c> is initialized on it. An application must
+///   never create this class directly. </remarks>
+class CSimulatedGattServerConnection : public CwclGattServerConnection
+{
+	DISABLE_COPY(CSimulatedGattServerConnection);
+
+private:
+	CSimulatedRadio*	FSimRadio;
+
+protected:
+	virtual int HalInitialize() override;
+	virtual int HalUninitialize() override;
+
+	virtual int HalCreateService(const wclGattUuid& Uuid,
+		CwclGattLocalService*& Service) override;
+	virtual CwclGattServerClient* HalCreateClient(const __int64 Address) override;
+
+public:
+	/// <summary> Creates new simulated GATT server connection. </summary>
+	/// <param name="Radio"> The owner simulated radio. </param>
+	CSimulatedGattServerConnection(CSimulatedRadio* const Radio);
+};
+
+/// <summary> The simulated Bluetooth LE radio. </summary>
+/// <remarks> <para> The radio implements the complete <c>CwclBluetoothRadio</c>
+///   HAL layer against a scripted population of virtual peers. Every peer
+///   has its own latency and loss settings so the framework overhead can be
+///   measured without any Bluetooth hardware. </para>
+///   <para> Notifications are delivered through the same framework messages
+///   the hardware drivers use, so the whole event path from the radio to the
+///   application is exercised. </para>
+///   <para> The <c>CwclBluetoothManager</c> only opens the radios it
+///   enumerates itself, so the application must call <c>Open</c> before it
+///   uses the simulated radio and <c>Close</c> when it is done. Until then
+///   the asynchronous events (discovering results, pairing requests,
+///   connection parameters changes and remote disconnects) are dropped.
+///   The radio processes its own messages on the scheduler thread. </para>
+///   <para> A <c>CwclGattServer</c> initialized on the radio is served as a
+///   peer with the radio address: a <c>CwclGattClient</c> connected to that
+///   address writes to the local characteristics, subscribes to them and
+///   receives their notifications, so both sides of a GATT link run without
+///   hardware. A client write waits until the server has processed it, so
+///   the client must not write from the thread that processes the server
+///   messages. Reads of the local characteristics return an empty
+///   value. </para>
+///   <para> The radio supports Bluetooth LE only. Classic discovering, SDP,
+///   virtual COM ports and device drivers management return
+///   <c>WCL_E_BLUETOOTH_FEATURE_NOT_SUPPORTED</c>. </para> </remarks>
+class CSimulatedRadio : public CwclBluetoothRadio
+{
+	DISABLE_COPY(CSimulatedRadio);
+
+private:
+	friend class CSimulatedGattClientConnection;
+	friend class CSimulatedGattLocalCharacteristic;
+	friend class CSimulatedGattServerClient;
+	friend class CSimulatedGattServerConnection;
+
+	typedef struct
+	{
+		CwclMessageReceiver*	Receiver;
+		CwclMessage*			Message;
+		bool					Discovery;
+	} SCHEDULED;
+	typedef std::multimap<unsigned __int64, SCHEDULED> SCHEDULE;
+	typedef std::map<__int64, SimPeer> PEERS;
+	typedef std::map<__int64, CSimulatedGattClientConnection*> CONNECTIONS;
+	typedef std::set<__int64> ADDRESSES;
+	typedef std::vector<CSimulatedGattLocalCharacteristic*> LOCAL_CHARACTERISTICS;
+	// The scalar peer properties a request copies out of the peers map, so
+	// a request never copies the peer GATT database.
+	typedef struct
+	{
+		unsigned long			Latency;
+		unsigned long			AttLatency;
+		unsigned short			MaxPduSize;
+		wclBluetoothAddressType	AddressType;
+		wclBluetoothDeviceType	DeviceType;
+		unsigned long			Cod;
+		char					Rssi;
+		unsigned char			RssiJitter;
+	} PEER_PARAMS;
+
+	__int64					FAddress;
+	unsigned long			FCod;
+	bool					FConnectable;
+	bool					FDiscoverable;
+	unsigned long			FDiscoveryDuration;
+	tstring					FName;
+	bool					FSimplePairing;
+
+	CONNECTIONS				FConnections;
+	CwclCriticalSection*	FCS;
+	bool					FDiscovering;
+	ADDRESSES				FPairing;
+	PEERS					FPeers;
+	unsigned long			FSeed;
+
+	// The local GATT server and its characteristics in the order they were
+	// added.
+	LOCAL_CHARACTERISTICS	FLocal;
+	CSimulatedGattServerConnection*	FServer;
+
+	// Held while a message is posted to a connection receiver so teardown
+	// can not free the receiver under the post. Taken before FCS.
+	CwclCriticalSection*	FPostCS;
+	SCHEDULE				FSchedule;
+	CwclAutoResetEvent*		FScheduleEvent;
+	bool					FTerminated;
+	HANDLE					FThread;
+
+	/* Scheduler. */
+
+	static UINT __stdcall _SchedulerThreadProc(LPVOID lpParam);
+	void SchedulerThreadProc();
+
+	int StartScheduler();
+	void StopScheduler();
+
+	void Schedule(CwclMessageReceiver* const Receiver, CwclMessage* const Message,
+		const unsigned long Delay, const bool Discovery = false);
+	void Unschedule(CwclMessageReceiver* const Receiver);
+	void UnscheduleDiscovery();
+
+	/* Helpers. */
+
+	static unsigned __int64 Now();
+
+	unsigned long Random(const unsigned long Range);
+	bool Lost(const SimPeer& Peer);
+
+	// Finds peer, simulates latency and loss. The peer parameters are
+	// returned in Params. Must be called outside of the critical section.
+	int PeerRequest(const __int64 Address, PEER_PARAMS& Params);
+
+	void CompletePairing(const __int64 Address, const bool Confirm);
+
+	/* Connections management. */
+
+	void RegisterConnection(CSimulatedGattClientConnection* const Connection);
+	void UnregisterConnection(CSimulatedGattClientConnection* const Connection);
+
+	/* Local GATT server. */
+
+	int RegisterServer(CSimulatedGattServerConnection* const Server);
+	void UnregisterServer(CSimulatedGattServerConnection* const Server);
+
+	void AddLocalCharacteristic(CSimulatedGattLocalCharacteristic* const Characteristic);
+	void RemoveLocalCharacteristic(CSimulatedGattLocalCharacteristic* const Characteristic);
+	// Rebuilds the peer with the radio address from the local
+	// characteristics. Must be called inside the critical section.
+	void UpdateServerPeer();
+	// Finds the local characteristic by its value handle. Must be called
+	// inside the critical section.
+	CSimulatedGattLocalCharacteristic* FindLocalCharacteristic(
+		const unsigned short Handle) const;
+
+	// Posts the message to the local GATT server. Returns false if there is
+	// no server. The message is released in any case.
+	bool PostServer(CwclMessage* const Message);
+	// Delivers the client write to the local GATT server and waits for the
+	// server to process it.
+	int ServerWrite(const unsigned short Handle, const unsigned char* const Value,
+		const unsigned long Length, const bool WithResponse);
+	void ServerSubscribed(const unsigned short Handle, const bool Subscribed);
+
+protected:
+	/* HAL initialization. */
+
+	virtual int HalGetFunctions() override;
+	virtual int HalInitialize() override;
+	virtual int HalLoadApi() override;
+	virtual int HalRegisterCallbacks() override;
+	virtual int HalSetGlobalInstance() override;
+
+	/* HAL finalization. */
+
+	virtual void HalClearFunctions() override;
+	virtual void HalClearGlobalInstance() override;
+	virtual void HalTerminateOperations() override;
+	virtual void HalUninitialize() override;
+	virtual void HalUnloadApi() override;
+	virtual void HalUnregisterCallbacks() override;
+
+	/* HAL local Radio methods. */
+
+	virtual int HalGetAddress(__int64& Address) override;
+	virtual int HalGetCod(unsigned long& Cod) override;
+	virtual int HalGetConnectable(bool& Connectable) override;
+	virtual int HalGetDiscoverable(bool& Discoverable) override;
+	virtual int HalGetHciVersion(unsigned char& Version, unsigned short& Revision) override;
+	virtual int HalGetLmpVersion(unsigned char& Version, unsigned short& Subversion) override;
+	virtual int HalGetManufacturer(unsigned short& Manu) override;
+	virtual int HalGetName(tstring& Name) override;
+
+	virtual int HalSetCod(const unsigned long Cod) override;
+	virtual int HalSetConnectable(const bool Connectable) override;
+	virtual int HalSetDiscoverable(const bool Discoverable) override;
+	virtual int HalSetName(const tstring& Name) override;
+
+	virtual int HalTurnOn() override;
+	virtual int HalTurnOff() override;
+
+	/* HAL remote devices discovering. */
+
+	virtual int HalDiscoverClassic(const unsigned char Timeout) override;
+	virtual int HalDiscoverBle(const unsigned char Timeout) override;
+	virtual int HalTerminate() override;
+
+	virtual int HalEnumPairedDevices(wclBluetoothAddresses& Devices) override;
+	virtual int HalEnumConnectedDevices(wclBluetoothAddresses& Devices) override;
+
+	virtual int HalEnumRemoteServices(const __int64 Address, const GUID* const Uuid,
+		wclBluetoothServices& Services) override;
+
+	virtual int HalIsRemoteDeviceInRange(const __int64 Address, bool& InRange) override;
+
+	virtual int HalRemoteDisconnect(const __int64 Address) override;
+
+	/* HAL remote device functions. */
+
+	virtual int HalGetRemoteAddressType(const __int64 Address,
+		wclBluetoothAddressType& AddrType) override;
+	virtual int HalGetRemoteCod(const __int64 Address, unsigned long& Cod) override;
+	virtual int HalGetRemoteDeviceType(const __int64 Address,
+		wclBluetoothDeviceType& DevType) override;
+	virtual int HalGetRemoteName(const __int64 Address, tstring& Name) override;
+	virtual int HalGetRemotePaired(const __int64 Address, bool& Paired) override;
+
+	virtual int HalGetRemoteConnectedStatus(const __int64 Address, bool& Connected) override;
+	virtual int HalGetRemoteRssi(const __int64 Address, char& Rssi) override;
+
+	/* HAL Authentication reply. */
+
+	virtual int HalConfirmReply(const __int64 Address, const bool Confirm) override;
+	virtual int HalIoCapabilityReply(const __int64 Address,
+		const wclBluetoothMitmProtection Mitm,
+		const wclBluetoothIoCapability IoCapability, const bool OobPresent) override;
+	virtual int HalNumericComparisonReply(const __int64 Address,
+		const unsigned long Value, const bool Confirm) override;
+	virtual int HalOobDataReply(const __int64 Address,
+		const wclBluetoothOobData& OobData) override;
+	virtual int HalPasskeyReply(const __int64 Address, const unsigned long Passkey) override;
+	virtual int HalPinReply(const __int64 Address, const tstring& Pin) override;
+	virtual int HalProtectionLevelReply(const __int64 Address,
+		const wclBluetoothLeProtectionLevel Protection) override;
+
+	/* HAL authentication. */
+
+	virtual int HalRemotePair(const __int64 Address,
+		const wclBluetoothPairingMethod Method) override;
+	virtual int HalRemoteUnpair(const __int64 Address,
+		const wclBluetoothPairingMethod Method) override;
+
+	/* HAL Secure Simple Pairing management. */
+
+	virtual int HalGetSimplePairingMode(bool& Enabled) override;
+	virtual int HalSetSimplePairingMode(const bool Enable) override;
+
+	/* HAL connections management. */
+
+	virtual int HalCreateConnection(const wclBluetoothConnectionType ConnectionType,
+		CwclCustomConnection*& Connection) override;
+
+	/* Virtual COM ports management. */
+
+	virtual int HalCreateComPort(const __int64 Address, const GUID& Service,
+		unsigned short& Number) override;
+	virtual int HalDestroyComPort(const unsigned short Number) override;
+	virtual int HalEnumComPorts(wclVirtualComPorts& ComPorts) override;
+
+	/* Remote Bluetooth device drivers management. */
+
+	virtual int HalEnumInstalledServices(const __int64 Address,
+		wclBluetoothInstalledServices& Services) override;
+	virtual int HalInstallDevice(const __int64 Address, const GUID& Service) override;
+	virtual int HalUninstallDevice(const __int64 Address, const GUID& Service) override;
+
+	/* HAL property getters. */
+
+	virtual wclBluetoothApi HalGetApi() const override;
+	virtual tstring HalGetApiName() const override;
+	virtual bool HalGetAvailable() const override;
+	virtual bool HalGetPlugged() const override;
+
+public:
+	/// <summary> Creates new simulated radio. </summary>
+	/// <param name="Manager"> The <c>CwclBluetoothManager</c> object that owns
+	///   the Radio. </param>
+	CSimulatedRadio(CwclBluetoothManager* const Manager);
+	/// <summary> Frees the simulated radio. </summary>
+	virtual ~CSimulatedRadio();
+
+	/// <summary> Starts the simulated radio. </summary>
+	/// <returns> If the function succeed the return value is
+	///   <c>WCL_E_SUCCESS</c>. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	/// <remarks> The method starts the thread that delivers the scheduled
+	///   events. Calling it on the opened radio does nothing. </remarks>
+	int Open();
+	/// <summary> Stops the simulated radio. </summary>
+	/// <remarks> The running discovering and pairings are cancelled and the
+	///   events that have not been delivered yet are dropped. </remarks>
+	void Close();
+
+	/* Peers scripting. */
+
+	/// <summary> Adds a virtual peer or replaces the existing one with the
+	///   same address. </summary>
+	/// <param name="Peer"> The peer description. </param>
+	/// <returns> If the function succeed the return value is
+	///   <c>WCL_E_SUCCESS</c>. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	int AddPeer(const SimPeer& Peer);
+	/// <summary> Adds <c>Count</c> virtual peers based on the template. </summary>
+	/// <param name="Template"> The template peer. Each generated peer gets the
+	///   template address plus its index and an indexed name. </param>
+	/// <param name="Count"> The number of peers to generate. </param>
+	/// <returns> If the function succeed the return value is
+	///   <c>WCL_E_SUCCESS</c>. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	int AddPeers(const SimPeer& Template, const unsigned long Count);
+	/// <summary> Removes all virtual peers. </summary>
+	void ClearPeers();
+	/// <summary> Removes the virtual peer. </summary>
+	/// <param name="Address"> The peer MAC address. </param>
+	/// <returns> If the function succeed the return value is
+	///   <c>WCL_E_SUCCESS</c>. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	int RemovePeer(const __int64 Address);
+	/// <summary> Moves the peer in or out of the radio range. </summary>
+	/// <param name="Address"> The peer MAC address. </param>
+	/// <param name="InRange"> The new peer range state. If the peer leaves the
+	///   range its connection is closed. </param>
+	/// <returns> If the function succeed the return value is
+	///   <c>WCL_E_SUCCESS</c>. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	int SetPeerInRange(const __int64 Address, const bool InRange);
+	/// <summary> Sends a notification from the peer to the connected GATT
+	///   client. </summary>
+	/// <param name="Address"> The peer MAC address. </param>
+	/// <param name="Handle"> The characteristic value handle, the same as a
+	///   real server reports. </param>
+	/// <param name="Value"> The characteristic value. </param>
+	/// <param name="Length"> The value length. </param>
+	/// <returns> If the function succeed the return value is
+	///   <c>WCL_E_SUCCESS</c>. Otherwise the method returns one of the WCL
+	///   error codes. </returns>
+	int Notify(const __int64 Address, const unsigned short Handle,
+		const unsigned char* const Value, const unsigned long Length);
+
+	/// <summary> Creates a peer with a default GATT database. </summary>
+	/// <param name="Address"> The peer MAC address. </param>
+	/// <returns> The peer with the Generic Access service (Device Name) and the
+	///   Battery service (notifiable Battery Level). </returns>
+	static SimPeer DefaultPeer(const __int64 Address);
+
+	/* Properties. */
+
+	/// <summary> Gets the discovering duration. </summary>
+	/// <returns> The discovering duration in milliseconds. 0 means the
+	///   <c>Timeout</c> passed to the <c>Discover</c> method is used. </returns>
+	unsigned long GetDiscoveryDuration() const;
+	/// <summary> Sets the discovering duration. </summary>
+	/// <param name="Value"> The discovering duration in milliseconds. 0 means
+	///   the <c>Timeout</c> passed to the <c>Discover</c> method is
+	///   used. </param>
+	void SetDiscoveryDuration(const unsigned long Value);
+	/// <summary> Gets and sets the discovering duration. </summary>
+	/// <value> The discovering duration in milliseconds. </value>
+	__declspec(property(get = GetDiscoveryDuration, put = SetDiscoveryDuration))
+		unsigned long DiscoveryDuration;
+
+	/// <summary> Gets the random generator seed. </summary>
+	/// <returns> The seed used to simulate RSSI jitter, loss and discovering
+	///   order. </returns>
+	unsigned long GetSeed() const;
+	/// <summary> Sets the random generator seed. </summary>
+	/// <param name="Value"> The seed. Use the same seed to repeat a
+	///   run. </param>
+	void SetSeed(const unsigned long Value);
+	/// <summary> Gets and sets the random generator seed. </summary>
+	/// <value> The seed. </value>
+	__declspec(property(get = GetSeed, put = SetSeed)) unsigned long Seed;
+};